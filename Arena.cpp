@@ -0,0 +1,33 @@
+#include "Arena.h"
+
+#include <algorithm>
+
+using tsm::Arena;
+
+thread_local Arena* Arena::current_{ nullptr };
+constexpr std::size_t Arena::DefaultBlockSize;
+
+void Arena::grow(std::size_t bytes)
+{
+    std::size_t size = std::max(blockSize_, bytes + sizeof(Block));
+    auto block = static_cast<Block*>(::operator new(size));
+    block->next = blocks_;
+    blocks_ = block;
+    next_ = reinterpret_cast<char*>(block + 1);
+    end_ = reinterpret_cast<char*>(block) + size;
+}
+
+void Arena::reset()
+{
+    for (Finalizer* f = finalizers_; f; f = f->next) {
+        f->destroy(f->object);
+    }
+    finalizers_ = nullptr;
+    while (blocks_) {
+        Block* next = blocks_->next;
+        ::operator delete(blocks_);
+        blocks_ = next;
+    }
+    next_ = end_ = nullptr;
+    allocated_ = 0;
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+namespace tsm {
+
+///
+/// A bump allocator for building state machines. Memory is handed out from
+/// large blocks and only returned, all at once, when the arena is destroyed
+/// or reset, so a batch of machines built in one arena sits in a few
+/// contiguous blocks instead of thousands of heap nodes.
+///
+/// While an ArenaScope is active on a thread, the containers of every
+/// StateMachineDef constructed on that thread - the transition table, the
+/// event set and the sub HSM set - allocate from its arena:
+///
+/// tsm::Arena arena;
+/// std::vector<MyMachine*> machines;
+/// for (int i = 0; i < 50000; ++i) {
+///     machines.push_back(arena.create<MyMachine>());
+/// }
+/// ...
+/// arena.reset(); // destroys the machines and frees everything
+///
+/// Machines built under an ArenaScope without create must be destroyed
+/// before the arena. State names longer than the small string buffer of
+/// std::string still come from the heap.
+///
+/// An arena is not thread safe. Use one arena per thread to build machines
+/// in parallel.
+///
+class Arena
+{
+  public:
+    static constexpr std::size_t DefaultBlockSize = 64 * 1024;
+
+    explicit Arena(std::size_t blockSize = DefaultBlockSize)
+      : blockSize_(blockSize)
+      , blocks_(nullptr)
+      , next_(nullptr)
+      , end_(nullptr)
+      , finalizers_(nullptr)
+      , allocated_(0)
+    {}
+
+    Arena(Arena const&) = delete;
+    Arena& operator=(Arena const&) = delete;
+
+    ~Arena() { reset(); }
+
+    void* allocate(std::size_t bytes, std::size_t align)
+    {
+        auto p = (reinterpret_cast<std::uintptr_t>(next_) + align - 1) &
+                 ~std::uintptr_t(align - 1);
+        if (!next_ || p + bytes > reinterpret_cast<std::uintptr_t>(end_)) {
+            grow(bytes + align);
+            p = (reinterpret_cast<std::uintptr_t>(next_) + align - 1) &
+                ~std::uintptr_t(align - 1);
+        }
+        next_ = reinterpret_cast<char*>(p + bytes);
+        allocated_ += bytes;
+        return reinterpret_cast<void*>(p);
+    }
+
+    ///
+    /// Construct a T in the arena, with the arena active so that T's
+    /// definitions allocate from it too. It is destroyed by reset or the
+    /// arena's destructor, in the reverse order of creation.
+    ///
+    template<typename T, typename... Args>
+    T* create(Args&&... args);
+
+    /// Destroy the objects made by create and free all blocks.
+    void reset();
+
+    /// The bytes handed out since the last reset.
+    std::size_t allocated() const { return allocated_; }
+
+    /// The arena of the innermost ArenaScope on this thread, or nullptr.
+    static Arena* current() { return current_; }
+
+  private:
+    friend class ArenaScope;
+
+    struct Block
+    {
+        Block* next;
+    };
+
+    struct Finalizer
+    {
+        void (*destroy)(void*);
+        void* object;
+        Finalizer* next;
+    };
+
+    template<typename T>
+    static void destroy(void* object)
+    {
+        static_cast<T*>(object)->~T();
+    }
+
+    void grow(std::size_t bytes);
+
+    std::size_t blockSize_;
+    Block* blocks_;
+    char* next_;
+    char* end_;
+    Finalizer* finalizers_;
+    std::size_t allocated_;
+
+    static thread_local Arena* current_;
+};
+
+///
+/// Makes an arena the current one on this thread for its lifetime, see
+/// Arena. Scopes nest like UniqueId spaces.
+///
+class ArenaScope
+{
+  public:
+    explicit ArenaScope(Arena& arena)
+      : enclosing_(Arena::current_)
+    {
+        Arena::current_ = &arena;
+    }
+
+    ArenaScope(ArenaScope const&) = delete;
+    ArenaScope& operator=(ArenaScope const&) = delete;
+
+    ~ArenaScope() { Arena::current_ = enclosing_; }
+
+  private:
+    Arena* enclosing_;
+};
+
+template<typename T, typename... Args>
+T* Arena::create(Args&&... args)
+{
+    ArenaScope scope(*this);
+    void* p = allocate(sizeof(T), alignof(T));
+    T* object = new (p) T(std::forward<Args>(args)...);
+    auto f = static_cast<Finalizer*>(
+      allocate(sizeof(Finalizer), alignof(Finalizer)));
+    f->destroy = &destroy<T>;
+    f->object = object;
+    f->next = finalizers_;
+    finalizers_ = f;
+    return object;
+}
+
+///
+/// A standard allocator drawing from the arena that is current when it is
+/// constructed, or from the heap if there is none. Deallocating arena memory
+/// does nothing.
+///
+template<typename T>
+struct ArenaAllocator
+{
+    using value_type = T;
+
+    ArenaAllocator()
+      : arena(Arena::current())
+    {}
+
+    template<typename U>
+    ArenaAllocator(ArenaAllocator<U> const& other)
+      : arena(other.arena)
+    {}
+
+    T* allocate(std::size_t n)
+    {
+        if (arena) {
+            return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t)
+    {
+        if (!arena) {
+            ::operator delete(p);
+        }
+    }
+
+    template<typename U>
+    bool operator==(ArenaAllocator<U> const& rhs) const
+    {
+        return arena == rhs.arena;
+    }
+
+    template<typename U>
+    bool operator!=(ArenaAllocator<U> const& rhs) const
+    {
+        return arena != rhs.arena;
+    }
+
+    Arena* arena;
+};
+
+} // namespace tsm
@@ -0,0 +1,133 @@
+#pragma once
+
+///
+/// Coroutine actions need C++20. TSM_HAS_COROUTINES is 1 when the compiler
+/// has them, e.g. in the TSM_CXX20 build, and everything in this header and
+/// StateMachineDef::addAsync is left out otherwise.
+///
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L &&      \
+  defined(__has_include)
+#if __has_include(<coroutine>)
+#define TSM_HAS_COROUTINES 1
+#endif
+#endif
+#ifndef TSM_HAS_COROUTINES
+#define TSM_HAS_COROUTINES 0
+#endif
+
+#if TSM_HAS_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+namespace tsm {
+
+///
+/// The return type of a coroutine action, see StateMachineDef::addAsync:
+///
+/// tsm::AsyncAction fetch(Request const& r)
+/// {
+///     reply = co_await client.get(r.url);
+/// }
+///
+/// The coroutine starts right away, in the action, and runs until it first
+/// suspends. Whoever resumes it - the completion of the I/O - then runs it
+/// to its end, and the end completes the transition of the machine. A
+/// coroutine action must not throw.
+///
+class AsyncAction
+{
+  public:
+    struct promise_type;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    struct promise_type
+    {
+        AsyncAction get_return_object()
+        {
+            return AsyncAction(Handle::from_promise(*this));
+        }
+
+        std::suspend_never initial_suspend() noexcept { return {}; }
+
+        // The frame is kept until the owner destroys it, so that done()
+        // can be seen
+        auto final_suspend() noexcept
+        {
+            struct Final
+            {
+                bool await_ready() noexcept { return false; }
+                void await_suspend(Handle h) noexcept
+                {
+                    promise_type& p = h.promise();
+                    if (p.onDone) {
+                        // May destroy the frame, which is suspended by now
+                        p.onDone(p.owner);
+                    }
+                }
+                void await_resume() noexcept {}
+            };
+            return Final{};
+        }
+
+        void return_void() {}
+
+        void unhandled_exception() noexcept { std::terminate(); }
+
+        void (*onDone)(void*) = nullptr;
+        void* owner = nullptr;
+    };
+
+    AsyncAction() = default;
+
+    AsyncAction(AsyncAction&& other) noexcept
+      : handle_(std::exchange(other.handle_, nullptr))
+    {}
+
+    AsyncAction& operator=(AsyncAction&& other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    AsyncAction(AsyncAction const&) = delete;
+    AsyncAction& operator=(AsyncAction const&) = delete;
+
+    /// A coroutine still suspended is destroyed without being finished.
+    ~AsyncAction() { reset(); }
+
+    /// True if there is no coroutine or it has run to its end.
+    bool done() const { return !handle_ || handle_.done(); }
+
+    ///
+    /// Call onDone(owner) when the coroutine, suspended now, runs to its
+    /// end. It is called on the thread resuming the coroutine.
+    ///
+    void onDone(void (*onDone)(void*), void* owner)
+    {
+        handle_.promise().onDone = onDone;
+        handle_.promise().owner = owner;
+    }
+
+    void reset()
+    {
+        if (handle_) {
+            std::exchange(handle_, nullptr).destroy();
+        }
+    }
+
+  private:
+    explicit AsyncAction(Handle handle)
+      : handle_(handle)
+    {}
+
+    Handle handle_ = nullptr;
+};
+
+} // namespace tsm
+
+#endif // TSM_HAS_COROUTINES
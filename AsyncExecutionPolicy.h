@@ -2,36 +2,79 @@
 
 #include "Event.h"
 #include "EventQueue.h"
+#include "Metrics.h"
+#include "TimerService.h"
+#include "WaitStrategy.h"
+
+#include <atomic>
+#include <iterator>
+#include <vector>
 
 ///
 /// The default policy class for asynchronous event processing. This policy is
 /// mixed in with a StateMachineT class to create an AsyncStateMachine. The
 /// client uses the sendEvent method to communicate with the state machine. A
 /// separate thread is created and blocks wating on events in the step method.
+/// The queue type defaults to the mutex based EventQueue. Any queue with the
+/// same addEvent/tryNextEvents/pollEvents/stop interface and a single
+/// consumer can be dropped in, e.g. the LockFreeEventQueue or a
+/// PriorityEventQueue.
+///
+/// The thread parks on the queue while the machine is idle. A latency
+/// sensitive machine can poll the queue instead, see WaitStrategy, and pin
+/// its thread to a CPU of its own:
+///
+/// sm.setWaitStrategy(tsm::WaitStrategy::SpinPark, 100000);
+/// sm.setCpuAffinity(3);
+/// sm.startSM();
+///
+/// scheduleEvent sends an event to the machine after a delay, see
+/// TimedEventTarget. Pending timers are cancelled when the machine stops.
+///
+/// The machine thread takes events with tryNextEvents or pollEvents and leaves
+/// its loop when the queue is stopped, without an exception.
+///
+/// For a StateMachine with a MetricsTracer the policy counts the events it
+/// sends and dispatches and samples their latency, see Metrics.h.
 ///
 namespace tsm {
-template<typename StateType>
-struct AsyncExecutionPolicy : public StateType
+template<typename StateType,
+         typename EventQueueType = EventQueueT<Event, std::mutex>>
+struct AsyncExecutionPolicy
+  : public StateType
+  , public TimedEventTarget
 {
-    using EventQueue = EventQueueT<Event, std::mutex>;
+    using EventQueue = EventQueueType;
     using ThreadCallback = void (AsyncExecutionPolicy::*)();
 
+    /// The polls SpinYield and SpinPark make before yielding or parking.
+    static constexpr std::size_t DefaultSpinBudget = 10000;
+
     AsyncExecutionPolicy()
       : StateType()
       , threadCallback_(&AsyncExecutionPolicy::step)
       , interrupt_(false)
+      , maxEventsPerWakeup_(64)
+      , waitStrategy_(WaitStrategy::Park)
+      , spinBudget_(DefaultSpinBudget)
+      , cpu_(-1)
     {}
 
-    virtual ~AsyncExecutionPolicy() = default;
+    virtual ~AsyncExecutionPolicy() { this->cancelTimers(); }
 
     void onEntry(Event const& e) override
     {
         StateType::onEntry(e);
         smThread_ = std::thread(threadCallback_, this);
+        if (cpu_ >= 0 && !detail::pinThread(smThread_, cpu_)) {
+            TSM_DLOG(WARNING) << this->name << ": Cannot pin thread to CPU "
+                              << cpu_;
+        }
     }
 
     void onExit(Event const& e) override
     {
+        this->cancelTimers();
         interrupt_ = true;
         eventQueue_.stop();
         smThread_.join();
@@ -41,35 +84,127 @@ struct AsyncExecutionPolicy : public StateType
 
     virtual void step()
     {
-        while (!interrupt_) {
-            processEvent();
+        while (!interrupt_ && processEvents()) {
         }
     };
 
-    void sendEvent(Event const& event) { eventQueue_.addEvent(event); }
+    void sendEvent(Event const& event)
+    {
+        sendCounted(*this, eventQueue_, event);
+    }
+
+    ///
+    /// Queue the events in [first, last) with a single lock acquisition and a
+    /// single wakeup of the state machine thread.
+    ///
+    template<typename InputIt>
+    void sendEvents(InputIt first, InputIt last)
+    {
+        sendCounted(*this, eventQueue_, first, last);
+    }
+
+    ///
+    /// The maximum number of events the state machine thread takes off the
+    /// queue each time it wakes up. Set before startSM.
+    ///
+    void setMaxEventsPerWakeup(std::size_t maxEvents)
+    {
+        maxEventsPerWakeup_ = maxEvents ? maxEvents : 1;
+    }
+
+    ///
+    /// How the state machine thread waits for events, and how many times it
+    /// polls the queue before it yields or parks. Set before startSM.
+    ///
+    void setWaitStrategy(WaitStrategy strategy,
+                         std::size_t spinBudget = DefaultSpinBudget)
+    {
+        waitStrategy_ = strategy;
+        spinBudget_ = spinBudget;
+    }
+
+    ///
+    /// Run the state machine thread on cpu only, or anywhere for a negative
+    /// cpu. Set before startSM. Only supported on Linux; elsewhere the thread
+    /// is left where the scheduler puts it.
+    ///
+    void setCpuAffinity(int cpu) { cpu_ = cpu; }
+
+    /// The queue, e.g. to configure a priority queue before startSM.
+    EventQueue& getEventQueue() { return eventQueue_; }
 
   protected:
+    void onTimer(Event const& e) override { sendEvent(e); }
+
     ThreadCallback threadCallback_;
     std::thread smThread_;
     EventQueue eventQueue_;
-    bool interrupt_;
+    std::atomic<bool> interrupt_;
+    std::size_t maxEventsPerWakeup_;
+    std::vector<Event> batch_;
+    WaitStrategy waitStrategy_;
+    std::size_t spinBudget_;
+    int cpu_;
+
+    // Wait for events as the wait strategy says and move up to maxEvents of
+    // them to batch_. Returns false once the queue is stopped.
+    bool waitForEvents(std::size_t maxEvents)
+    {
+        batch_.clear();
+        if (waitStrategy_ != WaitStrategy::Park) {
+            for (std::size_t spins = 0;; ++spins) {
+                if (interrupt_) {
+                    return false;
+                }
+                if (eventQueue_.pollEvents(std::back_inserter(batch_),
+                                           maxEvents)) {
+                    return true;
+                }
+                if (waitStrategy_ == WaitStrategy::Spin ||
+                    spins < spinBudget_) {
+                    detail::cpuRelax();
+                } else if (waitStrategy_ == WaitStrategy::SpinYield) {
+                    std::this_thread::yield();
+                } else {
+                    break;
+                }
+            }
+        }
+        // This is a blocking wait
+        return eventQueue_.tryNextEvents(std::back_inserter(batch_),
+                                         maxEvents) != 0;
+    }
+
+    // Process the next event. Returns false once the queue is stopped.
+    bool processEvent()
+    {
+        if (!waitForEvents(1)) {
+            TSM_DLOG(WARNING) << this->name
+                              << ": Exiting event loop on interrupt";
+            return false;
+        }
+        // go down the HSM hierarchy to handle the event as that is the
+        // "most active state"
+        executeCounted(*this, batch_.front());
+        return true;
+    }
 
-    void processEvent()
+    // Same as processEvent, but takes up to maxEventsPerWakeup_ events off the
+    // queue at once.
+    bool processEvents()
     {
-        try {
-            // This is a blocking wait
-            Event const& nextEvent = eventQueue_.nextEvent();
-            // go down the HSM hierarchy to handle the event as that is the
-            // "most active state"
-            this->dispatch(this)->execute(nextEvent);
-
-        } catch (EventQueueInterruptedException const& e) {
-            if (!interrupt_) {
-                throw e;
+        if (!waitForEvents(maxEventsPerWakeup_)) {
+            TSM_DLOG(WARNING) << this->name
+                              << ": Exiting event loop on interrupt";
+            return false;
+        }
+        for (Event const& nextEvent : batch_) {
+            if (interrupt_) {
+                break;
             }
-            DLOG(WARNING) << this->name << ": Exiting event loop on interrupt";
-            return;
+            executeCounted(*this, nextEvent);
         }
+        return true;
     }
 };
 
@@ -79,17 +214,19 @@ struct AsyncExecutionPolicy : public StateType
 /// each event - specifically, right before the blocking wait for the next
 /// event.
 ///
-template<typename StateType, typename Observer>
+template<typename StateType,
+         typename Observer,
+         typename EventQueueType = EventQueueT<Event, std::mutex>>
 struct AsyncExecWithObserver
-  : public AsyncExecutionPolicy<StateType>
+  : public AsyncExecutionPolicy<StateType, EventQueueType>
   , public Observer
 {
-    using AsyncExecutionPolicy<StateType>::interrupt_;
-    using AsyncExecutionPolicy<StateType>::eventQueue_;
+    using AsyncExecutionPolicy<StateType, EventQueueType>::interrupt_;
+    using AsyncExecutionPolicy<StateType, EventQueueType>::eventQueue_;
     using Observer::notify;
 
     AsyncExecWithObserver()
-      : AsyncExecutionPolicy<StateType>()
+      : AsyncExecutionPolicy<StateType, EventQueueType>()
       , Observer()
     {}
 
@@ -99,7 +236,9 @@ struct AsyncExecWithObserver
     {
         while (!interrupt_) {
             notify();
-            this->processEvent();
+            if (!this->processEvent()) {
+                break;
+            }
         }
     }
 };
@@ -0,0 +1,289 @@
+#include "BinaryDefinition.h"
+
+#include <algorithm>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using tsm::DefinitionHeader;
+using tsm::DefinitionTransition;
+using tsm::MappedDefinition;
+using tsm::detail::DefinitionWriter;
+
+constexpr std::uint32_t DefinitionHeader::Magic;
+constexpr std::uint16_t DefinitionHeader::Version;
+constexpr std::uint32_t DefinitionHeader::None;
+constexpr std::uint32_t MappedDefinition::None;
+
+void DefinitionWriter::transition(State const& from,
+                                  Event const& e,
+                                  State const& to,
+                                  bool hasAction,
+                                  bool hasGuard,
+                                  DefinitionNames const& names)
+{
+    state(from);
+    state(to);
+    if (e.space != space_) {
+        TSM_THROW(std::invalid_argument(
+          from.name + ": event " + std::to_string(e.id) +
+          " of another id space does not fit a binary definition"));
+    }
+    numEvents_ = std::max(numEvents_, e.id + 1);
+
+    DefinitionTransition t{
+      from.id, e.id, to.id, DefinitionHeader::None, DefinitionHeader::None };
+    if (hasAction) {
+        std::string const* name = names.actionName(from, e);
+        if (!name) {
+            TSM_THROW(std::invalid_argument(
+              from.name + ": the action on event " + std::to_string(e.id) +
+              " has no name"));
+        }
+        t.action = index(actionNames_, intern(*name));
+    }
+    if (hasGuard) {
+        std::string const* name = names.guardName(from, e);
+        if (!name) {
+            TSM_THROW(std::invalid_argument(
+              from.name + ": the guard on event " + std::to_string(e.id) +
+              " has no name"));
+        }
+        t.guard = index(guardNames_, intern(*name));
+    }
+    transitions_.push_back(t);
+}
+
+std::vector<char> DefinitionWriter::write(std::string const& name,
+                                          DefinitionNames const& names)
+{
+    DefinitionHeader h;
+    std::memset(&h, 0, sizeof(h));
+    h.magic = DefinitionHeader::Magic;
+    h.version = DefinitionHeader::Version;
+    h.headerSize = sizeof(DefinitionHeader);
+    h.name = intern(name);
+    h.numStates = static_cast<std::uint32_t>(stateNames_.size());
+    h.numEvents = numEvents_;
+    h.numTransitions = static_cast<std::uint32_t>(transitions_.size());
+    h.numActions = static_cast<std::uint32_t>(actionNames_.size());
+    h.numGuards = static_cast<std::uint32_t>(guardNames_.size());
+    h.startState = start_;
+    h.stopState = stop_;
+
+    // The first transition added for a (state, event) pair wins
+    std::vector<std::uint32_t> slots(std::size_t(h.numStates) * h.numEvents);
+    for (std::size_t i = 0; i < transitions_.size(); ++i) {
+        DefinitionTransition const& t = transitions_[i];
+        auto& slot = slots[t.fromState * h.numEvents + t.onEvent];
+        if (!slot) {
+            slot = static_cast<std::uint32_t>(i + 1);
+        }
+    }
+    std::vector<std::uint32_t> eventNames(h.numEvents, 0);
+    for (std::uint32_t id = 0; id < h.numEvents; ++id) {
+        if (std::string const* eventName = names.eventName(space_, id)) {
+            eventNames[id] = intern(*eventName);
+        }
+    }
+
+    std::uint32_t offset = sizeof(DefinitionHeader);
+    auto place = [&offset](std::size_t bytes) {
+        std::uint32_t at = offset;
+        offset += static_cast<std::uint32_t>(bytes);
+        return at;
+    };
+    h.slots = place(slots.size() * sizeof(std::uint32_t));
+    h.transitions = place(transitions_.size() * sizeof(DefinitionTransition));
+    h.stateNames = place(stateNames_.size() * sizeof(std::uint32_t));
+    h.eventNames = place(eventNames.size() * sizeof(std::uint32_t));
+    h.actionNames = place(actionNames_.size() * sizeof(std::uint32_t));
+    h.guardNames = place(guardNames_.size() * sizeof(std::uint32_t));
+    h.stringsSize = static_cast<std::uint32_t>(strings_.size());
+    h.strings = place(strings_.size());
+    h.size = offset;
+
+    std::vector<char> image(h.size);
+    auto copy = [&image](std::uint32_t at, void const* data, std::size_t n) {
+        if (n) {
+            std::memcpy(image.data() + at, data, n);
+        }
+    };
+    copy(0, &h, sizeof(h));
+    copy(h.slots, slots.data(), slots.size() * sizeof(std::uint32_t));
+    copy(h.transitions,
+         transitions_.data(),
+         transitions_.size() * sizeof(DefinitionTransition));
+    copy(h.stateNames,
+         stateNames_.data(),
+         stateNames_.size() * sizeof(std::uint32_t));
+    copy(h.eventNames,
+         eventNames.data(),
+         eventNames.size() * sizeof(std::uint32_t));
+    copy(h.actionNames,
+         actionNames_.data(),
+         actionNames_.size() * sizeof(std::uint32_t));
+    copy(h.guardNames,
+         guardNames_.data(),
+         guardNames_.size() * sizeof(std::uint32_t));
+    copy(h.strings, strings_.data(), strings_.size());
+    return image;
+}
+
+std::uint32_t DefinitionWriter::intern(std::string const& s)
+{
+    if (s.empty()) {
+        return 0;
+    }
+    auto it = interned_.find(s);
+    if (it != interned_.end()) {
+        return it->second;
+    }
+    auto offset = static_cast<std::uint32_t>(strings_.size());
+    strings_.append(s);
+    strings_.push_back('\0');
+    interned_.emplace(s, offset);
+    return offset;
+}
+
+std::uint32_t DefinitionWriter::index(std::vector<std::uint32_t>& table,
+                                      std::uint32_t name)
+{
+    // Interned, so equal names have equal offsets
+    auto it = std::find(table.begin(), table.end(), name);
+    if (it == table.end()) {
+        table.push_back(name);
+        return static_cast<std::uint32_t>(table.size() - 1);
+    }
+    return static_cast<std::uint32_t>(it - table.begin());
+}
+
+MappedDefinition::MappedDefinition(std::string const& path)
+  : mapping_(nullptr)
+  , mappedSize_(0)
+{
+#if defined(_WIN32)
+    TSM_THROW(std::runtime_error(path + ": mapping is not supported"));
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        TSM_THROW(std::runtime_error(path + ": cannot open"));
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        TSM_THROW(std::invalid_argument(path + ": not a definition"));
+    }
+    void* p = ::mmap(nullptr,
+                     static_cast<std::size_t>(st.st_size),
+                     PROT_READ,
+                     MAP_PRIVATE,
+                     fd,
+                     0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        TSM_THROW(std::runtime_error(path + ": cannot map"));
+    }
+    mapping_ = p;
+    mappedSize_ = static_cast<std::size_t>(st.st_size);
+#if TSM_EXCEPTIONS_ENABLED
+    try {
+        open(mapping_, mappedSize_);
+    } catch (...) {
+        ::munmap(mapping_, mappedSize_);
+        throw;
+    }
+#else
+    open(mapping_, mappedSize_);
+#endif
+#endif
+}
+
+MappedDefinition::MappedDefinition(void const* data, std::size_t size)
+  : mapping_(nullptr)
+  , mappedSize_(0)
+{
+    open(data, size);
+}
+
+MappedDefinition::~MappedDefinition()
+{
+#if !defined(_WIN32)
+    if (mapping_) {
+        ::munmap(mapping_, mappedSize_);
+    }
+#endif
+}
+
+void MappedDefinition::open(void const* data, std::size_t size)
+{
+    auto base = static_cast<char const*>(data);
+    header_ = reinterpret_cast<DefinitionHeader const*>(base);
+    DefinitionHeader const& h = *header_;
+    if (size < sizeof(DefinitionHeader) || h.magic != DefinitionHeader::Magic ||
+        h.version != DefinitionHeader::Version ||
+        h.headerSize != sizeof(DefinitionHeader) || h.size > size) {
+        TSM_THROW(std::invalid_argument("Not a definition image"));
+    }
+
+    // Every table has to lie inside the image
+    auto fits = [&h](std::uint32_t at, std::uint64_t bytes) {
+        return at >= sizeof(DefinitionHeader) && at + bytes <= h.size;
+    };
+    std::uint64_t word = sizeof(std::uint32_t);
+    if (!fits(h.slots, word * h.numStates * h.numEvents) ||
+        !fits(h.transitions,
+              sizeof(DefinitionTransition) * std::uint64_t(h.numTransitions)) ||
+        !fits(h.stateNames, word * h.numStates) ||
+        !fits(h.eventNames, word * h.numEvents) ||
+        !fits(h.actionNames, word * h.numActions) ||
+        !fits(h.guardNames, word * h.numGuards) ||
+        !fits(h.strings, h.stringsSize) || h.stringsSize == 0 ||
+        base[h.strings + h.stringsSize - 1] != '\0' ||
+        h.startState >= h.numStates ||
+        (h.stopState != None && h.stopState >= h.numStates)) {
+        TSM_THROW(std::invalid_argument("Corrupt definition image"));
+    }
+    slots_ = reinterpret_cast<std::uint32_t const*>(base + h.slots);
+    transitions_ =
+      reinterpret_cast<DefinitionTransition const*>(base + h.transitions);
+    stateNames_ = reinterpret_cast<std::uint32_t const*>(base + h.stateNames);
+    eventNames_ = reinterpret_cast<std::uint32_t const*>(base + h.eventNames);
+    actionNames_ = reinterpret_cast<std::uint32_t const*>(base + h.actionNames);
+    guardNames_ = reinterpret_cast<std::uint32_t const*>(base + h.guardNames);
+    strings_ = base + h.strings;
+
+    // Checked once here, so that lookups need no checks of their own
+    auto named = [&h](std::uint32_t const* names, std::uint32_t n) {
+        for (std::uint32_t i = 0; i < n; ++i) {
+            if (names[i] >= h.stringsSize) {
+                return false;
+            }
+        }
+        return true;
+    };
+    if (h.name >= h.stringsSize || !named(stateNames_, h.numStates) ||
+        !named(eventNames_, h.numEvents) ||
+        !named(actionNames_, h.numActions) ||
+        !named(guardNames_, h.numGuards)) {
+        TSM_THROW(std::invalid_argument("Corrupt definition image"));
+    }
+    for (std::uint64_t i = 0; i < std::uint64_t(h.numStates) * h.numEvents;
+         ++i) {
+        if (slots_[i] > h.numTransitions) {
+            TSM_THROW(std::invalid_argument("Corrupt definition image"));
+        }
+    }
+    for (std::uint32_t i = 0; i < h.numTransitions; ++i) {
+        DefinitionTransition const& t = transitions_[i];
+        if (t.toState >= h.numStates ||
+            (t.action != None && t.action >= h.numActions) ||
+            (t.guard != None && t.guard >= h.numGuards)) {
+            TSM_THROW(std::invalid_argument("Corrupt definition image"));
+        }
+    }
+}
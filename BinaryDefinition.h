@@ -0,0 +1,495 @@
+#pragma once
+
+#include "Event.h"
+#include "State.h"
+#include "StateMachineDef.h"
+#include "Throw.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace tsm {
+
+///
+/// A definition stored as a flat binary image, used in place: dense
+/// transition slots, the transitions and string tables of the state, event,
+/// action and guard names. Export it once from a StateMachineDef with
+/// exportDefinition, then map it with MappedDefinition on every start - no
+/// add calls, no parsing and no allocation per entry - and run it with a
+/// MappedStateMachine. All fields are 32 bit, in native byte order.
+///
+/// The image is laid out as
+///
+///   DefinitionHeader
+///   std::uint32_t      slots[numStates * numEvents] // transition + 1, or 0
+///   DefinitionTransition transitions[numTransitions]
+///   std::uint32_t      stateNames[numStates]        // offsets in strings
+///   std::uint32_t      eventNames[numEvents]
+///   std::uint32_t      actionNames[numActions]
+///   std::uint32_t      guardNames[numGuards]
+///   char               strings[stringsSize]         // NUL terminated
+///
+/// Only flat definitions fit: sub HSMs, history states, deferrals and the
+/// entry and exit actions of states are not part of the format.
+///
+struct DefinitionHeader
+{
+    static constexpr std::uint32_t Magic = 0x444d5354; // "TSMD"
+    static constexpr std::uint16_t Version = 1;
+    static constexpr std::uint32_t None = 0xFFFFFFFF;
+
+    std::uint32_t magic;
+    std::uint16_t version;
+    std::uint16_t headerSize;
+    std::uint32_t size; ///< Of the whole image
+    std::uint32_t name; ///< Of the definition, an offset in strings
+    std::uint32_t numStates;
+    std::uint32_t numEvents;
+    std::uint32_t numTransitions;
+    std::uint32_t numActions;
+    std::uint32_t numGuards;
+    std::uint32_t startState;
+    std::uint32_t stopState; ///< None if there is none
+    // Byte offsets of the tables from the start of the image
+    std::uint32_t slots;
+    std::uint32_t transitions;
+    std::uint32_t stateNames;
+    std::uint32_t eventNames;
+    std::uint32_t actionNames;
+    std::uint32_t guardNames;
+    std::uint32_t strings;
+    std::uint32_t stringsSize;
+};
+
+struct DefinitionTransition
+{
+    std::uint32_t fromState;
+    std::uint32_t onEvent;
+    std::uint32_t toState;
+    std::uint32_t action; ///< Index in the action names, or None
+    std::uint32_t guard;  ///< Index in the guard names, or None
+};
+
+///
+/// The names exportDefinition writes for the events, which have none of
+/// their own, and for the actions and guards of transitions, which are
+/// bound to functions again by name when the image is run. States and
+/// events are told apart by their id space as well as their id.
+///
+/// tsm::DefinitionNames names;
+/// names.event(sm.coin, "coin").action(sm.locked, sm.coin, "pay");
+///
+class DefinitionNames
+{
+  public:
+    DefinitionNames& event(Event const& e, std::string name)
+    {
+        events_[idOf(e)] = std::move(name);
+        return *this;
+    }
+
+    /// Name the action of the transition from state on e.
+    DefinitionNames& action(State const& from, Event const& e, std::string name)
+    {
+        actions_[std::make_pair(idOf(from), idOf(e))] = std::move(name);
+        return *this;
+    }
+
+    /// Name the guard of the transition from state on e.
+    DefinitionNames& guard(State const& from, Event const& e, std::string name)
+    {
+        guards_[std::make_pair(idOf(from), idOf(e))] = std::move(name);
+        return *this;
+    }
+
+    /// The name of the event id of the id space space.
+    std::string const* eventName(UniqueId::IdType space,
+                                 UniqueId::IdType id) const
+    {
+        auto it = events_.find(std::make_pair(space, id));
+        return it != events_.end() ? &it->second : nullptr;
+    }
+
+    std::string const* actionName(State const& from, Event const& e) const
+    {
+        return find(actions_, from, e);
+    }
+
+    std::string const* guardName(State const& from, Event const& e) const
+    {
+        return find(guards_, from, e);
+    }
+
+  private:
+    // (space, id)
+    using Id = std::pair<UniqueId::IdType, UniqueId::IdType>;
+    using Key = std::pair<Id, Id>;
+
+    template<typename T>
+    static Id idOf(T const& t)
+    {
+        return std::make_pair(t.space, t.id);
+    }
+
+    static std::string const* find(std::map<Key, std::string> const& names,
+                                   State const& from,
+                                   Event const& e)
+    {
+        auto it = names.find(std::make_pair(idOf(from), idOf(e)));
+        return it != names.end() ? &it->second : nullptr;
+    }
+
+    std::map<Id, std::string> events_;
+    std::map<Key, std::string> actions_;
+    std::map<Key, std::string> guards_;
+};
+
+namespace detail {
+
+// Builds the tables of an image, see exportDefinition.
+class DefinitionWriter
+{
+  public:
+    // The ids of an image are those of the definition's id space
+    explicit DefinitionWriter(UniqueId::IdType space)
+      : space_(space)
+      , strings_(1, '\0')
+    {}
+
+    void state(State const& s, bool start = false)
+    {
+        if (s.isHsm() || s.isHistory()) {
+            TSM_THROW(std::invalid_argument(
+              s.name + ": sub HSMs do not fit a binary definition"));
+        }
+        if (s.space != space_) {
+            TSM_THROW(std::invalid_argument(
+              s.name + ": states of another id space do not fit a binary "
+                       "definition"));
+        }
+        if (s.id >= stateNames_.size()) {
+            stateNames_.resize(s.id + 1, 0);
+        }
+        stateNames_[s.id] = intern(s.name);
+        if (start) {
+            start_ = s.id;
+        }
+    }
+
+    void transition(State const& from,
+                    Event const& e,
+                    State const& to,
+                    bool hasAction,
+                    bool hasGuard,
+                    DefinitionNames const& names);
+
+    void stop(State const& s)
+    {
+        state(s);
+        stop_ = s.id;
+    }
+
+    std::vector<char> write(std::string const& name,
+                            DefinitionNames const& names);
+
+  private:
+    std::uint32_t intern(std::string const& s);
+    static std::uint32_t index(std::vector<std::uint32_t>& table,
+                               std::uint32_t name);
+
+    UniqueId::IdType space_;
+    std::vector<DefinitionTransition> transitions_;
+    std::vector<std::uint32_t> stateNames_;
+    std::vector<std::uint32_t> actionNames_;
+    std::vector<std::uint32_t> guardNames_;
+    std::uint32_t numEvents_ = 0;
+    std::uint32_t start_ = DefinitionHeader::None;
+    std::uint32_t stop_ = DefinitionHeader::None;
+    std::string strings_;
+    std::map<std::string, std::uint32_t> interned_;
+};
+
+} // namespace detail
+
+///
+/// The binary image of the flat definition def, see DefinitionHeader. Every
+/// action and guard of def has to be named in names. Throws
+/// std::invalid_argument for definitions with sub HSMs, unnamed actions, or
+/// states or events from outside def's id space, e.g. global events, whose
+/// ids could clash with those of def.
+///
+/// std::ofstream("door.tsmd", std::ios::binary).write(image.data(),
+///                                                    image.size());
+///
+template<typename HSMDef, template<typename> class TransitionTableT>
+std::vector<char>
+exportDefinition(StateMachineDef<HSMDef, TransitionTableT>& def,
+                 DefinitionNames const& names)
+{
+    using Transition =
+      typename StateMachineDef<HSMDef, TransitionTableT>::Transition;
+    detail::DefinitionWriter writer(def.idSpace());
+    State* start = def.getStartState();
+    if (!start) {
+        TSM_THROW(std::invalid_argument(def.name + ": no start state"));
+    }
+    writer.state(*start, true);
+    if (State* stop = def.getStopState()) {
+        writer.stop(*stop);
+    }
+    def.getTable().forEach([&writer, &names](Transition const& t) {
+        writer.transition(t.fromState,
+                          t.onEvent,
+                          t.toState,
+                          bool(t.action),
+                          bool(t.guard),
+                          names);
+    });
+    return writer.write(def.name, names);
+}
+
+///
+/// A binary definition used in place, from a file mapped into memory or a
+/// buffer. The image is checked once, when it is opened; lookups are then a
+/// bounds check and an indexed load, as with the DenseTransitionTable.
+///
+class MappedDefinition
+{
+  public:
+    static constexpr std::uint32_t None = DefinitionHeader::None;
+
+    ///
+    /// Map the file at path, read only. Throws std::runtime_error if it
+    /// cannot be mapped and std::invalid_argument if it is not a definition
+    /// image.
+    ///
+    explicit MappedDefinition(std::string const& path);
+
+    /// Use the size bytes at data, 4 byte aligned, which outlive this.
+    MappedDefinition(void const* data, std::size_t size);
+
+    MappedDefinition(MappedDefinition const&) = delete;
+    MappedDefinition& operator=(MappedDefinition const&) = delete;
+
+    ~MappedDefinition();
+
+    /// The transition from state on event, nullptr if there is none.
+    DefinitionTransition const* next(std::uint32_t state,
+                                     std::uint32_t event) const
+    {
+        if (state >= header_->numStates || event >= header_->numEvents) {
+            return nullptr;
+        }
+        std::uint32_t slot = slots_[state * header_->numEvents + event];
+        return slot ? &transitions_[slot - 1] : nullptr;
+    }
+
+    DefinitionHeader const& header() const { return *header_; }
+
+    char const* name() const { return string(header_->name); }
+    char const* stateName(std::uint32_t id) const
+    {
+        return string(stateNames_[id]);
+    }
+    char const* eventName(std::uint32_t id) const
+    {
+        return string(eventNames_[id]);
+    }
+    char const* actionName(std::uint32_t i) const
+    {
+        return string(actionNames_[i]);
+    }
+    char const* guardName(std::uint32_t i) const
+    {
+        return string(guardNames_[i]);
+    }
+
+    /// The id of the state or event called name, None if there is none.
+    std::uint32_t findState(char const* name) const
+    {
+        return find(stateNames_, header_->numStates, name);
+    }
+    std::uint32_t findEvent(char const* name) const
+    {
+        return find(eventNames_, header_->numEvents, name);
+    }
+
+  private:
+    void open(void const* data, std::size_t size);
+
+    char const* string(std::uint32_t offset) const
+    {
+        return strings_ + offset;
+    }
+
+    std::uint32_t find(std::uint32_t const* names,
+                       std::uint32_t n,
+                       char const* name) const
+    {
+        for (std::uint32_t i = 0; i < n; ++i) {
+            if (std::strcmp(string(names[i]), name) == 0) {
+                return i;
+            }
+        }
+        return None;
+    }
+
+    void* mapping_;
+    std::size_t mappedSize_;
+    DefinitionHeader const* header_;
+    std::uint32_t const* slots_;
+    DefinitionTransition const* transitions_;
+    std::uint32_t const* stateNames_;
+    std::uint32_t const* eventNames_;
+    std::uint32_t const* actionNames_;
+    std::uint32_t const* guardNames_;
+    char const* strings_;
+};
+
+///
+/// The functions the action and guard names of binary definitions stand
+/// for, taking the Context a MappedStateMachine runs on.
+///
+/// tsm::DefinitionBindings<Wallet> bindings;
+/// bindings.action("pay", [](Wallet& w, tsm::Event const&) { ++w.credit; });
+///
+template<typename Context>
+class DefinitionBindings
+{
+  public:
+    using Action = void (*)(Context&, Event const&);
+    using Guard = bool (*)(Context&, Event const&);
+
+    DefinitionBindings& action(std::string name, Action fn)
+    {
+        actions_[std::move(name)] = fn;
+        return *this;
+    }
+
+    DefinitionBindings& guard(std::string name, Guard fn)
+    {
+        guards_[std::move(name)] = fn;
+        return *this;
+    }
+
+    Action findAction(char const* name) const { return find(actions_, name); }
+    Guard findGuard(char const* name) const { return find(guards_, name); }
+
+  private:
+    template<typename Fn>
+    static Fn find(std::map<std::string, Fn> const& fns, char const* name)
+    {
+        auto it = fns.find(name);
+        return it != fns.end() ? it->second : nullptr;
+    }
+
+    std::map<std::string, Action> actions_;
+    std::map<std::string, Guard> guards_;
+};
+
+///
+/// A flat state machine running a MappedDefinition on a Context. The
+/// actions and guards are bound once, on construction; execute is then a
+/// slot lookup, the guard and the action.
+///
+/// tsm::MappedDefinition def("turnstile.tsmd");
+/// tsm::MappedStateMachine<Wallet> sm(def, bindings, wallet);
+/// sm.startSM();
+/// sm.execute(def.findEvent("coin"));
+///
+template<typename Context>
+class MappedStateMachine
+{
+  public:
+    static constexpr std::uint32_t None = DefinitionHeader::None;
+
+    /// Throws std::invalid_argument if an action or guard is not bound.
+    MappedStateMachine(MappedDefinition const& def,
+                       DefinitionBindings<Context> const& bindings,
+                       Context& context)
+      : def_(def)
+      , context_(context)
+      , currentState_(None)
+    {
+        DefinitionHeader const& h = def.header();
+        actions_.reserve(h.numActions);
+        for (std::uint32_t i = 0; i < h.numActions; ++i) {
+            actions_.push_back(bindings.findAction(def.actionName(i)));
+            if (!actions_.back()) {
+                unbound(def.actionName(i));
+            }
+        }
+        guards_.reserve(h.numGuards);
+        for (std::uint32_t i = 0; i < h.numGuards; ++i) {
+            guards_.push_back(bindings.findGuard(def.guardName(i)));
+            if (!guards_.back()) {
+                unbound(def.guardName(i));
+            }
+        }
+    }
+
+    void startSM() { currentState_ = def_.header().startState; }
+
+    void stopSM() { currentState_ = None; }
+
+    ///
+    /// Execute e, an event of the definition the image was exported from,
+    /// or one with the same id. Returns true if a transition was taken.
+    ///
+    bool execute(Event const& e) { return execute(e.id, e); }
+
+    /// Execute the event with id event, passing no payload to the actions.
+    bool execute(std::uint32_t event)
+    {
+        return execute(event, Event::dummy_event);
+    }
+
+    /// The id of the current state, None if stopped.
+    std::uint32_t getCurrentState() const { return currentState_; }
+
+    char const* currentStateName() const
+    {
+        return currentState_ != None ? def_.stateName(currentState_) : "";
+    }
+
+    /// True once the stop state of the definition is reached.
+    bool isStopped() const
+    {
+        return currentState_ != None &&
+               currentState_ == def_.header().stopState;
+    }
+
+  private:
+    bool execute(std::uint32_t event, Event const& e)
+    {
+        DefinitionTransition const* t = def_.next(currentState_, event);
+        if (!t || (t->guard != None && !guards_[t->guard](context_, e))) {
+            return false;
+        }
+        if (t->action != None) {
+            actions_[t->action](context_, e);
+        }
+        currentState_ = t->toState;
+        return true;
+    }
+
+    void unbound(char const* name) const
+    {
+        TSM_THROW(std::invalid_argument(std::string(def_.name()) + ": " +
+                                        name + " is not bound"));
+    }
+
+    MappedDefinition const& def_;
+    Context& context_;
+    std::vector<typename DefinitionBindings<Context>::Action> actions_;
+    std::vector<typename DefinitionBindings<Context>::Guard> guards_;
+    std::uint32_t currentState_;
+};
+
+} // namespace tsm
@@ -0,0 +1,326 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#ifndef TSM_CALLBACK_SIZE
+#define TSM_CALLBACK_SIZE (3 * sizeof(void*))
+#endif
+
+namespace tsm {
+
+namespace detail {
+
+// The call signature of a function object with a single, non-template
+// operator().
+template<typename T>
+struct CallSignature;
+
+template<typename C, typename Ret, typename... Args>
+struct CallSignature<Ret (C::*)(Args...)>
+{
+    using type = Ret(Args...);
+};
+
+template<typename C, typename Ret, typename... Args>
+struct CallSignature<Ret (C::*)(Args...) const>
+{
+    using type = Ret(Args...);
+};
+
+// Turns a member function pointer into a function object taking the object as
+// its first argument, so it is invoked like any other callable.
+template<typename M>
+struct MemberFn;
+
+template<typename C, typename Ret, typename... Args>
+struct MemberFn<Ret (C::*)(Args...)>
+{
+    Ret operator()(C& c, Args... args) const
+    {
+        return (c.*fn)(std::forward<Args>(args)...);
+    }
+    Ret (C::*fn)(Args...);
+};
+
+template<typename C, typename Ret, typename... Args>
+struct MemberFn<Ret (C::*)(Args...) const>
+{
+    Ret operator()(C const& c, Args... args) const
+    {
+        return (c.*fn)(std::forward<Args>(args)...);
+    }
+    Ret (C::*fn)(Args...) const;
+};
+
+// Maps the event onto one argument of a callable: the HSMDef itself, the
+// event, or the event's payload.
+template<typename HSMDef, typename Event, typename Arg>
+struct CallbackArg
+{
+    using Decayed = typename std::decay<Arg>::type;
+    static constexpr bool isHsm = std::is_base_of<Decayed, HSMDef>::value;
+    static constexpr bool isEvent = std::is_same<Decayed, Event>::value;
+    static constexpr bool isPayload = !isHsm && !isEvent;
+
+    template<bool B = isHsm>
+    static typename std::enable_if<B, HSMDef&>::type get(HSMDef* hsm,
+                                                         Event const&)
+    {
+        return *hsm;
+    }
+
+    template<bool B = isEvent>
+    static typename std::enable_if<B, Event const&>::type get(HSMDef*,
+                                                              Event const& e)
+    {
+        return e;
+    }
+
+    template<bool B = isPayload>
+    static typename std::enable_if<B, Decayed const&>::type get(HSMDef*,
+                                                                Event const& e)
+    {
+        return *e.template payload<Decayed>();
+    }
+
+    static bool accepts(Event const& e)
+    {
+        return accepts(e, std::integral_constant<bool, isPayload>());
+    }
+
+  private:
+    // Only payload types are looked up, so that the HSMDef need not be
+    // copyable
+    static bool accepts(Event const&, std::false_type) { return true; }
+    static bool accepts(Event const& e, std::true_type)
+    {
+        return e.template payload<Decayed>() != nullptr;
+    }
+};
+
+template<typename HSMDef, typename Event, typename R, typename Sig>
+struct CallbackAdapter;
+
+template<typename HSMDef, typename Event, typename R, typename Ret>
+struct CallbackAdapter<HSMDef, Event, R, Ret()>
+{
+    static constexpr bool needsPayload = false;
+
+    template<typename F>
+    static R call(F& f, HSMDef*, Event const&)
+    {
+        return static_cast<R>(f());
+    }
+    static bool accepts(Event const&) { return true; }
+};
+
+template<typename HSMDef, typename Event, typename R, typename Ret, typename A>
+struct CallbackAdapter<HSMDef, Event, R, Ret(A)>
+{
+    using ArgA = CallbackArg<HSMDef, Event, A>;
+    static constexpr bool needsPayload = ArgA::isPayload;
+
+    template<typename F>
+    static R call(F& f, HSMDef* hsm, Event const& e)
+    {
+        return static_cast<R>(f(ArgA::get(hsm, e)));
+    }
+    static bool accepts(Event const& e) { return ArgA::accepts(e); }
+};
+
+template<typename HSMDef,
+         typename Event,
+         typename R,
+         typename Ret,
+         typename A,
+         typename B>
+struct CallbackAdapter<HSMDef, Event, R, Ret(A, B)>
+{
+    using ArgA = CallbackArg<HSMDef, Event, A>;
+    using ArgB = CallbackArg<HSMDef, Event, B>;
+    static_assert(ArgA::isHsm,
+                  "The first of two callback arguments must be the HSMDef");
+    static constexpr bool needsPayload = ArgB::isPayload;
+
+    template<typename F>
+    static R call(F& f, HSMDef* hsm, Event const& e)
+    {
+        return static_cast<R>(f(ArgA::get(hsm, e), ArgB::get(hsm, e)));
+    }
+    static bool accepts(Event const& e) { return ArgB::accepts(e); }
+};
+
+} // namespace detail
+
+///
+/// An action (R = void) or a guard (R = bool) of an HSMDef. It can be built
+/// from a member function of HSMDef, a lambda or any function object with a
+/// single, non-template operator(). It is called with what its parameters
+/// ask for:
+///
+/// void playSong();                       // member function
+/// void playSong(Song const& song);       // member function, payload
+/// [this] { return volume < 11; }         // captures the definition
+/// [](Player& p) { ++p.plays; }           // receives the definition
+/// [](Player& p, Song const& s) { ... }   // and the event's payload
+/// [](Event const& e) { ... }             // receives the event
+///
+/// A callback that takes a payload only accepts events that carry a payload
+/// of that type.
+///
+/// The callable is stored by value in a small buffer inside the callback (set
+/// its size with TSM_CALLBACK_SIZE), so there is no allocation. It is called
+/// through a thunk instantiated for its exact type, so the compiler sees the
+/// callable's body and inlines it there; a guard that checks a field costs
+/// one indirect call and the comparison.
+///
+template<typename HSMDef, typename Event, typename R>
+class Callback
+{
+  public:
+    static constexpr std::size_t StorageSize = TSM_CALLBACK_SIZE;
+    static constexpr std::size_t StorageAlign = alignof(void*);
+
+    Callback(std::nullptr_t = nullptr)
+      : ops_(nullptr)
+    {}
+
+    /// From a member function pointer. A null pointer makes an empty callback.
+    template<
+      typename M,
+      typename std::enable_if<std::is_member_function_pointer<M>::value,
+                              int>::type = 0>
+    Callback(M fn)
+      : ops_(nullptr)
+    {
+        if (fn) {
+            emplace(detail::MemberFn<M>{ fn });
+        }
+    }
+
+    /// From a lambda or function object.
+    template<typename F,
+             typename std::enable_if<
+               std::is_class<typename std::decay<F>::type>::value &&
+                 !std::is_same<typename std::decay<F>::type, Callback>::value,
+               int>::type = 0>
+    Callback(F&& f)
+      : ops_(nullptr)
+    {
+        emplace(std::forward<F>(f));
+    }
+
+    Callback(Callback const& other)
+      : ops_(nullptr)
+    {
+        copyFrom(other);
+    }
+
+    Callback& operator=(Callback const& other)
+    {
+        if (this != &other) {
+            reset();
+            copyFrom(other);
+        }
+        return *this;
+    }
+
+    ~Callback() { reset(); }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    R operator()(HSMDef* hsm, Event const& e) const
+    {
+        return ops_->invoke(&storage_, hsm, e);
+    }
+
+    /// True if the callback only accepts events carrying a certain payload.
+    bool needsPayload() const { return ops_ && ops_->accepts; }
+
+    /// False if the callback needs a payload that e does not carry.
+    bool accepts(Event const& e) const
+    {
+        return !ops_ || !ops_->accepts || ops_->accepts(e);
+    }
+
+  private:
+    struct Ops
+    {
+        R (*invoke)(void* f, HSMDef* hsm, Event const& e);
+        bool (*accepts)(Event const& e); ///< nullptr if no payload is needed
+        void (*copy)(void* dst, void const* src);
+        void (*destroy)(void* f);
+    };
+
+    template<typename F>
+    struct OpsFor
+    {
+        using Adapter = detail::CallbackAdapter<
+          HSMDef,
+          Event,
+          R,
+          typename detail::CallSignature<decltype(&F::operator())>::type>;
+
+        static R invoke(void* f, HSMDef* hsm, Event const& e)
+        {
+            return Adapter::call(*static_cast<F*>(f), hsm, e);
+        }
+        static void copy(void* dst, void const* src)
+        {
+            new (dst) F(*static_cast<F const*>(src));
+        }
+        static void destroy(void* f) { static_cast<F*>(f)->~F(); }
+        static const Ops ops;
+    };
+
+    template<typename F>
+    void emplace(F&& f)
+    {
+        using Fn = typename std::decay<F>::type;
+        static_assert(sizeof(Fn) <= StorageSize,
+                      "Callable does not fit in the callback. Increase "
+                      "TSM_CALLBACK_SIZE");
+        static_assert(StorageAlign % alignof(Fn) == 0,
+                      "Callable is over-aligned");
+        new (&storage_) Fn(std::forward<F>(f));
+        ops_ = &OpsFor<Fn>::ops;
+    }
+
+    void copyFrom(Callback const& other)
+    {
+        if (other.ops_) {
+            other.ops_->copy(&storage_, &other.storage_);
+            ops_ = other.ops_;
+        }
+    }
+
+    void reset()
+    {
+        if (ops_) {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    Ops const* ops_;
+    // Mutable so that mutable lambdas can be called through a const callback
+    mutable typename std::aligned_storage<StorageSize, StorageAlign>::type
+      storage_;
+};
+
+template<typename HSMDef, typename Event, typename R>
+template<typename F>
+const typename Callback<HSMDef, Event, R>::Ops
+  Callback<HSMDef, Event, R>::OpsFor<F>::ops = {
+      &Callback<HSMDef, Event, R>::OpsFor<F>::invoke,
+      OpsFor<F>::Adapter::needsPayload
+        ? &Callback<HSMDef, Event, R>::OpsFor<F>::Adapter::accepts
+        : nullptr,
+      &Callback<HSMDef, Event, R>::OpsFor<F>::copy,
+      &Callback<HSMDef, Event, R>::OpsFor<F>::destroy
+  };
+
+} // namespace tsm
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "StateMachineDef.h"
+
+#include <vector>
+
+namespace tsm {
+
+///
+/// Checks on a complete definition, run once before the machine is started:
+/// a missing start state, transitions hidden by an earlier transition with
+/// the same state and event, and states the start state cannot lead to. The
+/// tables accept all of these silently.
+///
+/// for (auto const& issue : tsm::validate(sm)) {
+///     std::cerr << issue.message << "\n";
+/// }
+///
+inline std::vector<DefinitionIssue> validate(IHsmDef& sm)
+{
+    std::vector<DefinitionIssue> issues;
+    sm.validate(issues);
+    return issues;
+}
+
+///
+/// Validate the hierarchy below sm and flatten it: every event a simple
+/// state has no transition for is resolved once, up front, to the transition,
+/// deferral or unhandled hook that walking up the parent HSMs would reach.
+/// Executing such an event then costs one lookup instead of a call per
+/// level of the hierarchy. The entry and exit actions along the way run as
+/// before.
+///
+/// Compile each instance after its hierarchy is complete. Transitions and
+/// deferrals added afterwards, and copies of a compiled definition, are not
+/// supported.
+///
+inline std::vector<DefinitionIssue> compile(IHsmDef& sm)
+{
+    std::vector<DefinitionIssue> issues = validate(sm);
+    sm.flatten();
+    return issues;
+}
+
+} // namespace tsm
@@ -1,3 +1,5 @@
 #include "Event.h"
 using tsm::Event;
 Event const Event::dummy_event{};
+constexpr std::size_t Event::PayloadSize;
+constexpr std::size_t Event::PayloadAlign;
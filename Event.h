@@ -1,37 +1,173 @@
 #pragma once
 #include "UniqueId.h"
 
+#include <cstddef>
 #include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#ifndef TSM_EVENT_PAYLOAD_SIZE
+#define TSM_EVENT_PAYLOAD_SIZE 32
+#endif
+
 namespace tsm {
 
+///
+/// An Event is identified by its (space, id) pair. Copies of an event compare
+/// equal to it, so the events declared in an HSMDef can be sent around freely.
+///
+/// An event can also carry a payload by value. The payload lives in a small
+/// buffer inside the event itself, so events are stored inline in the event
+/// queues without slicing and without a heap allocation per message:
+///
+/// sm.sendEvent(sm.set_speed.withPayload(Speed{ 42 }));
+///
+/// Actions and guards that take the payload type as a const reference receive
+/// it directly; see StateMachineDef::add. Payload types have to be copy
+/// constructible and fit in PayloadSize bytes (set with
+/// TSM_EVENT_PAYLOAD_SIZE).
+///
 class Event
 {
   public:
-    uint64_t id;
+    static constexpr std::size_t PayloadSize = TSM_EVENT_PAYLOAD_SIZE;
+    static constexpr std::size_t PayloadAlign = alignof(void*);
+
+    UniqueId::IdType id;    ///< Dense id within the owning definition
+    UniqueId::IdType space; ///< Id space of the owning definition
+
     Event()
-      : id(UniqueId::getId())
+      : Event(UniqueId::getEventId())
     {}
 
-    Event(Event const& other) = default;
+    Event(Event const& other)
+      : id(other.id)
+      , space(other.space)
+      , payloadOps_(nullptr)
+    {
+        copyPayload(other);
+    }
 
-    Event(Event&& other) = default;
+    Event(Event&& other)
+      : Event(static_cast<Event const&>(other))
+    {}
 
     Event& operator=(Event const& e)
     {
-        this->id = e.id;
+        if (this != &e) {
+            clearPayload();
+            this->id = e.id;
+            this->space = e.space;
+            copyPayload(e);
+        }
         return *this;
     }
-    virtual ~Event() = default;
 
-    bool operator==(const Event& rhs) const { return this->id == rhs.id; }
-    bool operator!=(const Event& rhs) const { return this->id != rhs.id; }
-    bool operator<(const Event& rhs) const { return this->id < rhs.id; }
+    virtual ~Event() { clearPayload(); }
+
+    bool operator==(const Event& rhs) const
+    {
+        return this->id == rhs.id && this->space == rhs.space;
+    }
+    bool operator!=(const Event& rhs) const { return !(*this == rhs); }
+    bool operator<(const Event& rhs) const
+    {
+        return this->space < rhs.space ||
+               (this->space == rhs.space && this->id < rhs.id);
+    }
+
+    /// A copy of this event that carries payload.
+    template<typename T>
+    Event withPayload(T&& payload) const
+    {
+        Event e(*this);
+        e.setPayload(std::forward<T>(payload));
+        return e;
+    }
+
+    template<typename T>
+    void setPayload(T&& payload)
+    {
+        using Payload = typename std::decay<T>::type;
+        static_assert(sizeof(Payload) <= PayloadSize,
+                      "Payload does not fit in the event. Increase "
+                      "TSM_EVENT_PAYLOAD_SIZE");
+        static_assert(PayloadAlign % alignof(Payload) == 0,
+                      "Payload is over-aligned");
+        clearPayload();
+        new (&payload_) Payload(std::forward<T>(payload));
+        payloadOps_ = &PayloadOpsFor<Payload>::ops;
+    }
+
+    /// The payload if the event carries one of type T, nullptr otherwise.
+    template<typename T>
+    T const* payload() const
+    {
+        if (payloadOps_ != &PayloadOpsFor<T>::ops) {
+            return nullptr;
+        }
+        return reinterpret_cast<T const*>(&payload_);
+    }
+
+    bool hasPayload() const { return payloadOps_ != nullptr; }
+
+    void clearPayload()
+    {
+        if (payloadOps_) {
+            payloadOps_->destroy(&payload_);
+            payloadOps_ = nullptr;
+        }
+    }
 
     static Event const
       dummy_event; ///< For startSM and stopSM calls, the state machine
                    ///< "automatically" transitions to the starting state.
                    ///< However, the State interface requires that an event be
                    ///< passed to the onEntry and onExit
+
+  private:
+    explicit Event(UniqueId::Id uid)
+      : id(uid.id)
+      , space(uid.space)
+      , payloadOps_(nullptr)
+    {}
+
+    // Type erasure for the inline payload. The address of the ops table also
+    // serves as the payload type's identity.
+    struct PayloadOps
+    {
+        void (*copy)(void* dst, void const* src);
+        void (*destroy)(void* payload);
+    };
+
+    template<typename T>
+    struct PayloadOpsFor
+    {
+        static void copy(void* dst, void const* src)
+        {
+            new (dst) T(*static_cast<T const*>(src));
+        }
+        static void destroy(void* payload) { static_cast<T*>(payload)->~T(); }
+        static const PayloadOps ops;
+    };
+
+    void copyPayload(Event const& other)
+    {
+        if (other.payloadOps_) {
+            other.payloadOps_->copy(&payload_, &other.payload_);
+            payloadOps_ = other.payloadOps_;
+        }
+    }
+
+    PayloadOps const* payloadOps_;
+    typename std::aligned_storage<PayloadSize, PayloadAlign>::type payload_;
+};
+
+template<typename T>
+const Event::PayloadOps Event::PayloadOpsFor<T>::ops = {
+    &Event::PayloadOpsFor<T>::copy,
+    &Event::PayloadOpsFor<T>::destroy
 };
 
 } // namespace tsm
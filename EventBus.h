@@ -0,0 +1,232 @@
+#pragma once
+
+#include "Event.h"
+#include "EventQueue.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace tsm {
+
+///
+/// Routes events between machines. Machines subscribe to topics - any
+/// event - and publishing an event hands it to the sendEvent of every
+/// subscriber, whatever its execution policy:
+///
+/// EventBus bus;
+/// bus.subscribe(config.reload, player);                 // as config.reload
+/// bus.subscribe(config.reload, recorder, recorder.reset); // as its own event
+/// bus.publish(config.reload.withPayload(Version{ 7 }));
+///
+/// A subscriber receives the topic event itself, or the event it subscribed
+/// with, carrying the payload of the published event in both cases. Events
+/// and their payloads are copied by value into the subscriber queues, so
+/// there is nothing to share or reclaim; to fan out a payload larger than
+/// Event::PayloadSize, publish a pointer to an immutable object that outlives
+/// the subscribers' processing.
+///
+/// publish(first, last) delivers a batch with one sendEvents - one lock
+/// acquisition and one wakeup - per subscriber, not per event, keeping the
+/// order of the events for each subscriber.
+///
+/// Subscribers are looked up by topic in a table indexed by event space and
+/// id. Both subscribing and publishing take the bus lock, which is held
+/// while the events are handed over. unsubscribe(machine) must be called
+/// before a subscribed machine is destroyed. A subscriber that processes
+/// events inside its sendEvent, such as an InlineStateMachine, must not
+/// publish to the same bus from its actions.
+///
+template<typename LockType>
+class EventBusT
+{
+  public:
+    EventBusT() = default;
+    EventBusT(EventBusT const&) = delete;
+    EventBusT& operator=(EventBusT const&) = delete;
+
+    /// Deliver topic to machine.
+    template<typename Machine>
+    void subscribe(Event const& topic, Machine& machine)
+    {
+        subscribe(topic, machine, topic);
+    }
+
+    /// Deliver topic to machine as the event as, with the topic's payload.
+    template<typename Machine>
+    void subscribe(Event const& topic, Machine& machine, Event const& as)
+    {
+        std::lock_guard<LockType> lock(mutex_);
+        std::size_t endpoint = endpointOf(&machine, &sendTo<Machine>);
+        if (topic.space >= topics_.size()) {
+            topics_.resize(topic.space + 1);
+        }
+        auto& byId = topics_[topic.space];
+        if (topic.id >= byId.size()) {
+            byId.resize(topic.id + 1);
+        }
+        byId[topic.id].push_back(Subscriber{ endpoint, as.id, as.space });
+    }
+
+    /// Stop delivering topic to machine.
+    template<typename Machine>
+    void unsubscribe(Event const& topic, Machine& machine)
+    {
+        std::lock_guard<LockType> lock(mutex_);
+        std::vector<Subscriber>* subscribers = find(topic);
+        if (subscribers) {
+            remove(*subscribers, &machine);
+        }
+    }
+
+    /// Remove every subscription of machine, e.g. before destroying it.
+    template<typename Machine>
+    void unsubscribe(Machine& machine)
+    {
+        std::lock_guard<LockType> lock(mutex_);
+        for (auto& byId : topics_) {
+            for (auto& subscribers : byId) {
+                remove(subscribers, &machine);
+            }
+        }
+        for (Endpoint& endpoint : endpoints_) {
+            if (endpoint.machine == &machine) {
+                endpoint.machine = nullptr;
+            }
+        }
+    }
+
+    /// Send e to the subscribers of its topic. Returns their number.
+    std::size_t publish(Event const& e)
+    {
+        std::lock_guard<LockType> lock(mutex_);
+        std::vector<Subscriber>* subscribers = find(e);
+        if (!subscribers) {
+            return 0;
+        }
+        Event delivered(e);
+        for (Subscriber const& s : *subscribers) {
+            delivered.id = s.id;
+            delivered.space = s.space;
+            Endpoint const& endpoint = endpoints_[s.endpoint];
+            endpoint.send(endpoint.machine, &delivered, &delivered + 1);
+        }
+        return subscribers->size();
+    }
+
+    ///
+    /// Send the events in [first, last) to the subscribers of their topics,
+    /// with a single sendEvents per subscriber. Returns the number of events
+    /// delivered.
+    ///
+    template<typename InputIt>
+    std::size_t publish(InputIt first, InputIt last)
+    {
+        std::lock_guard<LockType> lock(mutex_);
+        std::size_t delivered = 0;
+        for (; first != last; ++first) {
+            std::vector<Subscriber>* subscribers = find(*first);
+            if (!subscribers) {
+                continue;
+            }
+            for (Subscriber const& s : *subscribers) {
+                Endpoint& endpoint = endpoints_[s.endpoint];
+                if (endpoint.batch.empty()) {
+                    touched_.push_back(s.endpoint);
+                }
+                endpoint.batch.push_back(*first);
+                endpoint.batch.back().id = s.id;
+                endpoint.batch.back().space = s.space;
+            }
+            delivered += subscribers->size();
+        }
+        for (std::size_t i : touched_) {
+            Endpoint& endpoint = endpoints_[i];
+            endpoint.send(endpoint.machine,
+                          endpoint.batch.data(),
+                          endpoint.batch.data() + endpoint.batch.size());
+            endpoint.batch.clear();
+        }
+        touched_.clear();
+        return delivered;
+    }
+
+  private:
+    using SendFn = void (*)(void*, Event const*, Event const*);
+
+    template<typename Machine>
+    static void sendTo(void* machine, Event const* first, Event const* last)
+    {
+        static_cast<Machine*>(machine)->sendEvents(first, last);
+    }
+
+    // A subscribed machine, with the batch being built for it by publish.
+    struct Endpoint
+    {
+        void* machine;
+        SendFn send;
+        std::vector<Event> batch;
+    };
+
+    struct Subscriber
+    {
+        std::size_t endpoint;
+        UniqueId::IdType id;
+        UniqueId::IdType space;
+    };
+
+    // The endpoint of machine, made in a free slot if it has none.
+    std::size_t endpointOf(void* machine, SendFn send)
+    {
+        std::size_t free = endpoints_.size();
+        for (std::size_t i = 0; i < endpoints_.size(); ++i) {
+            if (endpoints_[i].machine == machine &&
+                endpoints_[i].send == send) {
+                return i;
+            }
+            if (!endpoints_[i].machine) {
+                free = i;
+            }
+        }
+        if (free == endpoints_.size()) {
+            endpoints_.emplace_back();
+        }
+        endpoints_[free].machine = machine;
+        endpoints_[free].send = send;
+        return free;
+    }
+
+    std::vector<Subscriber>* find(Event const& topic)
+    {
+        if (topic.space >= topics_.size() ||
+            topic.id >= topics_[topic.space].size() ||
+            topics_[topic.space][topic.id].empty()) {
+            return nullptr;
+        }
+        return &topics_[topic.space][topic.id];
+    }
+
+    void remove(std::vector<Subscriber>& subscribers, void* machine)
+    {
+        subscribers.erase(std::remove_if(subscribers.begin(),
+                                         subscribers.end(),
+                                         [&](Subscriber const& s) {
+                                             return endpoints_[s.endpoint]
+                                                      .machine == machine;
+                                         }),
+                          subscribers.end());
+    }
+
+    std::vector<std::vector<std::vector<Subscriber>>> topics_;
+    std::vector<Endpoint> endpoints_;
+    std::vector<std::size_t> touched_;
+    LockType mutex_;
+};
+
+/// A bus for machines that are all fed from one thread.
+using SimpleEventBus = EventBusT<dummy_mutex>;
+
+using EventBus = EventBusT<std::mutex>;
+
+} // namespace tsm
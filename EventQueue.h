@@ -1,11 +1,14 @@
 #pragma once
 
-#include <glog/logging.h>
+#include "Throw.h"
+#include "Trace.h"
 
+#include <algorithm>
 #include <condition_variable>
 #include <deque>
 #include <iostream>
 #include <mutex>
+#include <stdexcept>
 #include <string>
 #include <thread>
 
@@ -35,7 +38,9 @@ struct EventQueueInterruptedException : public std::runtime_error
 };
 
 // A thread safe event queue. Any thread can call addEvent if it has a pointer
-// to the event queue. The call to nextEvent is a blocking call
+// to the event queue. The call to nextEvent is a blocking call. Once the queue
+// is stopped, tryNextEvent and tryNextEvents return false and 0, and
+// nextEvent and nextEvents throw EventQueueInterruptedException.
 template<typename Event, typename LockType>
 class EventQueueT : private deque<Event>
 {
@@ -57,30 +62,85 @@ class EventQueueT : private deque<Event>
     const Event nextEvent()
     {
         std::unique_lock<LockType> lock(eventQueueMutex_);
-        cvEventAvailable_.wait(
-          lock, [this] { return (!this->empty() || this->interrupt_); });
-        if (interrupt_) {
-            throw EventQueueInterruptedException("Bailing from Event Queue");
-        } else {
-            const Event e = std::move(front());
-            DLOG(INFO) << "Thread:" << std::this_thread::get_id()
-                       << " Popping Event:" << e.id;
-            pop_front();
-            return std::move(e);
+        if (!wait(lock)) {
+            TSM_THROW(
+              EventQueueInterruptedException("Bailing from Event Queue"));
+        }
+        return pop();
+    }
+
+    // Block until there is an event and move it to e, or until the queue is
+    // stopped and return false.
+    bool tryNextEvent(Event& e)
+    {
+        std::unique_lock<LockType> lock(eventQueueMutex_);
+        if (!wait(lock)) {
+            return false;
+        }
+        e = pop();
+        return true;
+    }
+
+    // Block until there is at least one event. Then move up to maxEvents
+    // events to out under a single lock acquisition. Returns the number of
+    // events moved.
+    template<typename OutputIt>
+    std::size_t nextEvents(OutputIt out, std::size_t maxEvents)
+    {
+        std::unique_lock<LockType> lock(eventQueueMutex_);
+        if (!wait(lock)) {
+            TSM_THROW(
+              EventQueueInterruptedException("Bailing from Event Queue"));
+        }
+        return popMany(out, maxEvents);
+    }
+
+    // Same as nextEvents, but returns 0 once the queue is stopped.
+    template<typename OutputIt>
+    std::size_t tryNextEvents(OutputIt out, std::size_t maxEvents)
+    {
+        std::unique_lock<LockType> lock(eventQueueMutex_);
+        if (!wait(lock)) {
+            return 0;
+        }
+        return popMany(out, maxEvents);
+    }
+
+    // Move up to maxEvents of the queued events to out without waiting.
+    // Returns 0 if there are none, the queue is stopped or a producer holds
+    // the lock.
+    template<typename OutputIt>
+    std::size_t pollEvents(OutputIt out, std::size_t maxEvents)
+    {
+        std::unique_lock<LockType> lock(eventQueueMutex_, std::try_to_lock);
+        if (!lock.owns_lock() || interrupt_ || this->empty()) {
+            return 0;
         }
+        return popMany(out, maxEvents);
     }
 
     void addEvent(Event const& e)
     {
         std::lock_guard<LockType> lock(eventQueueMutex_);
-        DLOG(INFO) << "Thread:" << std::this_thread::get_id()
-                   << " Adding Event:" << e.id << "\n";
+        TSM_DLOG(INFO) << "Thread:" << std::this_thread::get_id()
+                       << " Adding Event:" << e.id << "\n";
         push_back(e);
         cvEventAvailable_.notify_all();
     }
 
+    // Add a whole batch of events under one lock acquisition and a single
+    // notification.
+    template<typename InputIt>
+    void addEvents(InputIt first, InputIt last)
+    {
+        std::lock_guard<LockType> lock(eventQueueMutex_);
+        this->insert(this->end(), first, last);
+        cvEventAvailable_.notify_all();
+    }
+
     void stop()
     {
+        std::lock_guard<LockType> lock(eventQueueMutex_);
         interrupt_ = true;
         cvEventAvailable_.notify_all();
         // Log the events that are going to get dumped if the queue is not empty
@@ -94,6 +154,35 @@ class EventQueueT : private deque<Event>
     }
 
   private:
+    // False if the queue was stopped while waiting for an event.
+    bool wait(std::unique_lock<LockType>& lock)
+    {
+        cvEventAvailable_.wait(
+          lock, [this] { return (!this->empty() || this->interrupt_); });
+        return !interrupt_;
+    }
+
+    Event pop()
+    {
+        Event e = std::move(front());
+        TSM_DLOG(INFO) << "Thread:" << std::this_thread::get_id()
+                       << " Popping Event:" << e.id;
+        pop_front();
+        return e;
+    }
+
+    template<typename OutputIt>
+    std::size_t popMany(OutputIt out, std::size_t maxEvents)
+    {
+        std::size_t n = std::min(maxEvents, size());
+        auto last = this->begin() + n;
+        std::move(this->begin(), last, out);
+        this->erase(this->begin(), last);
+        TSM_DLOG(INFO) << "Thread:" << std::this_thread::get_id() << " Popping "
+                       << n << " Events";
+        return n;
+    }
+
     LockType eventQueueMutex_;
     std::condition_variable_any cvEventAvailable_;
     bool interrupt_;
@@ -0,0 +1,11 @@
+#include "EventTrace.h"
+
+using tsm::TraceBuffer;
+using tsm::TraceHeader;
+using tsm::TraceRecord;
+
+constexpr std::uint32_t TraceRecord::None;
+constexpr std::size_t TraceBuffer::DefaultCapacity;
+constexpr std::size_t TraceBuffer::RecordWords;
+constexpr std::uint32_t TraceHeader::Magic;
+constexpr std::uint16_t TraceHeader::Version;
@@ -0,0 +1,326 @@
+#pragma once
+
+#include "Event.h"
+#include "Metrics.h"
+#include "State.h"
+#include "StateMachineDef.h"
+#include "Throw.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace tsm {
+
+///
+/// One hook of a traced machine, see TraceRecorder. 40 bytes, written and
+/// read as is. The states of each HSM of a hierarchy are numbered in an id
+/// space of its own, so a state is its id and its space.
+///
+struct TraceRecord
+{
+    static constexpr std::uint32_t None = 0xFFFFFFFF;
+
+    enum class Kind : std::uint8_t
+    {
+        Transition,    ///< Guard passed, from -> to
+        GuardRejected, ///< Guard failed in from
+        Unhandled      ///< Reached the top level HSM
+    };
+
+    std::int64_t time;      ///< Steady clock nanoseconds
+    std::uint32_t machine;  ///< See TraceRecorder::attach
+    std::uint32_t from;      ///< State id, None for Unhandled
+    std::uint32_t fromSpace; ///< State id space, None for Unhandled
+    std::uint32_t to;        ///< State id, None unless Transition
+    std::uint32_t toSpace;   ///< State id space, None unless Transition
+    std::uint32_t event;     ///< Event id
+    std::uint32_t space;    ///< Event id space
+    Kind kind;
+    std::uint8_t reserved[3];
+};
+
+static_assert(sizeof(TraceRecord) == 40, "TraceRecord is 40 bytes");
+
+///
+/// A ring of the last capacity TraceRecords of a machine. One thread, the
+/// machine's, records; any thread can dump at any time without stopping it.
+/// Recording is a handful of relaxed stores and no locked instruction, and
+/// records the dump finds half overwritten are left out of it.
+///
+class TraceBuffer
+{
+  public:
+    static constexpr std::size_t DefaultCapacity = 4096;
+
+    /// capacity is rounded up to a power of two.
+    explicit TraceBuffer(std::size_t capacity = DefaultCapacity)
+      : mask_(roundUp(capacity) - 1)
+      , words_(new std::atomic<std::uint64_t>[(mask_ + 1) * RecordWords])
+      , claimed_(0)
+      , published_(0)
+    {}
+
+    TraceBuffer(TraceBuffer const&) = delete;
+    TraceBuffer& operator=(TraceBuffer const&) = delete;
+
+    void record(TraceRecord const& r)
+    {
+        std::uint64_t n = claimed_.load(std::memory_order_relaxed);
+        claimed_.store(n + 1, std::memory_order_relaxed);
+
+        std::uint64_t words[RecordWords];
+        std::memcpy(words, &r, sizeof(r));
+        std::atomic<std::uint64_t>* slot = &words_[(n & mask_) * RecordWords];
+        for (std::size_t i = 0; i < RecordWords; ++i) {
+            // Released so that a dump seeing a word sees the claim too. Plain
+            // stores on x86 and no fence, unlike a seq_cst store.
+            slot[i].store(words[i], std::memory_order_release);
+        }
+        published_.store(n + 1, std::memory_order_release);
+    }
+
+    ///
+    /// Append the records in the ring to out, oldest first. Returns the
+    /// number appended.
+    ///
+    std::size_t dump(std::vector<TraceRecord>& out) const
+    {
+        std::uint64_t end = published_.load(std::memory_order_acquire);
+        std::uint64_t capacity = mask_ + 1;
+        std::uint64_t begin = end > capacity ? end - capacity : 0;
+        std::size_t first = out.size();
+        out.resize(first + (end - begin));
+        for (std::uint64_t n = begin; n != end; ++n) {
+            std::uint64_t words[RecordWords];
+            std::atomic<std::uint64_t> const* slot =
+              &words_[(n & mask_) * RecordWords];
+            for (std::size_t i = 0; i < RecordWords; ++i) {
+                words[i] = slot[i].load(std::memory_order_acquire);
+            }
+            std::memcpy(&out[first + (n - begin)], words, sizeof(words));
+        }
+        // Drop the records overwritten while they were copied
+        std::uint64_t claimed = claimed_.load(std::memory_order_relaxed);
+        std::uint64_t valid = claimed > capacity ? claimed - capacity : 0;
+        if (valid > begin) {
+            std::size_t torn = static_cast<std::size_t>(
+              std::min<std::uint64_t>(valid, end) - begin);
+            out.erase(out.begin() + first, out.begin() + first + torn);
+        }
+        return out.size() - first;
+    }
+
+    std::vector<TraceRecord> dump() const
+    {
+        std::vector<TraceRecord> records;
+        dump(records);
+        return records;
+    }
+
+    /// Records since construction, including those overwritten.
+    std::uint64_t recorded() const
+    {
+        return published_.load(std::memory_order_acquire);
+    }
+
+    std::size_t capacity() const { return mask_ + 1; }
+
+  private:
+    static constexpr std::size_t RecordWords =
+      sizeof(TraceRecord) / sizeof(std::uint64_t);
+
+    static std::size_t roundUp(std::size_t n)
+    {
+        std::size_t p = 1;
+        while (p < n) {
+            p <<= 1;
+        }
+        return p;
+    }
+
+    std::size_t mask_;
+    std::unique_ptr<std::atomic<std::uint64_t>[]> words_;
+    std::atomic<std::uint64_t> claimed_;
+    std::atomic<std::uint64_t> published_;
+};
+
+///
+/// A Tracer recording every transition, guard rejection and unhandled event
+/// of the machine into a TraceBuffer, for always-on tracing in production:
+///
+/// tsm::TraceBuffer trace;
+/// SimpleStateMachine<MyHSMDef, tsm::TraceRecorder> sm;
+/// sm.getTracer().attach(trace, 7);
+/// ...
+/// std::vector<tsm::TraceRecord> records = trace.dump();
+///
+/// Each HSM of a hierarchy has a tracer of its own; attach the sub HSMs to
+/// the same buffer to record the whole machine. A recorder not attached
+/// records nothing. Event payloads are not recorded.
+///
+struct TraceRecorder
+{
+    TraceRecorder()
+      : buffer_(nullptr)
+      , machine_(0)
+    {}
+
+    /// Record into buffer, with machine as the machine id of the records.
+    void attach(TraceBuffer& buffer, std::uint32_t machine = 0)
+    {
+        buffer_ = &buffer;
+        machine_ = machine;
+    }
+
+    void detach() { buffer_ = nullptr; }
+
+    void onTransition(IHsmDef const&,
+                      State const& from,
+                      Event const& e,
+                      State const& to)
+    {
+        record(TraceRecord::Kind::Transition, &from, &to, e);
+    }
+
+    void onGuardRejected(IHsmDef const&, State const& state, Event const& e)
+    {
+        record(TraceRecord::Kind::GuardRejected, &state, nullptr, e);
+    }
+
+    void onUnhandled(IHsmDef const&, Event const& e)
+    {
+        record(TraceRecord::Kind::Unhandled, nullptr, nullptr, e);
+    }
+
+  private:
+    void record(TraceRecord::Kind kind,
+                State const* from,
+                State const* to,
+                Event const& e)
+    {
+        if (!buffer_) {
+            return;
+        }
+        TraceRecord r;
+        r.time = MachineMetrics::now();
+        r.machine = machine_;
+        r.from = from ? from->id : TraceRecord::None;
+        r.fromSpace = from ? from->space : TraceRecord::None;
+        r.to = to ? to->id : TraceRecord::None;
+        r.toSpace = to ? to->space : TraceRecord::None;
+        r.event = e.id;
+        r.space = e.space;
+        r.kind = kind;
+        std::memset(r.reserved, 0, sizeof(r.reserved));
+        buffer_->record(r);
+    }
+
+    TraceBuffer* buffer_;
+    std::uint32_t machine_;
+};
+
+/// The header of a trace written by writeTrace; the records follow it.
+struct TraceHeader
+{
+    static constexpr std::uint32_t Magic = 0x54534d54; // "TMST"
+    static constexpr std::uint16_t Version = 2;
+
+    std::uint32_t magic;
+    std::uint16_t version;
+    std::uint16_t recordSize;
+    std::uint64_t count;
+};
+
+inline void writeTrace(std::ostream& out,
+                       std::vector<TraceRecord> const& records)
+{
+    TraceHeader header;
+    header.magic = TraceHeader::Magic;
+    header.version = TraceHeader::Version;
+    header.recordSize = sizeof(TraceRecord);
+    header.count = records.size();
+    out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    out.write(reinterpret_cast<char const*>(records.data()),
+              static_cast<std::streamsize>(records.size() *
+                                           sizeof(TraceRecord)));
+}
+
+/// Read a trace written by writeTrace. Throws std::invalid_argument if in
+/// does not hold one.
+inline std::vector<TraceRecord> readTrace(std::istream& in)
+{
+    TraceHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        header.magic != TraceHeader::Magic ||
+        header.version != TraceHeader::Version ||
+        header.recordSize != sizeof(TraceRecord)) {
+        TSM_THROW(std::invalid_argument("Not an event trace"));
+    }
+    std::vector<TraceRecord> records;
+    TraceRecord r;
+    for (std::uint64_t i = 0; i < header.count; ++i) {
+        if (!in.read(reinterpret_cast<char*>(&r), sizeof(r))) {
+            TSM_THROW(std::invalid_argument("Truncated event trace"));
+        }
+        records.push_back(r);
+    }
+    return records;
+}
+
+///
+/// Feed the events of the records [first, last) of machine into sm, a fresh
+/// machine of the traced definition, through processEventNow - one event
+/// per record. The event ids and spaces are those of the recording
+/// process, so a trace replays in the same program, with its definitions
+/// first constructed in the same order. A deferred event is recorded when
+/// it is finally executed, where the replay feeds it. Machines with
+/// orthogonal regions, which can record several hooks for one event, do
+/// not replay. Returns the number of events fed; throws
+/// std::invalid_argument for an event sm does not handle.
+///
+/// tsm::SimpleStateMachine<MyHSMDef> fresh;
+/// fresh.startSM();
+/// tsm::replayTrace(fresh, records.begin(), records.end(), 7);
+///
+template<typename SM, typename InputIt>
+std::size_t replayTrace(SM& sm,
+                        InputIt first,
+                        InputIt last,
+                        std::uint32_t machine = 0)
+{
+    std::set<Event> events;
+    sm.collectEvents(events);
+    std::map<std::pair<std::uint32_t, std::uint32_t>, Event const*> byId;
+    for (Event const& e : events) {
+        byId.emplace(std::make_pair(e.space, e.id), &e);
+    }
+
+    std::size_t fed = 0;
+    for (; first != last; ++first) {
+        TraceRecord const& r = *first;
+        if (r.machine != machine) {
+            continue;
+        }
+        auto it = byId.find(std::make_pair(r.space, r.event));
+        if (it == byId.end()) {
+            TSM_THROW(std::invalid_argument(
+              "The trace has an event the machine does not handle"));
+        }
+        sm.processEventNow(*it->second);
+        ++fed;
+    }
+    return fed;
+}
+
+} // namespace tsm
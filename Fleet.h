@@ -0,0 +1,161 @@
+#pragma once
+
+#include "Event.h"
+#include "SharedDefinition.h"
+#include "Throw.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace tsm {
+
+/// One event for one instance of a Fleet.
+struct FleetEvent
+{
+    std::uint32_t instance;
+    std::uint32_t event; ///< See Fleet::eventIndex
+};
+
+///
+/// A large number of instances of one SharedDefinition, stored as a single
+/// contiguous array of state indices: the numHsms active states of instance
+/// i are at states()[i * numHsms], so a flat machine is one uint16 per
+/// instance. Events arrive in batches of (instance, event) pairs:
+///
+/// SharedDefinition<MyHSMDef> def;
+/// Fleet<MyHSMDef> fleet(def, 1000000);
+/// auto go = fleet.eventIndex(def.prototype().go);
+/// std::vector<FleetEvent> batch = { { 42, go }, { 7, go } };
+/// fleet.apply(batch.data(), batch.size());
+///
+/// For a plain definition (see SharedDefinition::isPlain) applying an event
+/// is a load from a precomputed (state x event) table of next states, with
+/// no calls at all; broadcast turns into a gather that the compiler can
+/// vectorize. The execute, onEntry and onExit hooks of the states are not
+/// called on that path. Otherwise the batch is sorted by instance, keeping
+/// the order of the events of each instance, and run through the definition,
+/// so each instance's states are touched once per batch.
+///
+template<typename HSMDef>
+class Fleet
+{
+  public:
+    using Definition = SharedDefinition<HSMDef>;
+    using StateIndex = typename Definition::StateIndex;
+
+    /// size instances, all started.
+    Fleet(Definition const& definition, std::size_t size)
+      : definition_(definition)
+      , numHsms_(definition.numHsms())
+      , numEvents_(definition.events().size())
+      , states_(size * numHsms_)
+    {
+        if (definition.isPlain()) {
+            std::size_t numStates = definition.numStates(0);
+            next_.resize(numStates * numEvents_);
+            for (std::size_t s = 0; s < numStates; ++s) {
+                for (std::size_t e = 0; e < numEvents_; ++e) {
+                    next_[s * numEvents_ + e] = definition.target(
+                      static_cast<StateIndex>(s), definition.events()[e]);
+                }
+            }
+        }
+        for (std::size_t i = 0; i < size; ++i) {
+            definition_.start(&states_[i * numHsms_]);
+        }
+    }
+
+    std::size_t size() const { return states_.size() / numHsms_; }
+
+    ///
+    /// The index of e in the batches. Throws std::out_of_range for events
+    /// the definition does not handle.
+    ///
+    std::uint32_t eventIndex(Event const& e) const
+    {
+        auto const& events = definition_.events();
+        auto it = std::lower_bound(events.begin(), events.end(), e);
+        if (it == events.end() || *it != e) {
+            TSM_THROW(std::out_of_range("Event not handled by the fleet"));
+        }
+        return static_cast<std::uint32_t>(it - events.begin());
+    }
+
+    ///
+    /// Apply the n events of batch, in order for every instance. Instance ids
+    /// and event indices are not range checked.
+    ///
+    void apply(FleetEvent const* batch, std::size_t n)
+    {
+        if (!next_.empty()) {
+            std::size_t numEvents = numEvents_;
+            StateIndex* states = states_.data();
+            StateIndex const* next = next_.data();
+            for (std::size_t k = 0; k < n; ++k) {
+                StateIndex& s = states[batch[k].instance];
+                s = next[s * numEvents + batch[k].event];
+            }
+            return;
+        }
+        sorted_.assign(batch, batch + n);
+        std::stable_sort(sorted_.begin(),
+                         sorted_.end(),
+                         [](FleetEvent const& a, FleetEvent const& b) {
+                             return a.instance < b.instance;
+                         });
+        for (FleetEvent const& fe : sorted_) {
+            definition_.execute(&states_[fe.instance * numHsms_],
+                                definition_.events()[fe.event]);
+        }
+    }
+
+    /// Apply event index e to every instance.
+    void broadcast(std::uint32_t e)
+    {
+        if (!next_.empty()) {
+            // The column of next states for e, then one gather per instance
+            std::size_t numStates = definition_.numStates(0);
+            column_.resize(numStates);
+            for (std::size_t s = 0; s < numStates; ++s) {
+                column_[s] = next_[s * numEvents_ + e];
+            }
+            StateIndex const* column = column_.data();
+            StateIndex* states = states_.data();
+            std::size_t n = states_.size();
+            for (std::size_t i = 0; i < n; ++i) {
+                states[i] = column[states[i]];
+            }
+            return;
+        }
+        for (std::size_t i = 0; i < size(); ++i) {
+            definition_.execute(&states_[i * numHsms_],
+                                definition_.events()[e]);
+        }
+    }
+
+    /// The current state of the top level HSM of instance i.
+    State const* getCurrentState(std::size_t i) const
+    {
+        return definition_.currentState(&states_[i * numHsms_]);
+    }
+
+    /// The states of all instances, numHsms per instance.
+    StateIndex const* states() const { return states_.data(); }
+
+    Definition const& getDefinition() const { return definition_; }
+
+  private:
+    Definition const& definition_;
+    std::size_t numHsms_;
+    std::size_t numEvents_;
+    std::vector<StateIndex> states_;
+    // [state * numEvents_ + event] for plain definitions, empty otherwise
+    std::vector<StateIndex> next_;
+    std::vector<StateIndex> column_;
+    std::vector<FleetEvent> sorted_;
+};
+
+} // namespace tsm
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "Event.h"
+#include "Metrics.h"
+
+#include <deque>
+
+namespace tsm {
+
+///
+/// The policy for run to completion processing on the caller's thread.
+/// sendEvent - or processEventNow - executes the event before it returns,
+/// with no queue, no wait and no event copy in between:
+///
+/// InlineStateMachine<MyHSMDef> sm;
+/// sm.startSM();
+/// sm.sendEvent(sm.some_event); // handled on return
+///
+/// An event sent from an action, while another event is being processed, is
+/// held back and executed once the current event completes, in the order it
+/// was sent. So every event still runs to completion before the next one
+/// starts. If an action throws, the held back events are dropped and the
+/// exception reaches the outermost caller.
+///
+/// The machine is not thread safe: send events from one thread at a time,
+/// and do not schedule timed events to it.
+///
+/// For a StateMachine with a MetricsTracer the policy counts the events it
+/// dispatches and samples their latency, see Metrics.h.
+///
+template<typename StateType>
+struct InlineExecutionPolicy : public StateType
+{
+    InlineExecutionPolicy()
+      : StateType()
+      , processing_(false)
+    {}
+
+    virtual ~InlineExecutionPolicy() = default;
+
+    void processEventNow(Event const& event)
+    {
+        if (processing_) {
+            pending_.push_back(event);
+            return;
+        }
+        Drain drain(*this);
+        executeUnqueued(*this, event);
+        while (!pending_.empty()) {
+            Event next = pending_.front();
+            pending_.pop_front();
+            executeUnqueued(*this, next);
+        }
+    }
+
+    void sendEvent(Event const& event) { processEventNow(event); }
+
+    template<typename InputIt>
+    void sendEvents(InputIt first, InputIt last)
+    {
+        for (; first != last; ++first) {
+            processEventNow(*first);
+        }
+    }
+
+    /// The number of events sent from actions and not yet executed.
+    std::size_t pending() const { return pending_.size(); }
+
+  private:
+    // Marks the policy as processing, and leaves it idle with nothing held
+    // back however processing ends.
+    struct Drain
+    {
+        explicit Drain(InlineExecutionPolicy& policy)
+          : policy(policy)
+        {
+            policy.processing_ = true;
+        }
+
+        Drain(Drain const&) = delete;
+        Drain& operator=(Drain const&) = delete;
+
+        ~Drain()
+        {
+            policy.pending_.clear();
+            policy.processing_ = false;
+        }
+
+        InlineExecutionPolicy& policy;
+    };
+
+    std::deque<Event> pending_;
+    bool processing_;
+};
+} // namespace tsm
@@ -0,0 +1,311 @@
+#pragma once
+
+#include "EventQueue.h"
+#include "Throw.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+
+namespace tsm {
+
+///
+/// A bounded, lock-free, multi-producer/single-consumer event queue. It can
+/// be used in place of EventQueue<Event> wherever exactly one thread calls
+/// nextEvent, e.g. as the event queue of an AsyncExecutionPolicy:
+///
+/// AsyncExecutionPolicy<StateMachine<MyHSMDef>, LockFreeEventQueue<Event>>
+///
+/// Producers claim a slot in a ring buffer of Capacity cells with a single
+/// CAS; every cell carries a sequence number that tells producers and the
+/// consumer whether it is free or published. Nothing is locked on the hot
+/// path. Only when the queue is empty does the consumer park on a condition
+/// variable, and a producer only takes the lock to wake it on the
+/// empty-to-non-empty edge while it is actually parked.
+///
+/// When the ring is full, addEvent yields until the consumer frees a slot;
+/// tryAddEvent returns false instead. There is no addFront.
+///
+/// The interrupt semantics match EventQueueT: after stop(), tryNextEvent
+/// returns false and nextEvent throws EventQueueInterruptedException.
+///
+template<typename Event, std::size_t Capacity = 1024>
+class LockFreeEventQueue
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "Capacity must be a power of 2");
+
+  public:
+    LockFreeEventQueue()
+      : enqueuePos_(0)
+      , dequeuePos_(0)
+      , count_(0)
+      , parked_(false)
+      , interrupt_(false)
+    {
+        for (std::size_t i = 0; i < Capacity; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    LockFreeEventQueue(LockFreeEventQueue const&) = delete;
+    LockFreeEventQueue& operator=(LockFreeEventQueue const&) = delete;
+
+    ~LockFreeEventQueue()
+    {
+        stop();
+        Event* e;
+        while ((e = peek())) {
+            pop(e);
+        }
+    }
+
+    // Block until you get an event
+    const Event nextEvent()
+    {
+        Event* e = wait();
+        if (!e) {
+            TSM_THROW(
+              EventQueueInterruptedException("Bailing from Event Queue"));
+        }
+        const Event next = *e;
+        pop(e);
+        return next;
+    }
+
+    // Block until there is an event and copy it to next, or until the queue
+    // is stopped and return false.
+    bool tryNextEvent(Event& next)
+    {
+        Event* e = wait();
+        if (!e) {
+            return false;
+        }
+        next = *e;
+        pop(e);
+        return true;
+    }
+
+    // Consumer only. Block until there is at least one event, then move up to
+    // maxEvents events to out. Returns the number of events moved.
+    template<typename OutputIt>
+    std::size_t nextEvents(OutputIt out, std::size_t maxEvents)
+    {
+        std::size_t n = tryNextEvents(out, maxEvents);
+        if (n == 0) {
+            TSM_THROW(
+              EventQueueInterruptedException("Bailing from Event Queue"));
+        }
+        return n;
+    }
+
+    // Same as nextEvents, but returns 0 once the queue is stopped.
+    template<typename OutputIt>
+    std::size_t tryNextEvents(OutputIt out, std::size_t maxEvents)
+    {
+        std::size_t n = 0;
+        for (Event* e = wait(); n < maxEvents && e; e = peek()) {
+            *out++ = *e;
+            pop(e);
+            ++n;
+        }
+        return n;
+    }
+
+    // Consumer only. Move up to maxEvents of the published events to out
+    // without waiting. Returns 0 if there are none or the queue is stopped.
+    template<typename OutputIt>
+    std::size_t pollEvents(OutputIt out, std::size_t maxEvents)
+    {
+        if (interrupt_.load(std::memory_order_acquire)) {
+            return 0;
+        }
+        std::size_t n = 0;
+        Event* e;
+        while (n < maxEvents && (e = peek())) {
+            *out++ = *e;
+            pop(e);
+            ++n;
+        }
+        return n;
+    }
+
+    bool tryAddEvent(Event const& e)
+    {
+        if (!publish(e)) {
+            return false; // full
+        }
+        signal(1);
+        return true;
+    }
+
+    void addEvent(Event const& e)
+    {
+        while (!tryAddEvent(e)) {
+            std::this_thread::yield();
+        }
+    }
+
+    // Add a batch of events. The consumer is signalled once for the whole
+    // batch, unless the ring fills up on the way.
+    template<typename InputIt>
+    void addEvents(InputIt first, InputIt last)
+    {
+        std::ptrdiff_t n = 0;
+        for (; first != last; ++first) {
+            while (!publish(*first)) {
+                // Let the consumer drain what is published so far
+                if (n > 0) {
+                    signal(n);
+                    n = 0;
+                }
+                std::this_thread::yield();
+            }
+            ++n;
+        }
+        if (n > 0) {
+            signal(n);
+        }
+    }
+
+    void stop()
+    {
+        interrupt_.store(true, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(parkMutex_);
+        cvEventAvailable_.notify_all();
+    }
+
+    bool empty() const { return count_.value.load() == 0; }
+
+    std::size_t size() const
+    {
+        auto n = count_.value.load();
+        return n > 0 ? static_cast<std::size_t>(n) : 0;
+    }
+
+  private:
+    // Copy e into a free cell. Returns false if the ring is full.
+    bool publish(Event const& e)
+    {
+        std::size_t pos = enqueuePos_.value.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &cells_[pos & (Capacity - 1)];
+            std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+            auto dif = static_cast<std::ptrdiff_t>(seq - pos);
+            if (dif == 0) {
+                if (enqueuePos_.value.compare_exchange_weak(
+                      pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = enqueuePos_.value.load(std::memory_order_relaxed);
+            }
+        }
+        new (&cell->storage) Event(e);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Account for n published events and wake the consumer if this is the
+    // empty-to-non-empty edge and it is parked.
+    void signal(std::ptrdiff_t n)
+    {
+        std::ptrdiff_t before = count_.value.fetch_add(n);
+        if (before <= 0 && before + n > 0 && parked_.load()) {
+            std::lock_guard<std::mutex> lock(parkMutex_);
+            cvEventAvailable_.notify_one();
+        }
+    }
+
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence;
+        typename std::aligned_storage<sizeof(Event), alignof(Event)>::type
+          storage;
+    };
+
+    // Consumer only. The published event at the head, if there is one.
+    Event* peek()
+    {
+        std::size_t pos = dequeuePos_.value.load(std::memory_order_relaxed);
+        Cell& cell = cells_[pos & (Capacity - 1)];
+        std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+        if (seq != pos + 1) {
+            return nullptr;
+        }
+        return reinterpret_cast<Event*>(&cell.storage);
+    }
+
+    // Consumer only. Release the head cell returned by peek.
+    void pop(Event* e)
+    {
+        std::size_t pos = dequeuePos_.value.load(std::memory_order_relaxed);
+        Cell& cell = cells_[pos & (Capacity - 1)];
+        e->~Event();
+        cell.sequence.store(pos + Capacity, std::memory_order_release);
+        dequeuePos_.value.store(pos + 1, std::memory_order_relaxed);
+        count_.value.fetch_sub(1);
+    }
+
+    // Consumer only. Block until there is a published event at the head and
+    // return it, or return nullptr once the queue is stopped.
+    Event* wait()
+    {
+        for (;;) {
+            if (interrupt_.load(std::memory_order_acquire)) {
+                return nullptr;
+            }
+            if (Event* e = peek()) {
+                return e;
+            }
+            if (count_.value.load() > 0) {
+                // A producer has claimed the head cell but not published it
+                // yet. It is in the middle of a copy, so don't park.
+                std::this_thread::yield();
+                continue;
+            }
+            park();
+        }
+    }
+
+    void park()
+    {
+        std::unique_lock<std::mutex> lock(parkMutex_);
+        parked_.store(true);
+        cvEventAvailable_.wait(lock, [this] {
+            return count_.value.load() > 0 ||
+                   interrupt_.load(std::memory_order_acquire);
+        });
+        parked_.store(false);
+    }
+
+    // Keep the producer and consumer cursors on separate cache lines. Padding
+    // rather than alignas, which C++14 operator new does not honour.
+    template<typename T>
+    struct CacheLinePadded
+    {
+        explicit CacheLinePadded(T v)
+          : value(v)
+        {}
+        std::atomic<T> value;
+        char pad[64 - sizeof(std::atomic<T>)];
+    };
+
+    Cell cells_[Capacity];
+    CacheLinePadded<std::size_t> enqueuePos_;
+    CacheLinePadded<std::size_t> dequeuePos_;
+    CacheLinePadded<std::ptrdiff_t> count_;
+    std::atomic<bool> parked_;
+    std::atomic<bool> interrupt_;
+    std::mutex parkMutex_;
+    std::condition_variable cvEventAvailable_;
+};
+
+} // namespace tsm
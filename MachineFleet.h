@@ -0,0 +1,257 @@
+#pragma once
+
+#include "Arena.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace tsm {
+
+///
+/// size full machine instances of type SM, built, started and stopped in
+/// parallel on a ThreadPool:
+///
+/// tsm::MachineFleet<SimpleStateMachine<MyHSMDef>> fleet(100000);
+/// fleet.startAll(); // every machine is in its start state
+/// fleet[42].sendEvent(fleet[42].go);
+///
+/// The instances are split into numPartitions contiguous partitions, the
+/// partition p holding the instances [p * size / numPartitions,
+/// (p + 1) * size / numPartitions), whatever the pool and the scheduling.
+/// Every bulk operation runs one task per partition and returns once all of
+/// them are done; each partition builds its machines in an Arena of its own,
+/// and the ids of a definition come from its own UniqueId space, so the
+/// partitions share nothing. The calling thread runs partitions too and
+/// takes back the ones no worker has started yet. Called on a worker of the
+/// pool, a bulk operation runs every partition inline.
+///
+/// Unlike Fleet, which stores only the state indices of a SharedDefinition,
+/// the instances are independent machines with their own queues, policies
+/// and data. SM must be default constructible, and neither its constructor
+/// nor the bulk operations may throw.
+///
+template<typename SM>
+class MachineFleet
+{
+  public:
+    explicit MachineFleet(std::size_t size,
+                          std::size_t numPartitions = ThreadPool::defaultSize(),
+                          ThreadPool& pool = ThreadPool::shared())
+      : pool_(pool)
+      , numPartitions_(std::max<std::size_t>(
+          1, std::min(numPartitions, size ? size : 1)))
+      , partitions_(new Partition[numPartitions_])
+      , machines_(size, nullptr)
+      , op_(nullptr)
+      , context_(nullptr)
+      , outstanding_(0)
+      , queued_(0)
+    {
+        for (std::size_t p = 0; p < numPartitions_; ++p) {
+            partitions_[p].owner = this;
+            partitions_[p].index = p;
+            partitions_[p].state.store(Partition::Idle);
+        }
+        run([this](Partition& partition, std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; ++i) {
+                machines_[i] = partition.arena.template create<SM>();
+            }
+        });
+    }
+
+    MachineFleet(MachineFleet const&) = delete;
+    MachineFleet& operator=(MachineFleet const&) = delete;
+
+    /// The machines are destroyed in parallel too, stopped or not.
+    ~MachineFleet()
+    {
+        run([](Partition& partition, std::size_t, std::size_t) {
+            partition.arena.reset();
+        });
+        // Workers may still hold tasks that were taken back and run inline
+        std::unique_lock<std::mutex> lock(joinMutex_);
+        cvQueued_.wait(lock, [this] { return queued_ == 0; });
+    }
+
+    /// Call startSM on every machine. Returns once all have started.
+    void startAll()
+    {
+        forEach([](SM& sm, std::size_t) { sm.startSM(); });
+    }
+
+    /// Call stopSM on every machine. Returns once all have stopped.
+    void stopAll()
+    {
+        forEach([](SM& sm, std::size_t) { sm.stopSM(); });
+    }
+
+    ///
+    /// Call f(machine, index) for every machine; the machines of a partition
+    /// in index order, on one thread, the partitions in parallel.
+    ///
+    template<typename F>
+    void forEach(F f)
+    {
+        run([this, &f](Partition&, std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; ++i) {
+                f(*machines_[i], i);
+            }
+        });
+    }
+
+    SM& operator[](std::size_t i) { return *machines_[i]; }
+    SM const& operator[](std::size_t i) const { return *machines_[i]; }
+
+    std::size_t size() const { return machines_.size(); }
+
+    std::size_t numPartitions() const { return numPartitions_; }
+
+    /// The [begin, end) instances of partition p.
+    std::pair<std::size_t, std::size_t> partition(std::size_t p) const
+    {
+        return std::make_pair(begin(p), begin(p + 1));
+    }
+
+    /// The partition holding instance i, for i < size().
+    std::size_t partitionOf(std::size_t i) const
+    {
+        // The last p with begin(p) <= i
+        return ((i + 1) * numPartitions_ - 1) / size();
+    }
+
+  private:
+    struct Partition : public ThreadPool::Task
+    {
+        enum : int
+        {
+            Idle,
+            Pending,
+            Claimed
+        };
+
+        // Whoever moves the task from Pending to Claimed runs the partition.
+        bool claim()
+        {
+            int expected = Pending;
+            return state.compare_exchange_strong(expected, Claimed);
+        }
+
+        void run() override
+        {
+            if (claim()) {
+                owner->runPartition(*this);
+                owner->partitionDone();
+            }
+            owner->partitionReleased();
+        }
+
+        MachineFleet* owner;
+        std::size_t index;
+        std::atomic<int> state;
+        Arena arena;
+    };
+
+    using Op = void (*)(void* context,
+                        Partition& partition,
+                        std::size_t begin,
+                        std::size_t end);
+
+    std::size_t begin(std::size_t p) const
+    {
+        return p * size() / numPartitions_;
+    }
+
+    template<typename F>
+    static void invoke(void* context,
+                       Partition& partition,
+                       std::size_t begin,
+                       std::size_t end)
+    {
+        (*static_cast<F*>(context))(partition, begin, end);
+    }
+
+    template<typename F>
+    void run(F f)
+    {
+        op_ = &invoke<F>;
+        context_ = &f;
+        if (numPartitions_ == 1 || pool_.isWorkerThread()) {
+            for (std::size_t p = 0; p < numPartitions_; ++p) {
+                runPartition(partitions_[p]);
+            }
+        } else {
+            fanOut();
+        }
+        context_ = nullptr;
+    }
+
+    void fanOut()
+    {
+        // The first partition is this thread's
+        {
+            std::lock_guard<std::mutex> lock(joinMutex_);
+            outstanding_ = numPartitions_ - 1;
+            queued_ += numPartitions_ - 1;
+        }
+        for (std::size_t p = 1; p < numPartitions_; ++p) {
+            partitions_[p].state.store(Partition::Pending);
+            pool_.submit(&partitions_[p]);
+        }
+        runPartition(partitions_[0]);
+        for (std::size_t p = 1; p < numPartitions_; ++p) {
+            if (partitions_[p].claim()) {
+                runPartition(partitions_[p]);
+                partitionDone();
+            }
+        }
+        std::unique_lock<std::mutex> lock(joinMutex_);
+        cvJoin_.wait(lock, [this] { return outstanding_ == 0; });
+    }
+
+    void runPartition(Partition& partition)
+    {
+        std::size_t p = partition.index;
+        op_(context_, partition, begin(p), begin(p + 1));
+    }
+
+    void partitionDone()
+    {
+        std::lock_guard<std::mutex> lock(joinMutex_);
+        if (--outstanding_ == 0) {
+            cvJoin_.notify_one();
+        }
+    }
+
+    // The pool is done with a partition. Notified under the lock: once
+    // queued_ is 0 the destructor may return.
+    void partitionReleased()
+    {
+        std::lock_guard<std::mutex> lock(joinMutex_);
+        if (--queued_ == 0) {
+            cvQueued_.notify_one();
+        }
+    }
+
+    ThreadPool& pool_;
+    std::size_t numPartitions_;
+    std::unique_ptr<Partition[]> partitions_;
+    // Written by the partitions at disjoint indices, read after the join
+    std::vector<SM*> machines_;
+    Op op_;
+    void* context_;
+    std::size_t outstanding_;
+    std::mutex joinMutex_;
+    std::condition_variable cvJoin_;
+    // Partitions submitted to the pool and not yet run by it
+    std::size_t queued_;
+    std::condition_variable cvQueued_;
+};
+
+} // namespace tsm
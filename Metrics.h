@@ -0,0 +1,615 @@
+#pragma once
+
+#include "Event.h"
+#include "State.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace tsm {
+
+///
+/// A counter written by one thread and read by any. Incrementing is a
+/// relaxed load and store, not a locked read-modify-write, so it costs about
+/// as much as incrementing a plain integer.
+///
+class Counter
+{
+  public:
+    Counter()
+      : value_(0)
+    {}
+
+    void add(std::uint64_t n = 1)
+    {
+        value_.store(value_.load(std::memory_order_relaxed) + n,
+                     std::memory_order_relaxed);
+    }
+
+    /// Raise the value to v if it is lower.
+    void raise(std::uint64_t v)
+    {
+        if (v > get()) {
+            value_.store(v, std::memory_order_relaxed);
+        }
+    }
+
+    std::uint64_t get() const { return value_.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<std::uint64_t> value_;
+};
+
+/// A copy of a LatencyHistogram, see LatencyHistogram::snapshot.
+struct HistogramSnapshot
+{
+    static constexpr std::size_t NumBuckets = 64;
+
+    /// The upper bound of bucket i, in nanoseconds.
+    static std::uint64_t bucketLimit(std::size_t i)
+    {
+        return i >= NumBuckets - 1 ? ~std::uint64_t(0)
+                                   : (std::uint64_t(1) << i);
+    }
+
+    std::uint64_t mean() const { return count ? sum / count : 0; }
+
+    ///
+    /// An upper bound of the p-th percentile (0 < p <= 1), i.e. the limit of
+    /// the bucket it falls into. Zero if nothing was recorded.
+    ///
+    std::uint64_t percentile(double p) const
+    {
+        std::uint64_t rank = static_cast<std::uint64_t>(p * count + 0.5);
+        rank = rank ? rank : 1;
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < NumBuckets && count; ++i) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                return bucketLimit(i);
+            }
+        }
+        return 0;
+    }
+
+    std::array<std::uint64_t, NumBuckets> buckets;
+    std::uint64_t count;
+    std::uint64_t sum; ///< In nanoseconds
+    std::uint64_t max; ///< In nanoseconds
+};
+
+///
+/// A histogram of durations with power of two buckets: bucket i counts the
+/// values in [2^(i-1), 2^i) nanoseconds. Like Counter it has a single writer.
+///
+class LatencyHistogram
+{
+  public:
+    static constexpr std::size_t NumBuckets = HistogramSnapshot::NumBuckets;
+
+    void record(std::uint64_t ns)
+    {
+        buckets_[bucketOf(ns)].add();
+        sum_.add(ns);
+        max_.raise(ns);
+    }
+
+    /// Safe to call from any thread while the owner keeps recording.
+    HistogramSnapshot snapshot() const
+    {
+        HistogramSnapshot s;
+        s.count = 0;
+        for (std::size_t i = 0; i < NumBuckets; ++i) {
+            s.buckets[i] = buckets_[i].get();
+            s.count += s.buckets[i];
+        }
+        s.sum = sum_.get();
+        s.max = max_.get();
+        return s;
+    }
+
+    static std::size_t bucketOf(std::uint64_t ns)
+    {
+        std::size_t i = 0;
+        while (ns) {
+            ns >>= 1;
+            ++i;
+        }
+        return i < NumBuckets ? i : NumBuckets - 1;
+    }
+
+  private:
+    std::array<Counter, NumBuckets> buckets_;
+    Counter sum_;
+    Counter max_;
+};
+
+/// The execution time of the events that took one transition, see
+/// MachineMetrics::transitionTimes.
+struct TransitionTime
+{
+    UniqueId::IdType stateSpace; ///< Of the from state
+    UniqueId::IdType state;      ///< The id of the from state
+    UniqueId::IdType eventSpace;
+    UniqueId::IdType event;
+    HistogramSnapshot executionTime;
+};
+
+/// A consistent enough copy of a machine's MachineMetrics.
+struct MetricsSnapshot
+{
+    std::uint64_t eventsSent;
+    std::uint64_t eventsCoalesced; ///< Sent but dropped by the queue
+    std::uint64_t eventsProcessed;
+    std::uint64_t transitions;
+    std::uint64_t guardRejections;
+    std::uint64_t unhandledEvents;
+    std::uint64_t queueDepth;    ///< Events sent but not processed yet
+    std::uint64_t maxQueueDepth; ///< Deepest queue seen by the machine thread
+    HistogramSnapshot queueLatency;  ///< Sent to dispatched, sampled
+    HistogramSnapshot executionTime; ///< Handling one event, sampled
+};
+
+///
+/// The counters of a single state machine. Apart from eventsSent and
+/// eventsCoalesced, which the senders increment, they are only written by the
+/// thread processing the machine's events, with relaxed stores. snapshot()
+/// can be called from any thread at any time. eventsSent is split into
+/// NumShards counters on separate cache lines, one per sending thread modulo
+/// NumShards, so that senders on different threads do not contend on one.
+///
+/// Counting is done for every event. Timing would cost two clock reads per
+/// event, so only one event in every sample interval (64 by default) is
+/// timed: from sendEvent to dispatch, and through execute. The send times of
+/// the sampled events are kept here, by the sample interval of the event
+/// among the events sent, and matched with the first event dispatched in that
+/// interval. A
+/// sender samples one in every interval of its own sends, so with several
+/// sending threads, a queue that reorders or coalesces, or a consumer
+/// NumStamps samples behind, a sample may be dropped or taken for a
+/// neighbour's; with one sender and a FIFO queue it is exact. So is
+/// maxQueueDepth, which is only measured at the sampled events.
+/// The execution time of a timed event is also recorded for the transition it
+/// took, the first one if it took several, see transitionTimes.
+///
+class MachineMetrics
+{
+  public:
+    static constexpr std::uint64_t DefaultSampleInterval = 64;
+    static constexpr std::size_t NumStamps = 64;
+    static constexpr std::size_t NumShards = 8;
+
+    MachineMetrics()
+      : coalesced_(0)
+      , sampleMask_(DefaultSampleInterval - 1)
+      , sampleShift_(6)
+      , took_(false)
+    {
+        for (Shard& shard : sent_) {
+            shard.value.store(0, std::memory_order_relaxed);
+        }
+        for (Stamp& stamp : stamps_) {
+            stamp.interval.store(0, std::memory_order_relaxed);
+            stamp.sentAt.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    ///
+    /// Time one event in every interval events, rounded up to a power of
+    /// two. 1 times every event.
+    ///
+    void setSampleInterval(std::uint64_t interval)
+    {
+        std::uint64_t n = 1;
+        sampleShift_ = 0;
+        while (n < interval) {
+            n <<= 1;
+            ++sampleShift_;
+        }
+        sampleMask_ = n - 1;
+    }
+
+    MetricsSnapshot snapshot() const
+    {
+        MetricsSnapshot s;
+        s.eventsProcessed = processed_.get();
+        s.eventsSent = sent();
+        s.eventsCoalesced = coalesced_.load(std::memory_order_relaxed);
+        s.transitions = transitions_.get();
+        s.guardRejections = guardRejections_.get();
+        s.unhandledEvents = unhandled_.get();
+        std::uint64_t done = s.eventsProcessed + s.eventsCoalesced;
+        s.queueDepth = s.eventsSent > done ? s.eventsSent - done : 0;
+        s.maxQueueDepth = maxQueueDepth_.get();
+        s.queueLatency = queueLatency_.snapshot();
+        s.executionTime = executionTime_.snapshot();
+        return s;
+    }
+
+    static std::int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 std::chrono::steady_clock::now().time_since_epoch())
+          .count();
+    }
+
+    /// Counts n sent events, none of them timed.
+    void countSent(std::uint64_t n = 1)
+    {
+        sent_[shardIndex()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    /// Counts an event about to be queued and notes the time if it is sampled.
+    void countQueued()
+    {
+        std::uint64_t own =
+          sent_[shardIndex()].value.fetch_add(1, std::memory_order_relaxed);
+        if ((own & sampleMask_) == 0) {
+            std::uint64_t interval = (sent() - 1) >> sampleShift_;
+            Stamp& stamp = stamps_[interval % NumStamps];
+            stamp.sentAt.store(now(), std::memory_order_relaxed);
+            stamp.interval.store(interval + 1, std::memory_order_release);
+        }
+    }
+
+    /// Counts n sent events the queue dropped, see PriorityEventQueueT.
+    void countCoalesced(std::uint64_t n = 1)
+    {
+        coalesced_.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    ///
+    /// The execution times recorded for each transition, in (from state,
+    /// event) order. Safe to call from any thread.
+    ///
+    std::vector<TransitionTime> transitionTimes() const
+    {
+        std::lock_guard<std::mutex> lock(transitionMutex_);
+        std::vector<TransitionTime> times;
+        for (auto const& it : transitionTimes_) {
+            TransitionTime t;
+            std::tie(t.stateSpace, t.state, t.eventSpace, t.event) = it.first;
+            t.executionTime = it.second.snapshot();
+            times.push_back(t);
+        }
+        return times;
+    }
+
+    /// The execution times recorded for the transition from from on e.
+    HistogramSnapshot transitionTime(State const& from, Event const& e) const
+    {
+        std::lock_guard<std::mutex> lock(transitionMutex_);
+        auto it = transitionTimes_.find(keyOf(from, e));
+        return it != transitionTimes_.end() ? it->second.snapshot()
+                                            : LatencyHistogram().snapshot();
+    }
+
+    ///
+    /// Called by the machine thread before executing the next event. True if
+    /// it is timed.
+    ///
+    bool beginEvent()
+    {
+        took_ = false;
+        std::uint64_t processed = processed_.get();
+        // The position of the event among the events sent, if they are
+        // dispatched in order
+        std::uint64_t done =
+          processed + coalesced_.load(std::memory_order_relaxed);
+        bool timed = (processed & sampleMask_) == 0;
+        bool sampled = (done & sampleMask_) == 0;
+        if (!timed && !sampled) {
+            return false;
+        }
+        std::uint64_t sent = this->sent();
+        if (sent > done) {
+            maxQueueDepth_.raise(sent - done);
+        }
+        std::int64_t sentAt = 0;
+        if (sampled) {
+            std::uint64_t interval = done >> sampleShift_;
+            Stamp& stamp = stamps_[interval % NumStamps];
+            if (stamp.interval.load(std::memory_order_acquire) ==
+                interval + 1) {
+                sentAt = stamp.sentAt.load(std::memory_order_relaxed);
+                // Overwritten by a later sample meanwhile
+                if (stamp.interval.load(std::memory_order_relaxed) !=
+                    interval + 1) {
+                    sentAt = 0;
+                }
+            }
+        }
+        if (sentAt || timed) {
+            startedAt_ = now();
+            if (sentAt && startedAt_ > sentAt) {
+                queueLatency_.record(startedAt_ - sentAt);
+            }
+        }
+        return timed;
+    }
+
+    void endEvent(bool timed)
+    {
+        if (timed) {
+            std::uint64_t ns = now() - startedAt_;
+            executionTime_.record(ns);
+            if (took_) {
+                transitionHistogram(transition_).record(ns);
+            }
+        }
+        processed_.add();
+    }
+
+    /// Called by the machine thread for the transition from from on e.
+    void countTransition(State const& from, Event const& e)
+    {
+        transitions_.add();
+        if (!took_) {
+            took_ = true;
+            transition_ = keyOf(from, e);
+        }
+    }
+
+    void countGuardRejection() { guardRejections_.add(); }
+    void countUnhandled() { unhandled_.add(); }
+
+  private:
+    // (from state space, from state id, event space, event id)
+    using TransitionKey = std::tuple<UniqueId::IdType,
+                                     UniqueId::IdType,
+                                     UniqueId::IdType,
+                                     UniqueId::IdType>;
+
+    static TransitionKey keyOf(State const& from, Event const& e)
+    {
+        return TransitionKey(from.space, from.id, e.space, e.id);
+    }
+
+    // Padding rather than alignas, as in LockFreeEventQueue
+    struct Shard
+    {
+        std::atomic<std::uint64_t> value;
+        char pad[64 - sizeof(std::atomic<std::uint64_t>)];
+    };
+
+    // The send time of the sample of a sample interval, and the number of
+    // the interval plus one, 0 if none
+    struct Stamp
+    {
+        std::atomic<std::uint64_t> interval;
+        std::atomic<std::int64_t> sentAt;
+    };
+
+    // The calling thread's shard, the same for every machine
+    static std::size_t shardIndex()
+    {
+        static std::atomic<std::size_t> nextIndex{ 0 };
+        static thread_local std::size_t index =
+          nextIndex.fetch_add(1, std::memory_order_relaxed) % NumShards;
+        return index;
+    }
+
+    std::uint64_t sent() const
+    {
+        std::uint64_t n = 0;
+        for (Shard const& shard : sent_) {
+            n += shard.value.load(std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    // Only the machine thread inserts, so it can look up without the lock
+    LatencyHistogram& transitionHistogram(TransitionKey const& key)
+    {
+        auto it = transitionTimes_.find(key);
+        if (it == transitionTimes_.end()) {
+            std::lock_guard<std::mutex> lock(transitionMutex_);
+            it = transitionTimes_
+                   .emplace(std::piecewise_construct,
+                            std::forward_as_tuple(key),
+                            std::forward_as_tuple())
+                   .first;
+        }
+        return it->second;
+    }
+
+    // Written by the senders
+    std::array<Shard, NumShards> sent_;
+    std::atomic<std::uint64_t> coalesced_;
+    std::array<Stamp, NumStamps> stamps_;
+    std::uint64_t sampleMask_;
+    unsigned sampleShift_;
+    // Written by the machine thread only
+    Counter processed_;
+    Counter transitions_;
+    Counter guardRejections_;
+    Counter unhandled_;
+    Counter maxQueueDepth_;
+    LatencyHistogram queueLatency_;
+    LatencyHistogram executionTime_;
+    std::map<TransitionKey, LatencyHistogram> transitionTimes_;
+    mutable std::mutex transitionMutex_;
+    TransitionKey transition_;
+    bool took_;
+    std::int64_t startedAt_;
+};
+
+///
+/// The tracer that turns metrics on for a machine:
+///
+/// AsyncExecutionPolicy<StateMachine<MyHSMDef, MetricsTracer>> sm;
+/// MetricsSnapshot s = sm.getTracer().metrics.snapshot();
+///
+/// The execution policies find it through the machine's TracerType and count
+/// and time the events they send and dispatch. Machines with any other tracer
+/// carry no metrics code at all.
+///
+/// The hooks count what the machine itself does. A sub-HSM is a machine of
+/// its own with its own tracer, so its transitions and guard rejections are
+/// not counted here, while the events it handles are. Declare the sub-HSM
+/// with a MetricsTracer too to count them in its own getTracer().metrics.
+///
+struct MetricsTracer
+{
+    void onTransition(IHsmDef const&,
+                      State const& from,
+                      Event const& e,
+                      State const&)
+    {
+        metrics.countTransition(from, e);
+    }
+
+    void onGuardRejected(IHsmDef const&, State const&, Event const&)
+    {
+        metrics.countGuardRejection();
+    }
+
+    void onUnhandled(IHsmDef const&, Event const&) { metrics.countUnhandled(); }
+
+    MachineMetrics metrics;
+};
+
+namespace detail {
+
+template<typename T>
+struct Void
+{
+    using type = void;
+};
+
+template<typename T, typename = void>
+struct HasMetrics : std::false_type
+{};
+
+template<typename T>
+struct HasMetrics<T, typename Void<typename T::TracerType>::type>
+  : std::is_base_of<MetricsTracer, typename T::TracerType>
+{};
+
+// Queue e, true unless the queue dropped it. Queues whose addEvent returns
+// void always queue.
+template<typename Queue>
+auto addToQueue(Queue& queue, Event const& e, int)
+  -> decltype(bool(queue.addEvent(e)))
+{
+    return queue.addEvent(e);
+}
+
+template<typename Queue>
+bool addToQueue(Queue& queue, Event const& e, long)
+{
+    queue.addEvent(e);
+    return true;
+}
+
+// Queue [first, last), returning the number of events queued.
+template<typename Queue, typename InputIt>
+auto addToQueue(Queue& queue, InputIt first, InputIt last, int)
+  -> decltype(std::size_t(queue.addEvents(first, last)))
+{
+    return queue.addEvents(first, last);
+}
+
+template<typename Queue, typename InputIt>
+std::size_t addToQueue(Queue& queue, InputIt first, InputIt last, long)
+{
+    std::size_t n = static_cast<std::size_t>(std::distance(first, last));
+    queue.addEvents(first, last);
+    return n;
+}
+
+} // namespace detail
+
+/// The metrics of sm, or nullptr if its tracer is not a MetricsTracer.
+template<typename SM>
+typename std::enable_if<detail::HasMetrics<SM>::value, MachineMetrics*>::type
+metricsOf(SM& sm)
+{
+    return &sm.getTracer().metrics;
+}
+
+template<typename SM>
+constexpr typename std::enable_if<!detail::HasMetrics<SM>::value,
+                                  MachineMetrics*>::type
+metricsOf(SM&)
+{
+    return nullptr;
+}
+
+///
+/// Queue e on queue for sm and count it. Used by the execution policies'
+/// sendEvent.
+///
+template<typename SM, typename Queue>
+void sendCounted(SM& sm, Queue& queue, Event const& e)
+{
+    MachineMetrics* metrics = metricsOf(sm);
+    if (!metrics) {
+        queue.addEvent(e);
+        return;
+    }
+    metrics->countQueued();
+    if (!detail::addToQueue(queue, e, 0)) {
+        metrics->countCoalesced();
+    }
+}
+
+/// Same as sendCounted for the events in [first, last). They are not timed.
+template<typename SM, typename Queue, typename InputIt>
+void sendCounted(SM& sm, Queue& queue, InputIt first, InputIt last)
+{
+    MachineMetrics* metrics = metricsOf(sm);
+    if (!metrics) {
+        queue.addEvents(first, last);
+        return;
+    }
+    std::uint64_t n = std::distance(first, last);
+    metrics->countSent(n);
+    std::uint64_t added = detail::addToQueue(queue, first, last, 0);
+    if (added < n) {
+        metrics->countCoalesced(n - added);
+    }
+}
+
+///
+/// Execute e on the most active state of sm, keeping sm's metrics. Used by the
+/// execution policies wherever they dispatch an event.
+///
+template<typename SM>
+void executeCounted(SM& sm, Event const& e)
+{
+    MachineMetrics* metrics = metricsOf(sm);
+    if (!metrics) {
+        sm.dispatch(&sm)->execute(e);
+        return;
+    }
+    bool timed = metrics->beginEvent();
+    sm.dispatch(&sm)->execute(e);
+    metrics->endEvent(timed);
+}
+
+///
+/// Count e as sent and execute it right away, for the policies that dispatch
+/// without a queue.
+///
+template<typename SM>
+void executeUnqueued(SM& sm, Event const& e)
+{
+    MachineMetrics* metrics = metricsOf(sm);
+    if (metrics) {
+        metrics->countSent();
+    }
+    executeCounted(sm, e);
+}
+
+} // namespace tsm
@@ -1,3 +1,10 @@
+#pragma once
+
+#include "Trace.h"
+
+#include <condition_variable>
+#include <mutex>
+
 namespace tsm {
 ///
 /// A simple observer class. The notify method will be invoked by an
@@ -15,14 +22,14 @@ struct BlockingObserver
     {
         std::unique_lock<std::mutex> lock(smBusyMutex_);
         notified_ = true;
-        DLOG(INFO) << "Notify.....";
+        TSM_DLOG(INFO) << "Notify.....";
         cv_.notify_all();
     }
 
     void wait()
     {
         std::unique_lock<std::mutex> lock(smBusyMutex_);
-        DLOG(INFO) << "Wait.....";
+        TSM_DLOG(INFO) << "Wait.....";
         cv_.wait(lock, [this] { return this->notified_ == true; });
         notified_ = false;
     }
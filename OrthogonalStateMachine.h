@@ -4,78 +4,260 @@
 #include "State.h"
 #include "StateMachine.h"
 
-#include <memory>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <cstdint>
+#include <set>
+#include <tuple>
+#include <utility>
+#include <vector>
+
 namespace tsm {
-template<typename HSMDef1, typename HSMDef2>
+
+///
+/// An HSM made of orthogonal regions, one StateMachine<HSMDef> per HSMDef in
+/// Defs. All regions are active at the same time.
+///
+/// Every event sent to the machine is delivered to each region that handles
+/// it somewhere in its hierarchy, in the order the regions are listed. The
+/// regions interested in an event are looked up in an index built once at
+/// construction: a bitmask per event, stored in a flat array per id space, so
+/// routing costs two array lookups no matter how many regions there are.
+/// Events that no region handles go up to the parent HSM. So do events that
+/// every region they were delivered to left unhandled.
+///
+template<typename... Defs>
 struct OrthogonalStateMachine : public IHsmDef
 {
-    using type = OrthogonalStateMachine<HSMDef1, HSMDef2>;
-    using SM1Type = StateMachine<HSMDef1>;
-    using SM2Type = StateMachine<HSMDef2>;
+    using type = OrthogonalStateMachine<Defs...>;
+    using Regions = std::tuple<StateMachine<Defs>...>;
+    using RegionMask = std::uint64_t;
+
+    static constexpr std::size_t NumRegions = sizeof...(Defs);
+    static_assert(NumRegions >= 1 && NumRegions <= 64,
+                  "An OrthogonalStateMachine has 1 to 64 regions");
+
+    template<std::size_t I>
+    using RegionType = typename std::tuple_element<I, Regions>::type;
 
     OrthogonalStateMachine(std::string const& name, IHsmDef* parent = nullptr)
       : IHsmDef(name, parent)
-      , hsm1_(SM1Type(this))
-      , hsm2_(SM2Type(this))
-    {}
+      , shallowHistory(*this, false)
+      , deepHistory(*this, true)
+      , regions_(self<Defs>()...)
+      , routing_(false)
+      , unhandled_(0)
+    {
+        initRegions(std::index_sequence_for<Defs...>());
+        buildIndex();
+    }
 
     void startSM() { onEntry(Event::dummy_event); }
 
     void onEntry(Event const& e) override
     {
-        DLOG(INFO) << "Entering: " << this->name;
-        this->currentState_ = &hsm1_;
-        hsm1_.onEntry(e);
-        hsm2_.onEntry(e);
+        TSM_DLOG(INFO) << "Entering: " << this->name;
+        for (IHsmDef* region : regionList_) {
+            region->onEntry(e);
+        }
+    }
+
+    /// Regions are concurrent, so only deep history resumes them.
+    void resume(Event const& e, bool deep) override
+    {
+        for (IHsmDef* region : regionList_) {
+            if (deep) {
+                region->resume(e, true);
+            } else {
+                region->onEntry(e);
+            }
+        }
     }
 
     void stopSM() { onExit(Event::dummy_event); }
 
     void onExit(Event const& e) override
     {
-        // TODO(sriram): hsm1->currentState_ = nullptr; etc.
-
         // Stopping a HSM means stopping all of its sub HSMs
-        hsm1_.onExit(e);
-        hsm2_.onExit(e);
+        for (IHsmDef* region : regionList_) {
+            region->onExit(e);
+        }
+        handOverDeferred();
     }
 
+    ///
+    /// The machine itself is the most active state as far as dispatch is
+    /// concerned: events enter here and are routed to the regions' active
+    /// states.
+    ///
     void execute(Event const& nextEvent) override
     {
-        if (hsm1_.getEvents().find(nextEvent) != hsm1_.getEvents().end()) {
-            this->currentState_ = &hsm1_;
-            hsm1_.execute(nextEvent);
-        } else if (hsm2_.getEvents().find(nextEvent) !=
-                   hsm2_.getEvents().end()) {
-            this->currentState_ = &hsm2_;
-            hsm2_.execute(nextEvent);
-        } else {
+        if (routing_) {
+            // Bubbled up from the region we just delivered to.
+            ++unhandled_;
+            return;
+        }
+
+        RegionMask mask = regionsFor(nextEvent);
+        unhandled_ = 0;
+        routing_ = true;
+        deliver(mask, nextEvent);
+        routing_ = false;
+
+        if (std::bitset<NumRegions>(mask).count() == unhandled_) {
             if (parent_) {
                 parent_->execute(nextEvent);
             } else {
-                LOG(ERROR) << "Reached top level HSM. Cannot handle event";
+                TSM_DLOG(ERROR) << "Reached top level HSM. Cannot handle event";
             }
         }
     }
 
-    IHsmDef* dispatch(IHsmDef*)
+    /// The regions in order. The machine itself has no state of its own.
+    std::size_t numSnapshotSlots() override
+    {
+        std::size_t n = 0;
+        for (IHsmDef* region : regionList_) {
+            n += region->numSnapshotSlots();
+        }
+        return n;
+    }
+
+    void saveState(std::uint16_t*& out) override
+    {
+        for (IHsmDef* region : regionList_) {
+            region->saveState(out);
+        }
+    }
+
+    std::uint64_t snapshotFingerprint() override
+    {
+        std::uint64_t h =
+          detail::fingerprint(detail::FingerprintBasis, this->name);
+        for (IHsmDef* region : regionList_) {
+            h = detail::fingerprint(h, region->snapshotFingerprint());
+        }
+        return h;
+    }
+
+    void checkState(std::uint16_t const*& in) override
+    {
+        for (IHsmDef* region : regionList_) {
+            region->checkState(in);
+        }
+    }
+
+    void loadState(std::uint16_t const*& in) override
+    {
+        for (IHsmDef* region : regionList_) {
+            region->loadState(in);
+        }
+    }
+
+    void collectEvents(std::set<Event>& events) override
+    {
+        for (IHsmDef* region : regionList_) {
+            region->collectEvents(events);
+        }
+    }
+
+    void validate(std::vector<DefinitionIssue>& issues) override
+    {
+        for (IHsmDef* region : regionList_) {
+            region->validate(issues);
+        }
+    }
+
+    /// Events bubbling up from the regions still come here to be counted.
+    void flatten() override
+    {
+        for (IHsmDef* region : regionList_) {
+            region->flatten();
+        }
+    }
+
+    /// The regions that handle e, bit I standing for region I.
+    RegionMask regionsFor(Event const& e) const
     {
-        SM1Type* hsm = dynamic_cast<SM1Type*>(this->currentState_);
-        if (hsm) {
-            return hsm1_.dispatch(&hsm1_);
-        } else {
-            return hsm2_.dispatch(&hsm2_);
+        if (e.space >= index_.size() || e.id >= index_[e.space].size()) {
+            return 0;
         }
+        return index_[e.space][e.id];
     }
 
-    State* getStartState() override { return &hsm1_; }
+    State* getStartState() override { return regionList_[0]; }
     State* getStopState() override { return nullptr; }
 
-    auto& getHsm1() { return hsm1_; }
-    auto& getHsm2() { return hsm2_; }
+    template<std::size_t I>
+    RegionType<I>& getRegion()
+    {
+        return std::get<I>(regions_);
+    }
+
+    /// Transition targets resuming the regions, see HistoryState.
+    HistoryState shallowHistory;
+    HistoryState deepHistory;
+
+  protected:
+    ///
+    /// Execute nextEvent on the active state of every region in mask. The
+    /// regions run one after the other on the calling thread; see
+    /// ParallelRegionPolicy for running them concurrently.
+    ///
+    virtual void deliver(RegionMask mask, Event const& nextEvent)
+    {
+        for (std::size_t i = 0; mask; ++i, mask >>= 1) {
+            if (mask & 1) {
+                executeRegion(i, nextEvent);
+            }
+        }
+    }
+
+    void executeRegion(std::size_t i, Event const& nextEvent)
+    {
+        this->dispatch(regionList_[i])->execute(nextEvent);
+    }
+
+  private:
+    template<typename>
+    IHsmDef* self()
+    {
+        return this;
+    }
+
+    template<std::size_t... I>
+    void initRegions(std::index_sequence<I...>)
+    {
+        regionList_ = { { &std::get<I>(regions_)... } };
+    }
+
+    void buildIndex()
+    {
+        for (std::size_t i = 0; i < NumRegions; ++i) {
+            std::set<Event> events;
+            regionList_[i]->collectEvents(events);
+            for (Event const& e : events) {
+                if (e.space >= index_.size()) {
+                    index_.resize(e.space + 1);
+                }
+                auto& masks = index_[e.space];
+                if (e.id >= masks.size()) {
+                    masks.resize(e.id + 1, 0);
+                }
+                masks[e.id] |= RegionMask(1) << i;
+            }
+        }
+    }
 
-    SM1Type hsm1_;
-    SM2Type hsm2_;
+    Regions regions_;
+    std::array<IHsmDef*, NumRegions> regionList_;
+    // index_[space][id] is the mask of the regions handling that event
+    std::vector<std::vector<RegionMask>> index_;
+    bool routing_;
+    // Regions bubble unhandled events up concurrently under
+    // ParallelRegionPolicy
+    std::atomic<std::size_t> unhandled_;
 };
 
 } // namespace tsm
@@ -0,0 +1,214 @@
+#pragma once
+
+#include "Event.h"
+#include "ThreadPool.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+
+namespace tsm {
+
+///
+/// An opt-in policy for an OrthogonalStateMachine that runs the regions
+/// interested in an event concurrently on a ThreadPool:
+///
+/// ParentThreadExecutionPolicy<ParallelRegionPolicy<MyOrthogonalHSM>> sm;
+///
+/// The event is fanned out to the regions and joined before execute returns,
+/// so the machine still processes one event at a time, run to completion.
+/// Regions must not share unsynchronized data.
+///
+/// The policy keeps a moving average of the time every region takes to
+/// handle an event. Regions that are cheaper than the inline threshold run on
+/// the calling thread; putting them on the pool would cost more than it
+/// saves. The calling thread also runs one of the expensive regions, and
+/// takes back the ones no worker has started yet while it waits, so it never
+/// blocks on a task that is still queued. This makes it safe to run the
+/// machine itself on a worker of the same pool, e.g. with
+/// PooledExecutionPolicy.
+///
+template<typename OrthogonalType>
+struct ParallelRegionPolicy : public OrthogonalType
+{
+    using RegionMask = typename OrthogonalType::RegionMask;
+    static constexpr std::size_t NumRegions = OrthogonalType::NumRegions;
+
+    template<typename... Args>
+    ParallelRegionPolicy(Args&&... args)
+      : OrthogonalType(std::forward<Args>(args)...)
+      , pool_(nullptr)
+      , inlineThreshold_(std::chrono::microseconds(20))
+      , currentEvent_(nullptr)
+      , outstanding_(0)
+      , queued_(0)
+    {
+        for (std::size_t i = 0; i < NumRegions; ++i) {
+            tasks_[i].owner = this;
+            tasks_[i].index = i;
+            tasks_[i].state.store(Task::Idle);
+            cost_[i] = 0;
+        }
+    }
+
+    virtual ~ParallelRegionPolicy()
+    {
+        // Workers may still hold tasks that were taken back and run inline
+        std::unique_lock<std::mutex> lock(joinMutex_);
+        cvQueued_.wait(lock, [this] { return queued_ == 0; });
+    }
+
+    /// The regions run on ThreadPool::shared() unless this is called.
+    void setThreadPool(ThreadPool& pool) { pool_ = &pool; }
+
+    ///
+    /// Regions that usually take less than threshold to handle an event run
+    /// on the calling thread. Zero sends every region to the pool.
+    ///
+    void setInlineThreshold(std::chrono::nanoseconds threshold)
+    {
+        inlineThreshold_ = threshold;
+    }
+
+    /// The moving average of the time region i takes to handle an event.
+    std::chrono::nanoseconds getRegionCost(std::size_t i) const
+    {
+        return std::chrono::nanoseconds(cost_[i]);
+    }
+
+  protected:
+    void deliver(RegionMask mask, Event const& nextEvent) override
+    {
+        std::array<std::size_t, NumRegions> cheap;
+        std::array<std::size_t, NumRegions> heavy;
+        std::size_t nCheap = 0;
+        std::size_t nHeavy = 0;
+        for (std::size_t i = 0; mask; ++i, mask >>= 1) {
+            if (mask & 1) {
+                if (cost_[i] < inlineThreshold_.count()) {
+                    cheap[nCheap++] = i;
+                } else {
+                    heavy[nHeavy++] = i;
+                }
+            }
+        }
+
+        // Keep the last expensive region for this thread
+        std::size_t nPooled = nHeavy ? nHeavy - 1 : 0;
+        if (nPooled > 0) {
+            if (!pool_) {
+                pool_ = &ThreadPool::shared();
+            }
+            currentEvent_ = &nextEvent;
+            {
+                std::lock_guard<std::mutex> lock(joinMutex_);
+                outstanding_ = nPooled;
+                queued_ += nPooled;
+            }
+            for (std::size_t n = 0; n < nPooled; ++n) {
+                Task& task = tasks_[heavy[n]];
+                task.state.store(Task::Pending);
+                pool_->submit(&task);
+            }
+        }
+
+        for (std::size_t n = 0; n < nCheap; ++n) {
+            runRegion(cheap[n], nextEvent);
+        }
+        if (nHeavy > 0) {
+            runRegion(heavy[nHeavy - 1], nextEvent);
+        }
+
+        if (nPooled > 0) {
+            for (std::size_t n = 0; n < nPooled; ++n) {
+                Task& task = tasks_[heavy[n]];
+                if (task.claim()) {
+                    runRegion(task.index, nextEvent);
+                    taskDone();
+                }
+            }
+            std::unique_lock<std::mutex> lock(joinMutex_);
+            cvJoin_.wait(lock, [this] { return outstanding_ == 0; });
+            currentEvent_ = nullptr;
+        }
+    }
+
+  private:
+    struct Task : public ThreadPool::Task
+    {
+        enum : int
+        {
+            Idle,
+            Pending,
+            Claimed
+        };
+
+        // Whoever moves the task from Pending to Claimed runs the region.
+        bool claim()
+        {
+            int expected = Pending;
+            return state.compare_exchange_strong(expected, Claimed);
+        }
+
+        void run() override
+        {
+            if (claim()) {
+                owner->runRegion(index, *owner->currentEvent_);
+                owner->taskDone();
+            }
+            owner->taskReleased();
+        }
+
+        ParallelRegionPolicy* owner;
+        std::size_t index;
+        std::atomic<int> state;
+    };
+
+    void runRegion(std::size_t i, Event const& nextEvent)
+    {
+        auto start = std::chrono::steady_clock::now();
+        this->executeRegion(i, nextEvent);
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+        cost_[i] += (elapsed - cost_[i]) / 8;
+    }
+
+    void taskDone()
+    {
+        std::lock_guard<std::mutex> lock(joinMutex_);
+        if (--outstanding_ == 0) {
+            cvJoin_.notify_one();
+        }
+    }
+
+    // The pool is done with a task. Notified under the lock: once queued_
+    // is 0 the destructor may return.
+    void taskReleased()
+    {
+        std::lock_guard<std::mutex> lock(joinMutex_);
+        if (--queued_ == 0) {
+            cvQueued_.notify_one();
+        }
+    }
+
+    ThreadPool* pool_;
+    std::chrono::nanoseconds inlineThreshold_;
+    std::array<Task, NumRegions> tasks_;
+    // Written only by whoever runs the region, read after the join
+    std::array<std::int64_t, NumRegions> cost_;
+    Event const* currentEvent_;
+    std::size_t outstanding_;
+    std::mutex joinMutex_;
+    std::condition_variable cvJoin_;
+    // Tasks submitted to the pool and not yet run by it
+    std::size_t queued_;
+    std::condition_variable cvQueued_;
+};
+
+} // namespace tsm
@@ -2,29 +2,44 @@
 
 #include "Event.h"
 #include "EventQueue.h"
+#include "Metrics.h"
+#include "ScopedFlag.h"
+
+#include <iterator>
+#include <limits>
+#include <vector>
 ///
 /// The policy for "synchronous" event processing. Events can be queued up in
 /// the event queue as they arrive. However, to process each event, a
 /// corresponding number of calls to the step function is required. So if there
 /// are 3 queued events, the step function needs to be invoked 3 times for all
-/// the events to be processed.
+/// the events to be processed. processEventNow skips the queue. Once the
+/// machine is stopped, step and drain return without processing anything.
+///
+/// The queue is a single threaded EventQueueT by default. The same
+/// interface with another ordering, e.g. SimplePriorityEventQueue, can be
+/// selected with EventQueueType.
+///
+/// For a StateMachine with a MetricsTracer the policy counts the events it
+/// sends and dispatches and samples their latency, see Metrics.h.
 ///
 namespace tsm {
-template<typename StateType>
+template<typename StateType,
+         typename EventQueueType = EventQueueT<Event, dummy_mutex>>
 struct ParentThreadExecutionPolicy : public StateType
 {
-    using EventQueue = EventQueueT<Event, dummy_mutex>;
+    using EventQueue = EventQueueType;
 
     ParentThreadExecutionPolicy()
       : StateType()
-      , interrupt_(false)
+      , processing_(false)
     {}
 
     virtual ~ParentThreadExecutionPolicy() = default;
 
     void onExit(Event const& e) override
     {
-        DLOG(INFO) << "Exiting from Parent thread policy...";
+        TSM_DLOG(INFO) << "Exiting from Parent thread policy...";
         eventQueue_.stop();
         StateType::onExit(e);
     }
@@ -32,29 +47,91 @@ struct ParentThreadExecutionPolicy : public StateType
     void step()
     {
         if (eventQueue_.empty()) {
-            DLOG(WARNING) << "Event Queue is empty!";
+            TSM_DLOG(WARNING) << "Event Queue is empty!";
             return;
         }
-        try {
-            // This is a blocking wait
-            Event const& nextEvent = eventQueue_.nextEvent();
-            // go down the HSM hierarchy to handle the event as that is the
-            // "most active state"
-            this->dispatch(this)->execute(nextEvent);
-
-        } catch (EventQueueInterruptedException const& e) {
-            if (!interrupt_) {
-                throw e;
+        Event nextEvent = Event::dummy_event;
+        // This is a blocking wait
+        if (!eventQueue_.tryNextEvent(nextEvent)) {
+            TSM_DLOG(WARNING) << this->name
+                              << ": Exiting event loop on interrupt";
+            return;
+        }
+        // go down the HSM hierarchy to handle the event as that is the
+        // "most active state"
+        detail::ScopedFlag processing(processing_);
+        executeCounted(*this, nextEvent);
+    }
+
+    ///
+    /// Process up to maxEvents of the queued events, including events queued
+    /// while processing. The batch is taken off the queue in one go. Returns
+    /// the number of events processed.
+    ///
+    std::size_t drain(std::size_t maxEvents)
+    {
+        std::size_t processed = 0;
+        // Not a member: actions may call drain re-entrantly.
+        std::vector<Event> batch;
+        while (processed < maxEvents && !eventQueue_.empty()) {
+            batch.clear();
+            if (!eventQueue_.tryNextEvents(std::back_inserter(batch),
+                                           maxEvents - processed)) {
+                TSM_DLOG(WARNING) << this->name
+                                  << ": Exiting event loop on interrupt";
+                break;
+            }
+            detail::ScopedFlag processing(processing_);
+            for (Event const& nextEvent : batch) {
+                executeCounted(*this, nextEvent);
             }
-            DLOG(WARNING) << this->name << ": Exiting event loop on interrupt";
+            processed += batch.size();
+        }
+        return processed;
+    }
+
+    ///
+    /// Process events until the event queue is empty. Returns the number of
+    /// events processed.
+    ///
+    std::size_t stepAll()
+    {
+        return drain(std::numeric_limits<std::size_t>::max());
+    }
+
+    void sendEvent(Event const& event)
+    {
+        sendCounted(*this, eventQueue_, event);
+    }
+
+    template<typename InputIt>
+    void sendEvents(InputIt first, InputIt last)
+    {
+        sendCounted(*this, eventQueue_, first, last);
+    }
+
+    ///
+    /// Execute event right away, without going through the queue. Called
+    /// from an action - while an event is being processed - it sends event
+    /// instead: event joins the back of the queue and runs on a later step
+    /// or drain, after the events queued before it, not before the call in
+    /// progress returns.
+    ///
+    void processEventNow(Event const& event)
+    {
+        if (processing_) {
+            sendEvent(event);
             return;
         }
+        detail::ScopedFlag processing(processing_);
+        executeUnqueued(*this, event);
     }
 
-    void sendEvent(Event const& event) { eventQueue_.addEvent(event); }
+    /// The queue, e.g. to configure a priority queue before sending.
+    EventQueue& getEventQueue() { return eventQueue_; }
 
   protected:
     EventQueue eventQueue_;
-    bool interrupt_;
+    bool processing_;
 };
 } // namespace tsm
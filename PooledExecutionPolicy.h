@@ -0,0 +1,168 @@
+#pragma once
+
+#include "Event.h"
+#include "ThreadPool.h"
+#include "TimerService.h"
+#include "Trace.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+///
+/// An execution policy for running large numbers of state machines on a
+/// shared ThreadPool instead of a thread per machine (AsyncExecutionPolicy).
+/// Every machine has its own mailbox. When an event arrives at an idle
+/// machine, the machine is scheduled on the pool; the worker that picks it up
+/// processes up to maxEventsPerRun events and reschedules the machine if more
+/// are waiting, so busy machines cannot starve the others.
+///
+/// A machine is scheduled at most once at any time, so the events of a
+/// machine are processed serially and in the order they were sent, while
+/// different machines run in parallel on all the workers.
+///
+/// The machine runs on ThreadPool::shared() unless setThreadPool is called
+/// before startSM. stopSM waits for an in-flight run to finish, so it must
+/// not be called from the machine's own actions.
+///
+/// scheduleEvent sends an event to the machine after a delay, see
+/// TimedEventTarget. Pending timers are cancelled when the machine stops.
+///
+namespace tsm {
+template<typename StateType>
+struct PooledExecutionPolicy
+  : public StateType
+  , public TimedEventTarget
+  , private ThreadPool::Task
+{
+    PooledExecutionPolicy()
+      : StateType()
+      , pool_(nullptr)
+      , maxEventsPerRun_(64)
+      , running_(false)
+      , scheduled_(false)
+    {}
+
+    virtual ~PooledExecutionPolicy()
+    {
+        this->cancelTimers();
+        {
+            std::lock_guard<std::mutex> lock(mailboxMutex_);
+            running_ = false;
+        }
+        waitUntilIdle();
+    }
+
+    void setThreadPool(ThreadPool& pool) { pool_ = &pool; }
+
+    void setMaxEventsPerRun(std::size_t maxEvents)
+    {
+        maxEventsPerRun_ = maxEvents ? maxEvents : 1;
+    }
+
+    void onEntry(Event const& e) override
+    {
+        StateType::onEntry(e);
+        if (!pool_) {
+            pool_ = &ThreadPool::shared();
+        }
+        std::lock_guard<std::mutex> lock(mailboxMutex_);
+        running_ = true;
+        scheduleLocked();
+    }
+
+    void onExit(Event const& e) override
+    {
+        this->cancelTimers();
+        bool fromOwnRun;
+        {
+            std::lock_guard<std::mutex> lock(mailboxMutex_);
+            running_ = false;
+            mailbox_.clear();
+            // Reaching the stop state exits the machine from its own run.
+            fromOwnRun = (runner_ == std::this_thread::get_id());
+        }
+        if (!fromOwnRun) {
+            waitUntilIdle();
+        }
+        StateType::onExit(e);
+    }
+
+    void sendEvent(Event const& event)
+    {
+        std::lock_guard<std::mutex> lock(mailboxMutex_);
+        mailbox_.push_back(event);
+        scheduleLocked();
+    }
+
+    template<typename InputIt>
+    void sendEvents(InputIt first, InputIt last)
+    {
+        std::lock_guard<std::mutex> lock(mailboxMutex_);
+        mailbox_.insert(mailbox_.end(), first, last);
+        scheduleLocked();
+    }
+
+    /// Block until the machine has processed all of the events sent to it.
+    void waitUntilIdle()
+    {
+        std::unique_lock<std::mutex> lock(mailboxMutex_);
+        cvIdle_.wait(lock, [this] { return !scheduled_; });
+    }
+
+  protected:
+    void onTimer(Event const& e) override { sendEvent(e); }
+
+    // Runs on a pool worker. Only one worker runs a given machine at a time.
+    void run() override
+    {
+        for (std::size_t n = 0; n < maxEventsPerRun_; ++n) {
+            Event nextEvent = Event::dummy_event;
+            {
+                std::lock_guard<std::mutex> lock(mailboxMutex_);
+                if (!running_ || mailbox_.empty()) {
+                    runner_ = std::thread::id();
+                    scheduled_ = false;
+                    cvIdle_.notify_all();
+                    return;
+                }
+                nextEvent = mailbox_.front();
+                mailbox_.pop_front();
+                runner_ = std::this_thread::get_id();
+            }
+            // go down the HSM hierarchy to handle the event as that is the
+            // "most active state"
+            this->dispatch(this)->execute(nextEvent);
+        }
+
+        // Give the other machines a go before draining the rest.
+        std::lock_guard<std::mutex> lock(mailboxMutex_);
+        if (running_ && !mailbox_.empty()) {
+            pool_->submit(this);
+        } else {
+            runner_ = std::thread::id();
+            scheduled_ = false;
+            cvIdle_.notify_all();
+        }
+    }
+
+    void scheduleLocked()
+    {
+        if (running_ && !scheduled_ && !mailbox_.empty()) {
+            scheduled_ = true;
+            pool_->submit(this);
+        }
+    }
+
+    ThreadPool* pool_;
+    std::size_t maxEventsPerRun_;
+    std::deque<Event> mailbox_;
+    std::mutex mailboxMutex_;
+    std::condition_variable cvIdle_;
+    bool running_;
+    bool scheduled_;
+    std::thread::id runner_;
+};
+} // namespace tsm
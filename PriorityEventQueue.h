@@ -0,0 +1,277 @@
+#pragma once
+
+#include "EventQueue.h"
+#include "Throw.h"
+#include "Trace.h"
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tsm {
+
+///
+/// A thread safe event queue with NumLanes FIFO lanes. nextEvent takes the
+/// oldest event of the first non-empty lane, so events in lane 0 overtake
+/// everything else. Events go to DefaultLane unless setLane says otherwise.
+///
+/// An event marked with coalesce is only queued if it is not already
+/// pending: sending a heartbeat five times while the machine is busy leaves
+/// one heartbeat in the queue, with the payload of the first. addEvent
+/// returns false for the events it drops, and the execution policies count
+/// them as coalesced, see Metrics.h.
+///
+/// Lanes and coalescing are configured per event, before events are sent:
+///
+/// AsyncExecutionPolicy<StateMachine<MyHSMDef>, PriorityEventQueue<Event>> sm;
+/// sm.getEventQueue().setLane(sm.stop_event, 0);
+/// sm.getEventQueue().coalesce(sm.heartbeat);
+///
+/// It is a drop in replacement for EventQueueT, interrupt semantics
+/// included. addFront puts an event at the front of lane 0.
+///
+template<typename Event, typename LockType, std::size_t NumLanes = 3>
+class PriorityEventQueueT
+{
+    static_assert(NumLanes >= 1 && NumLanes <= 128,
+                  "A PriorityEventQueueT has 1 to 128 lanes");
+
+  public:
+    static constexpr std::size_t DefaultLane = NumLanes / 2;
+
+    PriorityEventQueueT()
+      : size_(0)
+      , interrupt_(false)
+    {}
+
+    ~PriorityEventQueueT() { stop(); }
+
+    /// Queue e in lane, 0 being the most urgent.
+    void setLane(Event const& e, std::size_t lane)
+    {
+        std::lock_guard<LockType> lock(eventQueueMutex_);
+        Class& c = classOf(e);
+        c = static_cast<Class>((c & Coalesce) |
+                               (lane < NumLanes ? lane : NumLanes - 1));
+    }
+
+    /// Do not queue e while it is pending.
+    void coalesce(Event const& e, bool enable = true)
+    {
+        std::lock_guard<LockType> lock(eventQueueMutex_);
+        Class& c = classOf(e);
+        c = static_cast<Class>(enable ? (c | Coalesce) : (c & ~Coalesce));
+    }
+
+    bool empty() const { return size_ == 0; }
+    std::size_t size() const { return size_; }
+
+    // Block until you get an event
+    const Event nextEvent()
+    {
+        std::unique_lock<LockType> lock(eventQueueMutex_);
+        if (!wait(lock)) {
+            TSM_THROW(
+              EventQueueInterruptedException("Bailing from Event Queue"));
+        }
+        return pop();
+    }
+
+    // Block until there is an event and move it to e, or until the queue is
+    // stopped and return false.
+    bool tryNextEvent(Event& e)
+    {
+        std::unique_lock<LockType> lock(eventQueueMutex_);
+        if (!wait(lock)) {
+            return false;
+        }
+        e = pop();
+        return true;
+    }
+
+    // Block until there is at least one event. Then move up to maxEvents
+    // events to out, most urgent lane first, under a single lock
+    // acquisition. Returns the number of events moved.
+    template<typename OutputIt>
+    std::size_t nextEvents(OutputIt out, std::size_t maxEvents)
+    {
+        std::unique_lock<LockType> lock(eventQueueMutex_);
+        if (!wait(lock)) {
+            TSM_THROW(
+              EventQueueInterruptedException("Bailing from Event Queue"));
+        }
+        return popMany(out, maxEvents);
+    }
+
+    // Same as nextEvents, but returns 0 once the queue is stopped.
+    template<typename OutputIt>
+    std::size_t tryNextEvents(OutputIt out, std::size_t maxEvents)
+    {
+        std::unique_lock<LockType> lock(eventQueueMutex_);
+        if (!wait(lock)) {
+            return 0;
+        }
+        return popMany(out, maxEvents);
+    }
+
+    // Move up to maxEvents of the queued events to out without waiting.
+    // Returns 0 if there are none, the queue is stopped or a producer holds
+    // the lock.
+    template<typename OutputIt>
+    std::size_t pollEvents(OutputIt out, std::size_t maxEvents)
+    {
+        std::unique_lock<LockType> lock(eventQueueMutex_, std::try_to_lock);
+        if (!lock.owns_lock() || interrupt_ || size_ == 0) {
+            return 0;
+        }
+        return popMany(out, maxEvents);
+    }
+
+    /// False if e was coalesced with a pending event and dropped.
+    bool addEvent(Event const& e)
+    {
+        std::lock_guard<LockType> lock(eventQueueMutex_);
+        bool added = push(e, false);
+        if (added) {
+            cvEventAvailable_.notify_all();
+        }
+        return added;
+    }
+
+    /// Returns the number of events queued, the rest were coalesced.
+    template<typename InputIt>
+    std::size_t addEvents(InputIt first, InputIt last)
+    {
+        std::lock_guard<LockType> lock(eventQueueMutex_);
+        std::size_t added = 0;
+        for (; first != last; ++first) {
+            added += push(*first, false);
+        }
+        if (added) {
+            cvEventAvailable_.notify_all();
+        }
+        return added;
+    }
+
+    void addFront(Event const& e)
+    {
+        std::lock_guard<LockType> lock(eventQueueMutex_);
+        if (push(e, true)) {
+            cvEventAvailable_.notify_all();
+        }
+    }
+
+    void stop()
+    {
+        std::lock_guard<LockType> lock(eventQueueMutex_);
+        interrupt_ = true;
+        cvEventAvailable_.notify_all();
+    }
+
+  private:
+    // The lane in the low bits, Coalesce for coalescing events
+    using Class = std::uint8_t;
+    static constexpr Class Coalesce = 0x80;
+
+    // The class of every event seen, indexed by space and id like the
+    // routing index of OrthogonalStateMachine. Pending flags alongside.
+    Class& classOf(Event const& e)
+    {
+        if (e.space >= classes_.size()) {
+            classes_.resize(e.space + 1);
+            pending_.resize(e.space + 1);
+        }
+        if (e.id >= classes_[e.space].size()) {
+            classes_[e.space].resize(e.id + 1, Class(DefaultLane));
+            pending_[e.space].resize(e.id + 1, false);
+        }
+        return classes_[e.space][e.id];
+    }
+
+    bool push(Event const& e, bool front)
+    {
+        Class c = classOf(e);
+        if (c & Coalesce) {
+            if (pending_[e.space][e.id]) {
+                TSM_DLOG(INFO) << "Coalescing Event:" << e.id;
+                return false;
+            }
+            pending_[e.space][e.id] = true;
+        }
+        if (front) {
+            lanes_[0].push_front(e);
+        } else {
+            lanes_[c & ~Coalesce].push_back(e);
+        }
+        ++size_;
+        return true;
+    }
+
+    void popped(Event const& e)
+    {
+        --size_;
+        pending_[e.space][e.id] = false;
+    }
+
+    // False if the queue was stopped while waiting for an event.
+    bool wait(std::unique_lock<LockType>& lock)
+    {
+        cvEventAvailable_.wait(
+          lock, [this] { return (size_ != 0 || this->interrupt_); });
+        return !interrupt_;
+    }
+
+    // The oldest event of the most urgent lane. The queue is not empty.
+    Event pop()
+    {
+        std::size_t i = 0;
+        while (lanes_[i].empty()) {
+            ++i;
+        }
+        Event e = std::move(lanes_[i].front());
+        lanes_[i].pop_front();
+        popped(e);
+        TSM_DLOG(INFO) << "Thread:" << std::this_thread::get_id()
+                       << " Popping Event:" << e.id;
+        return e;
+    }
+
+    template<typename OutputIt>
+    std::size_t popMany(OutputIt out, std::size_t maxEvents)
+    {
+        std::size_t n = 0;
+        for (auto& lane : lanes_) {
+            while (n < maxEvents && !lane.empty()) {
+                popped(lane.front());
+                *out++ = std::move(lane.front());
+                lane.pop_front();
+                ++n;
+            }
+        }
+        TSM_DLOG(INFO) << "Thread:" << std::this_thread::get_id() << " Popping "
+                       << n << " Events";
+        return n;
+    }
+
+    std::array<std::deque<Event>, NumLanes> lanes_;
+    std::vector<std::vector<Class>> classes_;
+    std::vector<std::vector<bool>> pending_;
+    std::size_t size_;
+    LockType eventQueueMutex_;
+    std::condition_variable_any cvEventAvailable_;
+    bool interrupt_;
+};
+
+template<typename Event, std::size_t NumLanes = 3>
+using SimplePriorityEventQueue =
+  PriorityEventQueueT<Event, dummy_mutex, NumLanes>;
+
+template<typename Event, std::size_t NumLanes = 3>
+using PriorityEventQueue = PriorityEventQueueT<Event, std::mutex, NumLanes>;
+
+} // namespace tsm
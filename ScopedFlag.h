@@ -0,0 +1,28 @@
+#pragma once
+
+namespace tsm {
+namespace detail {
+
+// Sets a flag for the lifetime of the scope and then restores its value.
+class ScopedFlag
+{
+  public:
+    explicit ScopedFlag(bool& flag)
+      : flag_(flag)
+      , saved_(flag)
+    {
+        flag_ = true;
+    }
+
+    ScopedFlag(ScopedFlag const&) = delete;
+    ScopedFlag& operator=(ScopedFlag const&) = delete;
+
+    ~ScopedFlag() { flag_ = saved_; }
+
+  private:
+    bool& flag_;
+    bool saved_;
+};
+
+} // namespace detail
+} // namespace tsm
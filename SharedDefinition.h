@@ -0,0 +1,454 @@
+#pragma once
+
+#include "Event.h"
+#include "State.h"
+#include "StateMachine.h"
+#include "StateMachineDef.h"
+#include "Throw.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace tsm {
+
+///
+/// The immutable part of a state machine - its states, events, transitions,
+/// guards and actions - built once and shared by any number of lightweight
+/// instances. An instance is nothing but the index of the active state of
+/// each HSM in the hierarchy; see MachineInstance.
+///
+/// SharedDefinition<MyHSMDef> def;
+/// MachineInstance<MyHSMDef> session(def);
+/// session.startSM();
+/// session.execute(def.prototype().some_event);
+///
+/// The definition builds one prototype StateMachine<HSMDef> and compiles the
+/// transitions of every HSM below it into flat (state x event) arrays. All
+/// instances run on that prototype: guards, actions and the execute, onEntry
+/// and onExit hooks of simple states are invoked on it. They must not keep
+/// per-instance data in the HSMDef; pass it in the event payload instead. As
+/// nothing in the definition changes after construction, instances can run
+/// on different threads at the same time as long as those callbacks only
+/// read shared data.
+///
+/// Sub HSMs are entered and exited the default way: entering one enters its
+/// start state, exiting one forgets its state. onEntry and onExit overrides
+/// of sub HSMs are not called. OrthogonalStateMachines, transitions to
+/// history pseudo-states and deferred events are not supported; the
+/// constructor throws std::invalid_argument for the latter two.
+///
+template<typename HSMDef>
+class SharedDefinition
+{
+  public:
+    using StateIndex = std::uint16_t;
+    using HsmIndex = std::uint16_t;
+
+    /// The state index of an HSM that is not active.
+    static constexpr StateIndex NoState =
+      std::numeric_limits<StateIndex>::max();
+    static constexpr HsmIndex NoHsm = std::numeric_limits<HsmIndex>::max();
+
+    /// What execute did with an event.
+    enum class Outcome : std::uint8_t
+    {
+        Transition,
+        GuardRejected,
+        Unhandled
+    };
+
+    SharedDefinition()
+      : prototype_()
+    {
+        addHsm(prototype_, NoHsm);
+        std::set<Event> events;
+        prototype_.collectEvents(events);
+        events_.assign(events.begin(), events.end());
+        Hsm const& top = hsms_[0];
+        plain_ = hsms_.size() == 1 && top.stop == NoState &&
+                 std::all_of(top.transitions.begin(),
+                             top.transitions.end(),
+                             [](Transition const& t) {
+                                 return !t.ref.accepts && !t.ref.act;
+                             });
+    }
+
+    SharedDefinition(SharedDefinition const&) = delete;
+    SharedDefinition& operator=(SharedDefinition const&) = delete;
+
+    ///
+    /// The machine all instances run on, e.g. to get at the events of the
+    /// definition. It is never started itself.
+    ///
+    StateMachine<HSMDef> const& prototype() const { return prototype_; }
+
+    /// Every event handled anywhere in the hierarchy, sorted.
+    std::vector<Event> const& events() const { return events_; }
+
+    /// The number of HSMs in the hierarchy, the top level one included.
+    std::size_t numHsms() const { return hsms_.size(); }
+
+    /// The number of states of HSM h.
+    std::size_t numStates(HsmIndex h) const { return hsms_[h].states.size(); }
+
+    /// State s of HSM h.
+    State const& state(HsmIndex h, StateIndex s) const
+    {
+        return *hsms_[h].states[s];
+    }
+
+    /// The transitions of HSM h on events of another id space, which are
+    /// looked up linearly instead of in the array.
+    std::size_t numForeign(HsmIndex h) const
+    {
+        return hsms_[h].overflow.size();
+    }
+
+    /// The HSM that is state s of HSM h, NoHsm if s is a simple state.
+    HsmIndex subHsm(HsmIndex h, StateIndex s) const
+    {
+        return hsms_[h].subHsms[s];
+    }
+
+    ///
+    /// True for a flat machine whose transitions have no guards and no
+    /// actions and which has no stop state. Its next state only depends on
+    /// the current state and the event, see target.
+    ///
+    bool isPlain() const { return plain_; }
+
+    ///
+    /// The state the top level HSM moves to from state s on e, s itself if
+    /// it does not handle e. This is all there is to execute for a plain
+    /// definition, apart from the execute, onEntry and onExit hooks of the
+    /// states.
+    ///
+    StateIndex target(StateIndex s, Event const& e) const
+    {
+        Transition const* t = find(hsms_[0], s, e);
+        return t ? t->to : s;
+    }
+
+    /// Enter the start state of the top level HSM. active has numHsms slots.
+    void start(StateIndex* active) const
+    {
+        for (std::size_t h = 0; h < hsms_.size(); ++h) {
+            active[h] = NoState;
+        }
+        enter(active, 0, Event::dummy_event);
+    }
+
+    void stop(StateIndex* active) const
+    {
+        for (std::size_t h = 0; h < hsms_.size(); ++h) {
+            active[h] = NoState;
+        }
+    }
+
+    ///
+    /// Handle e the way StateMachine::execute does: look for a transition in
+    /// the most active HSM, then in the HSMs above it.
+    ///
+    Outcome execute(StateIndex* active, Event const& e) const
+    {
+        HsmIndex h = activeLeaf(active);
+        while (h != NoHsm) {
+            Hsm const& hsm = hsms_[h];
+            StateIndex s = active[h];
+            Transition const* t = s == NoState ? nullptr : find(hsm, s, e);
+            if (!t) {
+                h = hsm.parent;
+                continue;
+            }
+            if (t->ref.accepts && !t->ref.accepts(t->ref, e)) {
+                return Outcome::GuardRejected;
+            }
+            fire(active, h, *t, e);
+            return Outcome::Transition;
+        }
+        return Outcome::Unhandled;
+    }
+
+    /// The current state of HSM h, nullptr if it is not active.
+    State const* currentState(StateIndex const* active, HsmIndex h = 0) const
+    {
+        return active[h] == NoState ? nullptr : hsms_[h].states[active[h]];
+    }
+
+    /// The most active (deepest) HSM.
+    HsmIndex activeLeaf(StateIndex const* active) const
+    {
+        HsmIndex h = 0;
+        while (active[h] != NoState && hsms_[h].subHsms[active[h]] != NoHsm) {
+            h = hsms_[h].subHsms[active[h]];
+        }
+        return h;
+    }
+
+  private:
+    struct Transition
+    {
+        TransitionRef ref;
+        StateIndex from;
+        StateIndex to;
+    };
+
+    struct Hsm
+    {
+        IHsmDef* def;
+        HsmIndex parent;
+        StateIndex start;
+        StateIndex stop;
+        std::vector<State*> states;
+        std::vector<HsmIndex> subHsms; ///< Per state, NoHsm for simple states
+        UniqueId::IdType eventSpace;
+        UniqueId::IdType numEvents;
+        /// [state * numEvents + event id], an index into transitions or -1
+        std::vector<std::int32_t> slots;
+        /// Transitions on events from other id spaces, searched linearly
+        std::vector<std::int32_t> overflow;
+        std::vector<Transition> transitions;
+    };
+
+    Transition const* find(Hsm const& hsm, StateIndex s, Event const& e) const
+    {
+        if (e.space == hsm.eventSpace && e.id < hsm.numEvents) {
+            std::int32_t i = hsm.slots[s * hsm.numEvents + e.id];
+            return i < 0 ? nullptr : &hsm.transitions[i];
+        }
+        for (std::int32_t i : hsm.overflow) {
+            Transition const& t = hsm.transitions[i];
+            if (t.from == s && *t.ref.onEvent == e) {
+                return &t;
+            }
+        }
+        return nullptr;
+    }
+
+    // Same sequence as TransitionT::doTransition and StateMachine::execute.
+    void fire(StateIndex* active,
+              HsmIndex h,
+              Transition const& t,
+              Event const& e) const
+    {
+        Hsm const& hsm = hsms_[h];
+        exit(active, h, e);
+        if (t.ref.act) {
+            t.ref.act(t.ref, e);
+        }
+        HsmIndex sub = hsm.subHsms[t.to];
+        if (sub != NoHsm) {
+            active[h] = t.to;
+            enter(active, sub, e);
+        } else {
+            hsm.states[t.to]->onEntry(e);
+            active[h] = t.to;
+            hsm.states[t.to]->execute(e);
+        }
+        if (t.to == hsm.stop) {
+            leave(active, h);
+        }
+    }
+
+    // Exit the current state of HSM h.
+    void exit(StateIndex* active, HsmIndex h, Event const& e) const
+    {
+        Hsm const& hsm = hsms_[h];
+        HsmIndex sub = hsm.subHsms[active[h]];
+        if (sub != NoHsm) {
+            leave(active, sub);
+        } else {
+            hsm.states[active[h]]->onExit(e);
+        }
+    }
+
+    // Enter HSM h: make its start state current, descending into sub HSMs.
+    void enter(StateIndex* active, HsmIndex h, Event const& e) const
+    {
+        while (true) {
+            Hsm const& hsm = hsms_[h];
+            active[h] = hsm.start;
+            HsmIndex sub = hsm.subHsms[hsm.start];
+            if (sub == NoHsm) {
+                hsm.states[hsm.start]->execute(e);
+                return;
+            }
+            h = sub;
+        }
+    }
+
+    // HSM h forgets its state, see StateMachineDef::onExit.
+    void leave(StateIndex* active, HsmIndex h) const
+    {
+        while (h != NoHsm && active[h] != NoState) {
+            HsmIndex sub = hsms_[h].subHsms[active[h]];
+            active[h] = NoState;
+            h = sub;
+        }
+    }
+
+    HsmIndex addHsm(IHsmDef& def, HsmIndex parent)
+    {
+        if (hsms_.size() >= NoHsm) {
+            TSM_THROW(std::length_error("Too many HSMs in " + prototype_.name));
+        }
+        HsmIndex h = static_cast<HsmIndex>(hsms_.size());
+        hsms_.emplace_back();
+        hsms_[h].def = &def;
+        hsms_[h].parent = parent;
+
+        if (def.defersEvents()) {
+            TSM_THROW(std::invalid_argument(
+              def.name + ": deferred events need per instance buffers"));
+        }
+        std::vector<TransitionRef> refs;
+        def.listTransitions(refs);
+
+        std::unordered_map<State*, StateIndex> index;
+        auto indexOf = [this, h, &index, &def](State* s) {
+            auto it = index.find(s);
+            if (it != index.end()) {
+                return it->second;
+            }
+            auto& states = hsms_[h].states;
+            if (states.size() >= NoState) {
+                TSM_THROW(std::length_error("Too many states in " + def.name));
+            }
+            StateIndex i = static_cast<StateIndex>(states.size());
+            states.push_back(s);
+            index.emplace(s, i);
+            return i;
+        };
+
+        hsms_[h].start = indexOf(def.getStartState());
+        State* stop = def.getStopState();
+        hsms_[h].stop = stop ? indexOf(stop) : NoState;
+
+        std::vector<Transition> transitions;
+        for (TransitionRef const& ref : refs) {
+            if (ref.toState->isHistory()) {
+                TSM_THROW(std::invalid_argument(
+                  def.name + ": history states need per instance history"));
+            }
+            StateIndex from = indexOf(ref.fromState);
+            StateIndex to = indexOf(ref.toState);
+            transitions.push_back(Transition{ ref, from, to });
+        }
+
+        // Sub HSMs may add to hsms_, so keep no references across this.
+        std::size_t numStates = hsms_[h].states.size();
+        std::vector<HsmIndex> subHsms(numStates, NoHsm);
+        for (std::size_t s = 0; s < numStates; ++s) {
+            State* state = hsms_[h].states[s];
+            if (state->isHsm()) {
+                subHsms[s] = addHsm(*static_cast<IHsmDef*>(state), h);
+            }
+        }
+
+        Hsm& hsm = hsms_[h];
+        hsm.subHsms = std::move(subHsms);
+        hsm.transitions = std::move(transitions);
+        buildIndex(hsm);
+        return h;
+    }
+
+    // Build the flat lookup array over the events of the HSM's own id
+    // space. Like the transition tables, the first transition listed for a
+    // (state, event) pair wins.
+    static void buildIndex(Hsm& hsm)
+    {
+        hsm.eventSpace = hsm.def->idSpace();
+        hsm.numEvents = 0;
+        for (Transition const& t : hsm.transitions) {
+            if (t.ref.onEvent->space == hsm.eventSpace) {
+                hsm.numEvents = std::max(hsm.numEvents, t.ref.onEvent->id + 1);
+            }
+        }
+        hsm.slots.assign(hsm.states.size() * hsm.numEvents, -1);
+        for (std::size_t i = 0; i < hsm.transitions.size(); ++i) {
+            Transition const& t = hsm.transitions[i];
+            if (t.ref.onEvent->space != hsm.eventSpace) {
+                hsm.overflow.push_back(static_cast<std::int32_t>(i));
+                continue;
+            }
+            auto& slot = hsm.slots[t.from * hsm.numEvents + t.ref.onEvent->id];
+            if (slot < 0) {
+                slot = static_cast<std::int32_t>(i);
+            }
+        }
+    }
+
+    StateMachine<HSMDef> prototype_;
+    std::vector<Hsm> hsms_;
+    std::vector<Event> events_;
+    bool plain_;
+};
+
+template<typename HSMDef>
+constexpr typename SharedDefinition<HSMDef>::StateIndex
+  SharedDefinition<HSMDef>::NoState;
+
+template<typename HSMDef>
+constexpr typename SharedDefinition<HSMDef>::HsmIndex
+  SharedDefinition<HSMDef>::NoHsm;
+
+///
+/// A state machine instance that runs on a SharedDefinition. It holds a
+/// pointer to the definition and the active state of each of its HSMs, at
+/// most MaxHsms of them: 16 bytes with the defaults.
+///
+template<typename HSMDef, std::size_t MaxHsms = 4>
+class MachineInstance
+{
+  public:
+    using Definition = SharedDefinition<HSMDef>;
+    using StateIndex = typename Definition::StateIndex;
+    using Outcome = typename Definition::Outcome;
+
+    explicit MachineInstance(Definition const& definition)
+      : definition_(&definition)
+    {
+        if (definition.numHsms() > MaxHsms) {
+            TSM_THROW(std::length_error(
+              "The definition has more HSMs than the instance can hold"));
+        }
+        active_.fill(Definition::NoState);
+    }
+
+    void startSM() { definition_->start(active_.data()); }
+
+    void stopSM() { definition_->stop(active_.data()); }
+
+    Outcome execute(Event const& e)
+    {
+        return definition_->execute(active_.data(), e);
+    }
+
+    /// The current state of the top level HSM, nullptr once stopped.
+    State const* getCurrentState() const
+    {
+        return definition_->currentState(active_.data());
+    }
+
+    /// The current state of the most active (deepest) HSM.
+    State const* getLeafState() const
+    {
+        return definition_->currentState(
+          active_.data(), definition_->activeLeaf(active_.data()));
+    }
+
+    Definition const& getDefinition() const { return *definition_; }
+
+  private:
+    Definition const* definition_;
+    std::array<StateIndex, MaxHsms> active_;
+};
+
+} // namespace tsm
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "StateMachineDef.h"
+#include "Throw.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+namespace tsm {
+
+///
+/// Snapshots of the active configuration of machines: the current state and
+/// the history of every HSM in the hierarchy, written as dense state ids;
+/// states from another definition's id space are numbered after them. A
+/// record is numSnapshotSlots() 16 bit slots, the same for every instance of
+/// a definition type, in native byte order. restore checks the whole record
+/// before it changes the machine.
+///
+/// std::vector<std::uint16_t> record(snapshotSlots(sm));
+/// snapshot(sm, record.data());
+/// ...
+/// restore(other, record.data()); // no entry actions run
+///
+/// Deferred events, event queues and data members of the definitions are
+/// not part of a snapshot.
+///
+inline std::size_t snapshotSlots(IHsmDef& sm)
+{
+    return sm.numSnapshotSlots();
+}
+
+inline void snapshot(IHsmDef& sm, std::uint16_t* record)
+{
+    sm.saveState(record);
+}
+
+inline void restore(IHsmDef& sm, std::uint16_t const* record)
+{
+    sm.restoreState(record);
+}
+
+///
+/// The header of a buffer of snapshots written by snapshotAll: fixed size
+/// records follow it back to back, so record i of a buffer mapped into
+/// memory is at snapshotRecord(buffer, i).
+///
+struct SnapshotHeader
+{
+    static constexpr std::uint32_t Magic = 0x534d5354; // "TSMS"
+    static constexpr std::uint16_t Version = 2;
+
+    std::uint32_t magic;
+    std::uint16_t version;
+    std::uint16_t slots;       ///< Per record
+    std::uint64_t count;       ///< Number of records
+    std::uint64_t fingerprint; ///< See IHsmDef::snapshotFingerprint
+};
+
+namespace detail {
+
+inline IHsmDef& hsmOf(IHsmDef& sm)
+{
+    return sm;
+}
+
+inline IHsmDef& hsmOf(IHsmDef* sm)
+{
+    return *sm;
+}
+
+} // namespace detail
+
+/// The number of bytes snapshotAll needs for count records of slots slots.
+inline std::size_t snapshotBufferSize(std::size_t slots, std::size_t count)
+{
+    return sizeof(SnapshotHeader) + count * slots * sizeof(std::uint16_t);
+}
+
+///
+/// Record i of a buffer written by snapshotAll. The buffer has to be at least
+/// 8 byte aligned, as memory from new or mmap is.
+///
+inline std::uint16_t const* snapshotRecord(void const* buffer, std::size_t i)
+{
+    SnapshotHeader header;
+    std::memcpy(&header, buffer, sizeof(header));
+    return reinterpret_cast<std::uint16_t const*>(
+             static_cast<char const*>(buffer) + sizeof(SnapshotHeader)) +
+           i * header.slots;
+}
+
+///
+/// Snapshot the machines in [first, last) - machines or pointers to them,
+/// all of the same definition type - into buffer, one record each after a
+/// SnapshotHeader. buffer needs snapshotBufferSize(slots, count) bytes and
+/// 8 byte alignment.
+///
+template<typename InputIt>
+void snapshotAll(InputIt first, InputIt last, void* buffer)
+{
+    SnapshotHeader header;
+    header.magic = SnapshotHeader::Magic;
+    header.version = SnapshotHeader::Version;
+    header.slots = 0;
+    header.count = 0;
+    header.fingerprint = 0;
+    auto record = reinterpret_cast<std::uint16_t*>(static_cast<char*>(buffer) +
+                                                   sizeof(SnapshotHeader));
+    for (; first != last; ++first, ++header.count) {
+        IHsmDef& sm = detail::hsmOf(*first);
+        std::size_t slots = sm.numSnapshotSlots();
+        std::uint64_t fingerprint = sm.snapshotFingerprint();
+        if (header.count == 0) {
+            header.slots = static_cast<std::uint16_t>(slots);
+            header.fingerprint = fingerprint;
+        } else if (slots != header.slots ||
+                   fingerprint != header.fingerprint) {
+            TSM_THROW(
+              std::invalid_argument("Machines of different definitions"));
+        }
+        sm.saveState(record);
+    }
+    std::memcpy(buffer, &header, sizeof(header));
+}
+
+///
+/// Restore the machines in [first, last) from the first records of a buffer
+/// of size bytes written by snapshotAll. Throws std::invalid_argument if the
+/// buffer is not a snapshot of as many machines of the same definition, or
+/// if a record names no state; then no machine is changed.
+///
+template<typename ForwardIt>
+void restoreAll(ForwardIt first,
+                ForwardIt last,
+                void const* buffer,
+                std::size_t size)
+{
+    SnapshotHeader header;
+    if (size < sizeof(header)) {
+        TSM_THROW(std::invalid_argument("Snapshot buffer too small"));
+    }
+    std::memcpy(&header, buffer, sizeof(header));
+    if (header.magic != SnapshotHeader::Magic ||
+        header.version != SnapshotHeader::Version) {
+        TSM_THROW(std::invalid_argument("Not a snapshot buffer"));
+    }
+    std::size_t count = static_cast<std::size_t>(std::distance(first, last));
+    if (count > header.count ||
+        size < snapshotBufferSize(header.slots, header.count)) {
+        TSM_THROW(std::invalid_argument("Snapshot buffer too small"));
+    }
+    std::uint16_t const* record = snapshotRecord(buffer, 0);
+    for (ForwardIt it = first; it != last; ++it) {
+        IHsmDef& sm = detail::hsmOf(*it);
+        if (sm.numSnapshotSlots() != header.slots ||
+            sm.snapshotFingerprint() != header.fingerprint) {
+            TSM_THROW(std::invalid_argument("Snapshot of another definition"));
+        }
+        sm.checkState(record);
+    }
+    record = snapshotRecord(buffer, 0);
+    for (; first != last; ++first) {
+        detail::hsmOf(*first).loadState(record);
+    }
+}
+
+} // namespace tsm
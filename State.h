@@ -1,11 +1,11 @@
 #pragma once
 
 #include "Event.h"
+#include "Trace.h"
 #include "UniqueId.h"
 
-#include <glog/logging.h>
-
 #include <memory>
+#include <stdexcept>
 #include <string>
 
 namespace tsm {
@@ -30,8 +30,7 @@ struct State
     State() = delete;
 
     State(std::string const& stateName)
-      : name(std::move(stateName))
-      , id(UniqueId::getId())
+      : State(stateName, UniqueId::getStateId(), Kind::Simple)
     {}
 
     State(State const& other) = default;
@@ -40,28 +39,61 @@ struct State
 
     virtual ~State() = default;
 
-    bool operator==(State const& rhs) { return this->id == rhs.id; }
+    bool operator==(State const& rhs) const
+    {
+        return this->id == rhs.id && this->space == rhs.space;
+    }
 
-    bool operator!=(State& rhs) { return !(*this == rhs); }
+    bool operator!=(State const& rhs) const { return !(*this == rhs); }
 
     virtual void execute(Event const& nextEvent)
     {
 
-        DLOG(INFO) << "Executing: " << this->name << std::endl;
+        TSM_DLOG(INFO) << "Executing: " << this->name;
     }
 
     virtual void onEntry(Event const&)
     {
-        DLOG(INFO) << "Entering: " << this->name << std::endl;
+        TSM_DLOG(INFO) << "Entering: " << this->name;
     }
 
     virtual void onExit(Event const&)
     {
-        DLOG(INFO) << "Exiting: " << this->name << std::endl;
+        TSM_DLOG(INFO) << "Exiting: " << this->name;
     }
 
+    /// True if this state is itself a (sub) HSM, i.e. an IHsmDef. Lets the
+    /// dispatch code descend the hierarchy without RTTI.
+    bool isHsm() const { return kind_ == Kind::Hsm; }
+
+    /// True for the history pseudo-states of an HSM, see HistoryState.
+    bool isHistory() const { return kind_ == Kind::History; }
+
     const std::string name;
 
-    const uint64_t id;
+    const UniqueId::IdType id;    ///< Dense id within the owning definition
+    const UniqueId::IdType space; ///< Id space of the owning definition
+
+  protected:
+    enum class Kind : std::uint8_t
+    {
+        Simple,
+        Hsm,
+        History
+    };
+
+    State(std::string const& stateName, Kind kind)
+      : State(stateName, UniqueId::getStateId(), kind)
+    {}
+
+    State(std::string const& stateName, UniqueId::Id uid, Kind kind)
+      : name(stateName)
+      , id(uid.id)
+      , space(uid.space)
+      , kind_(kind)
+    {}
+
+  private:
+    const Kind kind_;
 };
 } // namespace tsm
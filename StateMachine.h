@@ -3,16 +3,30 @@
 #include "Event.h"
 #include "State.h"
 #include "StateMachineDef.h"
+#include "Trace.h"
+
+#include <vector>
 
 namespace tsm {
-template<typename HSMDef>
-struct StateMachine : public HSMDef
+///
+/// Tracer receives a hook for every transition, rejected transition and
+/// unhandled event; see NullTracer for the interface. The default tracer does
+/// nothing and compiles away.
+///
+template<typename HSMDef, typename Tracer = TSM_DEFAULT_TRACER>
+struct StateMachine
+  : public HSMDef
+  , private Tracer
 {
-    using Transition = typename StateMachineDef<HSMDef>::Transition;
+    using Transition = typename HSMDef::Transition;
+    using TracerType = Tracer;
 
     StateMachine(IHsmDef* parent = nullptr)
       : HSMDef(parent)
-    {}
+    {
+        // All of HSMDef's states and events have been constructed.
+        UniqueId::leave(this->idSpace_);
+    }
 
     virtual ~StateMachine() = default;
 
@@ -20,59 +34,190 @@ struct StateMachine : public HSMDef
 
     void stopSM() { this->onExit(Event::dummy_event); }
 
-    // traverse the hsm hierarchy down.
-    IHsmDef* dispatch(IHsmDef* state) const
+    Tracer& getTracer() { return *this; }
+
+#if TSM_HAS_COROUTINES
+    void onExit(Event const& e) override
     {
-        IHsmDef* parent = state;
-        IHsmDef* kid = dynamic_cast<IHsmDef*>(parent->getCurrentState());
-        while (kid && kid->getParent()) {
-            parent = kid;
-            kid = dynamic_cast<IHsmDef*>(kid->getCurrentState());
-        }
-        return parent;
+        this->pendingAction_.reset();
+        HSMDef::onExit(e);
     }
+#endif
 
     void execute(Event const& nextEvent) override
     {
-        DLOG(INFO) << "Current State:" << this->currentState_->name
-                   << " Event:" << nextEvent.id;
+#if TSM_HAS_COROUTINES
+        if (!this->pendingAction_.done()) {
+            // In transition, see StateMachineDef::addAsync
+            this->deferred_.push_back(nextEvent);
+            return;
+        }
+#endif
+        TSM_DLOG(INFO) << "Current State:" << this->currentState_->name
+                       << " Event:" << nextEvent.id;
 
         Transition* t = this->next(*this->currentState_, nextEvent);
 
         if (!t) {
-            // If transition does not exist, pass event to parent HSM
-            if (this->parent_) {
+            if (Resolution const* r =
+                  this->resolved(*this->currentState_, nextEvent)) {
+                // Flattened, straight to the HSM that handles the event
+                r->owner->executeResolved(*r, nextEvent);
+            } else if (this->defers(*this->currentState_, nextEvent)) {
+                TSM_DLOG(INFO) << "Deferring event:" << nextEvent.id;
+                this->deferred_.push_back(nextEvent);
+            } else if (this->parent_) {
+                // If transition does not exist, pass event to parent HSM
                 // TODO(sriram) : should call onExit? UML spec seems to say yes
                 // invoking onExit() here will not work for Orthogonal state
                 // machines
                 // this->onExit(nextEvent);
                 this->parent_->execute(nextEvent);
             } else {
-                DLOG(ERROR) << "Reached top level HSM. Cannot handle event";
+                TSM_DLOG(ERROR) << "Reached top level HSM. Cannot handle event";
+                getTracer().onUnhandled(*this, nextEvent);
             }
         } else {
-            // Evaluate guard if it exists
-            bool result = t->guard && (this->*(t->guard))();
+            take(t, nextEvent);
+        }
+    }
 
-            if (!(t->guard) || result) {
-                // Perform entry and exit actions in the doTransition function.
-                // If just an internal transition, Entry and exit actions are
-                // not performed
-                t->template doTransition<HSMDef>(this);
-                this->currentState_ = &t->toState;
-                DLOG(INFO) << "Next State:" << this->currentState_->name;
+    void executeResolved(Resolution const& r, Event const& e) override
+    {
+        switch (r.kind) {
+            case Resolution::Kind::Transition:
+                take(const_cast<Transition*>(
+                       static_cast<Transition const*>(r.transition)),
+                     e);
+                break;
+            case Resolution::Kind::Defer:
+                this->deferred_.push_back(e);
+                break;
+            case Resolution::Kind::Unhandled:
+                getTracer().onUnhandled(*this, e);
+                break;
+            case Resolution::Kind::Forward:
+                execute(e);
+                break;
+        }
+    }
 
-                if (!dynamic_cast<IHsmDef*>(this->currentState_)) {
-                    this->currentState_->execute(nextEvent);
-                }
+  private:
+    // Take t, found for nextEvent in the current state, if its guard allows
+    void take(Transition* t, Event const& nextEvent)
+    {
+        // Evaluate guard if it exists
+        bool result = t->accepts(nextEvent) &&
+                      (!t->guard || t->guard(this, nextEvent));
 
-            } else {
-                DLOG(INFO) << "Guard prevented transition";
-            }
-            if (this->currentState_ == this->getStopState()) {
-                DLOG(INFO) << this->name << " Reached stop state. Exiting... ";
-                this->onExit(Event::dummy_event);
+        if (result) {
+#if TSM_HAS_COROUTINES
+            if (auto action = this->asyncAction(*t)) {
+                beginAsync(t, *action, nextEvent);
+                return;
             }
+#endif
+            // Perform entry and exit actions in the doTransition function.
+            // If just an internal transition, Entry and exit actions are
+            // not performed
+            t->template doTransition<HSMDef>(this, nextEvent);
+            arrive(*this->currentState_, t, nextEvent);
+        } else {
+            TSM_DLOG(INFO) << "Guard prevented transition";
+            getTracer().onGuardRejected(*this, *this->currentState_, nextEvent);
+        }
+        settle(result);
+    }
+
+    // Make the target of t, entered already, the current state
+    void arrive(State& previousState, Transition* t, Event const& nextEvent)
+    {
+        this->currentState_ = &t->toState;
+        if (this->currentState_->isHistory()) {
+            this->currentState_ =
+              &static_cast<HistoryState*>(this->currentState_)->owner;
+        }
+        TSM_DLOG(INFO) << "Next State:" << this->currentState_->name;
+        getTracer().onTransition(
+          *this, previousState, nextEvent, *this->currentState_);
+
+        if (previousState.isHsm() || this->currentState_->isHsm()) {
+            this->updateActiveLeaf();
+        }
+
+        if (!this->currentState_->isHsm()) {
+            this->currentState_->execute(nextEvent);
+        }
+    }
+
+    // Exit at the stop state, and replay the deferred events after a
+    // transition
+    void settle(bool moved)
+    {
+        if (this->currentState_ == this->getStopState()) {
+            TSM_DLOG(INFO) << this->name << " Reached stop state. Exiting... ";
+            this->onExit(Event::dummy_event);
+        }
+        if (moved && !this->deferred_.empty() && this->currentState_) {
+            replayDeferred();
+        }
+    }
+
+#if TSM_HAS_COROUTINES
+    using AsyncCallback = typename HSMDef::AsyncCallback;
+
+    void beginAsync(Transition* t,
+                    AsyncCallback const& action,
+                    Event const& nextEvent)
+    {
+        // Kept for the coroutine, which may refer to the payload
+        this->pendingTransition_ = t;
+        this->pendingEvent_ = nextEvent;
+        t->fromState.onExit(this->pendingEvent_);
+        // No current state: this HSM is the active leaf, and parks the
+        // events arriving in transition
+        this->currentState_ = nullptr;
+        this->updateActiveLeaf();
+
+        AsyncAction running = action(this, this->pendingEvent_);
+        if (running.done()) {
+            completeAsync();
+            return;
+        }
+        running.onDone(&StateMachine::completed, this);
+        this->pendingAction_ = std::move(running);
+    }
+
+    static void completed(void* self)
+    {
+        static_cast<StateMachine*>(self)->completeAsync();
+    }
+
+    void completeAsync()
+    {
+        // Done, and suspended in its final step
+        this->pendingAction_.reset();
+        Transition* t = this->pendingTransition_;
+        this->pendingTransition_ = nullptr;
+        t->toState.onEntry(this->pendingEvent_);
+        arrive(t->fromState, t, this->pendingEvent_);
+        settle(true);
+    }
+#endif
+
+    // Execute the deferred events again, from the most active state. Events
+    // the new state defers again are parked again.
+    void replayDeferred()
+    {
+        std::vector<Event> events;
+        events.swap(this->deferred_);
+        for (Event const& e : events) {
+            this->dispatch(this)->execute(e);
+        }
+        if (this->deferred_.empty()) {
+            // Keep the buffer's capacity
+            events.clear();
+            this->deferred_.swap(events);
         }
     }
 };
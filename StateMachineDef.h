@@ -1,23 +1,131 @@
 #pragma once
 
+#include "Arena.h"
+#include "AsyncAction.h"
 #include "Event.h"
 #include "State.h"
+#include "Throw.h"
 #include "Transition.h"
+#include "TransitionTable.h"
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
 #include <set>
+#include <stdexcept>
+#include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace tsm {
-typedef std::pair<State&, Event> StateEventPair;
+
+struct IHsmDef;
+
+///
+/// A type erased handle on one transition of an HSMDef, for code that walks
+/// the definitions of a whole hierarchy without knowing their types, see
+/// SharedDefinition.
+///
+struct TransitionRef
+{
+    IHsmDef* hsm; ///< The HSM owning the transition
+    State* fromState;
+    Event const* onEvent;
+    State* toState;
+    void const* transition;
+    /// False if the guard rejects e or the transition needs another payload.
+    /// nullptr if the transition has no guard and takes any event.
+    bool (*accepts)(TransitionRef const& t, Event const& e);
+    /// Run the action. nullptr if the transition has none.
+    void (*act)(TransitionRef const& t, Event const& e);
+};
+
+///
+/// A problem in a definition, found by IHsmDef::validate. See
+/// DefinitionCompiler.h.
+///
+struct DefinitionIssue
+{
+    enum class Kind
+    {
+        NoStartState,
+        DuplicateTransition, ///< The first transition added for a pair wins
+        UnreachableState,
+        UnreachableStopState
+    };
+
+    Kind kind;
+    IHsmDef const* hsm;
+    State const* state;  ///< nullptr for NoStartState
+    Event const* event;  ///< The event of a DuplicateTransition
+    std::string message; ///< For people
+};
+
+///
+/// Where an event that the current state of an HSM has no transition for
+/// ends up: what walking up the parent HSMs finds at run time. See
+/// IHsmDef::resolve.
+///
+struct Resolution
+{
+    enum class Kind : std::uint8_t
+    {
+        Transition, ///< Taken by owner
+        Defer,      ///< Deferred by owner
+        Forward,    ///< Executed by owner, which cannot be resolved through
+        Unhandled   ///< Unhandled by owner, the top level HSM
+    };
+
+    Kind kind;
+    IHsmDef* owner;
+    void const* transition; ///< The owner's transition, for Transition
+};
+
+namespace detail {
+
+constexpr std::uint64_t FingerprintBasis = 0xcbf29ce484222325;
+
+// FNV-1a over the bytes of v, low byte first, continuing from h
+inline std::uint64_t fingerprint(std::uint64_t h, std::uint64_t v)
+{
+    for (int i = 0; i < 8; ++i, v >>= 8) {
+        h = (h ^ (v & 0xFF)) * 0x100000001b3;
+    }
+    return h;
+}
+
+// FNV-1a over the characters of s and its length, continuing from h
+inline std::uint64_t fingerprint(std::uint64_t h, std::string const& s)
+{
+    for (char c : s) {
+        h = (h ^ static_cast<unsigned char>(c)) * 0x100000001b3;
+    }
+    return fingerprint(h, s.size());
+}
+
+} // namespace detail
 
 struct IHsmDef : public State
 {
     IHsmDef() = delete;
 
     IHsmDef(std::string const& name, IHsmDef* parent)
-      : State(name)
+      : State(name, Kind::Hsm)
       , parent_(parent)
       , currentState_(nullptr)
+      , history_(nullptr)
+      , activeLeaf_(this)
+    {}
+
+    IHsmDef(IHsmDef const& other)
+      : State(other)
+      , parent_(other.parent_)
+      , currentState_(other.currentState_)
+      , history_(other.history_)
+      , activeLeaf_(this)
     {}
 
     virtual ~IHsmDef() = default;
@@ -27,120 +135,865 @@ struct IHsmDef : public State
 
     State* getCurrentState()
     {
-        DLOG(INFO) << "Get Current State: "
-                   << ((currentState_) ? currentState_->name : "nullptr");
+        TSM_DLOG(INFO) << "Get Current State: "
+                       << ((currentState_) ? currentState_->name : "nullptr");
         return currentState_;
     }
 
     IHsmDef* getParent() const { return parent_; }
 
+    /// The id space of the states and events of this HSM, see UniqueId.h.
+    virtual UniqueId::IdType idSpace() const { return UniqueId::GlobalSpace; }
+
+    ///
+    /// Add every event handled anywhere in this HSM, including the sub HSMs
+    /// below it, to events.
+    ///
+    virtual void collectEvents(std::set<Event>& events) = 0;
+
+    ///
+    /// Append every transition of this HSM, not of the HSMs below it, to
+    /// transitions. Throws for HSMs that cannot list their transitions.
+    ///
+    virtual void listTransitions(std::vector<TransitionRef>& /* transitions */)
+    {
+        TSM_THROW(MethodNotImplementedException(
+          name + " cannot list its transitions"));
+    }
+
     void setParent(IHsmDef* parent) { parent_ = parent; }
 
+    ///
+    /// Append the problems of this HSM and of the HSMs below it to issues.
+    /// HSMs that cannot check themselves report nothing.
+    ///
+    virtual void validate(std::vector<DefinitionIssue>& /* issues */) {}
+
+    ///
+    /// What executing e does while from is the current state of this HSM,
+    /// and from has no transition on e. The same steps as the walk at run
+    /// time: this HSM's deferral, then the parent HSM with this HSM as its
+    /// current state, and so on up. HSMs that route events in their own way
+    /// resolve to Forward.
+    ///
+    virtual Resolution resolve(State& /* from */, Event const& /* e */)
+    {
+        return Resolution{ Resolution::Kind::Forward, this, nullptr };
+    }
+
+    /// Carry out r, resolved to this HSM, for e.
+    virtual void executeResolved(Resolution const& /* r */, Event const& e)
+    {
+        execute(e);
+    }
+
+    ///
+    /// Resolve, once, every event of the hierarchy for every simple state of
+    /// this HSM and of the HSMs below it, so that an event a state has no
+    /// transition for goes straight to the HSM handling it instead of up
+    /// through each parent. Call when the hierarchy is complete; transitions
+    /// added later are not seen. See DefinitionCompiler.h.
+    ///
+    virtual void flatten() {}
+
+    ///
+    /// Enter the HSM in the state it was in when it was last exited, without
+    /// going through its start state. With deep set, sub HSMs resume the
+    /// same way, otherwise they are entered afresh. An HSM that was never
+    /// exited, or that was exited from its stop state, is entered normally.
+    /// See HistoryState.
+    ///
+    virtual void resume(Event const& e, bool /* deep */) { onEntry(e); }
+
+    /// True if some state of this HSM defers an event, see
+    /// StateMachineDef::defer.
+    virtual bool defersEvents() const { return false; }
+
+    /// The number of events parked by the states of this HSM.
+    std::size_t numDeferred() const { return deferred_.size(); }
+
+    ///
+    /// The number of 16 bit slots saveState writes for the hierarchy rooted
+    /// at this HSM. The same for every instance of a definition type.
+    ///
+    virtual std::size_t numSnapshotSlots()
+    {
+        TSM_THROW(MethodNotImplementedException(name + " cannot be snapshot"));
+    }
+
+    ///
+    /// Write the current state and the history of every HSM in the
+    /// hierarchy, as dense state ids, to out and advance it. See Snapshot.h.
+    ///
+    virtual void saveState(std::uint16_t*& /* out */)
+    {
+        TSM_THROW(MethodNotImplementedException(name + " cannot be snapshot"));
+    }
+
+    ///
+    /// A hash of the names and slots of the states saveState writes for the
+    /// hierarchy rooted at this HSM, the same for every instance of a
+    /// definition type. A record is meant for machines with the fingerprint
+    /// of the one that wrote it, see SnapshotHeader.
+    ///
+    virtual std::uint64_t snapshotFingerprint()
+    {
+        TSM_THROW(MethodNotImplementedException(name + " cannot be snapshot"));
+    }
+
+    ///
+    /// Read back what saveState wrote and advance in. No entry or exit
+    /// actions are run and deferred events are dropped. Throws
+    /// std::invalid_argument for ids that name no state, before anything in
+    /// the hierarchy is changed.
+    ///
+    void restoreState(std::uint16_t const*& in)
+    {
+        std::uint16_t const* record = in;
+        checkState(record);
+        loadState(in);
+    }
+
+    /// Advance in over a record, throwing what restoreState would for it.
+    virtual void checkState(std::uint16_t const*& /* in */)
+    {
+        TSM_THROW(MethodNotImplementedException(name + " cannot be restored"));
+    }
+
+    /// restoreState for a record checkState accepted.
+    virtual void loadState(std::uint16_t const*& /* in */)
+    {
+        TSM_THROW(MethodNotImplementedException(name + " cannot be restored"));
+    }
+
+    ///
+    /// Return the most active (deepest) HSM below and including hsm - the
+    /// one an incoming event has to be executed on. This is a cached O(1)
+    /// lookup, see updateActiveLeaf.
+    ///
+    IHsmDef* dispatch(IHsmDef* hsm) const { return hsm->activeLeaf_; }
+
   protected:
+    ///
+    /// Keep the cached active leaf of this HSM and of all its ancestors up to
+    /// date. It has to be called whenever the current state of an HSM changes
+    /// to or from a sub HSM, or when an HSM is entered or exited. Transitions
+    /// between simple states leave the leaf alone, so the O(depth) walk is
+    /// off the common path. The walk stops at the first HSM whose leaf does
+    /// not change, e.g. at an OrthogonalStateMachine, so regions running in
+    /// parallel never write to their common ancestors.
+    ///
+    void updateActiveLeaf()
+    {
+        for (IHsmDef* hsm = this; hsm; hsm = hsm->parent_) {
+            State* kid = hsm->currentState_;
+            IHsmDef* leaf = (kid && kid->isHsm())
+                              ? static_cast<IHsmDef*>(kid)->activeLeaf_
+                              : hsm;
+            if (hsm->activeLeaf_ == leaf) {
+                break;
+            }
+            hsm->activeLeaf_ = leaf;
+        }
+    }
+
+    ///
+    /// When an HSM is exited, the events its states deferred move to the
+    /// parent, which replays them after its own transition.
+    ///
+    void handOverDeferred()
+    {
+        if (parent_ && !deferred_.empty()) {
+            parent_->deferred_.insert(
+              parent_->deferred_.end(), deferred_.begin(), deferred_.end());
+        }
+        deferred_.clear();
+    }
+
     IHsmDef* parent_;
     State* currentState_;
+    State* history_; ///< The current state at the last exit
+    /// Deferred events in arrival order, replayed on the next transition
+    std::vector<Event> deferred_;
+
+  private:
+    IHsmDef* activeLeaf_;
 };
 
-template<typename HSMDef>
-struct StateMachineDef : public IHsmDef
+///
+/// A history pseudo-state. A transition to it enters its owning HSM through
+/// IHsmDef::resume rather than through the start state, so a sub HSM picks
+/// up where it left off without running any of its entry work again:
+///
+/// add(Paused, end_pause, Playing.shallowHistory);
+/// add(Stopped, play, Playing); // starts over
+///
+/// The pseudo-state never becomes current, the owning HSM does. It shares the
+/// owner's id.
+///
+struct HistoryState : public State
 {
-    using ActionFn = void (HSMDef::*)(void);
-    using GuardFn = bool (HSMDef::*)(void);
-    using Transition = TransitionT<State, Event, ActionFn, GuardFn>;
-    using TransitionTableElement = std::pair<StateEventPair, Transition>;
-    using TransitionTable =
-      std::unordered_map<typename TransitionTableElement::first_type,
-                         typename TransitionTableElement::second_type>;
-
-    struct StateTransitionTable : private TransitionTable
-    {
-        using TransitionTable::end;
-        using TransitionTable::find;
-        using TransitionTable::insert;
-        using TransitionTable::size;
+    HistoryState(IHsmDef& owner, bool deep)
+      : State(owner.name + (deep ? " (H*)" : " (H)"),
+              UniqueId::Id{ owner.space, owner.id },
+              Kind::History)
+      , owner(owner)
+      , deep(deep)
+    {}
 
-      public:
-        Transition* next(State& fromState, Event const& onEvent)
-        {
-            // Check if event in HSM
-            StateEventPair pair(fromState, onEvent);
-            auto it = find(pair);
-            if (it != end()) {
-                return &it->second;
-            }
+    void onEntry(Event const& e) override { owner.resume(e, deep); }
 
-            DLOG(ERROR) << "No Transition:" << fromState.name
-                        << "\tonEvent:" << onEvent.id;
-            return nullptr;
-        }
+    IHsmDef& owner;
+    const bool deep;
+};
 
-        void print()
-        {
-            for (const auto& it : *this) {
-                DLOG(INFO) << it.first.first->name << "," << it.first.second.id
-                           << ":" << it.second->toState.name << "\n";
-            }
-        }
-    };
+///
+/// The TransitionTableT template parameter selects how the transitions are
+/// stored and looked up. See TransitionTable.h for the choices.
+///
+template<typename HSMDef,
+         template<typename> class TransitionTableT = HashedTransitionTable>
+struct StateMachineDef : public IHsmDef
+{
+    using ActionFn = void (HSMDef::*)(void);
+    using GuardFn = bool (HSMDef::*)(void);
+    using Action = Callback<HSMDef, Event, void>;
+    using Guard = Callback<HSMDef, Event, bool>;
+    using Transition = TransitionT<State, Event, Action, Guard>;
+    using StateTransitionTable = TransitionTableT<Transition>;
+#if TSM_HAS_COROUTINES
+    using AsyncCallback = Callback<HSMDef, Event, AsyncAction>;
+#endif
 
     StateMachineDef() = delete;
 
+    ///
+    /// The states and events of the definition are constructed after this
+    /// base, so they draw their ids from the definition's own id space. The
+    /// space stays active until the first add or defer, which the body of
+    /// the HSMDef constructor makes once all the members exist, until the
+    /// StateMachine wrapping the definition is constructed, or until the
+    /// definition is destroyed, on whichever thread, whichever comes first.
+    ///
     StateMachineDef(std::string const& name, IHsmDef* parent = nullptr)
       : IHsmDef(name, parent)
-    {}
+      , shallowHistory(*this, false)
+      , deepHistory(*this, true)
+      , table_(UniqueId::spaceTag<HSMDef>())
+      , idSpace_(UniqueId::spaceTag<HSMDef>())
+    {
+        UniqueId::enter(idSpace_);
+    }
 
-    virtual ~StateMachineDef() = default;
+    virtual ~StateMachineDef() { UniqueId::leave(idSpace_); }
 
+    ///
+    /// Add a transition. Actions and guards are HSMDef member functions,
+    /// lambdas or function objects; see Callback for the signatures they can
+    /// have. A transition whose action or guard takes a payload is only taken
+    /// when the event carries a payload of that type.
+    ///
+    /// add(Closed, open, Open, [this] { ++openCount; }, &Door::isUnlocked);
+    ///
     void add(State& fromState,
              Event const& onEvent,
              State& toState,
-             ActionFn action = nullptr,
-             GuardFn guard = nullptr)
+             Action action = nullptr,
+             Guard guard = nullptr)
     {
+        // All the states and events of the definition exist by now
+        UniqueId::leave(idSpace_);
 
         Transition t(fromState, onEvent, toState, action, guard);
-        addTransition(fromState, onEvent, t);
+        std::size_t before = table_.size();
+        table_.insert(fromState, onEvent, t);
+        if (table_.size() == before) {
+            // Dropped by the table, kept for validate
+            dropped_.emplace_back(&fromState, onEvent);
+        }
         eventSet_.insert(onEvent);
+        addSubHsm(fromState);
+        addSubHsm(toState);
+    }
+
+#if TSM_HAS_COROUTINES
+    ///
+    /// Add a transition whose action is a coroutine, see AsyncAction. The
+    /// from state is exited and the action started; if it suspends, the HSM
+    /// stays in transition, with no current state, until the coroutine
+    /// completes. Only then is the to state entered. Events arriving in
+    /// between are parked like deferred events and executed after the
+    /// transition. Parameters referring to the event or its payload stay
+    /// valid until the coroutine completes. Exiting the HSM, e.g. with
+    /// stopSM, destroys a suspended coroutine without completing it.
+    ///
+    /// addAsync(Idle, fetch, Ready, &Client::download);
+    ///
+    /// The coroutine is resumed by whoever completes what it awaits. Resume
+    /// it where the machine's events are processed - on the machine's own
+    /// thread, or through the machine's queue - since completing the
+    /// transition runs the machine.
+    ///
+    void addAsync(State& fromState,
+                  Event const& onEvent,
+                  State& toState,
+                  AsyncCallback action,
+                  Guard guard = nullptr)
+    {
+        // As with add, the first transition for the pair wins, whatever the
+        // table does with the later ones
+        bool taken = false;
+        table_.forEach([&](Transition const& t) {
+            if (&t.fromState == &fromState && t.onEvent == onEvent) {
+                taken = true;
+            }
+        });
+        add(fromState, onEvent, toState, nullptr, guard);
+        if (!taken) {
+            asyncActions_.emplace(std::make_pair(keyOf(fromState), onEvent),
+                                  action);
+        }
+    }
+
+    /// True while a coroutine action is suspended.
+    bool isInTransition() const { return !pendingAction_.done(); }
+
+    /// The coroutine action of t, nullptr if it has none.
+    AsyncCallback const* asyncAction(Transition const& t) const
+    {
+        if (asyncActions_.empty()) {
+            return nullptr;
+        }
+        auto it =
+          asyncActions_.find(std::make_pair(keyOf(t.fromState), t.onEvent));
+        return it != asyncActions_.end() ? &it->second : nullptr;
     }
 
+#endif
+    ///
+    /// Defer onEvent while state is current: instead of going up to the
+    /// parent HSM the event is parked in a buffer of this HSM, off the event
+    /// queue. The parked events are executed again, in the order they
+    /// arrived, as soon as this HSM makes a transition. A transition of state
+    /// on onEvent takes precedence over deferral.
+    ///
+    /// defer(Busy, request);
+    ///
+    void defer(State& state, Event const& onEvent)
+    {
+        UniqueId::leave(idSpace_);
+        deferrals_.insert(std::make_pair(keyOf(state), onEvent));
+        addSubHsm(state);
+    }
+
+    /// True if the current state defers e. Called for unhandled events only.
+    bool defers(State const& state, Event const& e) const
+    {
+        return !deferrals_.empty() &&
+               deferrals_.count(std::make_pair(keyOf(state), e)) != 0;
+    }
+
+    bool defersEvents() const override { return !deferrals_.empty(); }
+
+    UniqueId::IdType idSpace() const override { return idSpace_.tag; }
+
     Transition* next(State& currentState, Event const& nextEvent)
     {
         return table_.next(currentState, nextEvent);
     }
 
+    /// The resolution of e in state by flatten, nullptr if there is none.
+    Resolution const* resolved(State const& state, Event const& e) const
+    {
+        if (flat_.empty()) {
+            return nullptr;
+        }
+        auto it = flat_.find(FlatKey{ state.space, state.id, e.space, e.id });
+        return it != flat_.end() ? &it->second : nullptr;
+    }
+
+    Resolution resolve(State& from, Event const& e) override
+    {
+        if (Transition* t = table_.next(from, e)) {
+            return Resolution{ Resolution::Kind::Transition, this, t };
+        }
+        if (defers(from, e)) {
+            return Resolution{ Resolution::Kind::Defer, this, nullptr };
+        }
+        if (parent_) {
+            return parent_->resolve(*this, e);
+        }
+        return Resolution{ Resolution::Kind::Unhandled, this, nullptr };
+    }
+
+    void flatten() override
+    {
+        IHsmDef* top = this;
+        while (top->getParent()) {
+            top = top->getParent();
+        }
+        std::set<Event> events;
+        top->collectEvents(events);
+
+        indexStates();
+        flat_.clear();
+        forEachIndexed([&](State* state) {
+            if (state->isHsm()) {
+                return;
+            }
+            for (Event const& e : events) {
+                if (!table_.next(*state, e)) {
+                    flat_.emplace(
+                      FlatKey{ state->space, state->id, e.space, e.id },
+                      resolve(*state, e));
+                }
+            }
+        });
+        for (IHsmDef* sub : subHsmsById_) {
+            sub->flatten();
+        }
+    }
+
+    ///
+    /// Reports a missing start state, transitions dropped because an
+    /// earlier one has the same state and event, states that no transition
+    /// leads to from the start state and an unreachable stop state.
+    ///
+    void validate(std::vector<DefinitionIssue>& issues) override
+    {
+        using Kind = DefinitionIssue::Kind;
+        State* start = this->getStartState();
+        if (!start) {
+            issues.push_back(DefinitionIssue{ Kind::NoStartState,
+                                              this,
+                                              nullptr,
+                                              nullptr,
+                                              name + ": no start state" });
+        }
+
+        std::vector<std::pair<State const*, Event const*>> duplicates;
+        for (auto const& d : dropped_) {
+            duplicates.emplace_back(d.first, &d.second);
+        }
+        std::set<std::pair<State const*, Event>> seen;
+        std::unordered_map<State const*, std::vector<State*>> edges;
+        table_.forEach([&](Transition const& t) {
+            if (!seen.insert(std::make_pair(&t.fromState, t.onEvent)).second) {
+                duplicates.emplace_back(&t.fromState, &t.onEvent);
+            }
+            State* to = &t.toState;
+            if (to->isHistory()) {
+                to = &static_cast<HistoryState*>(to)->owner;
+            }
+            edges[&t.fromState].push_back(to);
+        });
+        for (auto const& d : duplicates) {
+            issues.push_back(DefinitionIssue{
+              Kind::DuplicateTransition,
+              this,
+              d.first,
+              d.second,
+              name + ": more than one transition from " + d.first->name +
+                " on event " + std::to_string(d.second->id) +
+                ", the first one added is used" });
+        }
+
+        indexStates();
+        std::set<State const*> reached;
+        std::vector<State const*> todo;
+        if (start) {
+            reached.insert(start);
+            todo.push_back(start);
+        }
+        while (!todo.empty()) {
+            State const* from = todo.back();
+            todo.pop_back();
+            for (State* to : edges[from]) {
+                if (reached.insert(to).second) {
+                    todo.push_back(to);
+                }
+            }
+        }
+        State* stop = this->getStopState();
+        forEachIndexed([&](State* state) {
+            if (reached.count(state)) {
+                return;
+            }
+            bool isStop = state == stop;
+            issues.push_back(DefinitionIssue{
+              isStop ? Kind::UnreachableStopState : Kind::UnreachableState,
+              this,
+              state,
+              nullptr,
+              name + ": " + (isStop ? "stop state " : "state ") + state->name +
+                " cannot be reached from the start state" });
+        });
+
+        for (IHsmDef* sub : subHsmsById_) {
+            sub->validate(issues);
+        }
+    }
+
     void onEntry(Event const& e) override
     {
-        DLOG(INFO) << "Entering: " << this->name;
+        TSM_DLOG(INFO) << "Entering: " << this->name;
         currentState_ = this->getStartState();
+        this->updateActiveLeaf();
 
-        this->currentState_->execute(e);
+        // A sub HSM (or a set of orthogonal regions) as the start state has
+        // to be entered to start its own start state.
+        if (currentState_->isHsm()) {
+            this->currentState_->onEntry(e);
+        } else {
+            this->currentState_->execute(e);
+        }
     }
-    void onExit(Event const&) override
+
+    ///
+    /// Exiting forgets the current state, after exiting it if it is a sub
+    /// HSM. It is kept as the history for a later re-entry through
+    /// shallowHistory or deepHistory, unless it is the stop state.
+    ///
+    void onExit(Event const& e) override
     {
-        // TODO (sriram): Does the sub-HSM remember which state it was in at
-        // exit? This really depends on exit/history policy. Sometimes you
-        // want to retain state information when you exit a sub-HSM for
-        // certain events. Maybe adding a currenEvent_ variable would allow
-        // HSMDefs to override onExit appropriately. Currently as you see,
-        // the policy is to 'forget' on exit by setting the currentState_ to
-        // nullptr.
-        DLOG(INFO) << "Exiting: " << this->name;
+        TSM_DLOG(INFO) << "Exiting: " << this->name;
+        State* current = this->currentState_;
+        if (current && current->isHsm()) {
+            current->onExit(e);
+        }
+        this->history_ = (current == this->getStopState()) ? nullptr : current;
         this->currentState_ = nullptr;
+        this->updateActiveLeaf();
+        this->handOverDeferred();
+    }
+
+    void resume(Event const& e, bool deep) override
+    {
+        if (!this->history_) {
+            onEntry(e);
+            return;
+        }
+        TSM_DLOG(INFO) << "Resuming: " << this->name;
+        currentState_ = this->history_;
+        this->updateActiveLeaf();
+
+        if (currentState_->isHsm()) {
+            auto sub = static_cast<IHsmDef*>(currentState_);
+            if (deep) {
+                sub->resume(e, true);
+            } else {
+                sub->onEntry(e);
+            }
+        } else {
+            this->currentState_->execute(e);
+        }
+    }
+
+    void collectEvents(std::set<Event>& events) override
+    {
+        events.insert(eventSet_.begin(), eventSet_.end());
+        State* start = this->getStartState();
+        if (start && start->isHsm()) {
+            addSubHsm(*start);
+        }
+        for (IHsmDef* sub : subHsms_) {
+            sub->collectEvents(events);
+        }
+    }
+
+    void listTransitions(std::vector<TransitionRef>& transitions) override
+    {
+        table_.forEach([this, &transitions](Transition const& t) {
+            transitions.push_back(TransitionRef{ this,
+                                                 &t.fromState,
+                                                 &t.onEvent,
+                                                 &t.toState,
+                                                 &t,
+                                                 conditional(t)
+                                                   ? &acceptsTransition
+                                                   : nullptr,
+                                                 t.action ? &actTransition
+                                                          : nullptr });
+        });
+    }
+
+    std::size_t numSnapshotSlots() override
+    {
+        indexStates();
+        std::size_t n = 2;
+        for (IHsmDef* sub : subHsmsById_) {
+            n += sub->numSnapshotSlots();
+        }
+        return n;
+    }
+
+    void saveState(std::uint16_t*& out) override
+    {
+        indexStates();
+        *out++ = slotOf(this->currentState_);
+        *out++ = slotOf(this->history_);
+        for (IHsmDef* sub : subHsmsById_) {
+            sub->saveState(out);
+        }
+    }
+
+    std::uint64_t snapshotFingerprint() override
+    {
+        indexStates();
+        if (!fingerprint_) {
+            std::uint64_t h =
+              detail::fingerprint(detail::FingerprintBasis, this->name);
+            h = detail::fingerprint(h, statesById_.size());
+            for (State* state : statesById_) {
+                h = state ? detail::fingerprint(h, state->name)
+                          : detail::fingerprint(h, std::uint64_t(0));
+            }
+            for (State* state : foreignStates_) {
+                h = detail::fingerprint(h, state->name);
+            }
+            fingerprint_ = h;
+        }
+        // Not cached: the sub HSMs may have been indexed again since
+        std::uint64_t h = fingerprint_;
+        for (IHsmDef* sub : subHsmsById_) {
+            h = detail::fingerprint(h, sub->snapshotFingerprint());
+        }
+        return h;
+    }
+
+    void checkState(std::uint16_t const*& in) override
+    {
+        indexStates();
+        stateOf(*in++);
+        stateOf(*in++);
+        for (IHsmDef* sub : subHsmsById_) {
+            sub->checkState(in);
+        }
+    }
+
+    void loadState(std::uint16_t const*& in) override
+    {
+        indexStates();
+        this->currentState_ = stateOf(*in++);
+        this->history_ = stateOf(*in++);
+        this->deferred_.clear();
+        for (IHsmDef* sub : subHsmsById_) {
+            sub->loadState(in);
+        }
+        this->updateActiveLeaf();
     }
 
     auto& getTable() const { return table_; }
     auto& getEvents() const { return eventSet_; }
 
+    /// Transition targets resuming this HSM, see HistoryState.
+    HistoryState shallowHistory;
+    HistoryState deepHistory;
+
+  private:
+    static bool conditional(Transition const& t)
+    {
+        return t.guard || t.action.needsPayload();
+    }
+
+    static bool acceptsTransition(TransitionRef const& ref, Event const& e)
+    {
+        auto t = static_cast<Transition const*>(ref.transition);
+        return t->accepts(e) &&
+               (!t->guard || t->guard(static_cast<HSMDef*>(ref.hsm), e));
+    }
+
+    static void actTransition(TransitionRef const& ref, Event const& e)
+    {
+        auto t = static_cast<Transition const*>(ref.transition);
+        t->action(static_cast<HSMDef*>(ref.hsm), e);
+    }
+
+    // A snapshot slot holds the id of a state of this definition's space
+    // plus one, or, past those, the position of a state from another space
+    // plus one; 0 for none.
+    std::uint16_t slotOf(State const* state) const
+    {
+        if (!state) {
+            return 0;
+        }
+        std::size_t slot;
+        if (state->space == idSpace_.tag) {
+            slot = state->id + 1;
+        } else {
+            auto it =
+              std::find(foreignStates_.begin(), foreignStates_.end(), state);
+            if (it == foreignStates_.end()) {
+                TSM_THROW(std::invalid_argument(
+                  this->name + ": " + state->name + " is not in the table"));
+            }
+            slot = statesById_.size() + (it - foreignStates_.begin()) + 1;
+        }
+        if (slot >= 0xFFFF) {
+            TSM_THROW(std::length_error("State id too large for a snapshot"));
+        }
+        return static_cast<std::uint16_t>(slot);
+    }
+
+    State* stateOf(std::uint16_t slot) const
+    {
+        if (!slot) {
+            return nullptr;
+        }
+        State* state = nullptr;
+        if (slot <= statesById_.size()) {
+            state = statesById_[slot - 1];
+        } else if (slot - statesById_.size() <= foreignStates_.size()) {
+            state = foreignStates_[slot - statesById_.size() - 1];
+        }
+        if (!state) {
+            TSM_THROW(std::invalid_argument(
+              this->name + ": snapshot names an unknown state"));
+        }
+        return state;
+    }
+
+    // Map the ids of all the states of this definition's space that can be
+    // current to the states, list the ones from other spaces, e.g. the
+    // states of another definition, in the order they were added, and list
+    // the sub HSMs in slot order. Rebuilt when transitions have been added
+    // since the last time.
+    void indexStates()
+    {
+        if (indexedTransitions_ == table_.size()) {
+            return;
+        }
+        indexedTransitions_ = table_.size();
+        fingerprint_ = 0;
+        statesById_.clear();
+        foreignStates_.clear();
+        subHsmsById_.clear();
+        auto addState = [this](State* state) {
+            if (!state) {
+                return;
+            }
+            if (state->isHistory()) {
+                state = &static_cast<HistoryState*>(state)->owner;
+            }
+            if (state->space != idSpace_.tag) {
+                if (std::find(foreignStates_.begin(),
+                              foreignStates_.end(),
+                              state) == foreignStates_.end()) {
+                    foreignStates_.push_back(state);
+                }
+                return;
+            }
+            if (state->id >= statesById_.size()) {
+                statesById_.resize(state->id + 1, nullptr);
+            }
+            statesById_[state->id] = state;
+        };
+        addState(this->getStartState());
+        addState(this->getStopState());
+        table_.forEach([&addState](Transition const& t) {
+            addState(&t.fromState);
+            addState(&t.toState);
+        });
+        forEachIndexed([this](State* state) {
+            if (state->isHsm()) {
+                subHsmsById_.push_back(static_cast<IHsmDef*>(state));
+            }
+        });
+    }
+
+    // Call f on every state indexed by indexStates, in slot order.
+    template<typename F>
+    void forEachIndexed(F f) const
+    {
+        for (State* state : statesById_) {
+            if (state) {
+                f(state);
+            }
+        }
+        for (State* state : foreignStates_) {
+            f(state);
+        }
+    }
+
+    void addSubHsm(State& state)
+    {
+        if (state.isHsm()) {
+            subHsms_.insert(static_cast<IHsmDef*>(&state));
+        }
+    }
+
   protected:
+    template<typename T>
+    using ArenaSet = std::set<T, std::less<T>, ArenaAllocator<T>>;
+
+    // The containers built by add and defer draw from the current Arena
     StateTransitionTable table_;
-    std::set<Event> eventSet_;
+    ArenaSet<Event> eventSet_;
+    ArenaSet<IHsmDef*> subHsms_;
+    // A state by (space, id): the id alone is only unique within its space
+    using StateKey = std::pair<UniqueId::IdType, UniqueId::IdType>;
 
-  private:
-    void addTransition(State& fromState, Event onEvent, Transition t)
+    static StateKey keyOf(State const& state)
     {
-        StateEventPair pair(fromState, onEvent);
-        TransitionTableElement e(pair, t);
-        table_.insert(e);
+        return std::make_pair(state.space, state.id);
     }
+
+    // (state, event) pairs, see defer
+    ArenaSet<std::pair<StateKey, Event>> deferrals_;
+#if TSM_HAS_COROUTINES
+    // (state, event) of the transitions added with addAsync
+    using AsyncKey = std::pair<StateKey, Event>;
+    std::map<AsyncKey,
+             AsyncCallback,
+             std::less<AsyncKey>,
+             ArenaAllocator<std::pair<AsyncKey const, AsyncCallback>>>
+      asyncActions_;
+    // The transition of a suspended coroutine action, see StateMachine
+    AsyncAction pendingAction_;
+    Transition* pendingTransition_ = nullptr;
+    Event pendingEvent_ = Event::dummy_event;
+#endif
+    // Transitions the table dropped as duplicates, see validate
+    std::vector<std::pair<State*, Event>,
+                ArenaAllocator<std::pair<State*, Event>>>
+      dropped_;
+    // Built on the first snapshot, restore, validate or flatten, see
+    // indexStates
+    std::vector<State*> statesById_;
+    std::vector<State*> foreignStates_;
+    std::vector<IHsmDef*> subHsmsById_;
+    std::size_t indexedTransitions_ = std::size_t(-1);
+    // Of this HSM's own slots, 0 until computed, see snapshotFingerprint
+    std::uint64_t fingerprint_ = 0;
+    UniqueId::Space idSpace_;
+
+  private:
+    // A simple state of this HSM and an event, see flatten
+    struct FlatKey
+    {
+        UniqueId::IdType stateSpace;
+        UniqueId::IdType state;
+        UniqueId::IdType space;
+        UniqueId::IdType id;
+
+        bool operator==(FlatKey const& rhs) const
+        {
+            return stateSpace == rhs.stateSpace && state == rhs.state &&
+                   space == rhs.space && id == rhs.id;
+        }
+    };
+
+    struct FlatKeyHash
+    {
+        std::size_t operator()(FlatKey const& k) const
+        {
+            std::uint64_t h = (std::uint64_t(k.state) << 32) ^
+                              (std::uint64_t(k.stateSpace) << 44) ^
+                              (std::uint64_t(k.space) << 20) ^ k.id;
+            return std::hash<std::uint64_t>{}(h);
+        }
+    };
+
+    std::unordered_map<FlatKey, Resolution, FlatKeyHash> flat_;
 };
 } // namespace tsm
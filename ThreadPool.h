@@ -0,0 +1,180 @@
+#pragma once
+
+#include "Trace.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace tsm {
+
+///
+/// A fixed pool of worker threads with work stealing. Every worker owns a
+/// task queue. Tasks submitted from a worker go to that worker's queue (they
+/// are likely to touch the same data), tasks submitted from any other thread
+/// are spread round robin. A worker that runs dry steals from the back of the
+/// other workers' queues before going to sleep.
+///
+/// Tasks are intrusive - the pool never allocates for a Task - and must stay
+/// alive until they have run. Tasks still queued when the pool is destroyed
+/// are not run.
+///
+class ThreadPool
+{
+  public:
+    struct Task
+    {
+        virtual ~Task() = default;
+        virtual void run() = 0;
+    };
+
+    explicit ThreadPool(std::size_t nThreads = defaultSize())
+      : pending_(0)
+      , nextWorker_(0)
+      , idleWorkers_(0)
+      , stop_(false)
+    {
+        nThreads = nThreads ? nThreads : 1;
+        for (std::size_t i = 0; i < nThreads; ++i) {
+            workers_.emplace_back(new Worker());
+        }
+        for (std::size_t i = 0; i < nThreads; ++i) {
+            threads_.emplace_back(&ThreadPool::workerLoop, this, i);
+        }
+    }
+
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(idleMutex_);
+            stop_ = true;
+        }
+        cvIdle_.notify_all();
+        for (auto& t : threads_) {
+            t.join();
+        }
+    }
+
+    void submit(Task* task)
+    {
+        auto& ctx = context();
+        std::size_t index = (ctx.pool == this)
+                              ? ctx.index
+                              : nextWorker_.fetch_add(1) % workers_.size();
+        // Count the task before it is visible, so pending_ never underflows.
+        pending_.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+            workers_[index]->tasks.push_back(task);
+        }
+        if (idleWorkers_.load() > 0) {
+            std::lock_guard<std::mutex> lock(idleMutex_);
+            cvIdle_.notify_one();
+        }
+    }
+
+    std::size_t size() const { return workers_.size(); }
+
+    /// True when called from one of this pool's worker threads.
+    bool isWorkerThread() const { return context().pool == this; }
+
+    ///
+    /// A process wide pool with one worker per hardware thread. Created on
+    /// first use.
+    ///
+    static ThreadPool& shared()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    static std::size_t defaultSize()
+    {
+        std::size_t n = std::thread::hardware_concurrency();
+        return n ? n : 1;
+    }
+
+  private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task*> tasks;
+    };
+
+    struct Context
+    {
+        ThreadPool* pool;
+        std::size_t index;
+    };
+
+    static Context& context()
+    {
+        static thread_local Context ctx{ nullptr, 0 };
+        return ctx;
+    }
+
+    // Own queue first, oldest task first. Then steal the newest task of the
+    // other workers.
+    Task* findTask(std::size_t index)
+    {
+        {
+            Worker& w = *workers_[index];
+            std::lock_guard<std::mutex> lock(w.mutex);
+            if (!w.tasks.empty()) {
+                Task* t = w.tasks.front();
+                w.tasks.pop_front();
+                return t;
+            }
+        }
+        for (std::size_t i = 1; i < workers_.size(); ++i) {
+            Worker& victim = *workers_[(index + i) % workers_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                Task* t = victim.tasks.back();
+                victim.tasks.pop_back();
+                return t;
+            }
+        }
+        return nullptr;
+    }
+
+    void workerLoop(std::size_t index)
+    {
+        context() = Context{ this, index };
+        for (;;) {
+            if (Task* task = findTask(index)) {
+                pending_.fetch_sub(1);
+                task->run();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(idleMutex_);
+            ++idleWorkers_;
+            cvIdle_.wait(lock, [this] { return stop_ || pending_ > 0; });
+            --idleWorkers_;
+            if (stop_) {
+                TSM_DLOG(INFO) << "Worker " << index << " exiting";
+                return;
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+    std::atomic<std::size_t> pending_;
+    std::atomic<std::size_t> nextWorker_;
+    std::atomic<std::size_t> idleWorkers_;
+    std::mutex idleMutex_;
+    std::condition_variable cvIdle_;
+    bool stop_;
+};
+
+} // namespace tsm
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+///
+/// tsm builds with and without exceptions. TSM_THROW(e) throws e when the
+/// compiler has exceptions enabled. Under -fno-exceptions it prints e.what()
+/// and aborts instead, since the error cannot be reported any other way.
+///
+/// None of the event loops depend on exceptions: the execution policies stop
+/// on the false return of tryNextEvent/tryNextEvents, so only genuine errors,
+/// such as a malformed snapshot, go through TSM_THROW.
+///
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND)
+#define TSM_EXCEPTIONS_ENABLED 1
+#define TSM_THROW(e) throw e
+#else
+#define TSM_EXCEPTIONS_ENABLED 0
+#define TSM_THROW(e) ::tsm::detail::fatal((e).what())
+#endif
+
+namespace tsm {
+namespace detail {
+
+[[noreturn]] inline void
+fatal(char const* what)
+{
+    std::fprintf(stderr, "tsm: %s\n", what);
+    std::abort();
+}
+
+} // namespace detail
+} // namespace tsm
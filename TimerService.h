@@ -0,0 +1,559 @@
+#pragma once
+
+#include "Event.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace tsm {
+
+///
+/// Identifies a scheduled timer. Tokens stay unique after their timer fired
+/// or was cancelled, so a stale token never cancels a newer timer. A default
+/// constructed token refers to no timer.
+///
+struct TimerToken
+{
+    std::uint32_t index = 0;
+    std::uint32_t generation = 0; ///< 0 for the empty token
+
+    explicit operator bool() const { return generation != 0; }
+};
+
+///
+/// A hashed timing wheel. Time is counted in ticks; a timer due at tick t
+/// lives in the doubly linked list of slot t % numSlots, so scheduling and
+/// cancelling are O(1). Nodes come from a free list and are addressed by
+/// index, so there is no allocation once the wheel has grown to the peak
+/// number of timers.
+///
+/// Timers can be put in a group, an intrusive list headed by a uint32_t the
+/// caller owns, to cancel them all at once (see cancelGroup).
+///
+/// A slot is only visited when its bit is set in an occupancy bitmap, so
+/// advancing over idle stretches is cheap. A timer more than numSlots ticks
+/// away is looked at once per revolution until it is due.
+///
+/// Not thread safe; see TimerService.
+///
+template<typename T>
+class TimingWheel
+{
+  public:
+    static constexpr std::uint32_t NoTimer =
+      std::numeric_limits<std::uint32_t>::max();
+
+    /// numSlots has to be a power of 2 and a multiple of 64.
+    explicit TimingWheel(std::size_t numSlots = 4096)
+      : mask_(numSlots - 1)
+      , current_(0)
+      , size_(0)
+      , free_(NoTimer)
+      , slots_(numSlots, NoTimer)
+      , occupied_(numSlots / 64, 0)
+    {}
+
+    TimingWheel(TimingWheel const&) = delete;
+    TimingWheel& operator=(TimingWheel const&) = delete;
+
+    ~TimingWheel()
+    {
+        for (Node& n : nodes_) {
+            if (n.pending) {
+                n.value().~T();
+            }
+        }
+    }
+
+    /// The current tick. Timers due at or before it have fired.
+    std::uint64_t now() const { return current_; }
+
+    std::size_t size() const { return size_; }
+
+    ///
+    /// Fire value at tick deadline, or at the next tick if deadline is not in
+    /// the future. If group is given, the timer is also linked into it.
+    ///
+    TimerToken schedule(T const& value,
+                        std::uint64_t deadline,
+                        std::uint32_t* group = nullptr)
+    {
+        if (deadline <= current_) {
+            deadline = current_ + 1;
+        }
+        std::uint32_t i = allocate();
+        Node& n = nodes_[i];
+        new (&n.storage) T(value);
+        n.deadline = deadline;
+        n.group = group;
+        n.slot = static_cast<std::uint32_t>(deadline & mask_);
+        linkSlot(i);
+        if (group) {
+            n.groupPrev = NoTimer;
+            n.groupNext = *group;
+            if (*group != NoTimer) {
+                nodes_[*group].groupPrev = i;
+            }
+            *group = i;
+        }
+        ++size_;
+        return TimerToken{ i, n.generation };
+    }
+
+    /// Cancel a pending timer. False if it already fired or was cancelled.
+    bool cancel(TimerToken token)
+    {
+        if (!find(token)) {
+            return false;
+        }
+        release(token.index);
+        return true;
+    }
+
+    /// The value of a pending timer, nullptr if it fired or was cancelled.
+    T* find(TimerToken token)
+    {
+        if (!token || token.index >= nodes_.size() ||
+            nodes_[token.index].generation != token.generation ||
+            !nodes_[token.index].pending) {
+            return nullptr;
+        }
+        return &nodes_[token.index].value();
+    }
+
+    /// Cancel every pending timer in group.
+    void cancelGroup(std::uint32_t& group)
+    {
+        while (group != NoTimer) {
+            release(group);
+        }
+    }
+
+    ///
+    /// Move time forward to tick now and call fire(value) for every timer
+    /// that is due. fire must not schedule or cancel timers on this wheel.
+    ///
+    template<typename Fire>
+    void advance(std::uint64_t now, Fire&& fire)
+    {
+        if (now <= current_) {
+            return;
+        }
+        std::uint64_t first = current_ + 1;
+        std::uint64_t ticks = now - current_;
+        current_ = now;
+        if (size_ == 0) {
+            return;
+        }
+        std::size_t numSlots = slots_.size();
+        std::size_t visits = ticks < numSlots ? ticks : numSlots;
+        for (std::size_t k = 0; k < visits && size_ > 0; ++k) {
+            std::size_t slot = (first + k) & mask_;
+            if (!(occupied_[slot / 64] & (std::uint64_t(1) << (slot % 64)))) {
+                continue;
+            }
+            std::uint32_t i = slots_[slot];
+            while (i != NoTimer) {
+                std::uint32_t next = nodes_[i].slotNext;
+                if (nodes_[i].deadline <= now) {
+                    T value = std::move(nodes_[i].value());
+                    release(i);
+                    fire(value);
+                }
+                i = next;
+            }
+        }
+    }
+
+    ///
+    /// The earliest tick at which a timer may be due, found from the occupied
+    /// slots. False if there are no timers.
+    ///
+    bool nextTick(std::uint64_t& tick) const
+    {
+        if (size_ == 0) {
+            return false;
+        }
+        std::size_t numSlots = slots_.size();
+        std::size_t start = (current_ + 1) & mask_;
+        for (std::size_t scanned = 0; scanned < numSlots + 64;) {
+            std::size_t slot = (start + scanned) & mask_;
+            std::uint64_t word = occupied_[slot / 64] >> (slot % 64);
+            if (word) {
+                std::size_t distance = scanned + lowestBit(word);
+                tick = current_ + 1 + distance;
+                return true;
+            }
+            scanned += 64 - slot % 64;
+        }
+        return false;
+    }
+
+  private:
+    // Nodes never move (see nodes_), so the value is constructed in place
+    // when a timer is scheduled and destroyed when it is released.
+    struct Node
+    {
+        T& value() { return *reinterpret_cast<T*>(&storage); }
+
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        std::uint64_t deadline;
+        std::uint32_t* group;
+        std::uint32_t slot;
+        std::uint32_t slotPrev;
+        std::uint32_t slotNext;
+        std::uint32_t groupPrev;
+        std::uint32_t groupNext;
+        std::uint32_t generation;
+        bool pending;
+    };
+
+    static std::size_t lowestBit(std::uint64_t word)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<std::size_t>(__builtin_ctzll(word));
+#else
+        std::size_t n = 0;
+        while (!(word & 1)) {
+            word >>= 1;
+            ++n;
+        }
+        return n;
+#endif
+    }
+
+    std::uint32_t allocate()
+    {
+        std::uint32_t i;
+        if (free_ != NoTimer) {
+            i = free_;
+            free_ = nodes_[i].slotNext;
+        } else {
+            i = static_cast<std::uint32_t>(nodes_.size());
+            nodes_.emplace_back();
+            nodes_[i].generation = 0;
+        }
+        Node& n = nodes_[i];
+        // Skip 0, the generation of the empty token
+        if (++n.generation == 0) {
+            n.generation = 1;
+        }
+        n.pending = true;
+        return i;
+    }
+
+    void linkSlot(std::uint32_t i)
+    {
+        Node& n = nodes_[i];
+        n.slotPrev = NoTimer;
+        n.slotNext = slots_[n.slot];
+        if (n.slotNext != NoTimer) {
+            nodes_[n.slotNext].slotPrev = i;
+        }
+        slots_[n.slot] = i;
+        occupied_[n.slot / 64] |= std::uint64_t(1) << (n.slot % 64);
+    }
+
+    // Unlink a pending node from its slot and group and put it on the free
+    // list.
+    void release(std::uint32_t i)
+    {
+        Node& n = nodes_[i];
+        if (n.slotPrev != NoTimer) {
+            nodes_[n.slotPrev].slotNext = n.slotNext;
+        } else {
+            slots_[n.slot] = n.slotNext;
+            if (n.slotNext == NoTimer) {
+                occupied_[n.slot / 64] &= ~(std::uint64_t(1) << (n.slot % 64));
+            }
+        }
+        if (n.slotNext != NoTimer) {
+            nodes_[n.slotNext].slotPrev = n.slotPrev;
+        }
+        if (n.group) {
+            if (n.groupPrev != NoTimer) {
+                nodes_[n.groupPrev].groupNext = n.groupNext;
+            } else {
+                *n.group = n.groupNext;
+            }
+            if (n.groupNext != NoTimer) {
+                nodes_[n.groupNext].groupPrev = n.groupPrev;
+            }
+            n.group = nullptr;
+        }
+        n.value().~T();
+        n.pending = false;
+        n.slotNext = free_;
+        free_ = i;
+        --size_;
+    }
+
+    std::uint64_t mask_;
+    std::uint64_t current_;
+    std::size_t size_;
+    std::uint32_t free_;
+    std::deque<Node> nodes_; // stable addresses as it grows
+    std::vector<std::uint32_t> slots_;
+    std::vector<std::uint64_t> occupied_;
+};
+
+template<typename T>
+constexpr std::uint32_t TimingWheel<T>::NoTimer;
+
+class TimerService;
+
+///
+/// Something a TimerService delivers events to. The execution policies that
+/// can take events from any thread derive from it, which gives them
+/// scheduleEvent and cancelEvent.
+///
+class TimedEventTarget
+{
+  public:
+    TimedEventTarget()
+      : timerService_(nullptr)
+      , timers_(std::numeric_limits<std::uint32_t>::max()) // no timers
+    {}
+
+    TimedEventTarget(TimedEventTarget const&) = delete;
+    TimedEventTarget& operator=(TimedEventTarget const&) = delete;
+
+    /// Timers run on TimerService::shared() unless this is called before
+    /// the first scheduleEvent.
+    void setTimerService(TimerService& service) { timerService_ = &service; }
+
+    ///
+    /// Send e to this machine after delay. Returns a token that cancels the
+    /// timer as long as it has not fired.
+    ///
+    template<typename Rep, typename Period>
+    TimerToken scheduleEvent(Event const& e,
+                             std::chrono::duration<Rep, Period> delay);
+
+    ///
+    /// False if the timer has already fired or was cancelled, or if token
+    /// was returned by another target's scheduleEvent.
+    ///
+    bool cancelEvent(TimerToken token);
+
+  protected:
+    virtual ~TimedEventTarget();
+
+    /// Called on the timer thread when a scheduled event is due.
+    virtual void onTimer(Event const& e) = 0;
+
+    ///
+    /// Cancel all pending timers of this target and wait for a delivery to
+    /// it that is in progress. Call this before the members onTimer uses go
+    /// away.
+    ///
+    void cancelTimers();
+
+  private:
+    friend class TimerService;
+
+    TimerService* timerService_;
+    std::uint32_t timers_; ///< Group of this target's timers, see TimingWheel
+};
+
+///
+/// Schedules events for any number of machines on one timing wheel and one
+/// thread. The thread sleeps until the earliest slot that holds a timer and
+/// sends the due events to their targets, waking the machines only when they
+/// have work.
+///
+/// Times are rounded up to whole ticks of the resolution given at
+/// construction, so an event is never delivered early.
+///
+class TimerService
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit TimerService(
+      Clock::duration resolution = std::chrono::milliseconds(1),
+      std::size_t numSlots = 4096)
+      : resolution_(resolution)
+      , epoch_(Clock::now())
+      , wheel_(numSlots)
+      , delivering_(nullptr)
+      , wakeTick_(std::numeric_limits<std::uint64_t>::max())
+      , stop_(false)
+    {
+        thread_ = std::thread(&TimerService::run, this);
+    }
+
+    TimerService(TimerService const&) = delete;
+    TimerService& operator=(TimerService const&) = delete;
+
+    ~TimerService()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cvWake_.notify_one();
+        thread_.join();
+    }
+
+    TimerToken schedule(TimedEventTarget& target,
+                        Event const& e,
+                        Clock::duration delay)
+    {
+        if (delay < Clock::duration::zero()) {
+            delay = Clock::duration::zero();
+        }
+        std::uint64_t ticks = static_cast<std::uint64_t>(
+          (delay.count() + resolution_.count() - 1) / resolution_.count());
+        std::lock_guard<std::mutex> lock(mutex_);
+        // nowTick() started up to a tick ago, so add one to never fire early
+        std::uint64_t deadline = nowTick() + ticks + 1;
+        TimerToken token =
+          wheel_.schedule(Entry{ &target, e }, deadline, &target.timers_);
+        if (deadline < wakeTick_) {
+            cvWake_.notify_one();
+        }
+        return token;
+    }
+
+    /// Cancel a timer of target. False if token is not a pending one of it.
+    bool cancel(TimedEventTarget& target, TimerToken token)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Entry* entry = wheel_.find(token);
+        return entry && entry->target == &target && wheel_.cancel(token);
+    }
+
+    /// Cancel all timers of target. See TimedEventTarget::cancelTimers.
+    void cancelAll(TimedEventTarget& target)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wheel_.cancelGroup(target.timers_);
+        for (Entry& entry : firing_) {
+            if (entry.target == &target) {
+                entry.target = nullptr;
+            }
+        }
+        if (std::this_thread::get_id() != thread_.get_id()) {
+            cvDelivered_.wait(
+              lock, [this, &target] { return delivering_ != &target; });
+        }
+    }
+
+    std::size_t pending() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return wheel_.size();
+    }
+
+    /// A process wide service with 1ms resolution. Created on first use.
+    static TimerService& shared()
+    {
+        static TimerService service;
+        return service;
+    }
+
+  private:
+    struct Entry
+    {
+        TimedEventTarget* target;
+        Event event;
+    };
+
+    std::uint64_t nowTick() const
+    {
+        return static_cast<std::uint64_t>((Clock::now() - epoch_) /
+                                          resolution_);
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stop_) {
+            wheel_.advance(nowTick(),
+                           [this](Entry& entry) { firing_.push_back(entry); });
+
+            // Deliver without holding the lock, so targets are free to
+            // schedule their next timer.
+            for (std::size_t i = 0; i < firing_.size(); ++i) {
+                TimedEventTarget* target = firing_[i].target;
+                if (!target) {
+                    continue; // cancelled while firing
+                }
+                delivering_ = target;
+                Event e = firing_[i].event;
+                lock.unlock();
+                target->onTimer(e);
+                lock.lock();
+                delivering_ = nullptr;
+                cvDelivered_.notify_all();
+            }
+            firing_.clear();
+
+            std::uint64_t tick;
+            if (wheel_.nextTick(tick)) {
+                wakeTick_ = tick;
+                cvWake_.wait_until(lock, epoch_ + tick * resolution_);
+            } else {
+                wakeTick_ = std::numeric_limits<std::uint64_t>::max();
+                cvWake_.wait(lock);
+            }
+        }
+    }
+
+    const Clock::duration resolution_;
+    const Clock::time_point epoch_;
+    TimingWheel<Entry> wheel_;
+    std::vector<Entry> firing_;
+    TimedEventTarget* delivering_;
+    std::uint64_t wakeTick_;
+    bool stop_;
+    mutable std::mutex mutex_;
+    std::condition_variable cvWake_;
+    std::condition_variable cvDelivered_;
+    std::thread thread_;
+};
+
+template<typename Rep, typename Period>
+TimerToken
+TimedEventTarget::scheduleEvent(Event const& e,
+                                std::chrono::duration<Rep, Period> delay)
+{
+    if (!timerService_) {
+        timerService_ = &TimerService::shared();
+    }
+    auto d = std::chrono::duration_cast<TimerService::Clock::duration>(delay);
+    if (d < delay) {
+        ++d; // Round up, never deliver early
+    }
+    return timerService_->schedule(*this, e, d);
+}
+
+inline bool TimedEventTarget::cancelEvent(TimerToken token)
+{
+    return timerService_ && timerService_->cancel(*this, token);
+}
+
+inline TimedEventTarget::~TimedEventTarget()
+{
+    cancelTimers();
+}
+
+inline void TimedEventTarget::cancelTimers()
+{
+    if (timerService_) {
+        timerService_->cancelAll(*this);
+    }
+}
+
+} // namespace tsm
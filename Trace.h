@@ -0,0 +1,78 @@
+#pragma once
+
+#include <iosfwd>
+
+///
+/// Logging and tracing hooks. Both compile to nothing unless asked for, so
+/// release builds carry no per-event logging cost and no glog dependency.
+///
+/// TSM_DLOG(severity) is the debug log used throughout tsm. It logs through
+/// glog's DLOG when the build defines TSM_HAVE_GLOG (CMake does when it finds
+/// glog), NDEBUG is not defined and TSM_DISABLE_LOGGING is not defined.
+/// Otherwise the statement is discarded by the compiler, arguments and all.
+///
+#if defined(TSM_HAVE_GLOG) && !defined(NDEBUG) && !defined(TSM_DISABLE_LOGGING)
+#define TSM_LOGGING_ENABLED 1
+#include <glog/logging.h>
+#define TSM_DLOG(severity) DLOG(severity)
+#else
+#define TSM_LOGGING_ENABLED 0
+#define TSM_DLOG(severity)                                                    \
+    while (false)                                                              \
+    ::tsm::NullLog()
+#endif
+
+///
+/// The tracer StateMachine uses when none is given. Define it before
+/// including tsm to trace every machine of a build, e.g.
+///
+/// #define TSM_DEFAULT_TRACER mylib::TransitionCounter
+///
+#ifndef TSM_DEFAULT_TRACER
+#define TSM_DEFAULT_TRACER ::tsm::NullTracer
+#endif
+
+namespace tsm {
+
+class Event;
+struct IHsmDef;
+struct State;
+
+/// Swallows everything streamed into a disabled TSM_DLOG.
+struct NullLog
+{
+    template<typename T>
+    NullLog& operator<<(T const&)
+    {
+        return *this;
+    }
+    NullLog& operator<<(std::ostream& (*)(std::ostream&)) { return *this; }
+};
+
+///
+/// A tracer receives the hooks StateMachine::execute calls for every event.
+/// Any type with these members can be passed as the Tracer parameter of
+/// StateMachine. It is an empty base of the machine, so NullTracer, whose
+/// members are empty and inline, costs neither space nor time.
+///
+struct NullTracer
+{
+    /// hsm took a transition from one of its states to another on e.
+    void onTransition(IHsmDef const& /* hsm */,
+                      State const& /* from */,
+                      Event const& /* e */,
+                      State const& /* to */)
+    {}
+
+    /// A guard, or an action or guard needing another payload, stopped a
+    /// transition out of state.
+    void onGuardRejected(IHsmDef const& /* hsm */,
+                         State const& /* state */,
+                         Event const& /* e */)
+    {}
+
+    /// e reached the top level HSM without being handled.
+    void onUnhandled(IHsmDef const& /* hsm */, Event const& /* e */) {}
+};
+
+} // namespace tsm
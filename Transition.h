@@ -1,5 +1,7 @@
 #pragma once
 
+#include "Callback.h"
+
 namespace tsm {
 
 template<typename State, typename Event, typename ActionFn, typename GuardFn>
@@ -21,16 +23,33 @@ struct TransitionT
 
     template<typename HSMType>
     void doTransition(HSMType* hsm)
+    {
+        doTransition(hsm, onEvent);
+    }
+
+    ///
+    /// Exit the current state, perform the action and enter the next state.
+    /// event is the event that triggered the transition; its payload is
+    /// passed on to an action that takes one.
+    ///
+    template<typename HSMType>
+    void doTransition(HSMType* hsm, Event const& event)
     {
         if (!hsm) {
             // throw NullPointerException;
         }
 
-        this->fromState.onExit(onEvent);
+        this->fromState.onExit(event);
         if (action) {
-            (hsm->*action)();
+            action(hsm, event);
         }
-        this->toState.onEntry(onEvent);
+        this->toState.onEntry(event);
+    }
+
+    /// False if the action or the guard needs a payload event does not carry.
+    bool accepts(Event const& event) const
+    {
+        return action.accepts(event) && guard.accepts(event);
     }
 
     State& fromState;
@@ -53,17 +72,21 @@ struct InternalTransitionT : public TransitionT<State, Event, ActionFn, GuardFn>
                                                      fromState,
                                                      action,
                                                      guard)
-      , action(action)
     {}
 
     template<typename HSMType>
     void doTransition(HSMType* hsm)
     {
-        if (action) {
-            (hsm->*action)();
+        doTransition(hsm, this->onEvent);
+    }
+
+    template<typename HSMType>
+    void doTransition(HSMType* hsm, Event const& event)
+    {
+        if (this->action) {
+            this->action(hsm, event);
         }
     }
-    ActionFn action;
 };
 
 } // namespace tsm
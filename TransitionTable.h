@@ -0,0 +1,228 @@
+#pragma once
+
+#include "Arena.h"
+#include "Event.h"
+#include "State.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace tsm {
+typedef std::pair<State&, Event> StateEventPair;
+
+///
+/// The default transition table. Transitions are keyed on the (State, Event)
+/// pair and stored in a std::unordered_map. It places no restriction on the
+/// states and events that can be added to it. The nodes come from the
+/// current Arena, if any.
+///
+template<typename Transition>
+using HashedTransitionMap = std::unordered_map<
+  StateEventPair,
+  Transition,
+  std::hash<StateEventPair>,
+  std::equal_to<StateEventPair>,
+  ArenaAllocator<std::pair<StateEventPair const, Transition>>>;
+
+template<typename Transition>
+struct HashedTransitionTable : private HashedTransitionMap<Transition>
+{
+    using TransitionTable = HashedTransitionMap<Transition>;
+    using TransitionTable::end;
+    using TransitionTable::find;
+    using TransitionTable::size;
+
+  public:
+    /// The table of the definition with the id space space.
+    explicit HashedTransitionTable(UniqueId::IdType /* space */) {}
+
+    void insert(State& fromState, Event const& onEvent, Transition const& t)
+    {
+        StateEventPair pair(fromState, onEvent);
+        TransitionTable::insert(std::make_pair(pair, t));
+    }
+
+    Transition* next(State& fromState, Event const& onEvent)
+    {
+        // Check if event in HSM
+        StateEventPair pair(fromState, onEvent);
+        auto it = find(pair);
+        if (it != end()) {
+            return &it->second;
+        }
+
+        TSM_DLOG(ERROR) << "No Transition:" << fromState.name
+                        << "\tonEvent:" << onEvent.id;
+        return nullptr;
+    }
+
+    /// Call f on every transition in the table.
+    template<typename F>
+    void forEach(F f) const
+    {
+        for (auto const& it : *this) {
+            f(it.second);
+        }
+    }
+
+    void print()
+    {
+        for (const auto& it : *this) {
+            TSM_DLOG(INFO) << it.first.first.name << "," << it.first.second.id
+                           << ":" << it.second.toState.name << "\n";
+        }
+    }
+};
+
+///
+/// A transition table that stores the transitions of a StateMachineDef in a
+/// flat (state x event) array indexed by the dense ids the definition assigns
+/// to its states and events (see UniqueId.h). A lookup is a bounds check and
+/// a single indexed load - no hashing, no Event copies and no chasing of
+/// bucket chains.
+///
+/// Transitions are staged as they are added and the flat array is
+/// (re)built, once, on the first lookup after the last add. Select it when
+/// defining the HSM:
+///
+/// struct MyHSMDef : StateMachineDef<MyHSMDef, DenseTransitionTable> { ... };
+///
+/// The array covers the id space of the definition the table belongs to.
+/// Transitions on states or events from any other space, e.g. global events
+/// or the states of another definition, do not fit it. They are kept aside
+/// and searched linearly.
+///
+/// As with the HashedTransitionTable, the first transition added for a
+/// (State, Event) pair wins. The staged transitions come from the current
+/// Arena. The flat array does not: it is built on whichever thread makes
+/// the first lookup, and the arena is not thread safe.
+///
+template<typename Transition>
+struct DenseTransitionTable
+{
+    /// The table of the definition with the id space space.
+    explicit DenseTransitionTable(UniqueId::IdType space)
+      : space_(space)
+      , numStates_(0)
+      , numEvents_(0)
+      , dirty_(false)
+    {}
+
+    // The slots point into transitions_, so copies have to re-index.
+    DenseTransitionTable(DenseTransitionTable const& other)
+      : space_(other.space_)
+      , numStates_(0)
+      , numEvents_(0)
+      , transitions_(other.transitions_)
+      , dirty_(true)
+    {}
+
+    DenseTransitionTable& operator=(DenseTransitionTable const&) = delete;
+
+    void insert(State&, Event const&, Transition const& t)
+    {
+        transitions_.push_back(t);
+        dirty_ = true;
+    }
+
+    Transition* next(State& fromState, Event const& onEvent)
+    {
+        if (dirty_) {
+            compile();
+        }
+        if (fromState.space == space_ && onEvent.space == space_ &&
+            fromState.id < numStates_ && onEvent.id < numEvents_) {
+            return slots_[fromState.id * numEvents_ + onEvent.id];
+        }
+        for (auto* t : overflow_) {
+            if (&t->fromState == &fromState && t->onEvent == onEvent) {
+                return t;
+            }
+        }
+        return nullptr;
+    }
+
+    size_t size() const { return transitions_.size(); }
+
+    /// The number of transitions kept off the array, see compile.
+    size_t numForeign()
+    {
+        if (dirty_) {
+            compile();
+        }
+        return overflow_.size();
+    }
+
+    ///
+    /// Build the flat lookup array from the staged transitions. Called
+    /// lazily from next(), but it can be invoked up front to keep the
+    /// allocation off the first event.
+    ///
+    void compile()
+    {
+        dirty_ = false;
+        slots_.clear();
+        overflow_.clear();
+        numStates_ = numEvents_ = 0;
+        if (transitions_.empty()) {
+            return;
+        }
+
+        for (auto const& t : transitions_) {
+            if (isDense(t)) {
+                numStates_ = std::max(numStates_, t.fromState.id + 1);
+                numEvents_ = std::max(numEvents_, t.onEvent.id + 1);
+            }
+        }
+        slots_.assign(size_t(numStates_) * numEvents_, nullptr);
+
+        for (auto& t : transitions_) {
+            if (!isDense(t)) {
+                overflow_.push_back(&t);
+                continue;
+            }
+            auto& slot = slots_[t.fromState.id * numEvents_ + t.onEvent.id];
+            if (!slot) {
+                slot = &t;
+            }
+        }
+    }
+
+    /// Call f on every transition, in the order they were added.
+    template<typename F>
+    void forEach(F f) const
+    {
+        for (auto const& t : transitions_) {
+            f(t);
+        }
+    }
+
+    void print()
+    {
+        for (const auto& t : transitions_) {
+            TSM_DLOG(INFO) << t.fromState.name << "," << t.onEvent.id << ":"
+                           << t.toState.name << "\n";
+        }
+    }
+
+  private:
+    bool isDense(Transition const& t) const
+    {
+        return t.fromState.space == space_ && t.onEvent.space == space_;
+    }
+
+    UniqueId::IdType space_;
+    UniqueId::IdType numStates_;
+    UniqueId::IdType numEvents_;
+    std::vector<Transition, ArenaAllocator<Transition>> transitions_;
+    // Built lazily, possibly on another thread than the one adding, so off
+    // the arena
+    std::vector<Transition*> slots_;
+    std::vector<Transition*> overflow_;
+    bool dirty_;
+};
+} // namespace tsm
@@ -2,4 +2,8 @@
 
 using tsm::UniqueId;
 
-std::uint64_t UniqueId::id_{ 0 };
+std::atomic<UniqueId::IdType> UniqueId::globalStateId_{ 0 };
+std::atomic<UniqueId::IdType> UniqueId::globalEventId_{ 0 };
+std::atomic<UniqueId::IdType> UniqueId::nextSpaceTag_{ 1 };
+thread_local std::shared_ptr<UniqueId::Stack> UniqueId::thread_;
+constexpr UniqueId::IdType UniqueId::GlobalSpace;
@@ -1,19 +1,155 @@
 #pragma once
+#include <atomic>
 #include <cstdint>
+#include <memory>
 #include <mutex>
 
 namespace tsm {
 
+///
+/// Hands out the ids for States and Events. Every StateMachineDef owns an id
+/// space: the states and events constructed as part of a definition are
+/// numbered 0..N-1 within that space (states and events are counted
+/// separately), so the ids can index arrays directly. Each HSMDef type gets
+/// its own space tag, which means that every instance of a definition assigns
+/// the same ids to its states and events.
+///
+/// States and events constructed outside of any definition are numbered from
+/// a process-wide counter in the global space (tag 0).
+///
+/// The active space is tracked per thread, so definitions can be constructed
+/// on many threads in parallel without contention. A space can be left on
+/// any thread, e.g. by a definition destroyed on another thread than the
+/// one that constructed it: each thread's stack of spaces has a mutex of
+/// its own, which only that thread and such a leave take.
+///
 struct UniqueId
 {
-    static uint64_t getId() { return ++id_; }
+    using IdType = std::uint32_t;
+
+    static constexpr IdType GlobalSpace = 0;
+
+    struct Id
+    {
+        IdType space;
+        IdType id;
+    };
+
+    struct Space;
+
+    /// The spaces entered on one thread, innermost first.
+    struct Stack
+    {
+        Stack()
+          : current(nullptr)
+        {}
+
+        std::mutex mutex;
+        Space* current;
+    };
+
+    ///
+    /// The id space of a single definition. enter() makes it the active
+    /// space on this thread, leave() takes it off the stack of spaces of the
+    /// thread that entered it again, wherever it is on it.
+    ///
+    struct Space
+    {
+        explicit Space(IdType tag)
+          : tag(tag)
+          , nextStateId(0)
+          , nextEventId(0)
+          , enclosing(nullptr)
+        {}
+
+        IdType tag;
+        IdType nextStateId;
+        IdType nextEventId;
+        Space* enclosing;
+        /// The stack the space is on, nullptr unless entered.
+        std::shared_ptr<Stack> stack;
+    };
+
+    static Id getStateId()
+    {
+        Stack& stack = thisThread();
+        std::lock_guard<std::mutex> lock(stack.mutex);
+        if (stack.current) {
+            return Id{ stack.current->tag, stack.current->nextStateId++ };
+        }
+        return Id{ GlobalSpace, globalStateId_.fetch_add(1) };
+    }
+
+    static Id getEventId()
+    {
+        Stack& stack = thisThread();
+        std::lock_guard<std::mutex> lock(stack.mutex);
+        if (stack.current) {
+            return Id{ stack.current->tag, stack.current->nextEventId++ };
+        }
+        return Id{ GlobalSpace, globalEventId_.fetch_add(1) };
+    }
+
+    /// The space tag shared by every instance of the definition type T.
+    template<typename T>
+    static IdType spaceTag()
+    {
+        static const IdType tag = nextSpaceTag_.fetch_add(1);
+        return tag;
+    }
+
+    static void enter(Space& space)
+    {
+        Stack& stack = thisThread();
+        std::lock_guard<std::mutex> lock(stack.mutex);
+        space.enclosing = stack.current;
+        space.stack = thread_;
+        stack.current = &space;
+    }
+
+    ///
+    /// Leave space, on whichever thread entered it. Spaces can be left in
+    /// any order and more than once; only the first call does anything.
+    ///
+    static void leave(Space& space)
+    {
+        if (!space.stack) {
+            return;
+        }
+        std::shared_ptr<Stack> stack = std::move(space.stack);
+        space.stack = nullptr;
+        std::lock_guard<std::mutex> lock(stack->mutex);
+        for (Space** link = &stack->current; *link;
+             link = &(*link)->enclosing) {
+            if (*link == &space) {
+                *link = space.enclosing;
+                break;
+            }
+        }
+    }
+
+    /// Reset the counters of the global space.
     static void reset()
     {
-        id_ = 1; // dummy_event gets id=0 assigned to it
+        globalStateId_ = 0;
+        globalEventId_ = 1; // dummy_event gets id=0 assigned to it
     }
 
   private:
-    static std::uint64_t id_;
+    static std::atomic<IdType> globalStateId_;
+    static std::atomic<IdType> globalEventId_;
+    static std::atomic<IdType> nextSpaceTag_;
+    // The stack of this thread, kept alive by the spaces on it when the
+    // thread ends first
+    static thread_local std::shared_ptr<Stack> thread_;
+
+    static Stack& thisThread()
+    {
+        if (!thread_) {
+            thread_ = std::make_shared<Stack>();
+        }
+        return *thread_;
+    }
 };
 
 } // namespace tsm
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <thread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace tsm {
+
+///
+/// How the thread of an AsyncExecutionPolicy waits for its next event.
+///
+/// Park blocks on the queue's condition variable straight away. It costs no
+/// CPU while the machine is idle, but every event sent to an idle machine
+/// pays for a futex wake and a context switch.
+///
+/// The other strategies poll the queue first. Spin polls until an event
+/// arrives and never sleeps, trading a whole core for the shortest handoff.
+/// SpinYield polls for the spin budget and then keeps polling with a
+/// std::this_thread::yield between polls. SpinPark polls for the spin budget
+/// and then parks like Park.
+///
+/// Polling is cheapest on the LockFreeEventQueue, which only reads its head
+/// cell; the mutex based queues try their lock on every poll.
+///
+enum class WaitStrategy
+{
+    Park,
+    Spin,
+    SpinYield,
+    SpinPark
+};
+
+namespace detail {
+
+// Tell the CPU this is a spin loop, to save power and let a sibling
+// hyperthread run.
+inline void
+cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// Pin t to cpu. Returns false if that is not possible, always on other
+// platforms than Linux.
+inline bool
+pinThread(std::thread& t, int cpu)
+{
+#if defined(__linux__)
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return false;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    return pthread_setaffinity_np(t.native_handle(), sizeof(cpus), &cpus) ==
+           0;
+#else
+    (void)t;
+    (void)cpu;
+    return false;
+#endif
+}
+
+} // namespace detail
+} // namespace tsm
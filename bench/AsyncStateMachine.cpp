@@ -0,0 +1,103 @@
+#include "GarageDoorSM.h"
+#include "Observer.h"
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+
+using tsm::AsyncExecWithObserver;
+using tsm::BlockingObserver;
+using tsm::EventQueueT;
+using tsm::LockFreeEventQueue;
+using tsm::StateMachine;
+using tsm::WaitStrategy;
+
+using tsmtest::GarageDoorDef;
+
+///
+/// The latency of an AsyncStateMachine from sendEvent to the observer being
+/// notified that the event was processed, one event in flight at a time.
+///
+template<typename EventQueueType>
+static void
+BM_AsyncSendToNotify(benchmark::State& state)
+{
+    AsyncExecWithObserver<StateMachine<GarageDoorDef>,
+                          BlockingObserver,
+                          EventQueueType>
+      sm;
+    sm.startSM();
+    sm.wait();
+
+    Event const* trip[] = { &sm.click_event,
+                            &sm.topSensor_event,
+                            &sm.click_event,
+                            &sm.bottomSensor_event };
+    std::size_t i = 0;
+    for (auto _ : state) {
+        sm.sendEvent(*trip[i++ & 3]);
+        sm.wait();
+    }
+    state.SetItemsProcessed(state.iterations());
+    sm.stopSM();
+}
+
+BENCHMARK_TEMPLATE(BM_AsyncSendToNotify, EventQueueT<Event, std::mutex>)
+  ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_AsyncSendToNotify, LockFreeEventQueue<Event>)
+  ->UseRealTime();
+
+///
+/// Counts the events processed, for a sender that spins rather than blocks
+/// until its event is done.
+///
+struct SpinningObserver
+{
+    SpinningObserver()
+      : notified(0)
+    {}
+
+    void notify() { notified.fetch_add(1, std::memory_order_release); }
+
+    void wait(std::size_t n)
+    {
+        while (notified.load(std::memory_order_acquire) < n) {
+            tsm::detail::cpuRelax();
+        }
+    }
+
+    std::atomic<std::size_t> notified;
+};
+
+///
+/// The handoff from sendEvent to an async machine on the lock-free queue,
+/// with its thread parked (range 0 = 0), spinning (1), spinning then
+/// yielding (2) or spinning then parking (3) between events. The spinning
+/// strategies only pay off with a core each for the sender and the machine.
+///
+static void
+BM_AsyncWaitStrategy(benchmark::State& state)
+{
+    AsyncExecWithObserver<StateMachine<GarageDoorDef>,
+                          SpinningObserver,
+                          LockFreeEventQueue<Event>>
+      sm;
+    sm.setWaitStrategy(static_cast<WaitStrategy>(state.range(0)));
+    sm.startSM();
+    std::size_t n = 1;
+    sm.wait(n);
+
+    Event const* trip[] = { &sm.click_event,
+                            &sm.topSensor_event,
+                            &sm.click_event,
+                            &sm.bottomSensor_event };
+    std::size_t i = 0;
+    for (auto _ : state) {
+        sm.sendEvent(*trip[i++ & 3]);
+        sm.wait(++n);
+    }
+    state.SetItemsProcessed(state.iterations());
+    sm.stopSM();
+}
+
+BENCHMARK(BM_AsyncWaitStrategy)->DenseRange(0, 3)->UseRealTime();
@@ -0,0 +1,150 @@
+#include "Event.h"
+#include "EventBus.h"
+#include "EventQueue.h"
+#include "LockFreeEventQueue.h"
+#include "PriorityEventQueue.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using tsm::Event;
+using tsm::EventBus;
+using tsm::EventQueue;
+using tsm::LockFreeEventQueue;
+using tsm::PriorityEventQueue;
+
+namespace {
+const int NEVENTS = 1 << 16;
+}
+
+///
+/// N producer threads feed NEVENTS events, in total, to a single consumer -
+/// the event loop of an AsyncStateMachine. The consumer runs on the
+/// benchmark thread. range(0) is the number of producers.
+///
+template<typename Queue>
+static void
+BM_EventQueueProducers(benchmark::State& state)
+{
+    const int nProducers = static_cast<int>(state.range(0));
+    const int eventsPerProducer = NEVENTS / nProducers;
+    const int nEvents = eventsPerProducer * nProducers;
+    Event e;
+
+    for (auto _ : state) {
+        auto queue = std::make_unique<Queue>();
+        std::vector<std::thread> producers;
+        for (int p = 0; p < nProducers; ++p) {
+            producers.emplace_back([&queue, &e, eventsPerProducer] {
+                for (int i = 0; i < eventsPerProducer; ++i) {
+                    queue->addEvent(e);
+                }
+            });
+        }
+        for (int i = 0; i < nEvents; ++i) {
+            benchmark::DoNotOptimize(queue->nextEvent());
+        }
+        for (auto& t : producers) {
+            t.join();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * nEvents);
+}
+
+BENCHMARK_TEMPLATE(BM_EventQueueProducers, EventQueue<Event>)
+  ->Arg(1)
+  ->Arg(4)
+  ->Arg(16)
+  ->Arg(64)
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_EventQueueProducers, LockFreeEventQueue<Event>)
+  ->Arg(1)
+  ->Arg(4)
+  ->Arg(16)
+  ->Arg(64)
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_EventQueueProducers, PriorityEventQueue<Event>)
+  ->Arg(1)
+  ->Arg(4)
+  ->Arg(16)
+  ->Arg(64)
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
+
+///
+/// Broadcast a batch of range(1) events to range(0) subscriber queues, one
+/// addEvent per queue and event, or through an EventBus, which takes each
+/// queue's lock once per batch.
+///
+struct QueueSubscriber
+{
+    template<typename InputIt>
+    void sendEvents(InputIt first, InputIt last)
+    {
+        queue.addEvents(first, last);
+    }
+
+    void drain()
+    {
+        std::vector<Event> sink;
+        queue.pollEvents(std::back_inserter(sink), SIZE_MAX);
+    }
+
+    EventQueue<Event> queue;
+};
+
+static void
+BM_BroadcastPerQueue(benchmark::State& state)
+{
+    std::vector<QueueSubscriber> subscribers(state.range(0));
+    std::vector<Event> batch(state.range(1));
+    for (auto _ : state) {
+        for (Event const& e : batch) {
+            for (auto& s : subscribers) {
+                s.queue.addEvent(e);
+            }
+        }
+        state.PauseTiming();
+        for (auto& s : subscribers) {
+            s.drain();
+        }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * batch.size() *
+                            subscribers.size());
+}
+
+static void
+BM_BroadcastThroughBus(benchmark::State& state)
+{
+    std::vector<QueueSubscriber> subscribers(state.range(0));
+    std::vector<Event> batch(state.range(1));
+    EventBus bus;
+    for (Event const& e : batch) {
+        for (auto& s : subscribers) {
+            bus.subscribe(e, s);
+        }
+    }
+    for (auto _ : state) {
+        bus.publish(batch.begin(), batch.end());
+        state.PauseTiming();
+        for (auto& s : subscribers) {
+            s.drain();
+        }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * batch.size() *
+                            subscribers.size());
+}
+
+BENCHMARK(BM_BroadcastPerQueue)->Args({ 100, 16 });
+BENCHMARK(BM_BroadcastThroughBus)->Args({ 100, 16 });
@@ -0,0 +1,60 @@
+#include "GarageDoorSM.h"
+#include "TestMachines.h"
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <vector>
+
+using tsm::Fleet;
+using tsm::FleetEvent;
+using tsm::SharedDefinition;
+
+using tsmtest::AHsmDef;
+using tsmtest::GarageDoorDef;
+
+///
+/// A batch of random (instance, event) pairs applied to a fleet of range(0)
+/// machines, one event per instance on average.
+///
+template<typename HSMDef>
+static void
+BM_FleetApply(benchmark::State& state)
+{
+    SharedDefinition<HSMDef> def;
+    std::size_t size = static_cast<std::size_t>(state.range(0));
+    Fleet<HSMDef> fleet(def, size);
+
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<std::uint32_t> instance(0, size - 1);
+    std::uniform_int_distribution<std::uint32_t> event(
+      0, def.events().size() - 1);
+    std::vector<FleetEvent> batch(size);
+    for (auto& fe : batch) {
+        fe = FleetEvent{ instance(rng), event(rng) };
+    }
+
+    for (auto _ : state) {
+        fleet.apply(batch.data(), batch.size());
+    }
+    state.SetItemsProcessed(state.iterations() * batch.size());
+}
+
+BENCHMARK_TEMPLATE(BM_FleetApply, GarageDoorDef)->Arg(1 << 10)->Arg(1 << 20);
+BENCHMARK_TEMPLATE(BM_FleetApply, AHsmDef)->Arg(1 << 10)->Arg(1 << 20);
+
+/// One event to every machine of a flat fleet.
+static void
+BM_FleetBroadcast(benchmark::State& state)
+{
+    SharedDefinition<GarageDoorDef> def;
+    Fleet<GarageDoorDef> fleet(def, static_cast<std::size_t>(state.range(0)));
+    auto click = fleet.eventIndex(def.prototype().click_event);
+
+    for (auto _ : state) {
+        fleet.broadcast(click);
+    }
+    state.SetItemsProcessed(state.iterations() * fleet.size());
+}
+
+BENCHMARK(BM_FleetBroadcast)->Arg(1 << 10)->Arg(1 << 20);
@@ -0,0 +1,440 @@
+#include "CdPlayerHSM.h"
+#include "GarageDoorSM.h"
+#include "TestMachines.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using tsm::Arena;
+using tsm::DefinitionBindings;
+using tsm::DefinitionNames;
+using tsm::DenseTransitionTable;
+using tsm::HashedTransitionTable;
+using tsm::IHsmDef;
+using tsm::InlineExecutionPolicy;
+using tsm::MachineFleet;
+using tsm::MappedDefinition;
+using tsm::MappedStateMachine;
+using tsm::MetricsTracer;
+using tsm::NullTracer;
+using tsm::OrthogonalStateMachine;
+using tsm::ParentThreadExecutionPolicy;
+using tsm::State;
+using tsm::StateMachine;
+using tsm::StateMachineDef;
+using tsm::TraceBuffer;
+using tsm::TraceRecorder;
+
+using tsmtest::AHsmDef;
+using tsmtest::CdPlayerController;
+using tsmtest::CdPlayerDef;
+using tsmtest::ErrorHSM;
+using tsmtest::GarageDoorDef;
+using tsmtest::GarageDoorDefT;
+
+namespace {
+
+///
+/// Execute the events of cycle, over and over, on the most active state of
+/// sm, the way the execution policies do. The cycle leaves sm in the state it
+/// started in.
+///
+template<typename SM>
+void
+executeCycle(benchmark::State& state, SM& sm, std::vector<Event> const& cycle)
+{
+    std::size_t i = 0;
+    for (auto _ : state) {
+        sm.dispatch(&sm)->execute(cycle[i]);
+        if (++i == cycle.size()) {
+            i = 0;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+///
+/// A large flat definition: every state has a transition on every event,
+/// to a state further on.
+///
+struct GridDef : public StateMachineDef<GridDef, DenseTransitionTable>
+{
+    static constexpr int NumStates = 400;
+    static constexpr int NumEvents = 10;
+
+    GridDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<GridDef, DenseTransitionTable>("Grid", parent)
+    {
+        states.reserve(NumStates);
+        for (int i = 0; i < NumStates; ++i) {
+            states.emplace_back("State " + std::to_string(i));
+        }
+        events.resize(NumEvents);
+        for (int i = 0; i < NumStates; ++i) {
+            for (int j = 0; j < NumEvents; ++j) {
+                add(states[i], events[j], states[(i + j + 1) % NumStates]);
+            }
+        }
+    }
+
+    State* getStartState() override { return &states[0]; }
+    State* getStopState() override { return nullptr; }
+
+    std::vector<State> states;
+    std::vector<Event> events;
+};
+
+} // namespace
+
+/// A flat machine: one trip of the garage door.
+template<template<typename> class TransitionTableT>
+static void
+BM_ExecuteGarageDoor(benchmark::State& state)
+{
+    StateMachine<GarageDoorDefT<TransitionTableT>> sm;
+    sm.startSM();
+    executeCycle(state,
+                 sm,
+                 { sm.click_event,
+                   sm.topSensor_event,
+                   sm.click_event,
+                   sm.bottomSensor_event });
+    sm.stopSM();
+}
+
+BENCHMARK_TEMPLATE(BM_ExecuteGarageDoor, HashedTransitionTable);
+BENCHMARK_TEMPLATE(BM_ExecuteGarageDoor, DenseTransitionTable);
+
+///
+/// A machine with a sub HSM: play, skip a song inside the Playing HSM, pause
+/// and resume, then stop.
+///
+static void
+BM_ExecuteCdPlayer(benchmark::State& state)
+{
+    StateMachine<CdPlayerDef<CdPlayerController>> sm;
+    sm.startSM();
+    sm.execute(sm.cd_detected);
+    executeCycle(state,
+                 sm,
+                 { sm.play,
+                   sm.Playing.next_song,
+                   sm.pause,
+                   sm.end_pause,
+                   sm.stop_event });
+    sm.stopSM();
+}
+
+BENCHMARK(BM_ExecuteCdPlayer);
+
+/// In and out of the nested BHsmDef, handling an event inside it.
+static void
+BM_ExecuteNestedHsm(benchmark::State& state)
+{
+    StateMachine<AHsmDef> sm;
+    sm.startSM();
+    executeCycle(
+      state, sm, { sm.e1, sm.e2_in, sm.bHsmDef.e1, sm.e2_out, sm.e3 });
+    sm.stopSM();
+}
+
+BENCHMARK(BM_ExecuteNestedHsm);
+
+///
+/// Pause from a song and resume it: pause goes up from the song to the CD
+/// Player, through the Playing HSM, or straight there once compiled (Arg 1).
+///
+static void
+BM_BubbleToParent(benchmark::State& state)
+{
+    StateMachine<CdPlayerDef<CdPlayerController>> sm;
+    if (state.range(0)) {
+        tsm::compile(sm);
+    }
+    sm.startSM();
+    sm.execute(sm.cd_detected);
+    sm.execute(sm.play);
+    executeCycle(state, sm, { sm.pause, sm.end_pause });
+    sm.stopSM();
+}
+
+BENCHMARK(BM_BubbleToParent)->Arg(0)->Arg(1);
+
+///
+/// Routing in an OrthogonalStateMachine. The garage door trip is handled by
+/// one region, however many regions there are; the error events are handled
+/// by all of them.
+///
+template<typename Orthogonal>
+static void
+BM_OrthogonalRouteToOne(benchmark::State& state)
+{
+    Orthogonal sm("Orthogonal");
+    auto& door = sm.template getRegion<0>();
+    sm.startSM();
+    executeCycle(state,
+                 sm,
+                 { door.click_event,
+                   door.topSensor_event,
+                   door.click_event,
+                   door.bottomSensor_event });
+    sm.stopSM();
+}
+
+BENCHMARK_TEMPLATE(BM_OrthogonalRouteToOne,
+                   OrthogonalStateMachine<GarageDoorDef>);
+BENCHMARK_TEMPLATE(BM_OrthogonalRouteToOne,
+                   OrthogonalStateMachine<GarageDoorDef,
+                                          ErrorHSM,
+                                          ErrorHSM,
+                                          ErrorHSM>);
+
+static void
+BM_OrthogonalRouteToAll(benchmark::State& state)
+{
+    OrthogonalStateMachine<ErrorHSM, ErrorHSM, ErrorHSM, ErrorHSM> sm(
+      "Orthogonal");
+    auto& errors = sm.getRegion<0>();
+    sm.startSM();
+    executeCycle(state, sm, { errors.error, errors.recover });
+    sm.stopSM();
+}
+
+BENCHMARK(BM_OrthogonalRouteToAll);
+
+///
+/// sendEvent and step through a ParentThreadExecutionPolicy, with and without
+/// metrics, to keep an eye on what the metrics cost.
+///
+template<typename Tracer>
+static void
+BM_SendAndStep(benchmark::State& state)
+{
+    ParentThreadExecutionPolicy<StateMachine<GarageDoorDef, Tracer>> sm;
+    sm.startSM();
+    Event const* trip[] = { &sm.click_event,
+                            &sm.topSensor_event,
+                            &sm.click_event,
+                            &sm.bottomSensor_event };
+    std::size_t i = 0;
+    for (auto _ : state) {
+        sm.sendEvent(*trip[i++ & 3]);
+        sm.step();
+    }
+    state.SetItemsProcessed(state.iterations());
+    sm.stopSM();
+}
+
+BENCHMARK_TEMPLATE(BM_SendAndStep, NullTracer);
+BENCHMARK_TEMPLATE(BM_SendAndStep, MetricsTracer);
+
+///
+/// The same trip through processEventNow of the parent thread policy and
+/// through the inline policy: no queue in between.
+///
+template<template<typename> class Policy, typename Tracer>
+static void
+BM_ProcessEventNow(benchmark::State& state)
+{
+    Policy<StateMachine<GarageDoorDef, Tracer>> sm;
+    sm.startSM();
+    Event const* trip[] = { &sm.click_event,
+                            &sm.topSensor_event,
+                            &sm.click_event,
+                            &sm.bottomSensor_event };
+    std::size_t i = 0;
+    for (auto _ : state) {
+        sm.processEventNow(*trip[i++ & 3]);
+    }
+    state.SetItemsProcessed(state.iterations());
+    sm.stopSM();
+}
+
+template<typename StateType>
+using ParentThread = ParentThreadExecutionPolicy<StateType>;
+
+BENCHMARK_TEMPLATE(BM_ProcessEventNow, ParentThread, NullTracer);
+BENCHMARK_TEMPLATE(BM_ProcessEventNow, InlineExecutionPolicy, NullTracer);
+BENCHMARK_TEMPLATE(BM_ProcessEventNow, InlineExecutionPolicy, MetricsTracer);
+
+/// The inline trip again, every transition recorded into a TraceBuffer.
+static void
+BM_ProcessEventNowTraced(benchmark::State& state)
+{
+    InlineExecutionPolicy<StateMachine<GarageDoorDef, TraceRecorder>> sm;
+    TraceBuffer trace;
+    sm.getTracer().attach(trace);
+    sm.startSM();
+    Event const* trip[] = { &sm.click_event,
+                            &sm.topSensor_event,
+                            &sm.click_event,
+                            &sm.bottomSensor_event };
+    std::size_t i = 0;
+    for (auto _ : state) {
+        sm.processEventNow(*trip[i++ & 3]);
+    }
+    state.SetItemsProcessed(state.iterations());
+    sm.stopSM();
+}
+
+BENCHMARK(BM_ProcessEventNowTraced);
+
+#if TSM_HAS_COROUTINES
+namespace {
+
+// Suspends the coroutine action until resumed by hand
+struct ManualIo
+{
+    bool await_ready() const { return false; }
+    void await_suspend(std::coroutine_handle<> h) { waiter = h; }
+    void await_resume() const {}
+
+    std::coroutine_handle<> waiter;
+};
+
+struct FetchDef : public StateMachineDef<FetchDef>
+{
+    FetchDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<FetchDef>("Fetch", parent)
+      , idle("Idle")
+      , ready("Ready")
+    {
+        addAsync(idle, fetch, ready, &FetchDef::download);
+        add(ready, reset, idle);
+    }
+
+    State* getStartState() override { return &idle; }
+    State* getStopState() override { return nullptr; }
+
+    tsm::AsyncAction download() { co_await io; }
+
+    State idle;
+    State ready;
+
+    Event fetch;
+    Event reset;
+
+    ManualIo io;
+};
+
+} // namespace
+
+/// A coroutine action suspending once, its completion and a plain transition
+/// back.
+static void
+BM_AsyncActionRoundTrip(benchmark::State& state)
+{
+    InlineExecutionPolicy<StateMachine<FetchDef>> sm;
+    sm.startSM();
+    for (auto _ : state) {
+        sm.processEventNow(sm.fetch);
+        sm.io.waiter.resume();
+        sm.processEventNow(sm.reset);
+    }
+    state.SetItemsProcessed(state.iterations());
+    sm.stopSM();
+}
+
+BENCHMARK(BM_AsyncActionRoundTrip);
+#endif
+
+///
+/// Build and destroy range(0) CdPlayers, on the heap or in one Arena, to
+/// see what construction costs.
+///
+static void
+BM_ConstructCdPlayers(benchmark::State& state)
+{
+    using CdPlayer = StateMachine<CdPlayerDef<CdPlayerController>>;
+    std::vector<std::unique_ptr<CdPlayer>> players(state.range(0));
+    for (auto _ : state) {
+        for (auto& sm : players) {
+            sm.reset(new CdPlayer);
+        }
+        for (auto& sm : players) {
+            sm.reset();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * players.size());
+}
+
+BENCHMARK(BM_ConstructCdPlayers)->Arg(1000);
+
+static void
+BM_ConstructCdPlayersInArena(benchmark::State& state)
+{
+    using CdPlayer = StateMachine<CdPlayerDef<CdPlayerController>>;
+    Arena arena;
+    for (auto _ : state) {
+        for (int64_t i = 0; i < state.range(0); ++i) {
+            benchmark::DoNotOptimize(arena.create<CdPlayer>());
+        }
+        arena.reset();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_ConstructCdPlayersInArena)->Arg(1000);
+
+/// Build and start range(0) CdPlayers in range(1) partitions of a
+/// MachineFleet, the way a cold start does.
+static void
+BM_StartMachineFleet(benchmark::State& state)
+{
+    using CdPlayer = ParentThreadExecutionPolicy<
+      StateMachine<CdPlayerDef<CdPlayerController>>>;
+    for (auto _ : state) {
+        MachineFleet<CdPlayer> fleet(state.range(0), state.range(1));
+        fleet.startAll();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_StartMachineFleet)
+  ->Args({ 10000, 1 })
+  ->Args({ 10000, 4 })
+  ->UseRealTime();
+
+/// Startup of a 4000 transition definition, built with add calls.
+static void
+BM_BuildLargeDefinition(benchmark::State& state)
+{
+    for (auto _ : state) {
+        StateMachine<GridDef> sm;
+        sm.startSM();
+        benchmark::DoNotOptimize(sm.getCurrentState());
+    }
+}
+
+BENCHMARK(BM_BuildLargeDefinition);
+
+/// The same definition mapped from its exported image.
+static void
+BM_MapLargeDefinition(benchmark::State& state)
+{
+    std::string path = "tsm_bench_grid.tsmd";
+    {
+        StateMachine<GridDef> sm;
+        std::vector<char> image = tsm::exportDefinition(sm, DefinitionNames());
+        std::ofstream(path, std::ios::binary)
+          .write(image.data(), static_cast<std::streamsize>(image.size()));
+    }
+    struct NoContext
+    {
+    } none;
+    DefinitionBindings<NoContext> bindings;
+    for (auto _ : state) {
+        MappedDefinition def(path);
+        MappedStateMachine<NoContext> sm(def, bindings, none);
+        sm.startSM();
+        benchmark::DoNotOptimize(sm.getCurrentState());
+    }
+    std::remove(path.c_str());
+}
+
+BENCHMARK(BM_MapLargeDefinition);
@@ -0,0 +1,56 @@
+#include "GarageDoorSM.h"
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <utility>
+
+using tsm::DenseTransitionTable;
+using tsm::HashedTransitionTable;
+using tsm::State;
+
+using tsmtest::GarageDoorDefT;
+
+///
+/// StateTransitionTable::next on the garage door's table (through
+/// StateMachineDef::next, which forwards to it), cycling through the (state,
+/// event) pairs of one trip of the door.
+///
+template<template<typename> class TransitionTableT>
+static void
+BM_TransitionTableNext(benchmark::State& state)
+{
+    GarageDoorDefT<TransitionTableT> door;
+    std::array<std::pair<State*, Event const*>, 4> trip = {
+        { { &door.doorClosed, &door.click_event },
+          { &door.doorOpening, &door.topSensor_event },
+          { &door.doorOpen, &door.click_event },
+          { &door.doorClosing, &door.bottomSensor_event } }
+    };
+
+    std::size_t i = 0;
+    for (auto _ : state) {
+        auto& step = trip[i++ & 3];
+        benchmark::DoNotOptimize(door.next(*step.first, *step.second));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(BM_TransitionTableNext, HashedTransitionTable);
+BENCHMARK_TEMPLATE(BM_TransitionTableNext, DenseTransitionTable);
+
+/// A lookup that finds no transition, e.g. an event bubbling up to a parent.
+template<template<typename> class TransitionTableT>
+static void
+BM_TransitionTableMiss(benchmark::State& state)
+{
+    GarageDoorDefT<TransitionTableT> door;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+          door.next(door.doorOpen, door.obstruct_event));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(BM_TransitionTableMiss, HashedTransitionTable);
+BENCHMARK_TEMPLATE(BM_TransitionTableMiss, DenseTransitionTable);
@@ -0,0 +1,23 @@
+#include <benchmark/benchmark.h>
+
+#ifndef TSM_VERSION
+#define TSM_VERSION "unknown"
+#endif
+
+///
+/// Run with --benchmark_out=<file> --benchmark_out_format=json (or build the
+/// tsm_bench_json target) to get results that can be compared across
+/// releases. The tsm version is recorded in the context of every run.
+///
+int
+main(int argc, char* argv[])
+{
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::AddCustomContext("tsm_version", TSM_VERSION);
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
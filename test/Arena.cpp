@@ -0,0 +1,108 @@
+#include "CdPlayerHSM.h"
+#include "GarageDoorSM.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+using tsm::Arena;
+using tsm::ArenaAllocator;
+using tsm::ArenaScope;
+using tsm::DenseTransitionTable;
+
+using tsmtest::CdPlayerController;
+using tsmtest::CdPlayerDef;
+using tsmtest::GarageDoorDefT;
+
+namespace {
+
+using CdPlayer = StateMachine<CdPlayerDef<CdPlayerController>>;
+
+/// Counts its destructions, to check that reset runs them.
+struct Tracked
+{
+    explicit Tracked(int* destroyed)
+      : destroyed(destroyed)
+    {}
+    ~Tracked() { ++*destroyed; }
+
+    int* destroyed;
+};
+
+} // namespace
+
+TEST(TestArena, testAllocationsAreAlignedAndFreedTogether)
+{
+    Arena arena(256);
+    for (std::size_t align : { 1, 2, 8, 16, 64 }) {
+        void* p = arena.allocate(3, align);
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(p) % align, 0u);
+    }
+    // Larger than a block
+    EXPECT_NE(arena.allocate(1000, 8), nullptr);
+    EXPECT_EQ(arena.allocated(), 5 * 3 + 1000u);
+
+    int destroyed = 0;
+    arena.create<Tracked>(&destroyed);
+    arena.create<Tracked>(&destroyed);
+    arena.reset();
+    EXPECT_EQ(destroyed, 2);
+    EXPECT_EQ(arena.allocated(), 0u);
+}
+
+TEST(TestArena, testAllocatorFallsBackToTheHeap)
+{
+    std::vector<int, ArenaAllocator<int>> heap(100, 1);
+    EXPECT_EQ(heap.get_allocator().arena, nullptr);
+
+    Arena arena;
+    {
+        ArenaScope scope(arena);
+        std::vector<int, ArenaAllocator<int>> v(100, 1);
+        EXPECT_EQ(v.get_allocator().arena, &arena);
+        {
+            Arena inner;
+            ArenaScope innerScope(inner);
+            EXPECT_EQ(Arena::current(), &inner);
+        }
+        EXPECT_EQ(Arena::current(), &arena);
+    }
+    EXPECT_EQ(Arena::current(), nullptr);
+    EXPECT_GE(arena.allocated(), 100 * sizeof(int));
+}
+
+TEST(TestArena, testMachinesBuiltInOneArena)
+{
+    Arena arena;
+    std::vector<CdPlayer*> players;
+    for (int i = 0; i < 1000; ++i) {
+        players.push_back(arena.create<CdPlayer>());
+    }
+    // Every transition table, event set and sub HSM set is in the arena
+    std::size_t perPlayer = arena.allocated() / players.size();
+    EXPECT_GT(perPlayer, sizeof(CdPlayer));
+
+    for (CdPlayer* sm : players) {
+        sm->startSM();
+        sm->dispatch(sm)->execute(sm->cd_detected);
+        sm->dispatch(sm)->execute(sm->play);
+        sm->dispatch(sm)->execute(sm->Playing.next_song);
+        ASSERT_EQ(sm->Playing.getCurrentState(), &sm->Playing.Song2);
+    }
+    arena.reset();
+}
+
+TEST(TestArena, testDenseTablesInTheArena)
+{
+    using Door = StateMachine<GarageDoorDefT<DenseTransitionTable>>;
+    Arena arena;
+    Door* door = arena.create<Door>();
+    std::size_t built = arena.allocated();
+    door->startSM();
+    door->dispatch(door)->execute(door->click_event);
+    EXPECT_EQ(door->getCurrentState(), &door->doorOpening);
+    // The flat array is compiled on the first lookup, possibly on the
+    // machine's own thread, so not in the arena
+    EXPECT_EQ(arena.allocated(), built);
+}
@@ -0,0 +1,221 @@
+#include "tsm.h"
+
+#include <gtest/gtest.h>
+
+#if TSM_HAS_COROUTINES
+
+#include <coroutine>
+#include <utility>
+
+using tsm::AsyncAction;
+using tsm::Event;
+using tsm::IHsmDef;
+using tsm::SimpleStateMachine;
+using tsm::State;
+using tsm::StateMachineDef;
+
+namespace {
+
+// Stands in for an I/O operation: suspends the awaiting coroutine until
+// complete is called.
+struct PendingRead
+{
+    bool await_ready() const { return false; }
+    void await_suspend(std::coroutine_handle<> h) { waiter = h; }
+    int await_resume() const { return value; }
+
+    void complete(int result)
+    {
+        value = result;
+        std::exchange(waiter, nullptr).resume();
+    }
+
+    bool waiting() const { return static_cast<bool>(waiter); }
+
+    std::coroutine_handle<> waiter;
+    int value = 0;
+};
+
+struct Request
+{
+    int id;
+};
+
+// Counts the frames destroyed
+struct FrameGuard
+{
+    explicit FrameGuard(int& destroyed)
+      : destroyed(destroyed)
+    {}
+    ~FrameGuard() { ++destroyed; }
+    int& destroyed;
+};
+
+struct ClientDef : public StateMachineDef<ClientDef>
+{
+    ClientDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<ClientDef>("Client", parent)
+      , idle("Idle")
+      , ready("Ready")
+      , cached("Cached")
+    {
+        addAsync(idle, fetch, ready, &ClientDef::download);
+        addAsync(idle, lookup, cached, &ClientDef::fromCache);
+        addAsync(idle, fetchIfOnline, ready, &ClientDef::download, [this] {
+            return online;
+        });
+        add(ready, reset, idle);
+        add(cached, reset, idle);
+    }
+
+    State* getStartState() override { return &idle; }
+    State* getStopState() override { return nullptr; }
+
+    AsyncAction download(Request const& request)
+    {
+        FrameGuard guard(framesDestroyed);
+        int value = co_await read;
+        // The payload outlives the suspension
+        requestId = request.id;
+        downloaded = value;
+    }
+
+    // Completes without suspending
+    AsyncAction fromCache()
+    {
+        downloaded = -1;
+        co_return;
+    }
+
+    State idle;
+    State ready;
+    State cached;
+
+    Event fetch;
+    Event fetchIfOnline;
+    Event lookup;
+    Event reset;
+
+    PendingRead read;
+    bool online = false;
+    int requestId = 0;
+    int downloaded = 0;
+    int framesDestroyed = 0;
+};
+
+using Client = SimpleStateMachine<ClientDef>;
+
+// A coroutine action added after a plain transition for the same pair
+struct ShadowedDef
+  : public StateMachineDef<ShadowedDef, tsm::DenseTransitionTable>
+{
+    ShadowedDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<ShadowedDef, tsm::DenseTransitionTable>("Shadowed",
+                                                                 parent)
+      , idle("Idle")
+      , plain("Plain")
+      , async("Async")
+    {
+        add(idle, go, plain);
+        addAsync(idle, go, async, &ShadowedDef::wait);
+    }
+
+    State* getStartState() override { return &idle; }
+    State* getStopState() override { return nullptr; }
+
+    AsyncAction wait()
+    {
+        ++started;
+        co_await read;
+    }
+
+    State idle;
+    State plain;
+    State async;
+
+    Event go;
+
+    PendingRead read;
+    int started = 0;
+};
+
+} // namespace
+
+TEST(TestAsyncAction, testInTransitionUntilTheCoroutineCompletes)
+{
+    Client sm;
+    sm.startSM();
+    sm.processEventNow(sm.fetch.withPayload(Request{ 7 }));
+    EXPECT_TRUE(sm.isInTransition());
+    EXPECT_TRUE(sm.read.waiting());
+    EXPECT_EQ(sm.getCurrentState(), nullptr);
+
+    // Parked, not dropped
+    sm.sendEvent(sm.reset);
+    sm.sendEvent(sm.fetch.withPayload(Request{ 8 }));
+    sm.stepAll();
+    EXPECT_EQ(sm.numDeferred(), 2u);
+
+    sm.read.complete(42);
+    EXPECT_EQ(sm.requestId, 7);
+    EXPECT_EQ(sm.downloaded, 42);
+    EXPECT_EQ(sm.framesDestroyed, 1);
+
+    // reset and the second fetch ran after the transition
+    EXPECT_TRUE(sm.isInTransition());
+    EXPECT_EQ(sm.numDeferred(), 0u);
+    sm.read.complete(43);
+    EXPECT_FALSE(sm.isInTransition());
+    EXPECT_EQ(sm.getCurrentState(), &sm.ready);
+    EXPECT_EQ(sm.requestId, 8);
+    EXPECT_EQ(sm.downloaded, 43);
+}
+
+TEST(TestAsyncAction, testCompletesRightAwayWithoutSuspending)
+{
+    Client sm;
+    sm.startSM();
+    sm.processEventNow(sm.lookup);
+    EXPECT_FALSE(sm.isInTransition());
+    EXPECT_EQ(sm.getCurrentState(), &sm.cached);
+    EXPECT_EQ(sm.downloaded, -1);
+}
+
+TEST(TestAsyncAction, testGuardIsCheckedBeforeTheAction)
+{
+    Client sm;
+    sm.startSM();
+    sm.processEventNow(sm.fetchIfOnline.withPayload(Request{ 1 }));
+    EXPECT_FALSE(sm.isInTransition());
+    EXPECT_EQ(sm.getCurrentState(), &sm.idle);
+
+    sm.online = true;
+    sm.processEventNow(sm.fetchIfOnline.withPayload(Request{ 1 }));
+    EXPECT_TRUE(sm.isInTransition());
+    sm.read.complete(5);
+    EXPECT_EQ(sm.getCurrentState(), &sm.ready);
+}
+
+TEST(TestAsyncAction, testStoppingDestroysTheCoroutine)
+{
+    Client sm;
+    sm.startSM();
+    sm.processEventNow(sm.fetch.withPayload(Request{ 3 }));
+    ASSERT_TRUE(sm.isInTransition());
+    sm.stopSM();
+    EXPECT_FALSE(sm.isInTransition());
+    EXPECT_EQ(sm.framesDestroyed, 1);
+    EXPECT_EQ(sm.getCurrentState(), nullptr);
+}
+
+TEST(TestAsyncAction, testFirstTransitionAddedWinsInADenseTable)
+{
+    SimpleStateMachine<ShadowedDef> sm;
+    sm.startSM();
+    sm.processEventNow(sm.go);
+    EXPECT_FALSE(sm.isInTransition());
+    EXPECT_EQ(sm.started, 0);
+    EXPECT_EQ(sm.getCurrentState(), &sm.plain);
+}
+
+#endif // TSM_HAS_COROUTINES
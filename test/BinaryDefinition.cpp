@@ -0,0 +1,247 @@
+#include "CdPlayerHSM.h"
+#include "GarageDoorSM.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using tsm::DefinitionBindings;
+using tsm::DefinitionNames;
+using tsm::DenseTransitionTable;
+using tsm::Event;
+using tsm::IHsmDef;
+using tsm::MappedDefinition;
+using tsm::MappedStateMachine;
+using tsm::State;
+using tsm::StateMachine;
+using tsm::StateMachineDef;
+
+using tsmtest::CdPlayerController;
+using tsmtest::CdPlayerDef;
+using tsmtest::GarageDoorDefT;
+
+namespace {
+
+struct Wallet
+{
+    int credit = 0;
+    int passed = 0;
+};
+
+struct TurnstileDef : public StateMachineDef<TurnstileDef>
+{
+    TurnstileDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<TurnstileDef>("Turnstile", parent)
+      , locked("Locked")
+      , unlocked("Unlocked")
+    {
+        add(locked, coin, unlocked, &TurnstileDef::pay);
+        add(unlocked, push, locked, &TurnstileDef::pass, &TurnstileDef::paid);
+        add(unlocked, coin, unlocked, &TurnstileDef::pay);
+    }
+
+    State* getStartState() override { return &locked; }
+    State* getStopState() override { return nullptr; }
+
+    void pay() { ++wallet.credit; }
+    void pass()
+    {
+        --wallet.credit;
+        ++wallet.passed;
+    }
+    bool paid() { return wallet.credit > 0; }
+
+    State locked;
+    State unlocked;
+
+    Event coin;
+    Event push;
+
+    Wallet wallet;
+};
+
+using Turnstile = StateMachine<TurnstileDef>;
+
+// Not part of any definition, so in the global id space
+Event powerFail;
+
+struct BellDef : public StateMachineDef<BellDef>
+{
+    BellDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<BellDef>("Bell", parent)
+      , quiet("Quiet")
+      , ringing("Ringing")
+    {
+        add(quiet, ring, ringing);
+        add(ringing, powerFail, quiet);
+    }
+
+    State* getStartState() override { return &quiet; }
+    State* getStopState() override { return nullptr; }
+
+    State quiet;
+    State ringing;
+
+    Event ring;
+};
+
+DefinitionNames
+turnstileNames(Turnstile& sm)
+{
+    DefinitionNames names;
+    names.event(sm.coin, "coin")
+      .event(sm.push, "push")
+      .action(sm.locked, sm.coin, "pay")
+      .action(sm.unlocked, sm.coin, "pay")
+      .action(sm.unlocked, sm.push, "pass")
+      .guard(sm.unlocked, sm.push, "paid");
+    return names;
+}
+
+DefinitionBindings<Wallet>
+walletBindings()
+{
+    DefinitionBindings<Wallet> bindings;
+    bindings.action("pay", [](Wallet& w, Event const&) { ++w.credit; })
+      .action("pass",
+              [](Wallet& w, Event const&) {
+                  --w.credit;
+                  ++w.passed;
+              })
+      .guard("paid", [](Wallet& w, Event const&) { return w.credit > 0; });
+    return bindings;
+}
+
+// A 4 byte aligned copy of an image, as a mapping would be.
+std::vector<std::uint32_t>
+aligned(std::vector<char> const& image)
+{
+    std::vector<std::uint32_t> words((image.size() + 3) / 4);
+    std::memcpy(words.data(), image.data(), image.size());
+    return words;
+}
+
+} // namespace
+
+TEST(TestBinaryDefinition, testMappedMachineRunsLikeTheDefinition)
+{
+    Turnstile sm;
+    std::vector<char> image = tsm::exportDefinition(sm, turnstileNames(sm));
+    auto words = aligned(image);
+    MappedDefinition def(words.data(), image.size());
+
+    EXPECT_STREQ(def.name(), "Turnstile");
+    EXPECT_EQ(def.header().numTransitions, 3u);
+    EXPECT_EQ(def.header().numActions, 2u); // pay is stored once
+    EXPECT_EQ(def.header().numGuards, 1u);
+    EXPECT_EQ(def.findState("Unlocked"), sm.unlocked.id);
+    EXPECT_EQ(def.findEvent("push"), sm.push.id);
+    EXPECT_EQ(def.findEvent("kick"), MappedDefinition::None);
+
+    Wallet wallet;
+    MappedStateMachine<Wallet> mapped(def, walletBindings(), wallet);
+    mapped.startSM();
+    sm.startSM();
+    EXPECT_STREQ(mapped.currentStateName(), "Locked");
+
+    // The events of the exporting definition, or their ids by name
+    for (Event const& e : { sm.push, sm.coin, sm.coin, sm.push, sm.push }) {
+        sm.execute(e);
+        mapped.execute(e);
+        EXPECT_EQ(mapped.getCurrentState(), sm.getCurrentState()->id);
+    }
+    EXPECT_FALSE(mapped.execute(def.findEvent("push")));
+    EXPECT_TRUE(mapped.execute(def.findEvent("coin")));
+    EXPECT_STREQ(mapped.currentStateName(), "Unlocked");
+    EXPECT_EQ(wallet.credit, 2);
+    EXPECT_EQ(wallet.passed, 1);
+    EXPECT_EQ(sm.wallet.passed, 1);
+}
+
+TEST(TestBinaryDefinition, testMappedFromAFile)
+{
+    using Door = StateMachine<GarageDoorDefT<DenseTransitionTable>>;
+    Door door;
+    std::vector<char> image = tsm::exportDefinition(door, DefinitionNames());
+    std::string path = ::testing::TempDir() + "tsm_garage_door.tsmd";
+    std::ofstream(path, std::ios::binary)
+      .write(image.data(), static_cast<std::streamsize>(image.size()));
+
+    {
+        MappedDefinition def(path);
+        struct NoContext
+        {
+        } none;
+        MappedStateMachine<NoContext> sm(def, {}, none);
+        sm.startSM();
+        // The duplicate (doorClosed, click_event) keeps the first transition
+        EXPECT_TRUE(sm.execute(door.click_event));
+        EXPECT_STREQ(sm.currentStateName(), "Door Opening");
+        EXPECT_TRUE(sm.execute(door.topSensor_event));
+        EXPECT_EQ(sm.getCurrentState(), door.doorOpen.id);
+        EXPECT_FALSE(sm.execute(door.obstruct_event));
+        EXPECT_FALSE(sm.isStopped());
+    }
+    std::remove(path.c_str());
+    EXPECT_THROW(MappedDefinition def(path), std::runtime_error);
+}
+
+TEST(TestBinaryDefinition, testExportNeedsNamesAndAFlatDefinition)
+{
+    Turnstile sm;
+    DefinitionNames names;
+    names.action(sm.locked, sm.coin, "pay");
+    EXPECT_THROW(tsm::exportDefinition(sm, names), std::invalid_argument);
+
+    StateMachine<CdPlayerDef<CdPlayerController>> player;
+    EXPECT_THROW(tsm::exportDefinition(player, DefinitionNames()),
+                 std::invalid_argument);
+}
+
+TEST(TestBinaryDefinition, testIdsOfOtherSpacesAreKeptApart)
+{
+    // A global event could clash with an event of the definition
+    StateMachine<BellDef> bell;
+    EXPECT_THROW(tsm::exportDefinition(bell, DefinitionNames()),
+                 std::invalid_argument);
+
+    // Naming an event of another definition with the same id
+    Turnstile sm;
+    ASSERT_EQ(bell.ring.id, sm.coin.id);
+    DefinitionNames names = turnstileNames(sm);
+    names.event(bell.ring, "ring");
+    std::vector<char> image = tsm::exportDefinition(sm, names);
+    auto words = aligned(image);
+    MappedDefinition def(words.data(), image.size());
+    EXPECT_STREQ(def.eventName(sm.coin.id), "coin");
+}
+
+TEST(TestBinaryDefinition, testBadImagesAndBindingsAreRejected)
+{
+    Turnstile sm;
+    std::vector<char> image = tsm::exportDefinition(sm, turnstileNames(sm));
+    auto words = aligned(image);
+    EXPECT_THROW(MappedDefinition(words.data(), image.size() - 1),
+                 std::invalid_argument);
+
+    auto corrupt = words;
+    reinterpret_cast<tsm::DefinitionHeader*>(corrupt.data())->numStates = 1000;
+    EXPECT_THROW(MappedDefinition(corrupt.data(), image.size()),
+                 std::invalid_argument);
+    corrupt = words;
+    reinterpret_cast<tsm::DefinitionHeader*>(corrupt.data())->magic = 0;
+    EXPECT_THROW(MappedDefinition(corrupt.data(), image.size()),
+                 std::invalid_argument);
+
+    MappedDefinition def(words.data(), image.size());
+    Wallet wallet;
+    DefinitionBindings<Wallet> partial;
+    partial.action("pay", [](Wallet& w, Event const&) { ++w.credit; });
+    EXPECT_THROW(MappedStateMachine<Wallet>(def, partial, wallet),
+                 std::invalid_argument);
+}
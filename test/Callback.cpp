@@ -0,0 +1,136 @@
+#include "tsm.h"
+
+#include <gtest/gtest.h>
+
+using tsm::Event;
+using tsm::IHsmDef;
+using tsm::SimpleStateMachine;
+using tsm::State;
+using tsm::StateMachineDef;
+
+namespace tsmtest {
+
+struct Level
+{
+    int value;
+};
+
+struct TankDef;
+
+// A function object guard
+struct BelowLimit
+{
+    int limit;
+    bool operator()(TankDef const& tank) const;
+};
+
+struct TankDef : public StateMachineDef<TankDef>
+{
+    TankDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<TankDef>("Tank HSM", parent)
+      , Empty("Empty")
+      , Filling("Filling")
+      , Full("Full")
+      , level(0)
+      , fills(0)
+      , drains(0)
+    {
+        add(Empty, fill, Filling, [this] { ++fills; });
+        add(Filling,
+            pour,
+            Filling,
+            [](TankDef& t, Level const& l) { t.level += l.value; },
+            BelowLimit{ 100 });
+        add(Filling, seal, Full, nullptr, [this] { return level >= 100; });
+        add(Full, release, Empty, [count = 0](TankDef& t) mutable {
+            t.level = 0;
+            t.drains = ++count;
+        });
+    }
+
+    virtual ~TankDef() = default;
+
+    State* getStartState() override { return &Empty; }
+    State* getStopState() override { return nullptr; }
+
+    // States
+    State Empty;
+    State Filling;
+    State Full;
+
+    // Events
+    Event fill;
+    Event pour;
+    Event seal;
+    Event release;
+
+    int level;
+    int fills;
+    int drains;
+};
+
+bool BelowLimit::operator()(TankDef const& tank) const
+{
+    return tank.level < limit;
+}
+} // namespace tsmtest
+
+using tsmtest::Level;
+using tsmtest::TankDef;
+
+TEST(TestCallback, testEmptyAndCopied)
+{
+    TankDef::Guard none;
+    TankDef::Guard nullMember = static_cast<TankDef::GuardFn>(nullptr);
+    EXPECT_FALSE(none);
+    EXPECT_FALSE(nullMember);
+
+    int calls = 0;
+    TankDef::Action counting = [&calls] { ++calls; };
+    TankDef::Action copy = counting;
+    TankDef::Action assigned;
+    assigned = copy;
+    ASSERT_TRUE(assigned);
+    counting(nullptr, Event::dummy_event);
+    copy(nullptr, Event::dummy_event);
+    assigned(nullptr, Event::dummy_event);
+    EXPECT_EQ(calls, 3);
+}
+
+TEST(TestCallback, testLambdasAndFunctors)
+{
+    SimpleStateMachine<TankDef> sm;
+    sm.startSM();
+
+    for (int round = 1; round <= 2; ++round) {
+        sm.sendEvent(sm.fill);
+        sm.step();
+        ASSERT_EQ(sm.getCurrentState(), &sm.Filling);
+        ASSERT_EQ(sm.fills, round);
+
+        // The lambda guard holds until the tank is full
+        sm.sendEvent(sm.seal);
+        sm.step();
+        ASSERT_EQ(sm.getCurrentState(), &sm.Filling);
+
+        // The functor guard stops the payload action at the limit
+        for (int i = 0; i < 3; ++i) {
+            sm.sendEvent(sm.pour.withPayload(Level{ 50 }));
+            sm.step();
+            ASSERT_EQ(sm.getCurrentState(), &sm.Filling);
+        }
+        ASSERT_EQ(sm.level, 100);
+
+        sm.sendEvent(sm.seal);
+        sm.step();
+        ASSERT_EQ(sm.getCurrentState(), &sm.Full);
+
+        // The mutable lambda keeps its own count
+        sm.sendEvent(sm.release);
+        sm.step();
+        ASSERT_EQ(sm.getCurrentState(), &sm.Empty);
+        ASSERT_EQ(sm.drains, round);
+        ASSERT_EQ(sm.level, 0);
+    }
+    sm.stopSM();
+}
@@ -1,6 +1,8 @@
 #include "CdPlayerHSM.h"
 #include "Observer.h"
 
+#include <gtest/gtest.h>
+
 using tsmtest::CdPlayerController;
 using tsmtest::CdPlayerDef;
 
@@ -30,10 +32,7 @@ struct TestCdPlayerHSM : public testing::Test
     TestCdPlayerHSM()
       : testing::Test()
     {}
-    virtual ~TestCdPlayerHSM()
-    { // TODO(sriram): ugh! Fix Id generation
-        tsm::UniqueId::reset();
-    }
+    virtual ~TestCdPlayerHSM() = default;
 };
 
 TEST_F(TestCdPlayerHSM, testTransitionsSeparateThreadPolicy)
@@ -66,7 +65,8 @@ TEST_F(TestCdPlayerHSM, testTransitionsSeparateThreadPolicy)
     sm.sendEvent(sm.pause);
     sm.wait();
     ASSERT_EQ(sm.getCurrentState(), &sm.Paused);
-    ASSERT_EQ(Playing.getCurrentState(), &Playing.Song2);
+    // Exited, with Song2 kept as its history
+    ASSERT_EQ(Playing.getCurrentState(), nullptr);
 
     sm.sendEvent(sm.end_pause);
     sm.wait();
@@ -114,7 +114,8 @@ TEST_F(TestCdPlayerHSM, testTransitionsParentThreadPolicy)
     sm.sendEvent(sm.pause);
     sm.step();
     ASSERT_EQ(sm.getCurrentState(), &sm.Paused);
-    ASSERT_EQ(Playing.getCurrentState(), &Playing.Song2);
+    // Exited, with Song2 kept as its history
+    ASSERT_EQ(Playing.getCurrentState(), nullptr);
 
     sm.sendEvent(sm.end_pause);
     sm.step();
@@ -161,3 +162,32 @@ TEST_F(TestCdPlayerHSM, testEventQueueInterruptedException)
 
     sm.stopSM();
 }
+
+TEST_F(TestCdPlayerHSM, testDispatchFollowsActiveSubHsm)
+{
+    CdPlayerHSMParentThread sm;
+    auto& Playing = sm.Playing;
+
+    sm.startSM();
+    ASSERT_EQ(sm.dispatch(&sm), &sm);
+
+    sm.sendEvent(sm.cd_detected);
+    sm.sendEvent(sm.play);
+    sm.step();
+    sm.step();
+    ASSERT_EQ(sm.dispatch(&sm), &Playing);
+
+    sm.sendEvent(sm.pause);
+    sm.step();
+    ASSERT_EQ(sm.dispatch(&sm), &sm);
+
+    sm.sendEvent(sm.end_pause);
+    sm.step();
+    ASSERT_EQ(sm.dispatch(&sm), &Playing);
+
+    sm.sendEvent(sm.stop_event);
+    sm.step();
+    ASSERT_EQ(sm.dispatch(&sm), &sm);
+
+    sm.stopSM();
+}
@@ -2,9 +2,6 @@
 
 #include "tsm.h"
 
-#include <glog/logging.h>
-#include <gtest/gtest.h>
-
 using tsm::Event;
 using tsm::EventQueue;
 using tsm::IHsmDef;
@@ -19,7 +16,7 @@ struct CdPlayerController
     // Actions
     void playSong(std::string const& songName)
     {
-        DLOG(INFO) << "Playing song: " << songName;
+        TSM_DLOG(INFO) << "Playing song: " << songName;
     }
 };
 
@@ -82,35 +79,17 @@ struct CdPlayerDef : public StateMachineDef<CdPlayerDef<ControllerType>>
         // Actions
         void PlaySong()
         {
-            DLOG(INFO) << "Play Song";
+            TSM_DLOG(INFO) << "Play Song";
             controller_.playSong(this->getCurrentState()->name);
         }
 
         // Guards
         bool PlaySongGuard()
         {
-            DLOG(INFO) << "Play Song Guard";
+            TSM_DLOG(INFO) << "Play Song Guard";
             return true;
         }
 
-        // If the event is a pause, stay on the song that is playing. For all
-        // other events, go back to the start state
-        void onEntry(Event const& e) override
-        {
-            auto parent = static_cast<CdPlayerDef*>(this->parent_);
-            if (parent->end_pause != e) {
-                StateMachineDef<PlayingHSMDef>::onEntry(e);
-            }
-        }
-
-        void onExit(Event const& e) override
-        {
-            auto parent = static_cast<CdPlayerDef*>(this->parent_);
-            if (parent->pause != e) {
-                StateMachineDef<PlayingHSMDef>::onExit(e);
-            }
-        }
-
         CdPlayerController controller_;
     };
 
@@ -137,7 +116,8 @@ struct CdPlayerDef : public StateMachineDef<CdPlayerDef<ControllerType>>
         add(Playing, pause, Paused);
         add(Playing, open_close, Open);
         //-------------------------------------------------
-        add(Paused, end_pause, Playing);
+        // Resume the song that was playing
+        add(Paused, end_pause, Playing.shallowHistory);
         add(Paused, stop_event, Stopped);
         add(Paused, open_close, Open);
     }
@@ -190,7 +170,7 @@ struct ErrorHSM : public StateMachineDef<ErrorHSM>
     Event recover;
 
     // Actions
-    void recovery() { DLOG(INFO) << "Recovering from Error:"; }
+    void recovery() { TSM_DLOG(INFO) << "Recovering from Error:"; }
 
     State* getStartState() { return &AllOk; }
     State* getStopState() { return nullptr; }
@@ -0,0 +1,197 @@
+#include "tsm.h"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+
+using tsm::Event;
+using tsm::IHsmDef;
+using tsm::ParentThreadExecutionPolicy;
+using tsm::SharedDefinition;
+using tsm::State;
+using tsm::StateMachine;
+using tsm::StateMachineDef;
+
+namespace {
+
+struct PrinterDef : public StateMachineDef<PrinterDef>
+{
+    PrinterDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<PrinterDef>("Printer", parent)
+      , idle("Idle")
+      , printing("Printing")
+      , jobs(0)
+      , cancelled(0)
+    {
+        add(idle, print, printing, [this] { ++jobs; });
+        add(printing, done, idle);
+        add(printing, cancel, idle, [this] { ++cancelled; });
+        defer(printing, print);
+        defer(printing, cancel);
+    }
+
+    State* getStartState() override { return &idle; }
+    State* getStopState() override { return nullptr; }
+
+    State idle;
+    State printing;
+
+    Event print;
+    Event done;
+    Event cancel;
+
+    int jobs;
+    int cancelled;
+};
+
+using Printer = ParentThreadExecutionPolicy<StateMachine<PrinterDef>>;
+
+struct JobDef : public StateMachineDef<JobDef>
+{
+    JobDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<JobDef>("Job", parent)
+      , idle("Idle")
+      , busy("Busy")
+    {
+        add(idle, work, busy);
+        defer(busy, work);
+    }
+
+    State* getStartState() override { return &idle; }
+    State* getStopState() override { return nullptr; }
+
+    State idle;
+    State busy;
+
+    Event work;
+};
+
+struct HostDef : public StateMachineDef<HostDef>
+{
+    HostDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<HostDef>("Host", parent)
+      , job(this)
+      , standby("Standby")
+      , queued(0)
+    {
+        add(job, suspend, standby);
+        add(standby, job.work, standby, [this] { ++queued; });
+    }
+
+    State* getStartState() override { return &job; }
+    State* getStopState() override { return nullptr; }
+
+    StateMachine<JobDef> job;
+    State standby;
+
+    Event suspend;
+
+    int queued;
+};
+
+// Goes to a state of another definition, whose id is the same as ready's
+struct RelayDef : public StateMachineDef<RelayDef>
+{
+    RelayDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<RelayDef>("Relay", parent)
+      , ready("Ready")
+    {
+        add(ready, go, other.busy);
+        defer(ready, hold);
+    }
+
+    State* getStartState() override { return &ready; }
+    State* getStopState() override { return nullptr; }
+
+    JobDef other;
+    State ready;
+
+    Event go;
+    Event hold;
+};
+
+} // namespace
+
+TEST(TestDeferral, testDeferredEventsReplayInOrderOnTheNextTransition)
+{
+    Printer sm;
+    sm.startSM();
+
+    sm.sendEvent(sm.print);
+    sm.sendEvent(sm.print);
+    sm.sendEvent(sm.print);
+    sm.stepAll();
+    EXPECT_EQ(sm.getCurrentState(), &sm.printing);
+    EXPECT_EQ(sm.numDeferred(), 2u);
+    EXPECT_EQ(sm.jobs, 1);
+
+    // The first parked print starts the next job, the second one parks again
+    sm.sendEvent(sm.done);
+    sm.step();
+    EXPECT_EQ(sm.getCurrentState(), &sm.printing);
+    EXPECT_EQ(sm.numDeferred(), 1u);
+    EXPECT_EQ(sm.jobs, 2);
+}
+
+TEST(TestDeferral, testTransitionsTakePrecedenceOverDeferral)
+{
+    Printer sm;
+    sm.startSM();
+
+    sm.sendEvent(sm.print);
+    sm.sendEvent(sm.print);
+    sm.sendEvent(sm.cancel);
+    sm.stepAll();
+    EXPECT_EQ(sm.cancelled, 1);
+    EXPECT_EQ(sm.jobs, 2);
+    EXPECT_EQ(sm.numDeferred(), 0u);
+}
+
+TEST(TestDeferral, testNothingIsDeferredWhereNotDeclared)
+{
+    Printer sm;
+    sm.startSM();
+
+    sm.sendEvent(sm.done);
+    sm.step();
+    EXPECT_EQ(sm.numDeferred(), 0u);
+    EXPECT_EQ(sm.getCurrentState(), &sm.idle);
+}
+
+TEST(TestDeferral, testEventsDeferredBySubHsmGoToTheParentOnExit)
+{
+    StateMachine<HostDef> sm;
+    sm.startSM();
+
+    sm.dispatch(&sm)->execute(sm.job.work);
+    sm.dispatch(&sm)->execute(sm.job.work);
+    EXPECT_EQ(sm.job.getCurrentState(), &sm.job.busy);
+    EXPECT_EQ(sm.job.numDeferred(), 1u);
+
+    sm.dispatch(&sm)->execute(sm.suspend);
+    EXPECT_EQ(sm.getCurrentState(), &sm.standby);
+    EXPECT_EQ(sm.job.numDeferred(), 0u);
+    EXPECT_EQ(sm.numDeferred(), 0u);
+    EXPECT_EQ(sm.queued, 1);
+}
+
+TEST(TestDeferral, testSharedDefinitionRejectsDeferral)
+{
+    EXPECT_THROW(SharedDefinition<PrinterDef>(), std::invalid_argument);
+}
+
+TEST(TestDeferral, testDeferralsAreKeptApartByIdSpace)
+{
+    StateMachine<RelayDef> sm;
+    ASSERT_EQ(sm.ready.id, sm.other.busy.id);
+    ASSERT_NE(sm.ready.space, sm.other.busy.space);
+    sm.startSM();
+
+    sm.dispatch(&sm)->execute(sm.hold);
+    EXPECT_EQ(sm.numDeferred(), 1u);
+
+    sm.dispatch(&sm)->execute(sm.go);
+    EXPECT_EQ(sm.getCurrentState(), &sm.other.busy);
+    sm.dispatch(&sm)->execute(sm.hold);
+    EXPECT_EQ(sm.numDeferred(), 0u);
+}
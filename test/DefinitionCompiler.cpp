@@ -0,0 +1,300 @@
+#include "CdPlayerHSM.h"
+#include "GarageDoorSM.h"
+#include "TestMachines.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+using tsm::DefinitionIssue;
+using tsm::DenseTransitionTable;
+using tsm::Event;
+using tsm::IHsmDef;
+using tsm::State;
+using tsm::StateMachine;
+using tsm::StateMachineDef;
+
+using tsmtest::AHsmDef;
+using tsmtest::CdPlayerController;
+using tsmtest::CdPlayerDef;
+using tsmtest::GarageDoorDefT;
+
+namespace {
+
+using Kind = DefinitionIssue::Kind;
+
+/// Records the hooks, to compare a flattened machine with a plain one.
+struct RecordingTracer
+{
+    void onTransition(IHsmDef const& hsm,
+                      State const& from,
+                      Event const&,
+                      State const& to)
+    {
+        log.push_back(hsm.name + ": " + from.name + " -> " + to.name);
+    }
+
+    void onGuardRejected(IHsmDef const& hsm, State const& state, Event const&)
+    {
+        log.push_back(hsm.name + ": rejected in " + state.name);
+    }
+
+    void onUnhandled(IHsmDef const& hsm, Event const&)
+    {
+        log.push_back(hsm.name + ": unhandled");
+    }
+
+    std::vector<std::string> log;
+};
+
+/// Three levels: events for the outer machine go up two parents.
+struct InnerDef : public StateMachineDef<InnerDef>
+{
+    InnerDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<InnerDef>("Inner", parent)
+      , x("X")
+      , y("Y")
+    {
+        add(x, step, y);
+        add(y, step, x);
+    }
+
+    State* getStartState() override { return &x; }
+    State* getStopState() override { return nullptr; }
+
+    State x;
+    State y;
+
+    Event step;
+};
+
+struct MiddleDef : public StateMachineDef<MiddleDef>
+{
+    MiddleDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<MiddleDef>("Middle", parent)
+      , a("A")
+      , inner(this)
+    {
+        add(a, in, inner);
+        add(inner, out, a);
+    }
+
+    State* getStartState() override { return &a; }
+    State* getStopState() override { return nullptr; }
+
+    State a;
+    StateMachine<InnerDef, RecordingTracer> inner;
+
+    Event in;
+    Event out;
+};
+
+struct OuterDef : public StateMachineDef<OuterDef>
+{
+    OuterDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<OuterDef>("Outer", parent)
+      , idle("Idle")
+      , middle(this)
+      , later(0)
+    {
+        add(idle, go, middle);
+        add(middle, reset, idle);
+        add(idle, job, idle, [this] { ++later; });
+        add(idle, recall, middle.deepHistory);
+        defer(middle, job);
+    }
+
+    State* getStartState() override { return &idle; }
+    State* getStopState() override { return nullptr; }
+
+    State idle;
+    StateMachine<MiddleDef, RecordingTracer> middle;
+
+    Event go;
+    Event reset;
+    Event job;
+    Event recall;
+
+    int later;
+};
+
+using Outer = StateMachine<OuterDef, RecordingTracer>;
+
+/// Goes to a state of another definition, whose id is the same as ready's.
+struct BridgeDef : public StateMachineDef<BridgeDef>
+{
+    BridgeDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<BridgeDef>("Bridge", parent)
+      , ready("Ready")
+    {
+        add(ready, go, other.y);
+        defer(ready, hold);
+    }
+
+    State* getStartState() override { return &ready; }
+    State* getStopState() override { return nullptr; }
+
+    InnerDef other;
+    State ready;
+
+    Event go;
+    Event hold;
+};
+
+/// A definition with problems of every kind.
+struct BrokenDef : public StateMachineDef<BrokenDef>
+{
+    BrokenDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<BrokenDef>("Broken", parent)
+      , on("On")
+      , off("Off")
+      , island("Island")
+      , done("Done")
+      , hasStart(true)
+    {
+        add(off, toggle, on);
+        add(on, toggle, off);
+        add(island, toggle, done);
+    }
+
+    State* getStartState() override { return hasStart ? &off : nullptr; }
+    State* getStopState() override { return &done; }
+
+    State on;
+    State off;
+    State island;
+    State done;
+
+    Event toggle;
+
+    bool hasStart;
+};
+
+bool
+has(std::vector<DefinitionIssue> const& issues, Kind kind, State const* state)
+{
+    for (auto const& issue : issues) {
+        if (issue.kind == kind && issue.state == state) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Drive the machine through every way an event can leave a leaf state.
+void
+play(Outer& sm)
+{
+    sm.startSM();
+    for (Event const* e : { &sm.go,
+                            &sm.middle.in,
+                            &sm.middle.inner.step,
+                            &sm.job,         // deferred by Outer
+                            &sm.go,          // unhandled
+                            &sm.middle.out,  // taken by Middle
+                            &sm.middle.in,
+                            &sm.reset,       // taken by Outer, replays job
+                            &sm.recall,      // deep history of Middle
+                            &sm.middle.inner.step }) {
+        sm.dispatch(&sm)->execute(*e);
+    }
+}
+
+} // namespace
+
+TEST(TestDefinitionCompiler, testDuplicateTransitionsAreReported)
+{
+    StateMachine<CdPlayerDef<CdPlayerController>> player;
+    auto issues = tsm::validate(player);
+    ASSERT_EQ(issues.size(), 1u);
+    EXPECT_EQ(issues[0].kind, Kind::DuplicateTransition);
+    EXPECT_EQ(issues[0].hsm, &player);
+    EXPECT_EQ(issues[0].state, &player.Empty);
+    EXPECT_EQ(*issues[0].event, player.cd_detected);
+
+    using DenseDoor = StateMachine<GarageDoorDefT<DenseTransitionTable>>;
+    StateMachine<GarageDoorDefT<>> door;
+    DenseDoor denseDoor;
+    for (auto const& found :
+         { tsm::validate(door), tsm::validate(denseDoor) }) {
+        ASSERT_EQ(found.size(), 1u);
+        EXPECT_EQ(found[0].kind, Kind::DuplicateTransition);
+        EXPECT_EQ(found[0].state->name, "Door Closed");
+    }
+}
+
+TEST(TestDefinitionCompiler, testUnreachableStatesAndNoStartState)
+{
+    StateMachine<BrokenDef> broken;
+    auto issues = tsm::validate(broken);
+    EXPECT_EQ(issues.size(), 2u);
+    EXPECT_TRUE(has(issues, Kind::UnreachableState, &broken.island));
+    EXPECT_TRUE(has(issues, Kind::UnreachableStopState, &broken.done));
+
+    broken.hasStart = false;
+    EXPECT_TRUE(has(tsm::validate(broken), Kind::NoStartState, nullptr));
+}
+
+TEST(TestDefinitionCompiler, testHierarchiesWithHistoryAreClean)
+{
+    StateMachine<AHsmDef> a;
+    EXPECT_TRUE(tsm::validate(a).empty());
+    Outer outer;
+    EXPECT_TRUE(tsm::compile(outer).empty());
+}
+
+TEST(TestDefinitionCompiler, testFlattenedMachineBehavesTheSame)
+{
+    Outer plain;
+    play(plain);
+
+    Outer flat;
+    tsm::compile(flat);
+    play(flat);
+
+    EXPECT_EQ(flat.getTracer().log, plain.getTracer().log);
+    EXPECT_EQ(flat.middle.getTracer().log, plain.middle.getTracer().log);
+    EXPECT_EQ(flat.middle.getTracer().log.back(), "Middle: A -> Inner");
+    EXPECT_EQ(flat.middle.inner.getTracer().log,
+              plain.middle.inner.getTracer().log);
+    EXPECT_EQ(flat.later, 1);
+    EXPECT_EQ(plain.later, 1);
+    EXPECT_EQ(flat.middle.inner.getCurrentState(), &flat.middle.inner.y);
+    EXPECT_EQ(flat.dispatch(&flat), &flat.middle.inner);
+}
+
+TEST(TestDefinitionCompiler, testFlattenedCdPlayer)
+{
+    StateMachine<CdPlayerDef<CdPlayerController>> sm;
+    tsm::compile(sm);
+    sm.startSM();
+    sm.dispatch(&sm)->execute(sm.cd_detected);
+    sm.dispatch(&sm)->execute(sm.play);
+    sm.dispatch(&sm)->execute(sm.Playing.next_song);
+    // From Song2 straight to the CD Player's transition
+    sm.dispatch(&sm)->execute(sm.pause);
+    EXPECT_EQ(sm.getCurrentState(), &sm.Paused);
+    sm.dispatch(&sm)->execute(sm.end_pause);
+    EXPECT_EQ(sm.getCurrentState(), &sm.Playing);
+    EXPECT_EQ(sm.Playing.getCurrentState(), &sm.Playing.Song2);
+    sm.dispatch(&sm)->execute(sm.stop_event);
+    EXPECT_EQ(sm.getCurrentState(), &sm.Stopped);
+}
+
+TEST(TestDefinitionCompiler, testFlattenKeepsIdSpacesApart)
+{
+    StateMachine<BridgeDef> sm;
+    ASSERT_EQ(sm.ready.id, sm.other.y.id);
+    ASSERT_NE(sm.ready.space, sm.other.y.space);
+    tsm::compile(sm);
+    sm.startSM();
+
+    sm.dispatch(&sm)->execute(sm.hold);
+    EXPECT_EQ(sm.numDeferred(), 1u);
+
+    sm.dispatch(&sm)->execute(sm.go);
+    EXPECT_EQ(sm.getCurrentState(), &sm.other.y);
+    sm.dispatch(&sm)->execute(sm.hold);
+    EXPECT_EQ(sm.numDeferred(), 0u);
+}
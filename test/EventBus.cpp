@@ -0,0 +1,126 @@
+#include "CdPlayerHSM.h"
+#include "tsm.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using tsm::Event;
+using tsm::EventBus;
+using tsm::IHsmDef;
+using tsm::InlineStateMachine;
+using tsm::SimpleEventBus;
+using tsm::SimpleStateMachine;
+using tsm::State;
+using tsm::StateMachineDef;
+
+using tsmtest::ErrorHSM;
+
+namespace {
+
+struct Version
+{
+    int number;
+};
+
+struct ReloaderDef : public StateMachineDef<ReloaderDef>
+{
+    ReloaderDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<ReloaderDef>("Reloader", parent)
+      , running("Running")
+      , version(0)
+    {
+        add(running, reload, running, &ReloaderDef::apply);
+    }
+
+    State* getStartState() override { return &running; }
+    State* getStopState() override { return nullptr; }
+
+    void apply(Version const& v) { version = v.number; }
+
+    State running;
+    Event reload;
+    int version;
+};
+
+/// Records the batches it is sent, one vector per sendEvents.
+struct Recorder
+{
+    template<typename InputIt>
+    void sendEvents(InputIt first, InputIt last)
+    {
+        batches.emplace_back(first, last);
+    }
+
+    std::vector<std::vector<Event>> batches;
+};
+
+} // namespace
+
+TEST(TestEventBus, testBroadcastReachesEverySubscriber)
+{
+    EventBus bus;
+    std::vector<SimpleStateMachine<ErrorHSM>> machines(3);
+    InlineStateMachine<ErrorHSM> inlined;
+    for (auto& sm : machines) {
+        sm.startSM();
+        bus.subscribe(sm.error, sm);
+    }
+    inlined.startSM();
+    bus.subscribe(inlined.error, inlined);
+
+    // Every ErrorHSM shares the ids of its events
+    EXPECT_EQ(bus.publish(inlined.error), 4u);
+    EXPECT_EQ(inlined.getCurrentState(), &inlined.ErrorMode);
+    for (auto& sm : machines) {
+        EXPECT_EQ(sm.stepAll(), 1u);
+        EXPECT_EQ(sm.getCurrentState(), &sm.ErrorMode);
+    }
+    EXPECT_EQ(bus.publish(inlined.recover), 0u);
+
+    for (auto& sm : machines) {
+        bus.unsubscribe(sm);
+        sm.stopSM();
+    }
+    bus.unsubscribe(inlined);
+    EXPECT_EQ(bus.publish(inlined.error), 0u);
+}
+
+TEST(TestEventBus, testSubscriberGetsItsOwnEventWithThePayload)
+{
+    SimpleEventBus bus;
+    Event configChanged;
+    InlineStateMachine<ReloaderDef> sm;
+    sm.startSM();
+    bus.subscribe(configChanged, sm, sm.reload);
+
+    EXPECT_EQ(bus.publish(configChanged.withPayload(Version{ 7 })), 1u);
+    EXPECT_EQ(sm.version, 7);
+
+    bus.unsubscribe(configChanged, sm);
+    EXPECT_EQ(bus.publish(configChanged.withPayload(Version{ 8 })), 0u);
+    EXPECT_EQ(sm.version, 7);
+}
+
+TEST(TestEventBus, testBatchIsOneSendPerSubscriber)
+{
+    SimpleEventBus bus;
+    Event a, b, c;
+    Recorder both, onlyB;
+    bus.subscribe(a, both);
+    bus.subscribe(b, both);
+    bus.subscribe(b, onlyB);
+
+    std::vector<Event> events = { a, b, c, a };
+    EXPECT_EQ(bus.publish(events.begin(), events.end()), 4u);
+
+    ASSERT_EQ(both.batches.size(), 1u);
+    std::vector<Event> inOrder = { a, b, a };
+    EXPECT_EQ(both.batches[0], inOrder);
+    ASSERT_EQ(onlyB.batches.size(), 1u);
+    EXPECT_EQ(onlyB.batches[0], std::vector<Event>{ b });
+
+    // Nothing left over for the next batch
+    bus.publish(events.begin() + 1, events.begin() + 2);
+    EXPECT_EQ(both.batches.back(), std::vector<Event>{ b });
+}
@@ -0,0 +1,136 @@
+#include "tsm.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+using tsm::Event;
+using tsm::EventQueue;
+using tsm::IHsmDef;
+using tsm::LockFreeEventQueue;
+using tsm::SimpleStateMachine;
+using tsm::State;
+using tsm::StateMachineDef;
+
+namespace tsmtest {
+
+struct Temperature
+{
+    double celsius;
+};
+
+struct ThermostatDef : public StateMachineDef<ThermostatDef>
+{
+    ThermostatDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<ThermostatDef>("Thermostat HSM", parent)
+      , Idle("Idle")
+      , Heating("Heating")
+      , setPoint(0)
+    {
+        add(Idle,
+            set_temp,
+            Heating,
+            &ThermostatDef::setTemp,
+            &ThermostatDef::inRange);
+        add(Heating, label, Heating, &ThermostatDef::setLabel);
+        add(Heating, reached, Idle);
+    }
+
+    virtual ~ThermostatDef() = default;
+
+    State* getStartState() override { return &Idle; }
+    State* getStopState() override { return nullptr; }
+
+    // States
+    State Idle;
+    State Heating;
+
+    // Events
+    Event set_temp;
+    Event label;
+    Event reached;
+
+    // Actions
+    void setTemp(Temperature const& t) { setPoint = t.celsius; }
+    void setLabel(std::string const& l) { currentLabel = l; }
+
+    // Guards
+    bool inRange(Temperature const& t) { return t.celsius < 30; }
+
+    double setPoint;
+    std::string currentLabel;
+};
+} // namespace tsmtest
+
+using tsmtest::Temperature;
+using tsmtest::ThermostatDef;
+
+TEST(TestEventPayload, testPayloadCopies)
+{
+    Event e;
+    EXPECT_FALSE(e.hasPayload());
+
+    std::string label(100, 'x'); // Longer than the small string buffer
+    Event withLabel = e.withPayload(label);
+    ASSERT_TRUE(withLabel.hasPayload());
+    EXPECT_EQ(withLabel, e);
+    EXPECT_EQ(withLabel.payload<Temperature>(), nullptr);
+
+    Event copy = withLabel;
+    Event assigned;
+    assigned = copy;
+    withLabel.clearPayload();
+    EXPECT_FALSE(withLabel.hasPayload());
+    ASSERT_NE(copy.payload<std::string>(), nullptr);
+    EXPECT_EQ(*copy.payload<std::string>(), label);
+    EXPECT_EQ(*assigned.payload<std::string>(), label);
+    EXPECT_EQ(assigned, e);
+}
+
+TEST(TestEventPayload, testQueuesKeepPayload)
+{
+    Event e;
+    EventQueue<Event> eq;
+    LockFreeEventQueue<Event, 4> lfq;
+
+    eq.addEvent(e.withPayload(Temperature{ 21.5 }));
+    lfq.addEvent(e.withPayload(Temperature{ 22.5 }));
+
+    Event e1 = eq.nextEvent();
+    Event e2 = lfq.nextEvent();
+    ASSERT_NE(e1.payload<Temperature>(), nullptr);
+    ASSERT_NE(e2.payload<Temperature>(), nullptr);
+    EXPECT_EQ(e1.payload<Temperature>()->celsius, 21.5);
+    EXPECT_EQ(e2.payload<Temperature>()->celsius, 22.5);
+}
+
+TEST(TestEventPayload, testActionsAndGuardsReceivePayload)
+{
+    SimpleStateMachine<ThermostatDef> sm;
+    sm.startSM();
+
+    // No payload: the transition is not taken
+    sm.sendEvent(sm.set_temp);
+    sm.step();
+    ASSERT_EQ(sm.getCurrentState(), &sm.Idle);
+
+    // Guard rejects
+    sm.sendEvent(sm.set_temp.withPayload(Temperature{ 35 }));
+    sm.step();
+    ASSERT_EQ(sm.getCurrentState(), &sm.Idle);
+
+    sm.sendEvent(sm.set_temp.withPayload(Temperature{ 25 }));
+    sm.step();
+    ASSERT_EQ(sm.getCurrentState(), &sm.Heating);
+    ASSERT_EQ(sm.setPoint, 25);
+
+    sm.sendEvent(sm.label.withPayload(std::string("living room")));
+    sm.step();
+    ASSERT_EQ(sm.currentLabel, "living room");
+
+    sm.sendEvent(sm.reached);
+    sm.step();
+    ASSERT_EQ(sm.getCurrentState(), &sm.Idle);
+
+    sm.stopSM();
+}
@@ -1,13 +1,19 @@
 #include "EventQueue.h"
 #include "Event.h"
+#include "LockFreeEventQueue.h"
 
-#include <glog/logging.h>
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <future>
+#include <iterator>
+#include <map>
+#include <vector>
 
 using tsm::Event;
 using tsm::EventQueue;
+using tsm::EventQueueInterruptedException;
+using tsm::LockFreeEventQueue;
 
 struct TestEventQueue : public testing::Test
 {
@@ -61,3 +67,139 @@ TEST_F(TestEventQueue, testAddFrom100Threads)
         t.join();
     }
 }
+
+TEST_F(TestEventQueue, testTryNextEventReturnsFalseOnStop)
+{
+    auto waiter = std::async(std::launch::async, [this] {
+        Event e = Event::dummy_event;
+        return eq_.tryNextEvent(e);
+    });
+    eq_.stop();
+    EXPECT_FALSE(waiter.get());
+
+    // Queued events are not handed out after stop either
+    eq_.addEvent(e1);
+    std::vector<Event> batch;
+    EXPECT_EQ(eq_.tryNextEvents(std::back_inserter(batch), 8), 0u);
+    EXPECT_TRUE(batch.empty());
+}
+
+struct TestLockFreeEventQueue : public testing::Test
+{
+    TestLockFreeEventQueue()
+      : testing::Test()
+    {}
+
+    LockFreeEventQueue<Event, 16> eq_;
+    Event e1;
+    Event e2;
+};
+
+TEST_F(TestLockFreeEventQueue, testSingleEvent)
+{
+    auto f1 = std::async(std::launch::async,
+                         &LockFreeEventQueue<Event, 16>::nextEvent,
+                         &eq_);
+
+    std::thread t1(&LockFreeEventQueue<Event, 16>::addEvent, &eq_, e1);
+
+    Event actualEvent1 = f1.get();
+    t1.join();
+    EXPECT_EQ(actualEvent1.id, e1.id);
+    EXPECT_TRUE(eq_.empty());
+}
+
+TEST_F(TestLockFreeEventQueue, testFullQueue)
+{
+    for (int i = 0; i < 16; i++) {
+        ASSERT_TRUE(eq_.tryAddEvent(i % 2 ? e1 : e2));
+    }
+    EXPECT_EQ(eq_.size(), 16u);
+    EXPECT_FALSE(eq_.tryAddEvent(e1));
+
+    EXPECT_EQ(eq_.nextEvent(), e2);
+    EXPECT_TRUE(eq_.tryAddEvent(e1));
+}
+
+TEST_F(TestLockFreeEventQueue, testStopInterruptsConsumer)
+{
+    auto f1 = std::async(std::launch::async,
+                         &LockFreeEventQueue<Event, 16>::nextEvent,
+                         &eq_);
+    eq_.stop();
+    EXPECT_THROW(f1.get(), EventQueueInterruptedException);
+}
+
+TEST_F(TestLockFreeEventQueue, testTryNextEventReturnsFalseOnStop)
+{
+    eq_.addEvent(e1);
+    eq_.addEvent(e2);
+    std::vector<Event> batch;
+    EXPECT_EQ(eq_.tryNextEvents(std::back_inserter(batch), 8), 2u);
+
+    auto waiter = std::async(std::launch::async, [this] {
+        Event e = Event::dummy_event;
+        return eq_.tryNextEvent(e);
+    });
+    eq_.stop();
+    EXPECT_FALSE(waiter.get());
+}
+
+TEST_F(TestLockFreeEventQueue, testFifoPerProducer)
+{
+    const int NPRODUCERS = 8;
+    const int NEVENTS = 1000;
+
+    std::vector<Event> producerEvents(NPRODUCERS);
+    std::vector<std::thread> producers;
+    for (auto const& e : producerEvents) {
+        producers.emplace_back([this, &e] {
+            for (int i = 0; i < NEVENTS; i++) {
+                eq_.addEvent(e);
+            }
+        });
+    }
+
+    // Count the events per producer. The ring is far smaller than the number
+    // of events, so producers have to wait for the consumer.
+    std::map<Event, int> counts;
+    for (int i = 0; i < NPRODUCERS * NEVENTS; i++) {
+        counts[eq_.nextEvent()]++;
+    }
+    for (auto&& t : producers) {
+        t.join();
+    }
+
+    EXPECT_TRUE(eq_.empty());
+    for (auto const& e : producerEvents) {
+        EXPECT_EQ(counts[e], NEVENTS);
+    }
+}
+
+TEST_F(TestEventQueue, testBatchAddAndDrain)
+{
+    std::vector<Event> v(10);
+    eq_.addEvents(v.begin(), v.end());
+    EXPECT_EQ(eq_.size(), 10u);
+
+    std::vector<Event> out;
+    EXPECT_EQ(eq_.nextEvents(std::back_inserter(out), 4), 4u);
+    EXPECT_EQ(eq_.nextEvents(std::back_inserter(out), 100), 6u);
+    EXPECT_TRUE(eq_.empty());
+    EXPECT_EQ(out, v);
+}
+
+TEST_F(TestLockFreeEventQueue, testBatchAddAndDrain)
+{
+    // Larger than the ring, so addEvents has to wait for the consumer.
+    std::vector<Event> v(100);
+    std::thread producer([this, &v] { eq_.addEvents(v.begin(), v.end()); });
+
+    std::vector<Event> out;
+    while (out.size() < v.size()) {
+        eq_.nextEvents(std::back_inserter(out), 7);
+    }
+    producer.join();
+    EXPECT_TRUE(eq_.empty());
+    EXPECT_EQ(out, v);
+}
@@ -0,0 +1,238 @@
+#include "tsm.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using tsm::Event;
+using tsm::IHsmDef;
+using tsm::ParentThreadExecutionPolicy;
+using tsm::State;
+using tsm::StateMachine;
+using tsm::StateMachineDef;
+using tsm::TraceBuffer;
+using tsm::TraceRecord;
+using tsm::TraceRecorder;
+
+namespace {
+
+using Kind = TraceRecord::Kind;
+
+struct SongsDef : public StateMachineDef<SongsDef>
+{
+    SongsDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<SongsDef>("Songs", parent)
+      , first("First")
+      , second("Second")
+      , repeat(false)
+    {
+        add(first, next_song, second);
+        add(second, next_song, first, nullptr, [this] { return repeat; });
+    }
+
+    State* getStartState() override { return &first; }
+    State* getStopState() override { return nullptr; }
+
+    State first;
+    State second;
+
+    Event next_song;
+
+    bool repeat;
+};
+
+struct PlayerDef : public StateMachineDef<PlayerDef>
+{
+    PlayerDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<PlayerDef>("Player", parent)
+      , stopped("Stopped")
+      , songs(this)
+      , paused("Paused")
+    {
+        add(stopped, play, songs);
+        add(songs, pause, paused);
+        add(paused, play, songs.shallowHistory);
+        add(songs, stop_event, stopped);
+        add(paused, stop_event, stopped);
+        defer(paused, songs.next_song);
+    }
+
+    State* getStartState() override { return &stopped; }
+    State* getStopState() override { return nullptr; }
+
+    State stopped;
+    StateMachine<SongsDef, TraceRecorder> songs;
+    State paused;
+
+    Event play;
+    Event pause;
+    Event stop_event;
+};
+
+using Player =
+  ParentThreadExecutionPolicy<StateMachine<PlayerDef, TraceRecorder>>;
+
+void
+attach(Player& sm, TraceBuffer& trace, std::uint32_t machine)
+{
+    sm.getTracer().attach(trace, machine);
+    sm.songs.getTracer().attach(trace, machine);
+}
+
+// Everything but the time and the machine id.
+bool
+sameSteps(std::vector<TraceRecord> const& a, std::vector<TraceRecord> const& b)
+{
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        if (a[i].kind != b[i].kind || a[i].from != b[i].from ||
+            a[i].fromSpace != b[i].fromSpace || a[i].to != b[i].to ||
+            a[i].toSpace != b[i].toSpace || a[i].event != b[i].event ||
+            a[i].space != b[i].space) {
+            return false;
+        }
+    }
+    return true;
+}
+
+TraceRecord
+numbered(std::int64_t n)
+{
+    TraceRecord r{};
+    r.time = n;
+    return r;
+}
+
+} // namespace
+
+TEST(TestEventTrace, testRecordsEveryHook)
+{
+    TraceBuffer trace;
+    Player sm;
+    attach(sm, trace, 3);
+    sm.startSM();
+    for (Event const* e :
+         { &sm.play, &sm.songs.next_song, &sm.songs.next_song, &sm.play }) {
+        sm.sendEvent(*e);
+    }
+    sm.stepAll();
+
+    std::vector<TraceRecord> records = trace.dump();
+    ASSERT_EQ(records.size(), 4u);
+    EXPECT_EQ(trace.recorded(), 4u);
+    EXPECT_EQ(records[0].kind, Kind::Transition);
+    EXPECT_EQ(records[0].from, sm.stopped.id);
+    EXPECT_EQ(records[0].fromSpace, sm.stopped.space);
+    EXPECT_EQ(records[0].to, sm.songs.id);
+    EXPECT_EQ(records[0].toSpace, sm.songs.space);
+    EXPECT_EQ(records[0].event, sm.play.id);
+    EXPECT_EQ(records[1].from, sm.songs.first.id);
+    EXPECT_EQ(records[1].fromSpace, sm.songs.first.space);
+    EXPECT_EQ(records[1].to, sm.songs.second.id);
+    EXPECT_EQ(records[1].toSpace, sm.songs.second.space);
+    // The sub HSM's states are told apart from the parent's by their space
+    EXPECT_NE(records[1].fromSpace, records[0].fromSpace);
+    EXPECT_EQ(records[2].kind, Kind::GuardRejected);
+    EXPECT_EQ(records[2].from, sm.songs.second.id);
+    EXPECT_EQ(records[2].fromSpace, sm.songs.second.space);
+    EXPECT_EQ(records[2].to, TraceRecord::None);
+    EXPECT_EQ(records[2].toSpace, TraceRecord::None);
+    EXPECT_EQ(records[3].kind, Kind::Unhandled);
+    EXPECT_EQ(records[3].from, TraceRecord::None);
+    EXPECT_EQ(records[3].fromSpace, TraceRecord::None);
+    EXPECT_EQ(records[3].space, sm.play.space);
+    for (TraceRecord const& r : records) {
+        EXPECT_EQ(r.machine, 3u);
+    }
+    EXPECT_LE(records[0].time, records[3].time);
+}
+
+TEST(TestEventTrace, testRingKeepsTheLatestRecords)
+{
+    TraceBuffer trace(3);
+    EXPECT_EQ(trace.capacity(), 4u);
+    for (int i = 0; i < 10; ++i) {
+        trace.record(numbered(i));
+    }
+    std::vector<TraceRecord> records = trace.dump();
+    ASSERT_EQ(records.size(), 4u);
+    EXPECT_EQ(records.front().time, 6);
+    EXPECT_EQ(records.back().time, 9);
+}
+
+TEST(TestEventTrace, testDumpWhileRecording)
+{
+    TraceBuffer trace(64);
+    std::atomic<bool> done(false);
+    std::thread writer([&] {
+        for (std::int64_t i = 0; i < 200000; ++i) {
+            trace.record(numbered(i));
+        }
+        done = true;
+    });
+    do {
+        std::vector<TraceRecord> records = trace.dump();
+        for (std::size_t i = 1; i < records.size(); ++i) {
+            ASSERT_EQ(records[i].time, records[i - 1].time + 1);
+        }
+    } while (!done);
+    writer.join();
+}
+
+TEST(TestEventTrace, testWrittenAndRead)
+{
+    TraceBuffer trace;
+    for (int i = 0; i < 5; ++i) {
+        trace.record(numbered(i));
+    }
+    std::stringstream file;
+    tsm::writeTrace(file, trace.dump());
+    std::vector<TraceRecord> records = tsm::readTrace(file);
+    ASSERT_EQ(records.size(), 5u);
+    EXPECT_EQ(records[4].time, 4);
+
+    std::stringstream garbage("not a trace at all");
+    EXPECT_THROW(tsm::readTrace(garbage), std::invalid_argument);
+}
+
+TEST(TestEventTrace, testReplayReproducesTheRun)
+{
+    TraceBuffer trace;
+    Player recorded;
+    attach(recorded, trace, 1);
+    recorded.startSM();
+    recorded.songs.repeat = true;
+    for (Event const* e : { &recorded.play,
+                            &recorded.songs.next_song,
+                            &recorded.pause,
+                            &recorded.songs.next_song, // deferred
+                            &recorded.play,            // replays next_song
+                            &recorded.songs.next_song,
+                            &recorded.stop_event,
+                            &recorded.pause }) {
+        recorded.sendEvent(*e);
+    }
+    recorded.stepAll();
+    std::stringstream file;
+    tsm::writeTrace(file, trace.dump());
+
+    std::vector<TraceRecord> records = tsm::readTrace(file);
+    TraceBuffer replayed;
+    Player fresh;
+    attach(fresh, replayed, 1);
+    fresh.startSM();
+    fresh.songs.repeat = true;
+    EXPECT_EQ(tsm::replayTrace(fresh, records.begin(), records.end(), 1),
+              records.size());
+    EXPECT_TRUE(sameSteps(replayed.dump(), records));
+    EXPECT_EQ(fresh.getCurrentState()->id, recorded.getCurrentState()->id);
+
+    // Records of other machines are skipped
+    EXPECT_EQ(tsm::replayTrace(fresh, records.begin(), records.end(), 2), 0u);
+}
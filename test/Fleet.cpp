@@ -0,0 +1,98 @@
+#include "GarageDoorSM.h"
+#include "TestMachines.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+using tsm::Fleet;
+using tsm::FleetEvent;
+using tsm::MachineInstance;
+using tsm::SharedDefinition;
+
+using tsmtest::AHsmDef;
+using tsmtest::GarageDoorDef;
+
+namespace {
+
+///
+/// Apply a random batch to a fleet and, one event at a time in batch order,
+/// to a MachineInstance per fleet member; they have to end up in the same
+/// states.
+///
+template<typename HSMDef>
+void
+checkBatchMatchesInstances(std::size_t size, std::size_t batchSize)
+{
+    SharedDefinition<HSMDef> def;
+    Fleet<HSMDef> fleet(def, size);
+    std::vector<MachineInstance<HSMDef>> instances(
+      size, MachineInstance<HSMDef>(def));
+    for (auto& instance : instances) {
+        instance.startSM();
+    }
+
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<std::uint32_t> instance(0, size - 1);
+    std::uniform_int_distribution<std::uint32_t> event(
+      0, def.events().size() - 1);
+    std::vector<FleetEvent> batch(batchSize);
+    for (auto& fe : batch) {
+        fe = FleetEvent{ instance(rng), event(rng) };
+    }
+
+    fleet.apply(batch.data(), batch.size());
+    for (auto const& fe : batch) {
+        instances[fe.instance].execute(def.events()[fe.event]);
+    }
+    for (std::size_t i = 0; i < size; ++i) {
+        ASSERT_EQ(fleet.getCurrentState(i), instances[i].getCurrentState())
+          << "instance " << i;
+    }
+}
+
+} // namespace
+
+TEST(TestFleet, testFlatFleetUsesNextStateTable)
+{
+    SharedDefinition<GarageDoorDef> def;
+    EXPECT_TRUE(def.isPlain());
+    checkBatchMatchesInstances<GarageDoorDef>(100, 5000);
+}
+
+TEST(TestFleet, testHierarchicalFleetMatchesInstances)
+{
+    SharedDefinition<AHsmDef> def;
+    EXPECT_FALSE(def.isPlain());
+    checkBatchMatchesInstances<AHsmDef>(100, 5000);
+}
+
+TEST(TestFleet, testBroadcast)
+{
+    SharedDefinition<GarageDoorDef> def;
+    auto& door = def.prototype();
+    Fleet<GarageDoorDef> fleet(def, 10000);
+    auto click = fleet.eventIndex(door.click_event);
+    auto top = fleet.eventIndex(door.topSensor_event);
+
+    std::vector<FleetEvent> half;
+    for (std::uint32_t i = 0; i < fleet.size(); i += 2) {
+        half.push_back(FleetEvent{ i, click });
+    }
+    fleet.apply(half.data(), half.size());
+    fleet.broadcast(top);
+
+    for (std::size_t i = 0; i < fleet.size(); ++i) {
+        EXPECT_EQ(fleet.getCurrentState(i),
+                  i % 2 ? &door.doorClosed : &door.doorOpen);
+    }
+}
+
+TEST(TestFleet, testUnknownEventThrows)
+{
+    SharedDefinition<GarageDoorDef> def;
+    Fleet<GarageDoorDef> fleet(def, 1);
+    Event stray;
+    EXPECT_THROW(fleet.eventIndex(stray), std::out_of_range);
+}
@@ -1,6 +1,8 @@
 #include "GarageDoorSM.h"
 #include "Observer.h"
 
+#include <gtest/gtest.h>
+
 using tsm::AsyncExecWithObserver;
 using tsm::BlockingObserver;
 using tsm::SimpleStateMachine;
@@ -18,7 +20,7 @@ struct TestGarageDoorSM : public ::testing::Test
     TestGarageDoorSM()
       : testing::Test()
     {}
-    ~TestGarageDoorSM() { tsm::UniqueId::reset(); }
+    ~TestGarageDoorSM() = default;
 };
 
 ///
@@ -69,3 +71,54 @@ TEST_F(TestGarageDoorSM, testGarageDoorParentThreadPolicy)
 
     sm->stopSM();
 }
+
+///
+/// The same garage door, running on the lock-free event queue.
+///
+using GarageDoorHSMLockFree =
+  tsm::AsyncExecWithObserver<StateMachine<GarageDoorDef>,
+                             BlockingObserver,
+                             tsm::LockFreeEventQueue<tsm::Event>>;
+
+TEST_F(TestGarageDoorSM, testGarageDoorLockFreeQueue)
+{
+    auto sm = std::make_shared<GarageDoorHSMLockFree>();
+
+    sm->startSM();
+
+    sm->wait();
+    ASSERT_EQ(sm->getCurrentState(), &sm->doorClosed);
+
+    sm->sendEvent(sm->click_event);
+    sm->wait();
+    ASSERT_EQ(sm->getCurrentState(), &sm->doorOpening);
+
+    sm->sendEvent(sm->topSensor_event);
+    sm->wait();
+    ASSERT_EQ(sm->getCurrentState(), &sm->doorOpen);
+
+    sm->stopSM();
+}
+
+TEST_F(TestGarageDoorSM, testGarageDoorParentThreadBatch)
+{
+    SimpleStateMachine<GarageDoorDef> sm;
+    std::vector<tsm::Event> events{ sm.click_event,
+                                    sm.topSensor_event,
+                                    sm.click_event,
+                                    sm.bottomSensor_event };
+
+    sm.startSM();
+    sm.sendEvents(events.begin(), events.end());
+
+    ASSERT_EQ(sm.drain(2), 2u);
+    ASSERT_EQ(sm.getCurrentState(), &sm.doorOpen);
+
+    ASSERT_EQ(sm.stepAll(), 2u);
+    ASSERT_EQ(sm.getCurrentState(), &sm.doorClosed);
+
+    // Nothing left to do
+    ASSERT_EQ(sm.stepAll(), 0u);
+
+    sm.stopSM();
+}
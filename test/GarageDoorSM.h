@@ -1,19 +1,24 @@
-#include "tsm.h"
+#pragma once
 
-#include <glog/logging.h>
-#include <gtest/gtest.h>
+#include "tsm.h"
 
 using tsm::Event;
 using tsm::EventQueue;
+using tsm::HashedTransitionTable;
 using tsm::State;
 using tsm::StateMachineDef;
 
 namespace tsmtest {
-struct GarageDoorDef : public StateMachineDef<GarageDoorDef>
+/// The garage door, with a choice of transition table.
+template<template<typename> class TransitionTableT = HashedTransitionTable>
+struct GarageDoorDefT
+  : public StateMachineDef<GarageDoorDefT<TransitionTableT>, TransitionTableT>
 {
+    using StateMachineDef<GarageDoorDefT, TransitionTableT>::add;
 
-    GarageDoorDef(IHsmDef* parent = nullptr)
-      : StateMachineDef<GarageDoorDef>("Garage Door HSM", parent)
+    GarageDoorDefT(tsm::IHsmDef* parent = nullptr)
+      : StateMachineDef<GarageDoorDefT, TransitionTableT>("Garage Door HSM",
+                                                          parent)
       , doorOpen("Door Open")
       , doorOpening("Door Opening")
       , doorClosing("Door Closing")
@@ -34,7 +39,7 @@ struct GarageDoorDef : public StateMachineDef<GarageDoorDef>
         add(doorClosed, click_event, doorOpening);
     }
 
-    virtual ~GarageDoorDef() = default;
+    virtual ~GarageDoorDefT() = default;
 
     State* getStartState() override { return &doorClosed; }
     State* getStopState() override { return nullptr; }
@@ -54,4 +59,6 @@ struct GarageDoorDef : public StateMachineDef<GarageDoorDef>
     Event obstruct_event;
 };
 
+using GarageDoorDef = GarageDoorDefT<>;
+
 } // namespace tsmtest
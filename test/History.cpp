@@ -0,0 +1,167 @@
+#include "tsm.h"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+
+using tsm::Event;
+using tsm::IHsmDef;
+using tsm::SharedDefinition;
+using tsm::State;
+using tsm::StateMachine;
+using tsm::StateMachineDef;
+
+namespace {
+
+/// A start state with expensive initialization, counted.
+struct InitState : public State
+{
+    InitState(std::string const& name)
+      : State(name)
+      , inits(0)
+    {}
+
+    void execute(Event const&) override { ++inits; }
+
+    int inits;
+};
+
+struct JobDef : public StateMachineDef<JobDef>
+{
+    JobDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<JobDef>("Job", parent)
+      , idle("Idle")
+      , busy("Busy")
+    {
+        add(idle, work, busy);
+        add(busy, done, idle);
+    }
+
+    State* getStartState() override { return &idle; }
+    State* getStopState() override { return nullptr; }
+
+    InitState idle;
+    State busy;
+
+    Event work;
+    Event done;
+};
+
+struct WorkerDef : public StateMachineDef<WorkerDef>
+{
+    WorkerDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<WorkerDef>("Worker", parent)
+      , job(this)
+      , ready("Ready")
+    {
+        add(ready, go, job);
+    }
+
+    State* getStartState() override { return &ready; }
+    State* getStopState() override { return nullptr; }
+
+    StateMachine<JobDef> job;
+    InitState ready;
+
+    Event go;
+};
+
+struct HostDef : public StateMachineDef<HostDef>
+{
+    HostDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<HostDef>("Host", parent)
+      , worker(this)
+      , off("Off")
+    {
+        add(off, boot, worker);
+        add(off, wake, worker.shallowHistory);
+        add(off, thaw, worker.deepHistory);
+        add(worker, suspend, off);
+    }
+
+    State* getStartState() override { return &off; }
+    State* getStopState() override { return nullptr; }
+
+    StateMachine<WorkerDef> worker;
+    State off;
+
+    Event boot;
+    Event wake;
+    Event thaw;
+    Event suspend;
+};
+
+struct Host : public StateMachine<HostDef>
+{
+    void send(Event const& e) { dispatch(this)->execute(e); }
+
+    /// Boot, start the job, suspend.
+    void suspendBusy()
+    {
+        startSM();
+        send(boot);
+        send(worker.go);
+        send(worker.job.work);
+        send(suspend);
+    }
+
+    State* leaf() { return dispatch(this)->getCurrentState(); }
+};
+
+} // namespace
+
+TEST(TestHistory, testShallowHistoryResumesTheTopLevelOnly)
+{
+    Host host;
+    host.suspendBusy();
+    ASSERT_EQ(host.getCurrentState(), &host.off);
+    EXPECT_EQ(host.worker.job.getCurrentState(), nullptr);
+
+    host.send(host.wake);
+    EXPECT_EQ(host.getCurrentState(), &host.worker);
+    EXPECT_EQ(host.worker.getCurrentState(), &host.worker.job);
+    // The job itself is entered afresh
+    EXPECT_EQ(host.leaf(), &host.worker.job.idle);
+    EXPECT_EQ(host.worker.ready.inits, 1);
+    EXPECT_EQ(host.worker.job.idle.inits, 2);
+}
+
+TEST(TestHistory, testDeepHistoryResumesEveryLevel)
+{
+    Host host;
+    host.suspendBusy();
+
+    host.send(host.thaw);
+    EXPECT_EQ(host.getCurrentState(), &host.worker);
+    EXPECT_EQ(host.leaf(), &host.worker.job.busy);
+    EXPECT_EQ(host.worker.ready.inits, 1);
+    EXPECT_EQ(host.worker.job.idle.inits, 1);
+
+    // The resumed machine carries on from there
+    host.send(host.worker.job.done);
+    EXPECT_EQ(host.leaf(), &host.worker.job.idle);
+}
+
+TEST(TestHistory, testOtherTransitionsStartOver)
+{
+    Host host;
+    host.suspendBusy();
+
+    host.send(host.boot);
+    EXPECT_EQ(host.worker.getCurrentState(), &host.worker.ready);
+    EXPECT_EQ(host.worker.ready.inits, 2);
+}
+
+TEST(TestHistory, testHistoryOfAnHsmNeverExitedIsItsStartState)
+{
+    Host host;
+    host.startSM();
+    host.send(host.thaw);
+    EXPECT_EQ(host.worker.getCurrentState(), &host.worker.ready);
+    EXPECT_EQ(host.worker.ready.inits, 1);
+}
+
+TEST(TestHistory, testSharedDefinitionRejectsHistory)
+{
+    EXPECT_THROW(SharedDefinition<HostDef>(), std::invalid_argument);
+}
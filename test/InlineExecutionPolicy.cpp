@@ -0,0 +1,176 @@
+#include "GarageDoorSM.h"
+#include "tsm.h"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <vector>
+
+using tsm::Event;
+using tsm::IHsmDef;
+using tsm::InlineExecutionPolicy;
+using tsm::InlineStateMachine;
+using tsm::MetricsSnapshot;
+using tsm::MetricsTracer;
+using tsm::ParentThreadExecutionPolicy;
+using tsm::State;
+using tsm::StateMachine;
+using tsm::StateMachineDef;
+
+using tsmtest::GarageDoorDef;
+
+namespace {
+
+///
+/// a -> b -> c -> a in a ring. Leaving a, the action sends hop and then
+/// back; each is only handled once the event in progress completes.
+///
+template<typename Policy>
+struct RingDef : public StateMachineDef<RingDef<Policy>>
+{
+    using StateMachineDef<RingDef<Policy>>::add;
+
+    RingDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<RingDef<Policy>>("Ring", parent)
+      , a("a")
+      , b("b")
+      , c("c")
+      , sm(nullptr)
+      , fail(false)
+    {
+        add(a, go, b, [this] {
+            visited.push_back(sm->getCurrentState());
+            sm->processEventNow(hop);
+            sm->processEventNow(back);
+            visited.push_back(sm->getCurrentState());
+            if (fail) {
+                throw std::runtime_error("action failed");
+            }
+        });
+        add(b, hop, c, [this] { visited.push_back(sm->getCurrentState()); });
+        add(c, back, a, [this] { visited.push_back(sm->getCurrentState()); });
+    }
+
+    State* getStartState() override { return &a; }
+    State* getStopState() override { return nullptr; }
+
+    State a;
+    State b;
+    State c;
+
+    Event go;
+    Event hop;
+    Event back;
+
+    Policy* sm;
+    bool fail;
+    std::vector<State*> visited;
+};
+
+template<typename Tracer>
+struct InlineRing
+  : InlineExecutionPolicy<StateMachine<RingDef<InlineRing<Tracer>>, Tracer>>
+{
+    InlineRing() { this->sm = this; }
+};
+
+struct QueuedRing
+  : ParentThreadExecutionPolicy<StateMachine<RingDef<QueuedRing>>>
+{
+    QueuedRing() { this->sm = this; }
+};
+
+} // namespace
+
+TEST(TestInlineExecutionPolicy, testEventsAreHandledOnSend)
+{
+    InlineStateMachine<GarageDoorDef> sm;
+    sm.startSM();
+    sm.sendEvent(sm.click_event);
+    EXPECT_EQ(sm.getCurrentState(), &sm.doorOpening);
+    std::vector<Event> events = { sm.topSensor_event, sm.click_event };
+    sm.sendEvents(events.begin(), events.end());
+    EXPECT_EQ(sm.getCurrentState(), &sm.doorClosing);
+    sm.stopSM();
+}
+
+TEST(TestInlineExecutionPolicy, testEventsFromActionsRunToCompletion)
+{
+    InlineRing<tsm::NullTracer> sm;
+    sm.startSM();
+    sm.processEventNow(sm.go);
+
+    // Both events sent from the first action waited for it to complete
+    std::vector<State*> expected = { &sm.a, &sm.a, &sm.b, &sm.c };
+    EXPECT_EQ(sm.visited, expected);
+    EXPECT_EQ(sm.getCurrentState(), &sm.a);
+    EXPECT_EQ(sm.pending(), 0u);
+}
+
+TEST(TestInlineExecutionPolicy, testThrowingActionDropsHeldBackEvents)
+{
+    InlineRing<tsm::NullTracer> sm;
+    sm.startSM();
+    sm.fail = true;
+    EXPECT_THROW(sm.processEventNow(sm.go), std::runtime_error);
+    EXPECT_EQ(sm.pending(), 0u);
+
+    EXPECT_EQ(sm.getCurrentState(), &sm.a);
+
+    // Not left processing: the next event runs as if nothing happened
+    sm.fail = false;
+    sm.visited.clear();
+    sm.processEventNow(sm.go);
+    std::vector<State*> expected = { &sm.a, &sm.a, &sm.b, &sm.c };
+    EXPECT_EQ(sm.visited, expected);
+}
+
+TEST(TestInlineExecutionPolicy, testMetricsCountEveryEvent)
+{
+    InlineRing<MetricsTracer> sm;
+    sm.getTracer().metrics.setSampleInterval(1);
+    sm.startSM();
+    sm.processEventNow(sm.go);
+
+    MetricsSnapshot s = sm.getTracer().metrics.snapshot();
+    EXPECT_EQ(s.eventsSent, 3u);
+    EXPECT_EQ(s.eventsProcessed, 3u);
+    EXPECT_EQ(s.transitions, 3u);
+    EXPECT_EQ(s.queueDepth, 0u);
+}
+
+TEST(TestParentThreadExecutionPolicy, testProcessEventNowSkipsTheQueue)
+{
+    QueuedRing sm;
+    sm.startSM();
+    sm.sendEvent(sm.hop);
+    sm.processEventNow(sm.go);
+
+    // go ran first; its action's events queued behind hop
+    EXPECT_EQ(sm.getCurrentState(), &sm.b);
+    std::vector<State*> expected = { &sm.a, &sm.a };
+    EXPECT_EQ(sm.visited, expected);
+    EXPECT_EQ(sm.stepAll(), 3u);
+    EXPECT_EQ(sm.getCurrentState(), &sm.a);
+}
+
+TEST(TestParentThreadExecutionPolicy, testEventsFromActionsWaitForSteps)
+{
+    QueuedRing sm;
+    sm.startSM();
+    sm.sendEvent(sm.go);
+    sm.sendEvent(sm.go); // unhandled in b
+    sm.step();
+
+    // hop and back were queued behind the second go, and step ran none
+    EXPECT_EQ(sm.getCurrentState(), &sm.b);
+    EXPECT_EQ(sm.getEventQueue().size(), 3u);
+    sm.step();
+    EXPECT_EQ(sm.getCurrentState(), &sm.b);
+    sm.step();
+    EXPECT_EQ(sm.getCurrentState(), &sm.c);
+    sm.step();
+    EXPECT_EQ(sm.getCurrentState(), &sm.a);
+    std::vector<State*> expected = { &sm.a, &sm.a, &sm.b, &sm.c };
+    EXPECT_EQ(sm.visited, expected);
+}
@@ -0,0 +1,208 @@
+#include "CdPlayerHSM.h"
+#include "GarageDoorSM.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using tsm::DenseTransitionTable;
+using tsm::Event;
+using tsm::IHsmDef;
+using tsm::InlineStateMachine;
+using tsm::MachineFleet;
+using tsm::SimpleStateMachine;
+using tsm::State;
+using tsm::StateMachineDef;
+using tsm::ThreadPool;
+
+using tsmtest::CdPlayerController;
+using tsmtest::CdPlayerDef;
+using tsmtest::GarageDoorDefT;
+
+namespace {
+
+std::atomic<int> liveLamps(0);
+
+struct LampDef : public StateMachineDef<LampDef>
+{
+    LampDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<LampDef>("Lamp", parent)
+      , off("Off")
+      , on("On")
+      , builtOn(std::this_thread::get_id())
+    {
+        add(off, toggle, on);
+        add(on, toggle, off);
+        ++liveLamps;
+    }
+
+    ~LampDef() override { --liveLamps; }
+
+    State* getStartState() override { return &off; }
+    State* getStopState() override { return nullptr; }
+
+    State off;
+    State on;
+
+    Event toggle;
+
+    std::thread::id builtOn;
+};
+
+using Lamp = SimpleStateMachine<LampDef>;
+using CdPlayer = SimpleStateMachine<CdPlayerDef<CdPlayerController>>;
+using Range = std::pair<std::size_t, std::size_t>;
+
+} // namespace
+
+TEST(TestMachineFleet, testAllStartAndStop)
+{
+    ThreadPool pool(3);
+    MachineFleet<CdPlayer> fleet(10000, 4, pool);
+    ASSERT_EQ(fleet.size(), 10000u);
+    fleet.startAll();
+    for (std::size_t i = 0; i < fleet.size(); ++i) {
+        ASSERT_EQ(fleet[i].getCurrentState(), &fleet[i].Empty);
+    }
+
+    // Every instance has the ids of the definition
+    CdPlayer single;
+    EXPECT_EQ(fleet[0].Empty.id, single.Empty.id);
+    EXPECT_EQ(fleet[9999].cd_detected.id, single.cd_detected.id);
+    EXPECT_EQ(fleet[9999].cd_detected.space, single.cd_detected.space);
+
+    fleet[7].sendEvent(fleet[7].cd_detected);
+    fleet[7].step();
+    EXPECT_EQ(fleet[7].getCurrentState(), &fleet[7].Stopped);
+
+    fleet.stopAll();
+    for (std::size_t i = 0; i < fleet.size(); ++i) {
+        ASSERT_EQ(fleet[i].getCurrentState(), nullptr);
+    }
+}
+
+TEST(TestMachineFleet, testPartitionsAreContiguousAndFixed)
+{
+    ThreadPool pool(2);
+    MachineFleet<Lamp> fleet(10, 3, pool);
+    ASSERT_EQ(fleet.numPartitions(), 3u);
+    EXPECT_EQ(fleet.partition(0), Range(0, 3));
+    EXPECT_EQ(fleet.partition(1), Range(3, 6));
+    EXPECT_EQ(fleet.partition(2), Range(6, 10));
+    for (std::size_t i = 0; i < fleet.size(); ++i) {
+        auto range = fleet.partition(fleet.partitionOf(i));
+        EXPECT_LE(range.first, i);
+        EXPECT_LT(i, range.second);
+    }
+
+    // A partition is built on one thread
+    for (std::size_t p = 0; p < fleet.numPartitions(); ++p) {
+        auto range = fleet.partition(p);
+        for (std::size_t i = range.first; i < range.second; ++i) {
+            EXPECT_EQ(fleet[i].builtOn, fleet[range.first].builtOn);
+        }
+    }
+
+    // No more partitions than instances
+    MachineFleet<Lamp> small(2, 8, pool);
+    EXPECT_EQ(small.numPartitions(), 2u);
+    MachineFleet<Lamp> empty(0, 8, pool);
+    EXPECT_EQ(empty.numPartitions(), 1u);
+    empty.startAll();
+}
+
+TEST(TestMachineFleet, testForEachVisitsEveryMachineOnce)
+{
+    ThreadPool pool(4);
+    MachineFleet<Lamp> fleet(1000, 8, pool);
+    fleet.startAll();
+    std::vector<int> visits(fleet.size(), 0);
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    fleet.forEach([&](Lamp& lamp, std::size_t i) {
+        ++visits[i];
+        if (i % 2) {
+            lamp.processEventNow(lamp.toggle);
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.insert(std::this_thread::get_id());
+    });
+    EXPECT_LE(threads.size(), 5u);
+    for (std::size_t i = 0; i < fleet.size(); ++i) {
+        ASSERT_EQ(visits[i], 1);
+        ASSERT_EQ(fleet[i].getCurrentState(),
+                  i % 2 ? &fleet[i].on : &fleet[i].off);
+    }
+}
+
+TEST(TestMachineFleet, testDestroysEveryMachine)
+{
+    ThreadPool pool(2);
+    {
+        MachineFleet<Lamp> fleet(500, 4, pool);
+        EXPECT_EQ(liveLamps.load(), 500);
+        fleet.startAll();
+    }
+    EXPECT_EQ(liveLamps.load(), 0);
+}
+
+TEST(TestMachineFleet, testBuiltOnAWorkerOfItsPool)
+{
+    // With a single worker busy building, nothing else would run the tasks
+    ThreadPool pool(1);
+    struct Build : public ThreadPool::Task
+    {
+        void run() override
+        {
+            bool ok;
+            {
+                MachineFleet<Lamp> fleet(100, 4, *pool);
+                fleet.startAll();
+                ok = fleet[99].getCurrentState() == &fleet[99].off;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            started = ok;
+            done = true;
+            cv.notify_one();
+        }
+
+        ThreadPool* pool;
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool started = false;
+        bool done = false;
+    } build;
+    build.pool = &pool;
+    pool.submit(&build);
+    std::unique_lock<std::mutex> lock(build.mutex);
+    build.cv.wait(lock, [&] { return build.done; });
+    EXPECT_TRUE(build.started);
+}
+
+TEST(TestMachineFleet, testMachinesOfOnePartitionRunOnManyThreads)
+{
+    // The first lookup compiles the dense table, on each machine's thread
+    using Door = InlineStateMachine<GarageDoorDefT<DenseTransitionTable>>;
+    ThreadPool pool(1);
+    MachineFleet<Door> fleet(8, 1, pool);
+    fleet.startAll();
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < fleet.size(); ++i) {
+        threads.emplace_back([&fleet, i] {
+            Door& door = fleet[i];
+            door.sendEvent(door.click_event);
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    for (std::size_t i = 0; i < fleet.size(); ++i) {
+        EXPECT_EQ(fleet[i].getCurrentState(), &fleet[i].doorOpening);
+    }
+}
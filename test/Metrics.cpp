@@ -0,0 +1,220 @@
+#include "CdPlayerHSM.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using tsm::AsyncExecutionPolicy;
+using tsm::Event;
+using tsm::IHsmDef;
+using tsm::LatencyHistogram;
+using tsm::MachineMetrics;
+using tsm::MetricsSnapshot;
+using tsm::MetricsTracer;
+using tsm::TransitionTime;
+using tsm::ParentThreadExecutionPolicy;
+using tsm::State;
+using tsm::StateMachine;
+using tsm::StateMachineDef;
+
+namespace {
+
+struct ValveDef : public StateMachineDef<ValveDef>
+{
+    ValveDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<ValveDef>("Valve", parent)
+      , shut("Shut")
+      , open("Open")
+      , enabled(true)
+    {
+        add(shut, turn, open, nullptr, [this] { return enabled; });
+        add(open, turn, shut);
+    }
+
+    State* getStartState() override { return &shut; }
+    State* getStopState() override { return nullptr; }
+
+    State shut;
+    State open;
+
+    Event turn;
+    Event flush;
+
+    bool enabled;
+};
+
+using MeteredValve =
+  ParentThreadExecutionPolicy<StateMachine<ValveDef, MetricsTracer>>;
+
+using AsyncMeteredValve =
+  AsyncExecutionPolicy<StateMachine<ValveDef, MetricsTracer>>;
+
+using MeteredCdPlayer = ParentThreadExecutionPolicy<
+  StateMachine<tsmtest::CdPlayerDef<tsmtest::CdPlayerController>,
+               MetricsTracer>>;
+
+} // namespace
+
+TEST(TestMetrics, testHistogramBuckets)
+{
+    EXPECT_EQ(LatencyHistogram::bucketOf(0), 0u);
+    EXPECT_EQ(LatencyHistogram::bucketOf(1), 1u);
+    EXPECT_EQ(LatencyHistogram::bucketOf(3), 2u);
+    EXPECT_EQ(LatencyHistogram::bucketOf(1000), 10u);
+    EXPECT_EQ(LatencyHistogram::bucketOf(~0ull), 63u);
+
+    LatencyHistogram h;
+    for (int i = 0; i < 90; ++i) {
+        h.record(100);
+    }
+    for (int i = 0; i < 10; ++i) {
+        h.record(5000);
+    }
+    auto s = h.snapshot();
+    EXPECT_EQ(s.count, 100u);
+    EXPECT_EQ(s.max, 5000u);
+    EXPECT_EQ(s.mean(), 590u);
+    EXPECT_EQ(s.percentile(0.5), 128u);
+    EXPECT_EQ(s.percentile(0.99), 8192u);
+}
+
+TEST(TestMetrics, testMetricsCountEveryOutcome)
+{
+    MeteredValve sm;
+    sm.getTracer().metrics.setSampleInterval(1);
+    sm.startSM();
+
+    sm.sendEvent(sm.turn);  // shut -> open
+    sm.sendEvent(sm.turn);  // open -> shut
+    sm.sendEvent(sm.flush); // unhandled
+    EXPECT_EQ(sm.getTracer().metrics.snapshot().queueDepth, 3u);
+    sm.stepAll();
+
+    sm.enabled = false;
+    sm.sendEvent(sm.turn); // rejected by the guard
+    sm.step();
+
+    MetricsSnapshot s = sm.getTracer().metrics.snapshot();
+    EXPECT_EQ(s.eventsSent, 4u);
+    EXPECT_EQ(s.eventsProcessed, 4u);
+    EXPECT_EQ(s.transitions, 2u);
+    EXPECT_EQ(s.unhandledEvents, 1u);
+    EXPECT_EQ(s.guardRejections, 1u);
+    EXPECT_EQ(s.queueDepth, 0u);
+    EXPECT_EQ(s.maxQueueDepth, 3u);
+    EXPECT_EQ(s.queueLatency.count, 4u);
+    EXPECT_EQ(s.executionTime.count, 4u);
+}
+
+TEST(TestMetrics, testExecutionTimePerTransition)
+{
+    MeteredValve sm;
+    sm.getTracer().metrics.setSampleInterval(1);
+    sm.startSM();
+
+    sm.sendEvent(sm.turn);  // shut -> open
+    sm.sendEvent(sm.turn);  // open -> shut
+    sm.sendEvent(sm.turn);  // shut -> open
+    sm.sendEvent(sm.flush); // unhandled
+    sm.stepAll();
+
+    auto& metrics = sm.getTracer().metrics;
+    EXPECT_EQ(metrics.transitionTime(sm.shut, sm.turn).count, 2u);
+    EXPECT_EQ(metrics.transitionTime(sm.open, sm.turn).count, 1u);
+    EXPECT_EQ(metrics.transitionTime(sm.open, sm.flush).count, 0u);
+
+    std::vector<TransitionTime> times = metrics.transitionTimes();
+    ASSERT_EQ(times.size(), 2u);
+    for (TransitionTime const& t : times) {
+        EXPECT_EQ(t.eventSpace, sm.turn.space);
+        EXPECT_EQ(t.event, sm.turn.id);
+    }
+    EXPECT_EQ(metrics.snapshot().executionTime.count, 4u);
+}
+
+TEST(TestMetrics, testAsyncMetricsAreSampled)
+{
+    AsyncMeteredValve sm;
+    sm.startSM();
+
+    std::vector<Event> events(1000, sm.turn);
+    sm.sendEvents(events.begin(), events.begin() + 500);
+    for (auto it = events.begin() + 500; it != events.end(); ++it) {
+        sm.sendEvent(*it);
+    }
+
+    // Snapshots can be taken while the machine runs
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    MetricsSnapshot s = sm.getTracer().metrics.snapshot();
+    while (s.eventsProcessed < events.size() &&
+           std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::yield();
+        s = sm.getTracer().metrics.snapshot();
+    }
+    sm.stopSM();
+
+    EXPECT_EQ(s.eventsSent, 1000u);
+    EXPECT_EQ(s.eventsProcessed, 1000u);
+    EXPECT_EQ(s.transitions, 1000u);
+    EXPECT_EQ(s.queueDepth, 0u);
+    // One event in 64 is timed. Batches are counted but not stamped
+    EXPECT_EQ(s.executionTime.count, 16u);
+    EXPECT_EQ(s.queueLatency.count, 8u);
+}
+
+TEST(TestMetrics, testOverwrittenStampsAreNotTimed)
+{
+    MeteredValve sm;
+    sm.getTracer().metrics.setSampleInterval(1);
+    sm.startSM();
+
+    // The last send reuses the first one's stamp
+    std::uint64_t const stamps = MachineMetrics::NumStamps;
+    for (std::size_t i = 0; i <= stamps; ++i) {
+        sm.sendEvent(sm.turn);
+    }
+    sm.stepAll();
+
+    MetricsSnapshot s = sm.getTracer().metrics.snapshot();
+    EXPECT_EQ(s.eventsProcessed, stamps + 1);
+    EXPECT_EQ(s.queueLatency.count, stamps);
+}
+
+TEST(TestMetrics, testSendsFromManyThreadsAreCounted)
+{
+    MachineMetrics metrics;
+    std::vector<std::thread> senders;
+    for (int t = 0; t < 4; ++t) {
+        senders.emplace_back([&metrics] {
+            for (int i = 0; i < 1000; ++i) {
+                metrics.countQueued();
+                metrics.countSent(2);
+            }
+        });
+    }
+    for (std::thread& t : senders) {
+        t.join();
+    }
+    MetricsSnapshot s = metrics.snapshot();
+    EXPECT_EQ(s.eventsSent, 12000u);
+    EXPECT_EQ(s.queueDepth, 12000u);
+}
+
+TEST(TestMetrics, testSubHsmTransitionsAreNotCounted)
+{
+    MeteredCdPlayer sm;
+    sm.startSM();
+    sm.sendEvent(sm.cd_detected);       // Empty -> Stopped
+    sm.sendEvent(sm.play);              // Stopped -> Playing
+    sm.sendEvent(sm.Playing.next_song); // Song1 -> Song2, in Playing
+    sm.sendEvent(sm.stop_event);        // Playing -> Stopped
+    sm.stepAll();
+    EXPECT_EQ(sm.getCurrentState(), &sm.Stopped);
+
+    MetricsSnapshot s = sm.getTracer().metrics.snapshot();
+    EXPECT_EQ(s.eventsProcessed, 4u);
+    EXPECT_EQ(s.transitions, 3u);
+    EXPECT_EQ(s.unhandledEvents, 0u);
+}
@@ -0,0 +1,65 @@
+#include "GarageDoorSM.h"
+#include "Observer.h"
+#include "tsm.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <vector>
+
+//
+// Built with -fno-exceptions, see CMakeLists.txt: the execution policies and
+// queues must start, drain and shut down without throwing.
+//
+static_assert(!TSM_EXCEPTIONS_ENABLED, "Build this file with -fno-exceptions");
+
+using tsm::AsyncExecWithObserver;
+using tsm::AsyncStateMachine;
+using tsm::BlockingObserver;
+using tsm::LockFreeEventQueue;
+using tsm::SimpleStateMachine;
+using tsm::StateMachine;
+
+using tsmtest::GarageDoorDef;
+
+TEST(TestNoExceptions, testParentThreadStopsQuietly)
+{
+    SimpleStateMachine<GarageDoorDef> sm;
+    sm.startSM();
+    sm.sendEvent(sm.click_event);
+    sm.sendEvent(sm.topSensor_event);
+    EXPECT_EQ(sm.stepAll(), 2u);
+    EXPECT_EQ(sm.getCurrentState(), &sm.doorOpen);
+
+    // Once stopped, queued events are dropped without throwing
+    sm.sendEvent(sm.click_event);
+    sm.stopSM();
+    sm.step();
+    EXPECT_EQ(sm.drain(8), 0u);
+}
+
+TEST(TestNoExceptions, testAsyncMachinesShutDown)
+{
+    using Door = AsyncExecWithObserver<StateMachine<GarageDoorDef>,
+                                       BlockingObserver,
+                                       LockFreeEventQueue<tsm::Event>>;
+    Door door;
+    door.startSM();
+    door.wait();
+    door.sendEvent(door.click_event);
+    door.wait();
+    EXPECT_EQ(door.getCurrentState(), &door.doorOpening);
+    door.stopSM();
+
+    // Machines stopped with events still queued
+    std::vector<std::unique_ptr<AsyncStateMachine<GarageDoorDef>>> doors(100);
+    for (auto& sm : doors) {
+        sm.reset(new AsyncStateMachine<GarageDoorDef>);
+        sm->startSM();
+        sm->sendEvent(sm->click_event);
+        sm->sendEvent(sm->topSensor_event);
+    }
+    for (auto& sm : doors) {
+        sm->stopSM();
+    }
+}
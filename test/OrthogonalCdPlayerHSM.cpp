@@ -2,7 +2,6 @@
 
 #include "Observer.h"
 
-#include <glog/logging.h>
 #include <gtest/gtest.h>
 
 using tsm::AsyncExecutionPolicy;
@@ -40,18 +39,18 @@ struct TestOrthogonalCdPlayerHSM : public testing::Test
     TestOrthogonalCdPlayerHSM()
       : testing::Test()
     {}
-    ~TestOrthogonalCdPlayerHSM() { tsm::UniqueId::reset(); }
+    ~TestOrthogonalCdPlayerHSM() = default;
 };
 
 TEST_F(TestOrthogonalCdPlayerHSM, testOrthogonalHSMSeparateThread)
 {
     auto sm = std::make_shared<OrthogonalCdPlayerHSMSeparateThread>();
 
-    auto* cdPlayerHSM = &sm->getHsm1();
+    auto* cdPlayerHSM = &sm->getRegion<0>();
 
     auto* Playing = &cdPlayerHSM->Playing;
 
-    auto* errorHSM = &sm->getHsm2();
+    auto* errorHSM = &sm->getRegion<1>();
 
     ASSERT_EQ(Playing->getParent(), cdPlayerHSM);
     ASSERT_EQ(sm.get(), cdPlayerHSM->getParent());
@@ -80,7 +79,8 @@ TEST_F(TestOrthogonalCdPlayerHSM, testOrthogonalHSMSeparateThread)
     sm->sendEvent(cdPlayerHSM->pause);
     sm->wait();
     ASSERT_EQ(cdPlayerHSM->getCurrentState(), &cdPlayerHSM->Paused);
-    ASSERT_EQ(Playing->getCurrentState(), &Playing->Song2);
+    // Exited, with Song2 kept as its history
+    ASSERT_EQ(Playing->getCurrentState(), nullptr);
 
     sm->sendEvent(cdPlayerHSM->end_pause);
     sm->wait();
@@ -111,11 +111,11 @@ TEST_F(TestOrthogonalCdPlayerHSM, testOrthogonalHSMParentThread)
 
     auto sm = std::make_shared<OrthogonalCdPlayerHSMParentThread>();
 
-    auto* cdPlayerHSM = &sm->getHsm1();
+    auto* cdPlayerHSM = &sm->getRegion<0>();
 
     auto* Playing = &cdPlayerHSM->Playing;
 
-    auto* errorHSM = &sm->getHsm2();
+    auto* errorHSM = &sm->getRegion<1>();
 
     ASSERT_EQ(Playing->getParent(), cdPlayerHSM);
     ASSERT_EQ(sm.get(), cdPlayerHSM->getParent());
@@ -143,7 +143,8 @@ TEST_F(TestOrthogonalCdPlayerHSM, testOrthogonalHSMParentThread)
     sm->sendEvent(cdPlayerHSM->pause);
     sm->step();
     ASSERT_EQ(cdPlayerHSM->getCurrentState(), &cdPlayerHSM->Paused);
-    ASSERT_EQ(Playing->getCurrentState(), &Playing->Song2);
+    // Exited, with Song2 kept as its history
+    ASSERT_EQ(Playing->getCurrentState(), nullptr);
 
     sm->sendEvent(cdPlayerHSM->end_pause);
     sm->step();
@@ -0,0 +1,168 @@
+#include "tsm.h"
+
+#include <gtest/gtest.h>
+
+using tsm::Event;
+using tsm::IHsmDef;
+using tsm::OrthogonalStateMachine;
+using tsm::SimpleStateMachine;
+using tsm::State;
+using tsm::StateMachineDef;
+
+namespace tsmtest {
+
+// Defined outside of any StateMachineDef, so every region shares it
+Event powerFail;
+
+struct LampDef : public StateMachineDef<LampDef>
+{
+    LampDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<LampDef>("Lamp HSM", parent)
+      , Off("Off")
+      , On("On")
+    {
+        add(Off, toggle, On);
+        add(On, toggle, Off);
+        add(On, powerFail, Off);
+    }
+
+    virtual ~LampDef() = default;
+
+    State* getStartState() override { return &Off; }
+    State* getStopState() override { return nullptr; }
+
+    State Off;
+    State On;
+
+    Event toggle;
+};
+
+struct FanDef : public StateMachineDef<FanDef>
+{
+    FanDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<FanDef>("Fan HSM", parent)
+      , Stopped("Stopped")
+      , Spinning("Spinning")
+      , faults(0)
+    {
+        add(Stopped, spin, Spinning);
+        add(Spinning, powerFail, Stopped, [this] { ++faults; });
+        add(Stopped, powerFail, Stopped, [this] { ++faults; });
+    }
+
+    virtual ~FanDef() = default;
+
+    State* getStartState() override { return &Stopped; }
+    State* getStopState() override { return nullptr; }
+
+    State Stopped;
+    State Spinning;
+
+    Event spin;
+
+    int faults;
+};
+
+using Appliances =
+  OrthogonalStateMachine<LampDef, FanDef, LampDef, FanDef, LampDef>;
+
+struct HouseDef : public StateMachineDef<HouseDef>
+{
+    HouseDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<HouseDef>("House HSM", parent)
+      , Running("Running", this)
+      , Halted("Halted")
+    {
+        add(Running, halt, Halted);
+        add(Halted, resume, Running);
+    }
+
+    virtual ~HouseDef() = default;
+
+    State* getStartState() override { return &Running; }
+    State* getStopState() override { return nullptr; }
+
+    Appliances Running;
+    State Halted;
+
+    Event halt;
+    Event resume;
+};
+} // namespace tsmtest
+
+using tsmtest::Appliances;
+using tsmtest::HouseDef;
+using tsmtest::powerFail;
+
+TEST(TestOrthogonalRegions, testIndex)
+{
+    Appliances sm("Appliances");
+    auto& lamp = sm.getRegion<0>();
+    auto& fan = sm.getRegion<1>();
+
+    // Every LampDef region shares the LampDef events
+    EXPECT_EQ(sm.regionsFor(lamp.toggle), 0x15u);
+    EXPECT_EQ(sm.regionsFor(sm.getRegion<4>().toggle), 0x15u);
+    EXPECT_EQ(sm.regionsFor(fan.spin), 0x0Au);
+    EXPECT_EQ(sm.regionsFor(powerFail), 0x1Fu);
+    EXPECT_EQ(sm.regionsFor(Event()), 0u);
+}
+
+TEST(TestOrthogonalRegions, testDeliverToAllRegions)
+{
+    SimpleStateMachine<HouseDef> sm;
+    auto& lamp0 = sm.Running.getRegion<0>();
+    auto& fan1 = sm.Running.getRegion<1>();
+    auto& lamp2 = sm.Running.getRegion<2>();
+    auto& fan3 = sm.Running.getRegion<3>();
+    auto& lamp4 = sm.Running.getRegion<4>();
+
+    sm.startSM();
+    ASSERT_EQ(sm.getCurrentState(), &sm.Running);
+    ASSERT_EQ(lamp0.getCurrentState(), &lamp0.Off);
+
+    sm.sendEvent(lamp0.toggle);
+    sm.step();
+    EXPECT_EQ(lamp0.getCurrentState(), &lamp0.On);
+    EXPECT_EQ(lamp2.getCurrentState(), &lamp2.On);
+    EXPECT_EQ(lamp4.getCurrentState(), &lamp4.On);
+    EXPECT_EQ(fan1.getCurrentState(), &fan1.Stopped);
+
+    sm.sendEvent(fan1.spin);
+    sm.step();
+    EXPECT_EQ(fan1.getCurrentState(), &fan1.Spinning);
+    EXPECT_EQ(fan3.getCurrentState(), &fan3.Spinning);
+
+    sm.sendEvent(powerFail);
+    sm.step();
+    EXPECT_EQ(lamp0.getCurrentState(), &lamp0.Off);
+    EXPECT_EQ(lamp2.getCurrentState(), &lamp2.Off);
+    EXPECT_EQ(lamp4.getCurrentState(), &lamp4.Off);
+    EXPECT_EQ(fan1.getCurrentState(), &fan1.Stopped);
+    EXPECT_EQ(fan3.getCurrentState(), &fan3.Stopped);
+    EXPECT_EQ(fan1.faults, 1);
+    EXPECT_EQ(fan3.faults, 1);
+
+    // The lamps are off and ignore it, the fans still handle it
+    sm.sendEvent(powerFail);
+    sm.step();
+    EXPECT_EQ(sm.getCurrentState(), &sm.Running);
+    EXPECT_EQ(fan1.faults, 2);
+
+    // No region handles halt, so it goes up to the house
+    sm.sendEvent(sm.halt);
+    sm.step();
+    EXPECT_EQ(sm.getCurrentState(), &sm.Halted);
+
+    sm.sendEvent(sm.resume);
+    sm.step();
+    EXPECT_EQ(sm.getCurrentState(), &sm.Running);
+    EXPECT_EQ(lamp0.getCurrentState(), &lamp0.Off);
+
+    // Reach the regions through the house again
+    sm.sendEvent(lamp0.toggle);
+    sm.step();
+    EXPECT_EQ(lamp4.getCurrentState(), &lamp4.On);
+
+    sm.stopSM();
+}
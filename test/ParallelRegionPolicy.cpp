@@ -0,0 +1,150 @@
+#include "tsm.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <set>
+#include <thread>
+
+using tsm::Event;
+using tsm::IHsmDef;
+using tsm::OrthogonalStateMachine;
+using tsm::ParallelRegionPolicy;
+using tsm::ParentThreadExecutionPolicy;
+using tsm::PooledExecutionPolicy;
+using tsm::State;
+using tsm::StateMachineDef;
+using tsm::ThreadPool;
+
+namespace tsmtest {
+
+struct StationDef : public StateMachineDef<StationDef>
+{
+    StationDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<StationDef>("Station HSM", parent)
+      , Idle("Idle")
+      , Busy("Busy")
+      , delay(0)
+      , runs(0)
+    {
+        add(Idle, work, Busy, &StationDef::doWork);
+        add(Busy, work, Idle, &StationDef::doWork);
+    }
+
+    virtual ~StationDef() = default;
+
+    State* getStartState() override { return &Idle; }
+    State* getStopState() override { return nullptr; }
+
+    // States
+    State Idle;
+    State Busy;
+
+    // Events
+    Event work;
+
+    // Actions
+    void doWork()
+    {
+        worker = std::this_thread::get_id();
+        std::this_thread::sleep_for(delay);
+        ++runs;
+    }
+
+    std::chrono::milliseconds delay;
+    std::thread::id worker;
+    int runs;
+};
+
+using FourStations =
+  OrthogonalStateMachine<StationDef, StationDef, StationDef, StationDef>;
+
+struct Stations : public FourStations
+{
+    Stations()
+      : FourStations("Stations")
+    {}
+    virtual ~Stations() = default;
+
+    std::set<std::thread::id> workers()
+    {
+        return { getRegion<0>().worker,
+                 getRegion<1>().worker,
+                 getRegion<2>().worker,
+                 getRegion<3>().worker };
+    }
+
+    Event const& work() { return getRegion<0>().work; }
+};
+} // namespace tsmtest
+
+using tsmtest::Stations;
+
+using ParallelStations = ParallelRegionPolicy<Stations>;
+
+TEST(TestParallelRegionPolicy, testCheapRegionsRunInline)
+{
+    ThreadPool pool(4);
+    ParentThreadExecutionPolicy<ParallelStations> sm;
+    sm.setThreadPool(pool);
+    sm.startSM();
+
+    for (int i = 0; i < 10; ++i) {
+        sm.sendEvent(sm.work());
+        sm.step();
+    }
+    std::set<std::thread::id> self{ std::this_thread::get_id() };
+    EXPECT_EQ(sm.workers(), self);
+    EXPECT_EQ(sm.getRegion<3>().runs, 10);
+    EXPECT_EQ(sm.getRegion<3>().getCurrentState(), &sm.getRegion<3>().Idle);
+    sm.stopSM();
+}
+
+TEST(TestParallelRegionPolicy, testHeavyRegionsRunConcurrently)
+{
+    ThreadPool pool(4);
+    ParentThreadExecutionPolicy<ParallelStations> sm;
+    sm.setThreadPool(pool);
+    sm.setInlineThreshold(std::chrono::nanoseconds(0));
+    sm.getRegion<0>().delay = std::chrono::milliseconds(50);
+    sm.getRegion<1>().delay = std::chrono::milliseconds(50);
+    sm.getRegion<2>().delay = std::chrono::milliseconds(50);
+    sm.getRegion<3>().delay = std::chrono::milliseconds(50);
+    sm.startSM();
+
+    auto start = std::chrono::steady_clock::now();
+    sm.sendEvent(sm.work());
+    sm.step();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    // Joined before step returns
+    EXPECT_EQ(sm.getRegion<0>().runs, 1);
+    EXPECT_EQ(sm.getRegion<1>().runs, 1);
+    EXPECT_EQ(sm.getRegion<2>().runs, 1);
+    EXPECT_EQ(sm.getRegion<3>().runs, 1);
+    EXPECT_EQ(sm.getRegion<2>().getCurrentState(), &sm.getRegion<2>().Busy);
+    EXPECT_GT(sm.workers().size(), 1u);
+    EXPECT_LT(elapsed, std::chrono::milliseconds(150));
+    EXPECT_GE(sm.getRegionCost(1), std::chrono::milliseconds(1));
+    sm.stopSM();
+}
+
+TEST(TestParallelRegionPolicy, testRunOnWorkerOfSamePool)
+{
+    // A single worker runs the machine itself, so the regions it fans out
+    // can only make progress if the machine takes them back.
+    ThreadPool pool(1);
+    PooledExecutionPolicy<ParallelStations> sm;
+    sm.setThreadPool(pool);
+    sm.setInlineThreshold(std::chrono::nanoseconds(0));
+    sm.startSM();
+
+    for (int i = 0; i < 5; ++i) {
+        sm.sendEvent(sm.work());
+    }
+    sm.waitUntilIdle();
+    EXPECT_EQ(sm.getRegion<0>().runs, 5);
+    EXPECT_EQ(sm.getRegion<3>().runs, 5);
+    EXPECT_EQ(sm.getRegion<3>().getCurrentState(), &sm.getRegion<3>().Busy);
+    sm.stopSM();
+}
@@ -0,0 +1,187 @@
+#include "tsm.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using tsm::Event;
+using tsm::IHsmDef;
+using tsm::PooledExecutionPolicy;
+using tsm::State;
+using tsm::StateMachine;
+using tsm::StateMachineDef;
+using tsm::ThreadPool;
+
+namespace tsmtest {
+
+// Counts down to zero and wakes up the waiting test thread.
+struct Latch
+{
+    explicit Latch(int count)
+      : count_(count)
+    {}
+
+    void countDown()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--count_ == 0) {
+            cv_.notify_all();
+        }
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return count_ == 0; });
+    }
+
+  private:
+    int count_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+
+struct CounterDef : public StateMachineDef<CounterDef>
+{
+    CounterDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<CounterDef>("Counter HSM", parent)
+      , Even("Even")
+      , Odd("Odd")
+      , latch(nullptr)
+      , expected(0)
+      , lastSeq(-1)
+      , outOfOrder(0)
+      , handled(0)
+    {
+        add(Even, tick, Odd, &CounterDef::count);
+        add(Odd, tick, Even, &CounterDef::count);
+    }
+
+    virtual ~CounterDef() = default;
+
+    State* getStartState() override { return &Even; }
+    State* getStopState() override { return nullptr; }
+
+    // States
+    State Even;
+    State Odd;
+
+    // Events
+    Event tick;
+
+    // Actions
+    void count(int const& seq)
+    {
+        if (seq != lastSeq + 1) {
+            ++outOfOrder;
+        }
+        lastSeq = seq;
+        if (++handled == expected) {
+            latch->countDown();
+        }
+    }
+
+    Latch* latch;
+    int expected;
+    int lastSeq;
+    int outOfOrder;
+    int handled;
+};
+} // namespace tsmtest
+
+using tsmtest::CounterDef;
+using tsmtest::Latch;
+
+using PooledCounter = PooledExecutionPolicy<StateMachine<CounterDef>>;
+
+TEST(TestPooledExecutionPolicy, testManyMachinesOnFewWorkers)
+{
+    const int numMachines = 200;
+    const int numEvents = 101;
+
+    ThreadPool pool(4);
+    Latch latch(numMachines);
+
+    std::vector<std::unique_ptr<PooledCounter>> machines;
+    for (int i = 0; i < numMachines; ++i) {
+        machines.emplace_back(new PooledCounter());
+        auto& sm = *machines.back();
+        sm.latch = &latch;
+        sm.expected = numEvents;
+        sm.setThreadPool(pool);
+        sm.setMaxEventsPerRun(8);
+        sm.startSM();
+    }
+
+    // Interleave the machines so that they all have work queued at once
+    for (int seq = 0; seq < numEvents; ++seq) {
+        for (auto& sm : machines) {
+            sm->sendEvent(sm->tick.withPayload(seq));
+        }
+    }
+    latch.wait();
+
+    for (auto& sm : machines) {
+        // The last action has run, the transition may still be finishing
+        sm->waitUntilIdle();
+        EXPECT_EQ(sm->outOfOrder, 0);
+        EXPECT_EQ(sm->handled, numEvents);
+        EXPECT_EQ(sm->getCurrentState(), &sm->Odd);
+        sm->stopSM();
+    }
+}
+
+TEST(TestPooledExecutionPolicy, testBatchSubmission)
+{
+    ThreadPool pool(2);
+    Latch latch(1);
+
+    PooledCounter sm;
+    sm.latch = &latch;
+    sm.expected = 10;
+    sm.setThreadPool(pool);
+    sm.startSM();
+
+    std::vector<Event> events;
+    for (int seq = 0; seq < 10; ++seq) {
+        events.push_back(sm.tick.withPayload(seq));
+    }
+    sm.sendEvents(events.begin(), events.end());
+    latch.wait();
+    sm.waitUntilIdle();
+
+    EXPECT_EQ(sm.outOfOrder, 0);
+    EXPECT_EQ(sm.getCurrentState(), &sm.Even);
+    sm.stopSM();
+}
+
+TEST(TestPooledExecutionPolicy, testRunsSubmittedTasks)
+{
+    ThreadPool pool(4);
+    std::atomic<int> done(0);
+    Latch latch(64);
+
+    struct CountTask : ThreadPool::Task
+    {
+        std::atomic<int>* done;
+        Latch* latch;
+        void run() override
+        {
+            ++*done;
+            latch->countDown();
+        }
+    };
+
+    std::vector<CountTask> tasks(64);
+    for (auto& t : tasks) {
+        t.done = &done;
+        t.latch = &latch;
+        pool.submit(&t);
+    }
+    latch.wait();
+    EXPECT_EQ(done.load(), 64);
+}
@@ -0,0 +1,158 @@
+#include "tsm.h"
+
+#include <gtest/gtest.h>
+
+#include <future>
+#include <iterator>
+#include <vector>
+
+using tsm::Event;
+using tsm::EventQueueInterruptedException;
+using tsm::IHsmDef;
+using tsm::MetricsSnapshot;
+using tsm::MetricsTracer;
+using tsm::ParentThreadExecutionPolicy;
+using tsm::PriorityEventQueue;
+using tsm::SimplePriorityEventQueue;
+using tsm::State;
+using tsm::StateMachine;
+using tsm::StateMachineDef;
+
+namespace {
+
+struct PlayerDef : public StateMachineDef<PlayerDef>
+{
+    PlayerDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<PlayerDef>("Player", parent)
+      , idle("Idle")
+      , playing("Playing")
+      , detected(0)
+    {
+        add(idle, play, playing);
+        add(playing, stop_event, idle);
+        add(idle, cd_detected, idle, [this] { ++detected; });
+        add(playing, cd_detected, playing, [this] { ++detected; });
+    }
+
+    State* getStartState() override { return &idle; }
+    State* getStopState() override { return nullptr; }
+
+    State idle;
+    State playing;
+
+    Event play;
+    Event stop_event;
+    Event cd_detected;
+
+    int detected;
+};
+
+using Player =
+  ParentThreadExecutionPolicy<StateMachine<PlayerDef, MetricsTracer>,
+                              SimplePriorityEventQueue<Event>>;
+
+} // namespace
+
+TEST(TestPriorityEventQueue, testUrgentLaneOvertakes)
+{
+    PriorityEventQueue<Event> queue;
+    Event normal, urgent, low;
+    queue.setLane(urgent, 0);
+    queue.setLane(low, 2);
+
+    queue.addEvent(low);
+    queue.addEvent(normal);
+    queue.addEvent(urgent);
+    queue.addEvent(normal);
+    queue.addEvent(urgent);
+    EXPECT_EQ(queue.size(), 5u);
+
+    std::vector<Event> order;
+    queue.nextEvents(std::back_inserter(order), 2);
+    order.push_back(queue.nextEvent());
+    queue.nextEvents(std::back_inserter(order), 10);
+    std::vector<Event> expected = { urgent, urgent, normal, normal, low };
+    EXPECT_EQ(order, expected);
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST(TestPriorityEventQueue, testCoalescingDropsPendingDuplicates)
+{
+    PriorityEventQueue<Event> queue;
+    Event heartbeat, other;
+    queue.coalesce(heartbeat);
+
+    EXPECT_TRUE(queue.addEvent(heartbeat));
+    EXPECT_FALSE(queue.addEvent(heartbeat));
+    EXPECT_TRUE(queue.addEvent(other));
+    EXPECT_TRUE(queue.addEvent(other));
+    std::vector<Event> batch = { heartbeat, other, heartbeat };
+    EXPECT_EQ(queue.addEvents(batch.begin(), batch.end()), 1u);
+    EXPECT_EQ(queue.size(), 4u);
+
+    // Once taken off the queue it can be queued again
+    EXPECT_EQ(queue.nextEvent(), heartbeat);
+    EXPECT_TRUE(queue.addEvent(heartbeat));
+}
+
+TEST(TestPriorityEventQueue, testStopInterruptsWaiters)
+{
+    PriorityEventQueue<Event> queue;
+    auto waiter = std::async(std::launch::async, [&queue] {
+        try {
+            queue.nextEvent();
+        } catch (EventQueueInterruptedException const&) {
+            return true;
+        }
+        return false;
+    });
+    queue.stop();
+    EXPECT_TRUE(waiter.get());
+}
+
+TEST(TestPriorityEventQueue, testTryNextEventsReturnsZeroOnStop)
+{
+    PriorityEventQueue<Event> queue;
+    Event e;
+    queue.addEvent(e);
+    Event next = Event::dummy_event;
+    EXPECT_TRUE(queue.tryNextEvent(next));
+    EXPECT_EQ(next, e);
+
+    auto waiter = std::async(std::launch::async, [&queue] {
+        std::vector<Event> batch;
+        return queue.tryNextEvents(std::back_inserter(batch), 8);
+    });
+    queue.stop();
+    EXPECT_EQ(waiter.get(), 0u);
+}
+
+TEST(TestPriorityEventQueue, testSelectedThroughTheExecutionPolicy)
+{
+    Player sm;
+    sm.getTracer().metrics.setSampleInterval(1);
+    sm.getEventQueue().setLane(sm.stop_event, 0);
+    sm.getEventQueue().coalesce(sm.cd_detected);
+    sm.startSM();
+
+    sm.sendEvent(sm.play);
+    sm.stepAll();
+    for (int i = 0; i < 10; ++i) {
+        sm.sendEvent(sm.cd_detected);
+    }
+    sm.sendEvent(sm.stop_event);
+
+    // stop_event goes first, the ten cd_detected are handled once
+    sm.step();
+    EXPECT_EQ(sm.getCurrentState(), &sm.idle);
+    EXPECT_EQ(sm.detected, 0);
+    sm.stepAll();
+    EXPECT_EQ(sm.detected, 1);
+
+    MetricsSnapshot s = sm.getTracer().metrics.snapshot();
+    EXPECT_EQ(s.eventsSent, 12u);
+    EXPECT_EQ(s.eventsCoalesced, 9u);
+    EXPECT_EQ(s.eventsProcessed, 3u);
+    EXPECT_EQ(s.queueDepth, 0u);
+    EXPECT_EQ(s.maxQueueDepth, 2u);
+}
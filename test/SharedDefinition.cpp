@@ -0,0 +1,191 @@
+#include "GarageDoorSM.h"
+#include "TestMachines.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using tsm::MachineInstance;
+using tsm::SharedDefinition;
+
+using tsmtest::AHsmDef;
+using tsmtest::GarageDoorDef;
+
+namespace {
+
+/// Per-session data lives outside the definition and travels in the payload.
+struct Session
+{
+    int logins;
+    bool banned;
+};
+
+struct SessionRef
+{
+    Session* session;
+};
+
+struct LoginDef : public StateMachineDef<LoginDef>
+{
+    LoginDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<LoginDef>("Login", parent)
+      , loggedOut("Logged Out")
+      , loggedIn("Logged In")
+    {
+        add(loggedOut,
+            login,
+            loggedIn,
+            [](SessionRef const& r) { ++r.session->logins; },
+            [](SessionRef const& r) { return !r.session->banned; });
+        add(loggedIn, logout, loggedOut);
+    }
+
+    State* getStartState() override { return &loggedOut; }
+    State* getStopState() override { return nullptr; }
+
+    State loggedOut;
+    State loggedIn;
+
+    Event login;
+    Event logout;
+};
+
+// Not part of any definition, so in the global id space
+Event doorbell;
+
+struct ChimeDef : public StateMachineDef<ChimeDef>
+{
+    ChimeDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<ChimeDef>("Chime", parent)
+      , quiet("Quiet")
+      , ringing("Ringing")
+    {
+        add(quiet, doorbell, ringing);
+        add(quiet, ring, ringing);
+        add(ringing, hush, quiet);
+    }
+
+    State* getStartState() override { return &quiet; }
+    State* getStopState() override { return nullptr; }
+
+    State quiet;
+    State ringing;
+
+    Event ring;
+    Event hush;
+};
+
+} // namespace
+
+TEST(TestSharedDefinition, testInstancesAreSmall)
+{
+    EXPECT_EQ(sizeof(MachineInstance<GarageDoorDef>),
+              sizeof(void*) + 4 * sizeof(std::uint16_t));
+}
+
+TEST(TestSharedDefinition, testInstancesShareOneDefinition)
+{
+    using Outcome = SharedDefinition<GarageDoorDef>::Outcome;
+    SharedDefinition<GarageDoorDef> def;
+    auto& door = def.prototype();
+    Event const* trip[] = { &door.click_event,
+                            &door.topSensor_event,
+                            &door.click_event,
+                            &door.bottomSensor_event };
+
+    std::vector<MachineInstance<GarageDoorDef>> doors(
+      1000, MachineInstance<GarageDoorDef>(def));
+    for (std::size_t i = 0; i < doors.size(); ++i) {
+        doors[i].startSM();
+        for (std::size_t n = 0; n < i % 4; ++n) {
+            ASSERT_EQ(doors[i].execute(*trip[n]), Outcome::Transition);
+        }
+    }
+
+    State const* expected[] = { &door.doorClosed,
+                                &door.doorOpening,
+                                &door.doorOpen,
+                                &door.doorClosing };
+    for (std::size_t i = 0; i < doors.size(); ++i) {
+        EXPECT_EQ(doors[i].getCurrentState(), expected[i % 4]);
+    }
+    EXPECT_EQ(doors[0].execute(door.topSensor_event), Outcome::Unhandled);
+}
+
+TEST(TestSharedDefinition, testNestedHsmMatchesStateMachine)
+{
+    SharedDefinition<AHsmDef> def;
+    EXPECT_EQ(def.numHsms(), 2u);
+    MachineInstance<AHsmDef> instance(def);
+    StateMachine<AHsmDef> sm;
+
+    auto& a = def.prototype();
+    instance.startSM();
+    sm.startSM();
+    EXPECT_EQ(instance.getCurrentState()->name, sm.getCurrentState()->name);
+
+    std::vector<Event> events = { a.e1,    a.e2_in,  a.bHsmDef.e1,
+                                  a.e2_out, a.e3,    a.e1,
+                                  a.e2_in,  a.e2_out, a.end_event };
+    for (Event const& e : events) {
+        instance.execute(e);
+        sm.dispatch(&sm)->execute(e);
+        ASSERT_EQ(instance.getCurrentState() != nullptr,
+                  sm.getCurrentState() != nullptr);
+        if (sm.getCurrentState()) {
+            EXPECT_EQ(instance.getCurrentState()->name,
+                      sm.getCurrentState()->name);
+            EXPECT_EQ(instance.getLeafState()->name,
+                      sm.dispatch(&sm)->getCurrentState()->name);
+        }
+    }
+    // end_event reaches the stop state
+    EXPECT_EQ(instance.getCurrentState(), nullptr);
+}
+
+TEST(TestSharedDefinition, testPerInstanceDataTravelsInThePayload)
+{
+    using Outcome = SharedDefinition<LoginDef>::Outcome;
+    SharedDefinition<LoginDef> def;
+    auto& login = def.prototype().login;
+    auto& logout = def.prototype().logout;
+
+    Session alice{ 0, false };
+    Session mallory{ 0, true };
+    MachineInstance<LoginDef> a(def);
+    MachineInstance<LoginDef> m(def);
+    a.startSM();
+    m.startSM();
+
+    // The transition only accepts events carrying a SessionRef
+    EXPECT_EQ(a.execute(login), Outcome::GuardRejected);
+    EXPECT_EQ(a.execute(login.withPayload(SessionRef{ &alice })),
+              Outcome::Transition);
+    EXPECT_EQ(a.execute(logout), Outcome::Transition);
+    EXPECT_EQ(a.execute(login.withPayload(SessionRef{ &alice })),
+              Outcome::Transition);
+    EXPECT_EQ(m.execute(login.withPayload(SessionRef{ &mallory })),
+              Outcome::GuardRejected);
+
+    EXPECT_EQ(alice.logins, 2);
+    EXPECT_EQ(mallory.logins, 0);
+    EXPECT_EQ(a.getCurrentState(), &def.prototype().loggedIn);
+    EXPECT_EQ(m.getCurrentState(), &def.prototype().loggedOut);
+}
+
+TEST(TestSharedDefinition, testForeignFirstEventKeepsTheArray)
+{
+    using Outcome = SharedDefinition<ChimeDef>::Outcome;
+    SharedDefinition<ChimeDef> def;
+    auto& chime = def.prototype();
+    ASSERT_NE(doorbell.space, chime.ring.space);
+    // Only the transition on the global event is off the array
+    EXPECT_EQ(def.numForeign(0), 1u);
+
+    MachineInstance<ChimeDef> sm(def);
+    sm.startSM();
+    EXPECT_EQ(sm.execute(chime.ring), Outcome::Transition);
+    EXPECT_EQ(sm.execute(chime.hush), Outcome::Transition);
+    EXPECT_EQ(sm.execute(doorbell), Outcome::Transition);
+    EXPECT_EQ(sm.getCurrentState(), &chime.ringing);
+}
@@ -0,0 +1,287 @@
+#include "GarageDoorSM.h"
+#include "TestMachines.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+using tsm::OrthogonalStateMachine;
+using tsm::SnapshotHeader;
+
+using tsmtest::AHsmDef;
+using tsmtest::GarageDoorDef;
+
+namespace {
+
+/// Counts its entries, to show restore does not run them.
+struct CountedState : public State
+{
+    CountedState(std::string const& name)
+      : State(name)
+      , runs(0)
+    {}
+
+    void execute(Event const&) override { ++runs; }
+
+    int runs;
+};
+
+struct SwitchDef : public StateMachineDef<SwitchDef>
+{
+    SwitchDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<SwitchDef>("Switch", parent)
+      , off("Off")
+      , on("On")
+    {
+        add(off, flip, on);
+        add(on, flip, off);
+    }
+
+    State* getStartState() override { return &off; }
+    State* getStopState() override { return nullptr; }
+
+    CountedState off;
+    State on;
+
+    Event flip;
+};
+
+using Panel = OrthogonalStateMachine<SwitchDef, SwitchDef, AHsmDef>;
+
+struct CabinetDef : public StateMachineDef<CabinetDef>
+{
+    CabinetDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<CabinetDef>("Cabinet", parent)
+      , panel("Panel", this)
+      , closed("Closed")
+    {
+        add(closed, open, panel);
+        add(panel, close, closed);
+        add(closed, reopen, panel.deepHistory);
+    }
+
+    State* getStartState() override { return &closed; }
+    State* getStopState() override { return nullptr; }
+
+    Panel panel;
+    State closed;
+
+    Event open;
+    Event close;
+    Event reopen;
+};
+
+// Goes to a state of another definition, whose id is the same as idle's
+struct RemoteDef : public StateMachineDef<RemoteDef>
+{
+    RemoteDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<RemoteDef>("Remote", parent)
+      , idle("Idle")
+      , extra("Extra")
+    {
+        add(idle, go, other.on);
+    }
+
+    State* getStartState() override { return &idle; }
+    State* getStopState() override { return nullptr; }
+
+    SwitchDef other;
+    State idle;
+    State extra;
+
+    Event go;
+    Event more;
+};
+
+template<typename SM>
+void send(SM& sm, Event const& e)
+{
+    sm.dispatch(&sm)->execute(e);
+}
+
+template<typename SM>
+std::vector<std::uint16_t> snapshotOf(SM& sm)
+{
+    std::vector<std::uint16_t> record(tsm::snapshotSlots(sm));
+    tsm::snapshot(sm, record.data());
+    return record;
+}
+
+} // namespace
+
+TEST(TestSnapshot, testNestedHsmRoundTrip)
+{
+    StateMachine<AHsmDef> sm;
+    sm.startSM();
+    send(sm, sm.e1);
+    send(sm, sm.e2_in);
+    // AHsmDef and its sub HSM, two slots each
+    auto record = snapshotOf(sm);
+    ASSERT_EQ(record.size(), 4u);
+
+    StateMachine<AHsmDef> copy;
+    tsm::restore(copy, record.data());
+    EXPECT_EQ(copy.getCurrentState(), &copy.bHsmDef);
+    EXPECT_EQ(copy.dispatch(&copy), &copy.bHsmDef);
+    EXPECT_EQ(copy.bHsmDef.getCurrentState(), &copy.bHsmDef.s1);
+
+    // The restored machine carries on like the original
+    send(copy, copy.e2_out);
+    send(sm, sm.e2_out);
+    EXPECT_EQ(snapshotOf(copy), snapshotOf(sm));
+    EXPECT_EQ(copy.getCurrentState(), &copy.s3);
+}
+
+TEST(TestSnapshot, testRestoreKeepsHistoryAndRunsNoEntryActions)
+{
+    StateMachine<CabinetDef> sm;
+    sm.startSM();
+    send(sm, sm.open);
+    // Both switches flip, they share their events
+    send(sm, sm.panel.getRegion<1>().flip);
+    send(sm, sm.panel.getRegion<2>().e1);
+    send(sm, sm.close);
+    EXPECT_EQ(sm.panel.getRegion<0>().off.runs, 1);
+
+    StateMachine<CabinetDef> copy;
+    tsm::restore(copy, snapshotOf(sm).data());
+    EXPECT_EQ(copy.getCurrentState(), &copy.closed);
+    EXPECT_EQ(copy.panel.getRegion<0>().off.runs, 0);
+
+    send(copy, copy.reopen);
+    EXPECT_EQ(copy.getCurrentState(), &copy.panel);
+    EXPECT_EQ(copy.panel.getRegion<1>().getCurrentState(),
+              &copy.panel.getRegion<1>().on);
+    EXPECT_EQ(copy.panel.getRegion<2>().getCurrentState(),
+              &copy.panel.getRegion<2>().s2);
+}
+
+TEST(TestSnapshot, testBulkSnapshotIntoOneBuffer)
+{
+    using Door = StateMachine<GarageDoorDef>;
+    std::vector<std::unique_ptr<Door>> doors;
+    std::vector<Door*> originals;
+    for (int i = 0; i < 1000; ++i) {
+        doors.emplace_back(new Door);
+        doors.back()->startSM();
+        for (int n = 0; n < i % 3; ++n) {
+            send(*doors.back(), doors.back()->click_event);
+        }
+        originals.push_back(doors.back().get());
+    }
+
+    std::size_t size = tsm::snapshotBufferSize(2, doors.size());
+    std::vector<std::uint64_t> buffer(size / sizeof(std::uint64_t) + 1);
+    tsm::snapshotAll(originals.begin(), originals.end(), buffer.data());
+
+    std::vector<Door> restored(doors.size());
+    tsm::restoreAll(restored.begin(), restored.end(), buffer.data(), size);
+    for (std::size_t i = 0; i < doors.size(); ++i) {
+        ASSERT_EQ(restored[i].getCurrentState()->id,
+                  doors[i]->getCurrentState()->id);
+    }
+    EXPECT_EQ(tsm::snapshotRecord(buffer.data(), 2)[0],
+              doors[2]->doorStoppedOpening.id + 1);
+}
+
+TEST(TestSnapshot, testRestoreRejectsForeignBuffers)
+{
+    std::vector<StateMachine<GarageDoorDef>> doors(2);
+    std::vector<StateMachine<AHsmDef>> others(2);
+    std::size_t size = tsm::snapshotBufferSize(2, 2);
+    std::vector<std::uint64_t> buffer(size / sizeof(std::uint64_t) + 1);
+    tsm::snapshotAll(doors.begin(), doors.end(), buffer.data());
+
+    EXPECT_THROW(
+      tsm::restoreAll(others.begin(), others.end(), buffer.data(), size),
+      std::invalid_argument);
+    std::vector<StateMachine<GarageDoorDef>> more(3);
+    EXPECT_THROW(
+      tsm::restoreAll(more.begin(), more.end(), buffer.data(), size),
+      std::invalid_argument);
+
+    std::uint16_t bad[2] = { 1000, 0 };
+    EXPECT_THROW(tsm::restore(doors[0], bad), std::invalid_argument);
+}
+
+TEST(TestSnapshot, testBadRecordChangesNothing)
+{
+    StateMachine<AHsmDef> sm;
+    sm.startSM();
+    send(sm, sm.e1);
+    send(sm, sm.e2_in);
+    auto record = snapshotOf(sm);
+    record.back() = 1000; // the history of the sub HSM
+
+    StateMachine<AHsmDef> copy;
+    copy.startSM();
+    auto before = snapshotOf(copy);
+    EXPECT_THROW(tsm::restore(copy, record.data()), std::invalid_argument);
+    EXPECT_EQ(snapshotOf(copy), before);
+    EXPECT_EQ(copy.getCurrentState(), &copy.s1);
+}
+
+TEST(TestSnapshot, testRestoreAllChecksTheDefinition)
+{
+    // The same number of slots, but other states
+    std::vector<StateMachine<GarageDoorDef>> doors(2);
+    std::vector<StateMachine<SwitchDef>> switches(2);
+    ASSERT_EQ(tsm::snapshotSlots(doors[0]), tsm::snapshotSlots(switches[0]));
+    ASSERT_NE(doors[0].snapshotFingerprint(),
+              switches[0].snapshotFingerprint());
+    std::size_t size = tsm::snapshotBufferSize(2, 2);
+    std::vector<std::uint64_t> buffer(size / sizeof(std::uint64_t) + 1);
+    tsm::snapshotAll(doors.begin(), doors.end(), buffer.data());
+    EXPECT_THROW(
+      tsm::restoreAll(switches.begin(), switches.end(), buffer.data(), size),
+      std::invalid_argument);
+
+    // A bad second record leaves the first machine as it was too
+    switches[0].startSM();
+    switches[1].startSM();
+    send(switches[0], switches[0].flip);
+    tsm::snapshotAll(switches.begin(), switches.end(), buffer.data());
+    const_cast<std::uint16_t*>(tsm::snapshotRecord(buffer.data(), 1))[0] =
+      1000;
+    std::vector<StateMachine<SwitchDef>> copies(2);
+    copies[0].startSM();
+    EXPECT_THROW(
+      tsm::restoreAll(copies.begin(), copies.end(), buffer.data(), size),
+      std::invalid_argument);
+    EXPECT_EQ(copies[0].getCurrentState(), &copies[0].off);
+}
+
+TEST(TestSnapshot, testStatesOfOtherSpacesHaveSlotsOfTheirOwn)
+{
+    StateMachine<RemoteDef> sm;
+    ASSERT_EQ(sm.idle.id, sm.other.on.id);
+    ASSERT_NE(sm.idle.space, sm.other.on.space);
+    sm.startSM();
+
+    StateMachine<RemoteDef> copy;
+    tsm::restore(copy, snapshotOf(sm).data());
+    EXPECT_EQ(copy.getCurrentState(), &copy.idle);
+
+    send(sm, sm.go);
+    tsm::restore(copy, snapshotOf(sm).data());
+    EXPECT_EQ(copy.getCurrentState(), &copy.other.on);
+}
+
+TEST(TestSnapshot, testTransitionsAddedLaterAreIndexed)
+{
+    StateMachine<RemoteDef> sm;
+    StateMachine<RemoteDef> copy;
+    snapshotOf(sm);
+    snapshotOf(copy);
+    sm.add(sm.other.on, sm.more, sm.extra);
+    copy.add(copy.other.on, copy.more, copy.extra);
+
+    sm.startSM();
+    send(sm, sm.go);
+    send(sm, sm.more);
+    tsm::restore(copy, snapshotOf(sm).data());
+    EXPECT_EQ(copy.getCurrentState(), &copy.extra);
+}
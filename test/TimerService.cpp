@@ -0,0 +1,175 @@
+#include "GarageDoorSM.h"
+#include "Observer.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using tsm::AsyncExecWithObserver;
+using tsm::BlockingObserver;
+using tsm::StateMachine;
+using tsm::TimerService;
+using tsm::TimerToken;
+using tsm::TimingWheel;
+
+using tsmtest::GarageDoorDef;
+
+using GarageDoorWithTimers =
+  AsyncExecWithObserver<StateMachine<GarageDoorDef>, BlockingObserver>;
+
+TEST(TestTimingWheel, testFiresInOrderOfDeadline)
+{
+    TimingWheel<int> wheel(64);
+    std::vector<int> fired;
+    auto collect = [&fired](int v) { fired.push_back(v); };
+
+    wheel.schedule(3, 30);
+    wheel.schedule(1, 10);
+    wheel.schedule(2, 20);
+    wheel.schedule(4, 200); // a few revolutions away
+    ASSERT_EQ(wheel.size(), 4u);
+
+    // A lower bound: the slot of the timer at 200 comes up first
+    std::uint64_t tick;
+    ASSERT_TRUE(wheel.nextTick(tick));
+    EXPECT_EQ(tick, 200u % 64);
+
+    while (wheel.nextTick(tick)) {
+        wheel.advance(tick, collect);
+    }
+    EXPECT_EQ(fired, (std::vector<int>{ 1, 2, 3, 4 }));
+    EXPECT_EQ(wheel.now(), 200u);
+    EXPECT_EQ(wheel.size(), 0u);
+}
+
+TEST(TestTimingWheel, testLargeJump)
+{
+    TimingWheel<int> wheel(64);
+    int fired = 0;
+    auto count = [&fired](int) { ++fired; };
+
+    for (int i = 1; i <= 500; ++i) {
+        wheel.schedule(i, i);
+    }
+    wheel.advance(250, count);
+    EXPECT_EQ(fired, 250);
+    wheel.advance(10000, count);
+    EXPECT_EQ(fired, 500);
+
+    // In the past now, so due at the next tick
+    wheel.schedule(0, 5);
+    wheel.advance(10001, count);
+    EXPECT_EQ(fired, 501);
+}
+
+TEST(TestTimingWheel, testCancel)
+{
+    TimingWheel<int> wheel(64);
+    int fired = 0;
+    auto count = [&fired](int) { ++fired; };
+
+    TimerToken a = wheel.schedule(1, 5);
+    TimerToken b = wheel.schedule(2, 5);
+    EXPECT_TRUE(wheel.cancel(a));
+    EXPECT_FALSE(wheel.cancel(a));
+    EXPECT_FALSE(wheel.cancel(TimerToken()));
+    wheel.advance(5, count);
+    EXPECT_EQ(fired, 1);
+    EXPECT_FALSE(wheel.cancel(b));
+
+    // The node of a is reused; its old token must not cancel the new timer
+    TimerToken c = wheel.schedule(3, 10);
+    EXPECT_EQ(wheel.find(a), nullptr);
+    ASSERT_NE(wheel.find(c), nullptr);
+    EXPECT_EQ(*wheel.find(c), 3);
+    EXPECT_FALSE(wheel.cancel(a));
+    EXPECT_TRUE(wheel.cancel(c));
+}
+
+TEST(TestTimingWheel, testGroups)
+{
+    TimingWheel<int> wheel(256);
+    std::uint32_t groupA = TimingWheel<int>::NoTimer;
+    std::uint32_t groupB = TimingWheel<int>::NoTimer;
+    std::vector<TimerToken> tokens;
+    for (int i = 0; i < 100000; ++i) {
+        std::uint32_t* group = (i % 2) ? &groupA : &groupB;
+        tokens.push_back(wheel.schedule(i, 1 + i % 1000, group));
+    }
+    ASSERT_EQ(wheel.size(), 100000u);
+
+    for (int i = 0; i < 100000; i += 4) {
+        ASSERT_TRUE(wheel.cancel(tokens[i]));
+    }
+    wheel.cancelGroup(groupA);
+    EXPECT_EQ(groupA, TimingWheel<int>::NoTimer);
+    EXPECT_EQ(wheel.size(), 25000u);
+
+    int fired = 0;
+    wheel.advance(1000, [&fired](int v) {
+        EXPECT_EQ(v % 4, 2);
+        ++fired;
+    });
+    EXPECT_EQ(fired, 25000);
+    EXPECT_EQ(groupB, TimingWheel<int>::NoTimer);
+}
+
+TEST(TestTimerService, testScheduledEventIsDelivered)
+{
+    TimerService timers;
+    GarageDoorWithTimers sm;
+    sm.setTimerService(timers);
+
+    sm.startSM();
+    sm.wait();
+    sm.sendEvent(sm.click_event);
+    sm.wait();
+    ASSERT_EQ(sm.getCurrentState(), &sm.doorOpening);
+
+    // The door takes 30ms to open
+    auto start = TimerService::Clock::now();
+    TimerToken token =
+      sm.scheduleEvent(sm.topSensor_event, std::chrono::milliseconds(30));
+    EXPECT_TRUE(token);
+    EXPECT_EQ(timers.pending(), 1u);
+    sm.wait();
+    EXPECT_GE(TimerService::Clock::now() - start,
+              std::chrono::milliseconds(30));
+    EXPECT_EQ(sm.getCurrentState(), &sm.doorOpen);
+    EXPECT_EQ(timers.pending(), 0u);
+    EXPECT_FALSE(sm.cancelEvent(token));
+
+    sm.stopSM();
+}
+
+TEST(TestTimerService, testCancelledEventIsNotDelivered)
+{
+    TimerService timers;
+    GarageDoorWithTimers sm;
+    sm.setTimerService(timers);
+
+    sm.startSM();
+    sm.wait();
+
+    TimerToken token =
+      sm.scheduleEvent(sm.click_event, std::chrono::milliseconds(20));
+    EXPECT_TRUE(sm.cancelEvent(token));
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    EXPECT_EQ(sm.getCurrentState(), &sm.doorClosed);
+
+    // Another machine's token cancels nothing
+    GarageDoorWithTimers other;
+    other.setTimerService(timers);
+    token = sm.scheduleEvent(sm.click_event, std::chrono::milliseconds(20));
+    EXPECT_FALSE(other.cancelEvent(token));
+    EXPECT_TRUE(sm.cancelEvent(token));
+
+    // Pending timers go away with the machine
+    sm.scheduleEvent(sm.click_event, std::chrono::seconds(60));
+    sm.scheduleEvent(sm.click_event, std::chrono::hours(1));
+    EXPECT_EQ(timers.pending(), 2u);
+    sm.stopSM();
+    EXPECT_EQ(timers.pending(), 0u);
+}
@@ -0,0 +1,113 @@
+#include "tsm.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+using tsm::Event;
+using tsm::IHsmDef;
+using tsm::NullTracer;
+using tsm::State;
+using tsm::StateMachine;
+using tsm::StateMachineDef;
+
+namespace {
+
+struct TurnstileDef : public StateMachineDef<TurnstileDef>
+{
+    TurnstileDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<TurnstileDef>("Turnstile", parent)
+      , locked("Locked")
+      , unlocked("Unlocked")
+      , credit(0)
+    {
+        add(locked, coin, unlocked, &TurnstileDef::pay);
+        add(unlocked, push, locked, &TurnstileDef::pass, &TurnstileDef::paid);
+    }
+
+    State* getStartState() override { return &locked; }
+    State* getStopState() override { return nullptr; }
+
+    void pay() { ++credit; }
+    void pass() { --credit; }
+    bool paid() { return credit > 0; }
+
+    State locked;
+    State unlocked;
+
+    Event coin;
+    Event push;
+    Event kick;
+
+    int credit;
+};
+
+/// Records every hook as a line of text.
+struct RecordingTracer
+{
+    void onTransition(IHsmDef const& hsm,
+                      State const& from,
+                      Event const&,
+                      State const& to)
+    {
+        log.push_back(hsm.name + ": " + from.name + " -> " + to.name);
+    }
+
+    void onGuardRejected(IHsmDef const& hsm, State const& state, Event const&)
+    {
+        log.push_back(hsm.name + ": rejected in " + state.name);
+    }
+
+    void onUnhandled(IHsmDef const& hsm, Event const&)
+    {
+        log.push_back(hsm.name + ": unhandled");
+    }
+
+    std::vector<std::string> log;
+};
+
+using TracedTurnstile = tsm::ParentThreadExecutionPolicy<
+  StateMachine<TurnstileDef, RecordingTracer>>;
+
+} // namespace
+
+TEST(TestTrace, testNullTracerTakesNoSpace)
+{
+    static_assert(
+      sizeof(StateMachine<TurnstileDef, NullTracer>) == sizeof(TurnstileDef),
+      "NullTracer must be an empty base");
+    static_assert(
+      std::is_same<StateMachine<TurnstileDef>::TracerType, NullTracer>::value,
+      "NullTracer is the default tracer");
+}
+
+TEST(TestTrace, testTracerSeesEveryOutcome)
+{
+    TracedTurnstile sm;
+    sm.startSM();
+
+    sm.sendEvent(sm.coin);
+    sm.step();
+    sm.sendEvent(sm.push);
+    sm.step();
+    sm.sendEvent(sm.kick);
+    sm.step();
+
+    // Take the credit away so the guard on push fails
+    sm.sendEvent(sm.coin);
+    sm.step();
+    sm.credit = 0;
+    sm.sendEvent(sm.push);
+    sm.step();
+
+    std::vector<std::string> expected = {
+        "Turnstile: Locked -> Unlocked",
+        "Turnstile: Unlocked -> Locked",
+        "Turnstile: unhandled",
+        "Turnstile: Locked -> Unlocked",
+        "Turnstile: rejected in Unlocked",
+    };
+    EXPECT_EQ(sm.getTracer().log, expected);
+    EXPECT_EQ(&sm.unlocked, sm.getCurrentState());
+}
@@ -0,0 +1,144 @@
+#include "tsm.h"
+
+#include <gtest/gtest.h>
+
+using tsm::DenseTransitionTable;
+using tsm::Event;
+using tsm::IHsmDef;
+using tsm::SimpleStateMachine;
+using tsm::State;
+using tsm::StateMachine;
+using tsm::StateMachineDef;
+
+namespace tsmtest {
+struct DenseGarageDoorDef
+  : public StateMachineDef<DenseGarageDoorDef, DenseTransitionTable>
+{
+    using Base = StateMachineDef<DenseGarageDoorDef, DenseTransitionTable>;
+
+    DenseGarageDoorDef(IHsmDef* parent = nullptr)
+      : Base("Dense Garage Door HSM", parent)
+      , doorOpen("Door Open")
+      , doorOpening("Door Opening")
+      , doorClosing("Door Closing")
+      , doorClosed("Door Closed")
+    {
+        add(doorClosed, click_event, doorOpening);
+        add(doorOpening, topSensor_event, doorOpen);
+        add(doorOpen, click_event, doorClosing);
+        add(doorClosing, bottomSensor_event, doorClosed);
+        // Duplicate. The first one added wins.
+        add(doorClosed, click_event, doorClosing);
+    }
+
+    virtual ~DenseGarageDoorDef() = default;
+
+    State* getStartState() override { return &doorClosed; }
+    State* getStopState() override { return nullptr; }
+
+    // States
+    State doorOpen;
+    State doorOpening;
+    State doorClosing;
+    State doorClosed;
+
+    // Events
+    Event click_event;
+    Event bottomSensor_event;
+    Event topSensor_event;
+};
+
+// Not part of any definition, so in the global id space
+Event powerCut;
+
+struct PoweredDoorDef
+  : public StateMachineDef<PoweredDoorDef, DenseTransitionTable>
+{
+    using Base = StateMachineDef<PoweredDoorDef, DenseTransitionTable>;
+
+    PoweredDoorDef(IHsmDef* parent = nullptr)
+      : Base("Powered Door HSM", parent)
+      , open("Open")
+      , closed("Closed")
+    {
+        add(open, powerCut, closed);
+        add(closed, click_event, open);
+        add(open, click_event, closed);
+    }
+
+    State* getStartState() override { return &closed; }
+    State* getStopState() override { return nullptr; }
+
+    State open;
+    State closed;
+
+    Event click_event;
+};
+} // namespace tsmtest
+
+using tsmtest::DenseGarageDoorDef;
+using tsmtest::PoweredDoorDef;
+
+TEST(TestDenseTransitionTable, testLookup)
+{
+    StateMachine<DenseGarageDoorDef> def;
+    auto& table = def.getTable();
+    EXPECT_EQ(table.size(), 5u);
+
+    auto* t = def.next(def.doorClosed, def.click_event);
+    ASSERT_NE(t, nullptr);
+    EXPECT_EQ(&t->toState, &def.doorOpening);
+
+    t = def.next(def.doorClosing, def.bottomSensor_event);
+    ASSERT_NE(t, nullptr);
+    EXPECT_EQ(&t->toState, &def.doorClosed);
+
+    // Valid state and event but no transition
+    EXPECT_EQ(def.next(def.doorOpen, def.topSensor_event), nullptr);
+
+    // Event and state the table knows nothing about
+    Event unknownEvent;
+    State unknownState("Unknown");
+    EXPECT_EQ(def.next(def.doorOpen, unknownEvent), nullptr);
+    EXPECT_EQ(def.next(unknownState, def.click_event), nullptr);
+}
+
+TEST(TestDenseTransitionTable, testStateMachine)
+{
+    SimpleStateMachine<DenseGarageDoorDef> sm;
+
+    sm.startSM();
+    ASSERT_EQ(sm.getCurrentState(), &sm.doorClosed);
+
+    sm.sendEvent(sm.click_event);
+    sm.sendEvent(sm.topSensor_event);
+    sm.sendEvent(sm.click_event);
+    sm.sendEvent(sm.bottomSensor_event);
+
+    sm.step();
+    ASSERT_EQ(sm.getCurrentState(), &sm.doorOpening);
+    sm.step();
+    ASSERT_EQ(sm.getCurrentState(), &sm.doorOpen);
+    sm.step();
+    ASSERT_EQ(sm.getCurrentState(), &sm.doorClosing);
+    sm.step();
+    ASSERT_EQ(sm.getCurrentState(), &sm.doorClosed);
+
+    sm.stopSM();
+}
+
+TEST(TestDenseTransitionTable, testForeignFirstTransitionKeepsTheArray)
+{
+    StateMachine<PoweredDoorDef> def;
+    ASSERT_NE(tsmtest::powerCut.space, def.click_event.space);
+    auto* t = def.next(def.closed, def.click_event);
+    ASSERT_NE(t, nullptr);
+    EXPECT_EQ(&t->toState, &def.open);
+    t = def.next(def.open, tsmtest::powerCut);
+    ASSERT_NE(t, nullptr);
+    EXPECT_EQ(&t->toState, &def.closed);
+
+    // Only the transition on the global event is off the array
+    auto table = def.getTable();
+    EXPECT_EQ(table.numForeign(), 1u);
+}
@@ -0,0 +1,142 @@
+#include "CdPlayerHSM.h"
+#include "GarageDoorSM.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+using tsm::IHsmDef;
+using tsm::StateMachine;
+using tsm::StateMachineDef;
+using tsm::UniqueId;
+
+using tsmtest::CdPlayerController;
+using tsmtest::CdPlayerDef;
+using tsmtest::GarageDoorDef;
+
+TEST(TestUniqueId, testDefinitionIdsAreDense)
+{
+    StateMachine<GarageDoorDef> sm;
+
+    EXPECT_EQ(sm.doorOpen.id, 0u);
+    EXPECT_EQ(sm.doorOpening.id, 1u);
+    EXPECT_EQ(sm.doorStoppedOpening.id, 5u);
+    EXPECT_EQ(sm.click_event.id, 0u);
+    EXPECT_EQ(sm.obstruct_event.id, 3u);
+
+    EXPECT_EQ(sm.doorOpen.space, sm.click_event.space);
+    EXPECT_NE(sm.doorOpen.space, UniqueId::GlobalSpace);
+
+    // Nothing constructed after the definition leaks into its space.
+    Event e;
+    EXPECT_EQ(e.space, UniqueId::GlobalSpace);
+}
+
+TEST(TestUniqueId, testNestedDefinitions)
+{
+    StateMachine<CdPlayerDef<CdPlayerController>> sm;
+
+    // The sub HSM is a state of its parent, but numbers its own states and
+    // events in its own space.
+    EXPECT_EQ(sm.Stopped.id, 0u);
+    EXPECT_EQ(sm.Playing.id, 1u);
+    EXPECT_EQ(sm.Paused.id, 2u);
+    EXPECT_EQ(sm.Playing.space, sm.Stopped.space);
+
+    EXPECT_EQ(sm.Playing.Song1.id, 0u);
+    EXPECT_EQ(sm.Playing.next_song.id, 0u);
+    EXPECT_NE(sm.Playing.Song1.space, sm.Stopped.space);
+    EXPECT_NE(sm.Playing.next_song, sm.play);
+}
+
+TEST(TestUniqueId, testParallelConstruction)
+{
+    const int NTHREADS = 8;
+    const int NMACHINES = 100;
+    using GarageDoorSM = StateMachine<GarageDoorDef>;
+
+    std::vector<std::vector<std::unique_ptr<GarageDoorSM>>> machines(NTHREADS);
+    std::vector<std::thread> threads;
+    for (auto& v : machines) {
+        threads.emplace_back([&v] {
+            for (int i = 0; i < NMACHINES; i++) {
+                v.emplace_back(new GarageDoorSM());
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    GarageDoorSM reference;
+    for (auto& v : machines) {
+        for (auto& sm : v) {
+            ASSERT_EQ(sm->doorClosed, reference.doorClosed);
+            ASSERT_EQ(sm->topSensor_event, reference.topSensor_event);
+        }
+    }
+}
+
+TEST(TestUniqueId, testBareDefinitionLeavesItsSpace)
+{
+    // Not wrapped in a StateMachine: the space ends with the first add
+    GarageDoorDef def;
+    EXPECT_NE(def.doorOpen.space, UniqueId::GlobalSpace);
+
+    Event e;
+    EXPECT_EQ(e.space, UniqueId::GlobalSpace);
+    EXPECT_EQ(State("Outside").space, UniqueId::GlobalSpace);
+}
+
+TEST(TestUniqueId, testSpacesLeftInAnyOrder)
+{
+    UniqueId::Space outer(UniqueId::spaceTag<int>());
+    UniqueId::Space inner(UniqueId::spaceTag<long>());
+    UniqueId::enter(outer);
+    UniqueId::enter(inner);
+    UniqueId::leave(outer);
+    EXPECT_EQ(State("In inner").space, inner.tag);
+    UniqueId::leave(inner);
+    UniqueId::leave(inner);
+    EXPECT_EQ(State("Outside").space, UniqueId::GlobalSpace);
+
+    // Definitions destroyed out of construction order
+    using GarageDoorSM = StateMachine<GarageDoorDef>;
+    std::unique_ptr<GarageDoorDef> a(new GarageDoorDef);
+    std::unique_ptr<GarageDoorSM> b(new GarageDoorSM);
+    a.reset();
+    b.reset();
+    EXPECT_EQ(Event().space, UniqueId::GlobalSpace);
+    EXPECT_EQ(State("Outside").space, UniqueId::GlobalSpace);
+}
+
+namespace {
+
+// No add or defer in the constructor, so nothing leaves the space there
+struct QuietDef : public StateMachineDef<QuietDef>
+{
+    QuietDef(IHsmDef* parent = nullptr)
+      : StateMachineDef<QuietDef>("Quiet", parent)
+      , idle("Idle")
+    {}
+
+    State* getStartState() override { return &idle; }
+    State* getStopState() override { return nullptr; }
+
+    State idle;
+};
+
+} // namespace
+
+TEST(TestUniqueId, testDefinitionDestroyedOnAnotherThread)
+{
+    std::unique_ptr<QuietDef> def(new QuietDef);
+    EXPECT_NE(def->idle.space, UniqueId::GlobalSpace);
+    std::thread([&def] { def.reset(); }).join();
+
+    // This thread's stack of spaces no longer holds the definition's
+    EXPECT_EQ(Event().space, UniqueId::GlobalSpace);
+    EXPECT_EQ(State("Outside").space, UniqueId::GlobalSpace);
+}
@@ -0,0 +1,122 @@
+#include "GarageDoorSM.h"
+#include "Observer.h"
+#include "tsm.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+using tsm::AsyncExecWithObserver;
+using tsm::BlockingObserver;
+using tsm::EventQueue;
+using tsm::Event;
+using tsm::IHsmDef;
+using tsm::LockFreeEventQueue;
+using tsm::NullTracer;
+using tsm::PriorityEventQueue;
+using tsm::State;
+using tsm::StateMachine;
+using tsm::WaitStrategy;
+
+using tsmtest::GarageDoorDef;
+
+namespace {
+
+/// Records the CPU the machine thread took its last transition on.
+struct CpuTracer : NullTracer
+{
+    CpuTracer()
+      : cpu(-1)
+    {}
+
+    void onTransition(IHsmDef const&, State const&, Event const&, State const&)
+    {
+#if defined(__linux__)
+        cpu = sched_getcpu();
+#endif
+    }
+
+    std::atomic<int> cpu;
+};
+
+template<typename EventQueueType>
+using Door = AsyncExecWithObserver<StateMachine<GarageDoorDef, CpuTracer>,
+                                   BlockingObserver,
+                                   EventQueueType>;
+
+template<typename EventQueueType>
+void
+openAndClose(WaitStrategy strategy)
+{
+    Door<EventQueueType> sm;
+    sm.setWaitStrategy(strategy, 100);
+    sm.startSM();
+    sm.wait();
+    Event const* trip[] = { &sm.click_event,
+                            &sm.topSensor_event,
+                            &sm.click_event,
+                            &sm.bottomSensor_event };
+    for (int i = 0; i < 100; ++i) {
+        sm.sendEvent(*trip[i & 3]);
+        sm.wait();
+    }
+    EXPECT_EQ(sm.getCurrentState(), &sm.doorClosed);
+    // A spinning thread sees the stop as promptly as a parked one
+    sm.stopSM();
+}
+
+} // namespace
+
+TEST(TestWaitStrategy, testEveryStrategyOnEveryQueue)
+{
+    for (WaitStrategy strategy : { WaitStrategy::Park,
+                                   WaitStrategy::Spin,
+                                   WaitStrategy::SpinYield,
+                                   WaitStrategy::SpinPark }) {
+        openAndClose<EventQueue<Event>>(strategy);
+        openAndClose<LockFreeEventQueue<Event>>(strategy);
+        openAndClose<PriorityEventQueue<Event>>(strategy);
+    }
+}
+
+TEST(TestWaitStrategy, testSpinParkParksWhenIdle)
+{
+    Door<EventQueue<Event>> sm;
+    sm.setWaitStrategy(WaitStrategy::SpinPark, 10);
+    sm.startSM();
+    sm.wait();
+    // Well past the spin budget: the thread is parked and still wakes up
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    sm.sendEvent(sm.click_event);
+    sm.wait();
+    EXPECT_EQ(sm.getCurrentState(), &sm.doorOpening);
+    sm.stopSM();
+}
+
+#if defined(__linux__)
+TEST(TestWaitStrategy, testThreadPinnedToCpu)
+{
+    cpu_set_t allowed;
+    ASSERT_EQ(sched_getaffinity(0, sizeof(allowed), &allowed), 0);
+    int cpu = 0;
+    while (!CPU_ISSET(cpu, &allowed)) {
+        ++cpu;
+    }
+
+    Door<LockFreeEventQueue<Event>> sm;
+    sm.setCpuAffinity(cpu);
+    sm.startSM();
+    sm.wait();
+    for (int i = 0; i < 10; ++i) {
+        sm.sendEvent(sm.click_event);
+        sm.wait();
+        EXPECT_EQ(sm.getTracer().cpu.load(), cpu);
+    }
+    sm.stopSM();
+}
+#endif
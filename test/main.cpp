@@ -3,7 +3,6 @@
 
 #include <memory>
 
-#include <glog/logging.h>
 #include <gtest/gtest.h>
 
 using tsm::Event;
@@ -29,13 +28,13 @@ class TestState : public testing::Test
 
 TEST_F(TestState, Construct)
 {
-    DLOG(INFO) << "Test" << std::endl;
+    TSM_DLOG(INFO) << "Test";
     EXPECT_EQ(state_.name, "Dummy");
 }
 
 struct TestStateMachineProperties : public testing::Test
 {
-    virtual ~TestStateMachineProperties() { tsm::UniqueId::reset(); }
+    virtual ~TestStateMachineProperties() = default;
 };
 
 TEST_F(TestStateMachineProperties, testMachineExitsWhenReachingStopState)
@@ -65,8 +64,10 @@ TEST_F(TestStateMachineProperties, testMachineExitsWhenReachingStopState)
 int
 main(int argc, char* argv[])
 {
+#if TSM_LOGGING_ENABLED
     google::InitGoogleLogging(argv[0]);
     google::InstallFailureSignalHandler();
+#endif
     testing::InitGoogleTest(&argc, argv);
 
     return RUN_ALL_TESTS();
@@ -1,15 +1,34 @@
 #pragma once
 
+#include "Arena.h"
+#include "AsyncAction.h"
+#include "BinaryDefinition.h"
+#include "DefinitionCompiler.h"
 #include "Event.h"
+#include "EventBus.h"
+#include "EventTrace.h"
 #include "EventQueue.h"
+#include "Fleet.h"
+#include "LockFreeEventQueue.h"
+#include "MachineFleet.h"
+#include "Metrics.h"
 #include "OrthogonalStateMachine.h"
+#include "ParallelRegionPolicy.h"
+#include "PriorityEventQueue.h"
+#include "SharedDefinition.h"
+#include "Snapshot.h"
 #include "State.h"
 #include "StateMachine.h"
 #include "StateMachineDef.h"
+#include "TimerService.h"
 #include "Transition.h"
+#include "TransitionTable.h"
+#include "WaitStrategy.h"
 
 #include "AsyncExecutionPolicy.h"
+#include "InlineExecutionPolicy.h"
 #include "ParentThreadExecutionPolicy.h"
+#include "PooledExecutionPolicy.h"
 
 namespace tsm {
 
@@ -34,6 +53,13 @@ namespace tsm {
 template<typename HSMDef>
 using SimpleStateMachine = ParentThreadExecutionPolicy<StateMachine<HSMDef>>;
 ///
+/// A state machine that handles each event inside sendEvent, on the caller's
+/// thread, without a queue or a call to step. Events sent from actions run
+/// after the current event completes.
+///
+template<typename HSMDef>
+using InlineStateMachine = InlineExecutionPolicy<StateMachine<HSMDef>>;
+///
 /// An Asynchronous state machine. Event processing is done in a separate
 /// thread. Usage is similar to SimpleStateMachine above. The final call
 /// to "step" is not required. The state machine is blocked waiting on the next
@@ -45,6 +71,20 @@ using SimpleStateMachine = ParentThreadExecutionPolicy<StateMachine<HSMDef>>;
 ///
 template<typename HSMDef>
 using AsyncStateMachine = AsyncExecutionPolicy<StateMachine<HSMDef>>;
+///
+/// Same as the AsyncStateMachine, but events are passed through a lock-free
+/// queue. Prefer it when many threads feed a single state machine.
+///
+template<typename HSMDef>
+using LockFreeAsyncStateMachine =
+  AsyncExecutionPolicy<StateMachine<HSMDef>, LockFreeEventQueue<Event>>;
+///
+/// A state machine that shares a pool of worker threads with other machines
+/// instead of owning a thread. Use it when running thousands of machines.
+/// Events for a machine are still processed one at a time, in order.
+///
+template<typename HSMDef>
+using PooledStateMachine = PooledExecutionPolicy<StateMachine<HSMDef>>;
 }
 
 // Provide a hash function for StateEventPair
@@ -56,10 +96,10 @@ struct hash<tsm::StateEventPair>
     size_t operator()(const tsm::StateEventPair& s) const
     {
         State* statePtr = &s.first;
-        uint64_t id_s = statePtr->id;
-        tsm::Event event = s.second;
         auto address = reinterpret_cast<uintptr_t>(statePtr);
-        uint64_t id_e = event.id;
+        tsm::Event const& event = s.second;
+        uint64_t id_s = (uint64_t(statePtr->space) << 32) | statePtr->id;
+        uint64_t id_e = (uint64_t(event.space) << 32) | event.id;
         size_t hash_value = hash<uint64_t>{}(id_s) ^
                             hash<uintptr_t>{}(address) ^
                             (hash<uint64_t>{}(id_e) << 1);